@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -65,6 +65,7 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_crop(m_po.add("crop").requiresValue("x,y,width,height").description("Crop all the images to the given rectangle"))
   , m_slice(m_po.add("slice").requiresValue("<name>").description("Crop the sprite to the given slice area"))
   , m_filenameFormat(m_po.add("filename-format").requiresValue("<fmt>").description("Special format to generate filenames"))
+  , m_compressionLevel(m_po.add("compression-level").requiresValue("<level>").description("Compression level to save .aseprite files:\n  fast\n  default\n  small\n  or a number from 0 to 9"))
 #ifdef ENABLE_SCRIPTING
   , m_script(m_po.add("script").requiresValue("<filename>").description("Execute a specific script"))
   , m_scriptParam(m_po.add("script-param").requiresValue("name=value").description("Parameter for a script executed from the\nCLI that you can access with app.params"))
@@ -73,6 +74,7 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_listTags(m_po.add("list-tags").description("List tags of the next given sprite\nor include frame tags in JSON data"))
   , m_listSlices(m_po.add("list-slices").description("List slices of the next given sprite\nor include slices in JSON data"))
   , m_oneFrame(m_po.add("oneframe").description("Load just the first frame"))
+  , m_jobs(m_po.add("jobs").mnemonic('j').requiresValue("<n>").description("Process up to <n> files at the same time in\nbatch mode (0 = number of CPUs) and print\na summary with the elapsed time"))
   , m_verbose(m_po.add("verbose").mnemonic('v').description("Explain what is being done"))
   , m_debug(m_po.add("debug").description("Extreme verbose mode and\ncopy log to desktop"))
 #ifdef _WIN32
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -81,6 +81,7 @@ public:
   const Option& crop() const { return m_crop; }
   const Option& slice() const { return m_slice; }
   const Option& filenameFormat() const { return m_filenameFormat; }
+  const Option& compressionLevel() const { return m_compressionLevel; }
 #ifdef ENABLE_SCRIPTING
   const Option& script() const { return m_script; }
   const Option& scriptParam() const { return m_scriptParam; }
@@ -89,6 +90,7 @@ public:
   const Option& listTags() const { return m_listTags; }
   const Option& listSlices() const { return m_listSlices; }
   const Option& oneFrame() const { return m_oneFrame; }
+  const Option& jobs() const { return m_jobs; }
 
   bool hasExporterParams() const;
 #ifdef _WIN32
@@ -147,6 +149,7 @@ private:
   Option& m_crop;
   Option& m_slice;
   Option& m_filenameFormat;
+  Option& m_compressionLevel;
 #ifdef ENABLE_SCRIPTING
   Option& m_script;
   Option& m_scriptParam;
@@ -155,6 +158,7 @@ private:
   Option& m_listTags;
   Option& m_listSlices;
   Option& m_oneFrame;
+  Option& m_jobs;
 
   Option& m_verbose;
   Option& m_debug;
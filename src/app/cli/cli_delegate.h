@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -19,6 +19,21 @@ namespace app {
   class Params;
   struct CliOpenFile;
 
+  // Statistics of the CLI processing when --jobs is used
+  struct CliSummary {
+    int jobs = 0;               // Files processed at the same time
+    int openedFiles = 0;
+    int savedFiles = 0;
+    double loadTime = 0.0;      // Seconds loading files (sum of all threads)
+    double saveTime = 0.0;      // Seconds saving files (sum of all threads)
+    double waitTime = 0.0;      // Seconds waiting for other threads
+    double exportTime = 0.0;    // Seconds exporting the sprite sheet
+    double totalTime = 0.0;     // Seconds processing all the options
+  };
+
+  // With --jobs, saveFile() and loadPalette() can be called from
+  // several threads at the same time (each one with its own context),
+  // the other member functions are called from the main thread only.
   class CliDelegate {
   public:
     virtual ~CliDelegate() { }
@@ -32,6 +47,7 @@ namespace app {
     virtual void saveFile(Context* ctx, const CliOpenFile& cof) { }
     virtual void loadPalette(Context* ctx, const CliOpenFile& cof, const std::string& filename) { }
     virtual void exportFiles(Context* ctx, DocExporter& exporter) { }
+    virtual void showSummary(const CliSummary& summary) { }
 #ifdef ENABLE_SCRIPTING
     virtual int execScript(const std::string& filename,
                            const Params& params) {
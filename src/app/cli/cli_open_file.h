@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2016-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -26,6 +26,7 @@ namespace app {
     std::string filenameFormat;
     std::string tag;
     std::string slice;
+    std::string compressionLevel;
     std::vector<std::string> includeLayers;
     std::vector<std::string> excludeLayers;
     doc::frame_t fromFrame, toFrame;
@@ -52,6 +53,10 @@ namespace app {
       return (!slice.empty());
     }
 
+    bool hasCompressionLevel() const {
+      return (!compressionLevel.empty());
+    }
+
     bool hasFrameRange() const {
       return (fromFrame >= 0 && toFrame >= 0);
     }
@@ -11,21 +11,30 @@
 
 #include "app/cli/cli_processor.h"
 
+#include "app/app.h"
 #include "app/cli/app_options.h"
 #include "app/cli/cli_delegate.h"
-#include "app/commands/commands.h"
+#include "app/commands/command.h"
+#include "app/commands/command_factory.h"
 #include "app/commands/params.h"
 #include "app/console.h"
+#include "app/context.h"
 #include "app/doc.h"
 #include "app/doc_exporter.h"
 #include "app/doc_undo.h"
+#include "app/extensions.h"
 #include "app/file/file.h"
+#include "app/file/split_filename.h"
 #include "app/filename_formatter.h"
 #include "app/restore_visible_layers.h"
 #include "app/ui_context.h"
+#include "base/chrono.h"
 #include "base/convert_to.h"
 #include "base/fs.h"
+#include "base/replace_string.h"
 #include "base/split_string.h"
+#include "base/string.h"
+#include "base/thread_pool.h"
 #include "doc/layer.h"
 #include "doc/selected_frames.h"
 #include "doc/selected_layers.h"
@@ -36,7 +45,10 @@
 #include "render/dithering_algorithm.h"
 
 #include <algorithm>
+#include <future>
+#include <memory>
 #include <queue>
+#include <thread>
 #include <vector>
 
 namespace app {
@@ -140,6 +152,196 @@ std::string convert_filter_to_layer_path_if_possible(
     return filter;
 }
 
+// Returns the params of ChangePixelFormatCommand for --color-mode
+Params color_mode_params(const std::string& mode,
+                         const render::DitheringAlgorithm ditheringAlgorithm,
+                         const std::string& ditheringMatrix)
+{
+  Params params;
+  if (mode == "rgb") {
+    params.set("format", "rgb");
+  }
+  else if (mode == "grayscale") {
+    params.set("format", "grayscale");
+  }
+  else if (mode == "indexed") {
+    params.set("format", "indexed");
+    switch (ditheringAlgorithm) {
+      case render::DitheringAlgorithm::None:
+        params.set("dithering", "none");
+        break;
+      case render::DitheringAlgorithm::Ordered:
+        params.set("dithering", "ordered");
+        break;
+      case render::DitheringAlgorithm::Old:
+        params.set("dithering", "old");
+        break;
+      case render::DitheringAlgorithm::ErrorDiffusion:
+        params.set("dithering", "error-diffusion");
+        break;
+    }
+
+    if (ditheringAlgorithm != render::DitheringAlgorithm::None &&
+        !ditheringMatrix.empty()) {
+      params.set("dithering-matrix", ditheringMatrix.c_str());
+    }
+  }
+  else {
+    throw std::runtime_error("--color-mode needs a valid color mode for conversion\n"
+                             "Usage: --color-mode <mode>\n"
+                             "Where <mode> can be rgb, grayscale, or indexed");
+  }
+  return params;
+}
+
+// Returns the maximum size of --shrink-to <width,height>
+void get_shrink_to_size(const std::string& value,
+                        double& maxWidth,
+                        double& maxHeight)
+{
+  std::vector<std::string> dimensions;
+  base::split_string(value, dimensions, ",");
+  if (dimensions.size() < 2)
+    throw std::runtime_error("--shrink-to needs two parameters separated by comma (,)\n"
+                             "Usage: --shrink-to width,height\n"
+                             "E.g. --shrink-to 128,64");
+
+  maxWidth = base::convert_to<double>(dimensions[0]);
+  maxHeight = base::convert_to<double>(dimensions[1]);
+}
+
+// Returns true if the filename matches the pattern, where '*'
+// matches any sequence of characters.
+bool match_pattern(const char* pattern, const char* fn)
+{
+  for (; *pattern; ++pattern, ++fn) {
+    if (*pattern == '*') {
+      for (; ; ++fn) {
+        if (match_pattern(pattern+1, fn))
+          return true;
+        if (!*fn)
+          return false;
+      }
+    }
+    if (*pattern != *fn)
+      return false;
+  }
+  return (*fn == 0);
+}
+
+// Converts a filename to a pattern to compare the files read/written
+// by different input files with --jobs. Template elements (e.g.
+// {layer} or {frame}) are replaced with '*', and the path is made
+// absolute and lower case (in case that the file system is case
+// insensitive).
+std::string filename_pattern(const std::string& fn)
+{
+  std::string pattern;
+  int level = 0;
+  for (const char chr : fn) {
+    if (chr == '{') {
+      if (level++ == 0)
+        pattern.push_back('*');
+    }
+    else if (chr == '}') {
+      if (level > 0)
+        --level;
+    }
+    else if (level == 0)
+      pattern.push_back(chr);
+  }
+  return base::string_to_lower(
+    base::normalize_path(
+      base::get_absolute_path(pattern)));
+}
+
+// Pattern of the files that can be loaded opening the given file
+// (e.g. "sprite1.png" can load a sequence of files like
+// "sprite1.png", "sprite2.png", etc.)
+std::string input_pattern(const std::string& fn, const bool oneFrame)
+{
+  std::string left, right;
+  int width;
+  if (!oneFrame && split_filename(fn, left, right, width) >= 0)
+    return filename_pattern(left + "*" + right);
+  else
+    return filename_pattern(fn);
+}
+
+// Pattern of the files that can be saved with --save-as <fn>
+std::string output_pattern(const std::string& fn,
+                           const std::string& filenameFormat)
+{
+  // Default filename format (e.g. "{path}/{title}{frame}.{extension}"
+  // which can include the layer or tag name after the title)
+  if (filenameFormat.empty()) {
+    std::string left, right;
+    int width;
+    split_filename(fn, left, right, width);
+    return filename_pattern(left + "*" + right);
+  }
+
+  // Same elements that filename_formatter() replaces with the --save-as
+  // filename, the other ones are replaced with '*'
+  std::string path = base::get_file_path(fn);
+  if (path.empty())
+    path = ".";
+
+  std::string output = filenameFormat;
+  base::replace_string(output, "{fullname}", fn);
+  base::replace_string(output, "{path}", path);
+  base::replace_string(output, "{name}", base::get_file_name(fn));
+  base::replace_string(output, "{title}", base::get_file_title(fn));
+  base::replace_string(output, "{extension}", base::get_file_extension(fn));
+  return filename_pattern(output);
+}
+
+// Returns true if the two patterns (from filename_pattern()) can
+// match the same file.
+bool can_match_same_file(const std::string& a, const std::string& b)
+{
+  const std::size_t aWildcard = a.find('*');
+  const std::size_t bWildcard = b.find('*');
+
+  if (aWildcard == std::string::npos &&
+      bWildcard == std::string::npos)
+    return (a == b);
+  else if (bWildcard == std::string::npos)
+    return match_pattern(a.c_str(), b.c_str());
+  else if (aWildcard == std::string::npos)
+    return match_pattern(b.c_str(), a.c_str());
+
+  // Two patterns can match the same file if the fixed prefixes and
+  // suffixes are compatible (this can be true for patterns that
+  // cannot match the same file, but it's enough to know what files
+  // cannot be processed at the same time)
+  const std::size_t prefix = std::min(aWildcard, bWildcard);
+  const std::size_t suffix = std::min(a.size() - a.rfind('*') - 1,
+                                      b.size() - b.rfind('*') - 1);
+  return (a.compare(0, prefix, b, 0, prefix) == 0 &&
+          a.compare(a.size()-suffix, suffix, b, b.size()-suffix, suffix) == 0);
+}
+
+bool can_match_same_file(const std::string& a,
+                         const std::vector<std::string>& b)
+{
+  for (const auto& pattern : b) {
+    if (can_match_same_file(a, pattern))
+      return true;
+  }
+  return false;
+}
+
+bool can_match_same_file(const std::vector<std::string>& a,
+                         const std::vector<std::string>& b)
+{
+  for (const auto& pattern : a) {
+    if (can_match_same_file(pattern, b))
+      return true;
+  }
+  return false;
+}
+
 } // anonymous namespace
 
 // static
@@ -170,16 +372,72 @@ void CliProcessor::FilterLayers(const Sprite* sprite,
   }
 }
 
+// An input file and the options after it (until the next file name)
+// processed with --jobs in a background thread with its own context.
+struct CliProcessor::Job {
+  std::string filename;
+  State state;                      // CLI state to process this file
+  std::vector<const Value*> values; // Options after the file name
+
+  // Patterns of files (see filename_pattern()) used to know which
+  // files cannot be processed at the same time
+  std::string filenamePattern;      // This file
+  std::string inputPattern;         // This file or a sequence of files
+  std::vector<std::string> reads;   // --palette files
+  std::vector<std::string> writes;  // --save-as files
+
+  // The state of this file depends on other files processed before
+  // (the --save-as with {layer}, {tag}, or {slice} in m_splitSaves,
+  // and the job that sets the filename format in formatJob)
+  std::size_t splitSaves = 0;
+  int formatJob = -1;
+  bool needsState = false;          // The state is needed to process the file
+  bool skipped = false;             // The file was already used
+
+  std::unique_ptr<Context> ctx;
+  OpenBatchOfFiles batch;
+  CliOpenFile openCof;              // State after opening the file
+  std::string openOutput;           // Console output opening the file
+  std::string output;               // Console output of the options
+  CliSummary summary;
+  std::future<void> done;
+
+  // Returns true if this file cannot be processed at the same time
+  // that the given previous file.
+  bool dependsOn(const Job& prev) const {
+    return
+      // The file can be loaded as part of the previous sequence
+      can_match_same_file(prev.inputPattern, filenamePattern) ||
+      // Files saved by the previous one are read by this one
+      can_match_same_file(prev.writes, reads) ||
+      can_match_same_file(inputPattern, prev.writes) ||
+      // Files read by the previous one are saved by this one
+      can_match_same_file(prev.reads, writes) ||
+      can_match_same_file(prev.inputPattern, writes) ||
+      // Both files save the same file
+      can_match_same_file(prev.writes, writes);
+  }
+};
+
 CliProcessor::CliProcessor(CliDelegate* delegate,
                            const AppOptions& options)
   : m_delegate(delegate)
   , m_options(options)
   , m_exporter(nullptr)
+  , m_collectedJobs(0)
+  , m_firstOpenedJob(-1)
+  , m_lastOpenedJob(nullptr)
 {
   if (options.hasExporterParams())
     m_exporter.reset(new DocExporter);
 }
 
+CliProcessor::~CliProcessor()
+{
+  // The exporter can reference documents of the jobs
+  m_exporter.reset();
+}
+
 int CliProcessor::process(Context* ctx)
 {
   // --help
@@ -192,416 +450,53 @@ int CliProcessor::process(Context* ctx)
   }
   // Process other options and file names
   else if (!m_options.values().empty()) {
-#ifdef ENABLE_SCRIPTING
-    Params scriptParams;
-#endif
-    Console console;
-    CliOpenFile cof;
-    SpriteSheetType sheetType = SpriteSheetType::None;
-    Doc* lastDoc = nullptr;
-    render::DitheringAlgorithm ditheringAlgorithm = render::DitheringAlgorithm::None;
-    std::string ditheringMatrix;
+    State state;
+    state.exporter = m_exporter.get();
+    base::Chrono chrono;
 
+    // --jobs <n>
     for (const auto& value : m_options.values()) {
-      const AppOptions::Option* opt = value.option();
-
-      // Special options/commands
-      if (opt) {
-        // --data <file.json>
-        if (opt == &m_options.data()) {
-          if (m_exporter)
-            m_exporter->setDataFilename(value.value());
-        }
-        // --format <format>
-        else if (opt == &m_options.format()) {
-          if (m_exporter) {
-            SpriteSheetDataFormat format = SpriteSheetDataFormat::Default;
-
-            if (value.value() == "json-hash")
-              format = SpriteSheetDataFormat::JsonHash;
-            else if (value.value() == "json-array")
-              format = SpriteSheetDataFormat::JsonArray;
-
-            m_exporter->setDataFormat(format);
-          }
-        }
-        // --sheet <file.png>
-        else if (opt == &m_options.sheet()) {
-          if (m_exporter)
-            m_exporter->setTextureFilename(value.value());
-        }
-        // --sheet-width <width>
-        else if (opt == &m_options.sheetWidth()) {
-          if (m_exporter)
-            m_exporter->setTextureWidth(strtol(value.value().c_str(), nullptr, 0));
-        }
-        // --sheet-height <height>
-        else if (opt == &m_options.sheetHeight()) {
-          if (m_exporter)
-            m_exporter->setTextureHeight(strtol(value.value().c_str(), nullptr, 0));
-        }
-        // --sheet-columns <columns>
-        else if (opt == &m_options.sheetColumns()) {
-          if (m_exporter)
-            m_exporter->setTextureColumns(strtol(value.value().c_str(), nullptr, 0));
-        }
-        // --sheet-rows <rows>
-        else if (opt == &m_options.sheetRows()) {
-          if (m_exporter)
-            m_exporter->setTextureRows(strtol(value.value().c_str(), nullptr, 0));
-        }
-        // --sheet-type <sheet-type>
-        else if (opt == &m_options.sheetType()) {
-          if (value.value() == "horizontal")
-            sheetType = SpriteSheetType::Horizontal;
-          else if (value.value() == "vertical")
-            sheetType = SpriteSheetType::Vertical;
-          else if (value.value() == "rows")
-            sheetType = SpriteSheetType::Rows;
-          else if (value.value() == "columns")
-            sheetType = SpriteSheetType::Columns;
-          else if (value.value() == "packed")
-            sheetType = SpriteSheetType::Packed;
-        }
-        // --sheet-pack
-        else if (opt == &m_options.sheetPack()) {
-          sheetType = SpriteSheetType::Packed;
-        }
-        // --split-layers
-        else if (opt == &m_options.splitLayers()) {
-          cof.splitLayers = true;
-          if (m_exporter)
-            m_exporter->setSplitLayers(true);
-        }
-        // --split-tags
-        else if (opt == &m_options.splitTags()) {
-          cof.splitTags = true;
-          if (m_exporter)
-            m_exporter->setSplitTags(true);
-        }
-        // --split-slice
-        else if (opt == &m_options.splitSlices()) {
-          cof.splitSlices = true;
-        }
-        // --layer <layer-name>
-        else if (opt == &m_options.layer()) {
-          cof.includeLayers.push_back(value.value());
-        }
-        // --ignore-layer <layer-name>
-        else if (opt == &m_options.ignoreLayer()) {
-          cof.excludeLayers.push_back(value.value());
-        }
-        // --all-layers
-        else if (opt == &m_options.allLayers()) {
-          cof.allLayers = true;
-        }
-        // --tag <tag-name>
-        else if (opt == &m_options.tag()) {
-          cof.tag = value.value();
-        }
-        // --frame-range from,to
-        else if (opt == &m_options.frameRange()) {
-          std::vector<std::string> splitRange;
-          base::split_string(value.value(), splitRange, ",");
-          if (splitRange.size() < 2)
-            throw std::runtime_error("--frame-range needs two parameters separated by comma (,)\n"
-                                     "Usage: --frame-range from,to\n"
-                                     "E.g. --frame-range 0,99");
-
-          cof.fromFrame = base::convert_to<frame_t>(splitRange[0]);
-          cof.toFrame   = base::convert_to<frame_t>(splitRange[1]);
-        }
-        // --ignore-empty
-        else if (opt == &m_options.ignoreEmpty()) {
-          cof.ignoreEmpty = true;
-          if (m_exporter)
-            m_exporter->setIgnoreEmptyCels(true);
-        }
-        // --merge-duplicates
-        else if (opt == &m_options.mergeDuplicates()) {
-          if (m_exporter)
-            m_exporter->setMergeDuplicates(true);
-        }
-        // --border-padding
-        else if (opt == &m_options.borderPadding()) {
-          if (m_exporter)
-            m_exporter->setBorderPadding(strtol(value.value().c_str(), NULL, 0));
-        }
-        // --shape-padding
-        else if (opt == &m_options.shapePadding()) {
-          if (m_exporter)
-            m_exporter->setShapePadding(strtol(value.value().c_str(), NULL, 0));
-        }
-        // --inner-padding
-        else if (opt == &m_options.innerPadding()) {
-          if (m_exporter)
-            m_exporter->setInnerPadding(strtol(value.value().c_str(), NULL, 0));
-        }
-        // --trim
-        else if (opt == &m_options.trim()) {
-          cof.trim = true;
-          if (m_exporter)
-            m_exporter->setTrimCels(true);
-        }
-        // --trim-sprite
-        else if (opt == &m_options.trimSprite()) {
-          cof.trim = true;
-          if (m_exporter)
-            m_exporter->setTrimSprite(true);
-        }
-        // --trim-by-grid
-        else if (opt == &m_options.trimByGrid()) {
-          cof.trim = cof.trimByGrid = true;
-          if (m_exporter) {
-            m_exporter->setTrimCels(true);
-            m_exporter->setTrimByGrid(true);
-          }
-        }
-        // --crop x,y,width,height
-        else if (opt == &m_options.crop()) {
-          std::vector<std::string> parts;
-          base::split_string(value.value(), parts, ",");
-          if (parts.size() < 4)
-            throw std::runtime_error("--crop needs four parameters separated by comma (,)\n"
-                                     "Usage: --crop x,y,width,height\n"
-                                     "E.g. --crop 0,0,32,32");
-
-          cof.crop.x = base::convert_to<int>(parts[0]);
-          cof.crop.y = base::convert_to<int>(parts[1]);
-          cof.crop.w = base::convert_to<int>(parts[2]);
-          cof.crop.h = base::convert_to<int>(parts[3]);
-        }
-        // --slice <slice>
-        else if (opt == &m_options.slice()) {
-          cof.slice = value.value();
-        }
-        // --filename-format
-        else if (opt == &m_options.filenameFormat()) {
-          cof.filenameFormat = value.value();
-          if (m_exporter)
-            m_exporter->setFilenameFormat(cof.filenameFormat);
-        }
-        // --save-as <filename>
-        else if (opt == &m_options.saveAs()) {
-          if (lastDoc) {
-            std::string fn = value.value();
-
-            // Automatic --split-layer, --split-tags, --split-slices
-            // in case the output filename already contains {layer},
-            // {tag}, or {slice} template elements.
-            bool hasLayerTemplate = (is_layer_in_filename_format(fn) ||
-                                     is_group_in_filename_format(fn));
-            bool hasTagTemplate = is_tag_in_filename_format(fn);
-            bool hasSliceTemplate = is_slice_in_filename_format(fn);
-
-            if (hasLayerTemplate || hasTagTemplate || hasSliceTemplate) {
-              cof.splitLayers = (cof.splitLayers || hasLayerTemplate);
-              cof.splitTags = (cof.splitTags || hasTagTemplate);
-              cof.splitSlices = (cof.splitSlices || hasSliceTemplate);
-              cof.filenameFormat =
-                get_default_filename_format(
-                  fn,
-                  true,                                   // With path
-                  (lastDoc->sprite()->totalFrames() > 1), // Has frames
-                  false,                                  // Has layer
-                  false);                                 // Has frame tag
-            }
-
-            cof.document = lastDoc;
-            cof.filename = fn;
-            saveFile(ctx, cof);
-          }
-          else
-            console.printf("A document is needed before --save-as argument\n");
-        }
-        // --palette <filename>
-        else if (opt == &m_options.palette()) {
-          if (lastDoc) {
-            ASSERT(cof.document == lastDoc);
-
-            std::string filename = value.value();
-            m_delegate->loadPalette(ctx, cof, filename);
-          }
-          else {
-            console.printf("You need to load a document to change its palette with --palette\n");
-          }
-        }
-        // --scale <factor>
-        else if (opt == &m_options.scale()) {
-          Params params;
-          params.set("scale", value.value().c_str());
-
-          // Scale all sprites
-          for (auto doc : ctx->documents()) {
-            ctx->setActiveDocument(doc);
-            ctx->executeCommand(Commands::instance()->byId(CommandId::SpriteSize()),
-                                params);
-          }
-        }
-        // --dithering-algorithm <algorithm>
-        else if (opt == &m_options.ditheringAlgorithm()) {
-          if (value.value() == "none")
-            ditheringAlgorithm = render::DitheringAlgorithm::None;
-          else if (value.value() == "ordered")
-            ditheringAlgorithm = render::DitheringAlgorithm::Ordered;
-          else if (value.value() == "old")
-            ditheringAlgorithm = render::DitheringAlgorithm::Old;
-          else if (value.value() == "error-diffusion")
-            ditheringAlgorithm = render::DitheringAlgorithm::ErrorDiffusion;
-          else
-            throw std::runtime_error("--dithering-algorithm needs a valid algorithm name\n"
-                                     "Usage: --dithering-algorithm <algorithm>\n"
-                                     "Where <algorithm> can be none, ordered, old, or error-diffusion");
-        }
-        // --dithering-matrix <id>
-        else if (opt == &m_options.ditheringMatrix()) {
-          ditheringMatrix = value.value();
-        }
-        // --color-mode <mode>
-        else if (opt == &m_options.colorMode()) {
-          Command* command = Commands::instance()->byId(CommandId::ChangePixelFormat());
-          Params params;
-          if (value.value() == "rgb") {
-            params.set("format", "rgb");
-          }
-          else if (value.value() == "grayscale") {
-            params.set("format", "grayscale");
-          }
-          else if (value.value() == "indexed") {
-            params.set("format", "indexed");
-            switch (ditheringAlgorithm) {
-              case render::DitheringAlgorithm::None:
-                params.set("dithering", "none");
-                break;
-              case render::DitheringAlgorithm::Ordered:
-                params.set("dithering", "ordered");
-                break;
-              case render::DitheringAlgorithm::Old:
-                params.set("dithering", "old");
-                break;
-              case render::DitheringAlgorithm::ErrorDiffusion:
-                params.set("dithering", "error-diffusion");
-                break;
-            }
-
-            if (ditheringAlgorithm != render::DitheringAlgorithm::None &&
-                !ditheringMatrix.empty()) {
-              params.set("dithering-matrix", ditheringMatrix.c_str());
-            }
-          }
-          else {
-            throw std::runtime_error("--color-mode needs a valid color mode for conversion\n"
-                                     "Usage: --color-mode <mode>\n"
-                                     "Where <mode> can be rgb, grayscale, or indexed");
-          }
-
-          for (auto doc : ctx->documents()) {
-            ctx->setActiveDocument(doc);
-            ctx->executeCommand(command, params);
-          }
-        }
-        // --shrink-to <width,height>
-        else if (opt == &m_options.shrinkTo()) {
-          std::vector<std::string> dimensions;
-          base::split_string(value.value(), dimensions, ",");
-          if (dimensions.size() < 2)
-            throw std::runtime_error("--shrink-to needs two parameters separated by comma (,)\n"
-                                     "Usage: --shrink-to width,height\n"
-                                     "E.g. --shrink-to 128,64");
-
-          double maxWidth = base::convert_to<double>(dimensions[0]);
-          double maxHeight = base::convert_to<double>(dimensions[1]);
-          double scaleWidth, scaleHeight, scale;
-
-          // Shrink all sprites if needed
-          for (auto doc : ctx->documents()) {
-            ctx->setActiveDocument(doc);
-            scaleWidth = (doc->width() > maxWidth ? maxWidth / doc->width() : 1.0);
-            scaleHeight = (doc->height() > maxHeight ? maxHeight / doc->height() : 1.0);
-            if (scaleWidth < 1.0 || scaleHeight < 1.0) {
-              scale = std::min(scaleWidth, scaleHeight);
-              Params params;
-              params.set("scale", base::convert_to<std::string>(scale).c_str());
-              ctx->executeCommand(Commands::instance()->byId(CommandId::SpriteSize()),
-                                  params);
-            }
-          }
-        }
-#ifdef ENABLE_SCRIPTING
-        // --script <filename>
-        else if (opt == &m_options.script()) {
-          std::string filename = value.value();
-          int code;
-          try {
-            code = m_delegate->execScript(filename, scriptParams);
-          }
-          catch (const std::exception& ex) {
-            Console::showException(ex);
-            return -1;
-          }
-          if (code != 0)
-            return code;
-        }
-        // --script-param <name=value>
-        else if (opt == &m_options.scriptParam()) {
-          const std::string& v = value.value();
-          auto i = v.find('=');
-          if (i != std::string::npos)
-            scriptParams.set(v.substr(0, i).c_str(),
-                             v.substr(i+1).c_str());
-          else
-            scriptParams.set(v.c_str(), "1");
-        }
-#endif
-        // --list-layers
-        else if (opt == &m_options.listLayers()) {
-          if (m_exporter)
-            m_exporter->setListLayers(true);
-          else
-            cof.listLayers = true;
-        }
-        // --list-tags
-        else if (opt == &m_options.listTags()) {
-          if (m_exporter)
-            m_exporter->setListTags(true);
-          else
-            cof.listTags = true;
-        }
-        // --list-slices
-        else if (opt == &m_options.listSlices()) {
-          if (m_exporter)
-            m_exporter->setListSlices(true);
-          else
-            cof.listSlices = true;
-        }
-        // --oneframe
-        else if (opt == &m_options.oneFrame()) {
-          cof.oneFrame = true;
-        }
+      if (value.option() == &m_options.jobs()) {
+        int jobs = base::convert_to<int>(value.value());
+        if (jobs <= 0)
+          jobs = int(std::thread::hardware_concurrency());
+        m_summary.jobs = std::max(1, jobs);
       }
-      // File names aren't associated to any option
-      else {
-        cof.document = nullptr;
-        cof.filename = base::normalize_path(value.value());
-
-        if (// Check that the filename wasn't used loading a sequence
-            // of images as one sprite
-            m_usedFiles.find(cof.filename) == m_usedFiles.end() &&
-            // Open sprite
-            openFile(ctx, cof)) {
-          lastDoc = cof.document;
-        }
+    }
+
+    if (canProcessJobs(ctx)) {
+      processJobs(ctx, state);
+    }
+    else {
+      if (m_summary.jobs > 1)
+        m_summary.jobs = 1;
+
+      for (const auto& value : m_options.values()) {
+        const int code = processOption(ctx, state, value, m_summary);
+        if (code != 0)
+          return code;
       }
     }
 
     if (m_exporter) {
       // Rows sprite sheet as the default type
-      if (sheetType == SpriteSheetType::None)
-        sheetType = SpriteSheetType::Rows;
-      m_exporter->setSpriteSheetType(sheetType);
+      if (state.sheetType == SpriteSheetType::None)
+        state.sheetType = SpriteSheetType::Rows;
+      m_exporter->setSpriteSheetType(state.sheetType);
 
+      base::Chrono exportChrono;
       m_delegate->exportFiles(ctx, *m_exporter.get());
       m_exporter.reset(nullptr);
+      m_summary.exportTime = exportChrono.elapsed();
+    }
+
+    // Close the documents of the jobs
+    m_lastOpenedJob = nullptr;
+    m_jobs.clear();
+
+    if (m_summary.jobs > 0) {
+      m_summary.totalTime = chrono.elapsed();
+      m_delegate->showSummary(m_summary);
     }
   }
 
@@ -618,24 +513,427 @@ int CliProcessor::process(Context* ctx)
   return 0;
 }
 
-bool CliProcessor::openFile(Context* ctx, CliOpenFile& cof)
+// Processes one option or file name. Returns a non-zero value if the
+// CLI processing must be stopped (the exit code of a --script).
+int CliProcessor::processOption(Context* ctx,
+                                State& state,
+                                const Value& value,
+                                CliSummary& summary)
 {
-  m_delegate->beforeOpenFile(cof);
+  const AppOptions::Option* opt = value.option();
+  CliOpenFile& cof = state.cof;
+  DocExporter* exporter = state.exporter;
+
+  // Special options/commands
+  if (opt) {
+    // --data <file.json>
+    if (opt == &m_options.data()) {
+      if (exporter)
+        exporter->setDataFilename(value.value());
+    }
+    // --format <format>
+    else if (opt == &m_options.format()) {
+      if (exporter) {
+        SpriteSheetDataFormat format = SpriteSheetDataFormat::Default;
 
-  Doc* oldDoc = ctx->activeDocument();
+        if (value.value() == "json-hash")
+          format = SpriteSheetDataFormat::JsonHash;
+        else if (value.value() == "json-array")
+          format = SpriteSheetDataFormat::JsonArray;
+
+        exporter->setDataFormat(format);
+      }
+    }
+    // --sheet <file.png>
+    else if (opt == &m_options.sheet()) {
+      if (exporter)
+        exporter->setTextureFilename(value.value());
+    }
+    // --sheet-width <width>
+    else if (opt == &m_options.sheetWidth()) {
+      if (exporter)
+        exporter->setTextureWidth(strtol(value.value().c_str(), nullptr, 0));
+    }
+    // --sheet-height <height>
+    else if (opt == &m_options.sheetHeight()) {
+      if (exporter)
+        exporter->setTextureHeight(strtol(value.value().c_str(), nullptr, 0));
+    }
+    // --sheet-columns <columns>
+    else if (opt == &m_options.sheetColumns()) {
+      if (exporter)
+        exporter->setTextureColumns(strtol(value.value().c_str(), nullptr, 0));
+    }
+    // --sheet-rows <rows>
+    else if (opt == &m_options.sheetRows()) {
+      if (exporter)
+        exporter->setTextureRows(strtol(value.value().c_str(), nullptr, 0));
+    }
+    // --sheet-type <sheet-type>
+    else if (opt == &m_options.sheetType()) {
+      if (value.value() == "horizontal")
+        state.sheetType = SpriteSheetType::Horizontal;
+      else if (value.value() == "vertical")
+        state.sheetType = SpriteSheetType::Vertical;
+      else if (value.value() == "rows")
+        state.sheetType = SpriteSheetType::Rows;
+      else if (value.value() == "columns")
+        state.sheetType = SpriteSheetType::Columns;
+      else if (value.value() == "packed")
+        state.sheetType = SpriteSheetType::Packed;
+    }
+    // --sheet-pack
+    else if (opt == &m_options.sheetPack()) {
+      state.sheetType = SpriteSheetType::Packed;
+    }
+    // --split-layers
+    else if (opt == &m_options.splitLayers()) {
+      cof.splitLayers = true;
+      if (exporter)
+        exporter->setSplitLayers(true);
+    }
+    // --split-tags
+    else if (opt == &m_options.splitTags()) {
+      cof.splitTags = true;
+      if (exporter)
+        exporter->setSplitTags(true);
+    }
+    // --split-slice
+    else if (opt == &m_options.splitSlices()) {
+      cof.splitSlices = true;
+    }
+    // --layer <layer-name>
+    else if (opt == &m_options.layer()) {
+      cof.includeLayers.push_back(value.value());
+    }
+    // --ignore-layer <layer-name>
+    else if (opt == &m_options.ignoreLayer()) {
+      cof.excludeLayers.push_back(value.value());
+    }
+    // --all-layers
+    else if (opt == &m_options.allLayers()) {
+      cof.allLayers = true;
+    }
+    // --tag <tag-name>
+    else if (opt == &m_options.tag()) {
+      cof.tag = value.value();
+    }
+    // --frame-range from,to
+    else if (opt == &m_options.frameRange()) {
+      std::vector<std::string> splitRange;
+      base::split_string(value.value(), splitRange, ",");
+      if (splitRange.size() < 2)
+        throw std::runtime_error("--frame-range needs two parameters separated by comma (,)\n"
+                                 "Usage: --frame-range from,to\n"
+                                 "E.g. --frame-range 0,99");
+
+      cof.fromFrame = base::convert_to<frame_t>(splitRange[0]);
+      cof.toFrame   = base::convert_to<frame_t>(splitRange[1]);
+    }
+    // --ignore-empty
+    else if (opt == &m_options.ignoreEmpty()) {
+      cof.ignoreEmpty = true;
+      if (exporter)
+        exporter->setIgnoreEmptyCels(true);
+    }
+    // --merge-duplicates
+    else if (opt == &m_options.mergeDuplicates()) {
+      if (exporter)
+        exporter->setMergeDuplicates(true);
+    }
+    // --border-padding
+    else if (opt == &m_options.borderPadding()) {
+      if (exporter)
+        exporter->setBorderPadding(strtol(value.value().c_str(), NULL, 0));
+    }
+    // --shape-padding
+    else if (opt == &m_options.shapePadding()) {
+      if (exporter)
+        exporter->setShapePadding(strtol(value.value().c_str(), NULL, 0));
+    }
+    // --inner-padding
+    else if (opt == &m_options.innerPadding()) {
+      if (exporter)
+        exporter->setInnerPadding(strtol(value.value().c_str(), NULL, 0));
+    }
+    // --trim
+    else if (opt == &m_options.trim()) {
+      cof.trim = true;
+      if (exporter)
+        exporter->setTrimCels(true);
+    }
+    // --trim-sprite
+    else if (opt == &m_options.trimSprite()) {
+      cof.trim = true;
+      if (exporter)
+        exporter->setTrimSprite(true);
+    }
+    // --trim-by-grid
+    else if (opt == &m_options.trimByGrid()) {
+      cof.trim = cof.trimByGrid = true;
+      if (exporter) {
+        exporter->setTrimCels(true);
+        exporter->setTrimByGrid(true);
+      }
+    }
+    // --crop x,y,width,height
+    else if (opt == &m_options.crop()) {
+      std::vector<std::string> parts;
+      base::split_string(value.value(), parts, ",");
+      if (parts.size() < 4)
+        throw std::runtime_error("--crop needs four parameters separated by comma (,)\n"
+                                 "Usage: --crop x,y,width,height\n"
+                                 "E.g. --crop 0,0,32,32");
+
+      cof.crop.x = base::convert_to<int>(parts[0]);
+      cof.crop.y = base::convert_to<int>(parts[1]);
+      cof.crop.w = base::convert_to<int>(parts[2]);
+      cof.crop.h = base::convert_to<int>(parts[3]);
+    }
+    // --slice <slice>
+    else if (opt == &m_options.slice()) {
+      cof.slice = value.value();
+    }
+    // --filename-format
+    else if (opt == &m_options.filenameFormat()) {
+      cof.filenameFormat = value.value();
+      if (exporter)
+        exporter->setFilenameFormat(cof.filenameFormat);
+    }
+    // --compression-level <level>
+    else if (opt == &m_options.compressionLevel()) {
+      const std::string& level = value.value();
+      if (level == "fast")
+        cof.compressionLevel = "1";
+      else if (level == "default")
+        cof.compressionLevel = "-1";
+      else if (level == "small")
+        cof.compressionLevel = "9";
+      else {
+        const int n = base::convert_to<int>(level);
+        if (n < 0 || n > 9 ||
+            base::convert_to<std::string>(n) != level)
+          throw std::runtime_error("--compression-level must be fast, default, small, or a number from 0 to 9\n"
+                                   "Usage: --compression-level <level>\n"
+                                   "E.g. --compression-level 9");
+        cof.compressionLevel = level;
+      }
+    }
+    // --save-as <filename>
+    else if (opt == &m_options.saveAs()) {
+      if (state.lastDoc) {
+        std::string fn = value.value();
+
+        // Automatic --split-layer, --split-tags, --split-slices
+        // in case the output filename already contains {layer},
+        // {tag}, or {slice} template elements.
+        bool hasLayerTemplate = (is_layer_in_filename_format(fn) ||
+                                 is_group_in_filename_format(fn));
+        bool hasTagTemplate = is_tag_in_filename_format(fn);
+        bool hasSliceTemplate = is_slice_in_filename_format(fn);
+
+        if (hasLayerTemplate || hasTagTemplate || hasSliceTemplate) {
+          cof.splitLayers = (cof.splitLayers || hasLayerTemplate);
+          cof.splitTags = (cof.splitTags || hasTagTemplate);
+          cof.splitSlices = (cof.splitSlices || hasSliceTemplate);
+          cof.filenameFormat =
+            get_default_filename_format(
+              fn,
+              true,                                         // With path
+              (state.lastDoc->sprite()->totalFrames() > 1), // Has frames
+              false,                                        // Has layer
+              false);                                       // Has frame tag
+        }
+
+        cof.document = state.lastDoc;
+        cof.filename = fn;
+        saveFile(ctx, cof, summary);
+      }
+      else
+        Console().printf("A document is needed before --save-as argument\n");
+    }
+    // --palette <filename>
+    else if (opt == &m_options.palette()) {
+      if (state.lastDoc) {
+        ASSERT(cof.document == state.lastDoc);
 
-  m_batch.open(ctx,
-               cof.filename,
-               cof.oneFrame);
+        std::string filename = value.value();
+        m_delegate->loadPalette(ctx, cof, filename);
+      }
+      else {
+        Console().printf("You need to load a document to change its palette with --palette\n");
+      }
+    }
+    // --scale <factor>
+    else if (opt == &m_options.scale()) {
+      std::unique_ptr<Command> command(CommandFactory::createSpriteSizeCommand());
+      Params params;
+      params.set("scale", value.value().c_str());
+
+      // Scale all sprites
+      for (auto doc : ctx->documents()) {
+        ctx->setActiveDocument(doc);
+        ctx->executeCommand(command.get(), params);
+      }
+    }
+    // --dithering-algorithm <algorithm>
+    else if (opt == &m_options.ditheringAlgorithm()) {
+      if (value.value() == "none")
+        state.ditheringAlgorithm = render::DitheringAlgorithm::None;
+      else if (value.value() == "ordered")
+        state.ditheringAlgorithm = render::DitheringAlgorithm::Ordered;
+      else if (value.value() == "old")
+        state.ditheringAlgorithm = render::DitheringAlgorithm::Old;
+      else if (value.value() == "error-diffusion")
+        state.ditheringAlgorithm = render::DitheringAlgorithm::ErrorDiffusion;
+      else
+        throw std::runtime_error("--dithering-algorithm needs a valid algorithm name\n"
+                                 "Usage: --dithering-algorithm <algorithm>\n"
+                                 "Where <algorithm> can be none, ordered, old, or error-diffusion");
+    }
+    // --dithering-matrix <id>
+    else if (opt == &m_options.ditheringMatrix()) {
+      state.ditheringMatrix = value.value();
+    }
+    // --color-mode <mode>
+    else if (opt == &m_options.colorMode()) {
+      std::unique_ptr<Command> command(CommandFactory::createChangePixelFormatCommand());
+      const Params params = color_mode_params(value.value(),
+                                              state.ditheringAlgorithm,
+                                              state.ditheringMatrix);
+
+      for (auto doc : ctx->documents()) {
+        ctx->setActiveDocument(doc);
+        ctx->executeCommand(command.get(), params);
+      }
+    }
+    // --shrink-to <width,height>
+    else if (opt == &m_options.shrinkTo()) {
+      std::unique_ptr<Command> command(CommandFactory::createSpriteSizeCommand());
+      double maxWidth, maxHeight;
+      double scaleWidth, scaleHeight, scale;
+      get_shrink_to_size(value.value(), maxWidth, maxHeight);
+
+      // Shrink all sprites if needed
+      for (auto doc : ctx->documents()) {
+        ctx->setActiveDocument(doc);
+        scaleWidth = (doc->width() > maxWidth ? maxWidth / doc->width() : 1.0);
+        scaleHeight = (doc->height() > maxHeight ? maxHeight / doc->height() : 1.0);
+        if (scaleWidth < 1.0 || scaleHeight < 1.0) {
+          scale = std::min(scaleWidth, scaleHeight);
+          Params params;
+          params.set("scale", base::convert_to<std::string>(scale).c_str());
+          ctx->executeCommand(command.get(), params);
+        }
+      }
+    }
+#ifdef ENABLE_SCRIPTING
+    // --script <filename>
+    else if (opt == &m_options.script()) {
+      std::string filename = value.value();
+      int code;
+      try {
+        code = m_delegate->execScript(filename, state.scriptParams);
+      }
+      catch (const std::exception& ex) {
+        Console::showException(ex);
+        return -1;
+      }
+      if (code != 0)
+        return code;
+    }
+    // --script-param <name=value>
+    else if (opt == &m_options.scriptParam()) {
+      const std::string& v = value.value();
+      auto i = v.find('=');
+      if (i != std::string::npos)
+        state.scriptParams.set(v.substr(0, i).c_str(),
+                               v.substr(i+1).c_str());
+      else
+        state.scriptParams.set(v.c_str(), "1");
+    }
+#endif
+    // --list-layers
+    else if (opt == &m_options.listLayers()) {
+      if (m_exporter) {
+        if (exporter)
+          exporter->setListLayers(true);
+      }
+      else
+        cof.listLayers = true;
+    }
+    // --list-tags
+    else if (opt == &m_options.listTags()) {
+      if (m_exporter) {
+        if (exporter)
+          exporter->setListTags(true);
+      }
+      else
+        cof.listTags = true;
+    }
+    // --list-slices
+    else if (opt == &m_options.listSlices()) {
+      if (m_exporter) {
+        if (exporter)
+          exporter->setListSlices(true);
+      }
+      else
+        cof.listSlices = true;
+    }
+    // --oneframe
+    else if (opt == &m_options.oneFrame()) {
+      cof.oneFrame = true;
+    }
+  }
+  // File names aren't associated to any option
+  else {
+    cof.document = nullptr;
+    cof.filename = base::normalize_path(value.value());
+
+    if (// Check that the filename wasn't used loading a sequence
+        // of images as one sprite
+        m_usedFiles.find(cof.filename) == m_usedFiles.end() &&
+        // Open sprite
+        openFile(ctx, cof, summary)) {
+      state.lastDoc = cof.document;
+    }
+  }
+  return 0;
+}
+
+bool CliProcessor::openFile(Context* ctx, CliOpenFile& cof, CliSummary& summary)
+{
+  m_delegate->beforeOpenFile(cof);
+
+  Doc* doc = loadFile(ctx, m_batch, cof, summary);
 
   // Mark used file names as "already processed" so we don't try to
   // open then again
-  for (const auto& usedFn : m_batch.usedFiles()) {
-    auto fn = base::normalize_path(usedFn);
-    m_usedFiles.insert(fn);
+  markUsedFiles(m_batch.usedFiles());
 
-    os::instance()->markCliFileAsProcessed(fn);
-  }
+  // Add document to exporter
+  if (m_exporter && doc)
+    addDocumentSamples(cof);
+
+  m_delegate->afterOpenFile(cof);
+
+  return (doc ? true: false);
+}
+
+// Opens the file in the given context (in the main thread or in a
+// job thread), the document is returned in cof.document.
+Doc* CliProcessor::loadFile(Context* ctx,
+                            OpenBatchOfFiles& batch,
+                            CliOpenFile& cof,
+                            CliSummary& summary)
+{
+  Doc* oldDoc = ctx->activeDocument();
+
+  base::Chrono chrono;
+  batch.open(ctx,
+             cof.filename,
+             cof.oneFrame);
+  summary.loadTime += chrono.elapsed();
 
   Doc* doc = ctx->activeDocument();
   // If the active document is equal to the previous one, it
@@ -646,57 +944,71 @@ bool CliProcessor::openFile(Context* ctx, CliOpenFile& cof)
   cof.document = doc;
 
   if (doc) {
+    ++summary.openedFiles;
+
     // Show all layers
     if (cof.allLayers) {
       for (doc::Layer* layer : doc->sprite()->allLayers())
         layer->setVisible(true);
     }
+  }
+  return doc;
+}
 
-    // Add document to exporter
-    if (m_exporter) {
-      Tag* tag = nullptr;
-      SelectedFrames selFrames;
+void CliProcessor::markUsedFiles(const base::paths& usedFiles)
+{
+  for (const auto& usedFn : usedFiles) {
+    auto fn = base::normalize_path(usedFn);
+    m_usedFiles.insert(fn);
 
-      if (cof.hasTag()) {
-        tag = doc->sprite()->tags().getByName(cof.tag);
-      }
-      if (cof.hasFrameRange()) {
-        // --frame-range with --frame-tag
-        if (tag) {
-          selFrames.insert(
-            tag->fromFrame()+std::clamp(cof.fromFrame, 0, tag->frames()-1),
-            tag->fromFrame()+std::clamp(cof.toFrame, 0, tag->frames()-1));
-        }
-        // --frame-range without --frame-tag
-        else {
-          selFrames.insert(cof.fromFrame, cof.toFrame);
-        }
-      }
+    if (os::instance())
+      os::instance()->markCliFileAsProcessed(fn);
+  }
+}
 
-      SelectedLayers filteredLayers;
-      if (cof.hasLayersFilter())
-        filterLayers(doc->sprite(), cof, filteredLayers);
+void CliProcessor::addDocumentSamples(const CliOpenFile& cof)
+{
+  Doc* doc = cof.document;
+  Tag* tag = nullptr;
+  SelectedFrames selFrames;
 
-      m_exporter->addDocumentSamples(
-        doc, tag,
-        cof.splitLayers,
-        cof.splitTags,
-        (cof.hasLayersFilter() ? &filteredLayers: nullptr),
-        (!selFrames.empty() ? &selFrames: nullptr));
+  if (cof.hasTag()) {
+    tag = doc->sprite()->tags().getByName(cof.tag);
+  }
+  if (cof.hasFrameRange()) {
+    // --frame-range with --frame-tag
+    if (tag) {
+      selFrames.insert(
+        tag->fromFrame()+std::clamp(cof.fromFrame, 0, tag->frames()-1),
+        tag->fromFrame()+std::clamp(cof.toFrame, 0, tag->frames()-1));
+    }
+    // --frame-range without --frame-tag
+    else {
+      selFrames.insert(cof.fromFrame, cof.toFrame);
     }
   }
 
-  m_delegate->afterOpenFile(cof);
-
-  return (doc ? true: false);
+  SelectedLayers filteredLayers;
+  if (cof.hasLayersFilter())
+    filterLayers(doc->sprite(), cof, filteredLayers);
+
+  m_exporter->addDocumentSamples(
+    doc, tag,
+    cof.splitLayers,
+    cof.splitTags,
+    (cof.hasLayersFilter() ? &filteredLayers: nullptr),
+    (!selFrames.empty() ? &selFrames: nullptr));
 }
 
-void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
+void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof, CliSummary& summary)
 {
   ctx->setActiveDocument(cof.document);
 
-  Command* trimCommand = Commands::instance()->byId(CommandId::AutocropSprite());
-  Command* undoCommand = Commands::instance()->byId(CommandId::Undo());
+  // New instances (instead of Commands::instance()) because commands
+  // keep their params and files can be saved from several threads
+  // with --jobs
+  std::unique_ptr<Command> trimCommand(CommandFactory::createAutocropSpriteCommand());
+  std::unique_ptr<Command> undoCommand(CommandFactory::createUndoCommand());
   Doc* doc = cof.document;
   bool clearUndo = false;
 
@@ -706,9 +1018,8 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
     cropParams.set("y", base::convert_to<std::string>(cof.crop.y).c_str());
     cropParams.set("width", base::convert_to<std::string>(cof.crop.w).c_str());
     cropParams.set("height", base::convert_to<std::string>(cof.crop.h).c_str());
-    ctx->executeCommand(
-      Commands::instance()->byId(CommandId::CropSprite()),
-      cropParams);
+    std::unique_ptr<Command> cropCommand(CommandFactory::createCropSpriteCommand());
+    ctx->executeCommand(cropCommand.get(), cropParams);
   }
 
   std::string fn = cof.filename;
@@ -815,7 +1126,7 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
           if (cof.trimByGrid) {
             params.set("byGrid", "true");
           }
-          ctx->executeCommand(trimCommand, params);
+          ctx->executeCommand(trimCommand.get(), params);
         }
 
         CliOpenFile itemCof = cof;
@@ -845,10 +1156,13 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
         itemCof.filenameFormat = filename_formatter(filenameFormat, fnInfo, false);
 
         // Call delegate
+        base::Chrono saveChrono;
         m_delegate->saveFile(ctx, itemCof);
+        summary.saveTime += saveChrono.elapsed();
+        ++summary.savedFiles;
 
         if (cof.trim) {
-          ctx->executeCommand(undoCommand);
+          ctx->executeCommand(undoCommand.get());
           clearUndo = true;
         }
       }
@@ -857,7 +1171,7 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
 
   // Undo crop
   if (!cof.crop.isEmpty()) {
-    ctx->executeCommand(undoCommand);
+    ctx->executeCommand(undoCommand.get());
     clearUndo = true;
   }
 
@@ -868,4 +1182,333 @@ void CliProcessor::saveFile(Context* ctx, const CliOpenFile& cof)
   }
 }
 
+// Files can be processed in background threads if they don't need
+// the UI, and if the CLI options don't access other files/documents
+// in ways that we cannot know in advance.
+bool CliProcessor::canProcessJobs(Context* ctx) const
+{
+  if (m_summary.jobs <= 1 ||
+      !ctx ||
+      ctx->isUIAvailable() ||
+      m_options.previewCLI())
+    return false;
+
+  int files = 0;
+  for (const auto& value : m_options.values()) {
+    const AppOptions::Option* opt = value.option();
+    if (!opt) {
+      ++files;
+    }
+#ifdef ENABLE_SCRIPTING
+    // Scripts can access all the sprites and any file
+    else if (opt == &m_options.script()) {
+      return false;
+    }
+#endif
+    // These options modify all the opened sprites, and all of them
+    // are used in the sprite sheet
+    else if (m_exporter && files > 1 &&
+             (opt == &m_options.scale() ||
+              opt == &m_options.colorMode() ||
+              opt == &m_options.shrinkTo())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// With --jobs <n>, each file name and the options after it (until
+// the next file name) are processed in a thread pool of <n> threads,
+// each file in its own context. Then the files are "collected" in the
+// main thread in the CLI order (calling the delegate and printing
+// their console output), so the result is the same as processing the
+// files one by one.
+void CliProcessor::processJobs(Context* ctx, State& state)
+{
+  int formatJob = -1;
+  for (const auto& value : m_options.values()) {
+    if (!planOption(ctx, state, value, formatJob))
+      break;
+  }
+
+  base::thread_pool pool(m_summary.jobs);
+
+  // Twice the number of threads, so the threads don't need to wait
+  // the main thread to collect the processed files
+  const std::size_t maxJobs = std::size_t(2*m_summary.jobs);
+
+  for (std::size_t i=0; i<m_jobs.size(); ++i) {
+    Job& job = *m_jobs[i];
+
+    std::size_t n = jobDependencies(job, i);
+    if (i >= maxJobs)
+      n = std::max(n, i-maxJobs+1);
+    collectJobs(ctx, n);
+
+    if (job.needsState)
+      resolveState(job, job.state.cof);
+
+    // Check that the filename wasn't used loading a sequence of
+    // images as one sprite
+    if (m_usedFiles.find(job.filename) != m_usedFiles.end()) {
+      job.skipped = true;
+      continue;
+    }
+
+    auto task = std::make_shared<std::packaged_task<void()>>(
+      [this, &job]{ runJob(job); });
+    job.done = task->get_future();
+    pool.execute([task]{ (*task)(); });
+  }
+
+  collectJobs(ctx, m_jobs.size());
+}
+
+// Adds the option to the last job (options before the first file
+// name are processed directly). Returns false if the next options
+// must be ignored, i.e. the option is invalid and will throw an
+// exception when its job is processed.
+bool CliProcessor::planOption(Context* ctx,
+                              State& state,
+                              const Value& value,
+                              int& formatJob)
+{
+  const AppOptions::Option* opt = value.option();
+
+  // Each file name starts a new job with a copy of the current state
+  if (!opt) {
+    auto job = std::make_unique<Job>();
+    job->filename = base::normalize_path(value.value());
+    job->state = state;
+    job->state.exporter = nullptr;
+    job->state.lastDoc = nullptr;
+    job->state.cof.document = nullptr;
+    job->state.cof.filename = job->filename;
+    job->filenamePattern = filename_pattern(job->filename);
+    job->inputPattern = input_pattern(job->filename, state.cof.oneFrame);
+    job->splitSaves = m_splitSaves.size();
+    m_jobs.push_back(std::move(job));
+    return true;
+  }
+
+  if (m_jobs.empty()) {
+    processOption(ctx, state, value, m_summary);
+    return true;
+  }
+
+  const std::size_t i = m_jobs.size()-1;
+  Job& job = *m_jobs[i];
+  job.values.push_back(&value);
+
+  try {
+    // --save-as <filename>
+    if (opt == &m_options.saveAs()) {
+      const std::string& fn = value.value();
+      const bool hasLayerTemplate = (is_layer_in_filename_format(fn) ||
+                                     is_group_in_filename_format(fn));
+      const bool hasTagTemplate = is_tag_in_filename_format(fn);
+      const bool hasSliceTemplate = is_slice_in_filename_format(fn);
+
+      // The automatic --split-* options and filename format (see
+      // processOption()) are used for the next files too
+      if (hasLayerTemplate || hasTagTemplate || hasSliceTemplate) {
+        m_splitSaves.push_back(
+          SplitSave{ i, hasLayerTemplate, hasTagTemplate, hasSliceTemplate });
+        formatJob = int(i);
+        job.writes.push_back(output_pattern(fn, std::string()));
+      }
+      else {
+        if (formatJob >= 0 && formatJob < int(i))
+          job.formatJob = formatJob;
+        job.writes.push_back(
+          output_pattern(fn, (formatJob >= 0 ? std::string():
+                                               state.cof.filenameFormat)));
+      }
+      job.needsState = true;
+    }
+    // --palette <filename>
+    else if (opt == &m_options.palette()) {
+      job.reads.push_back(filename_pattern(value.value()));
+    }
+    // --scale <factor>
+    else if (opt == &m_options.scale()) {
+      // Nothing to do
+    }
+    // --color-mode <mode>
+    else if (opt == &m_options.colorMode()) {
+      const Params params = color_mode_params(value.value(),
+                                              state.ditheringAlgorithm,
+                                              state.ditheringMatrix);
+
+      // Dithering matrices from extensions are loaded the first time
+      // they are used, so we load them from the main thread
+      if (params.has_param("dithering-matrix") && App::instance())
+        App::instance()->extensions().ditheringMatrix(state.ditheringMatrix);
+    }
+    // --shrink-to <width,height>
+    else if (opt == &m_options.shrinkTo()) {
+      double maxWidth, maxHeight;
+      get_shrink_to_size(value.value(), maxWidth, maxHeight);
+    }
+    // Other options change the state for the next files (and the
+    // sprite sheet options are used only from the main thread)
+    else {
+      processOption(ctx, state, value, m_summary);
+
+      if (opt == &m_options.filenameFormat())
+        formatJob = -1;
+    }
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  return true;
+}
+
+// Returns the number of jobs that must be collected before
+// processing the given one.
+std::size_t CliProcessor::jobDependencies(const Job& job,
+                                          const std::size_t index) const
+{
+  std::size_t n = m_collectedJobs;
+  for (std::size_t i=m_collectedJobs; i<index; ++i) {
+    if (job.dependsOn(*m_jobs[i]))
+      n = i+1;
+  }
+
+  if (job.needsState) {
+    // The --split-* options are modified only if there is a
+    // document before the --save-as
+    if (m_firstOpenedJob < 0) {
+      for (std::size_t i=0; i<job.splitSaves; ++i)
+        n = std::max(n, m_splitSaves[i].job+1);
+    }
+    if (job.formatJob >= 0)
+      n = std::max(n, std::size_t(job.formatJob+1));
+  }
+  return n;
+}
+
+// Modifies the state of the given job with the changes of previous
+// jobs that were not known when the CLI options were planned.
+void CliProcessor::resolveState(const Job& job, CliOpenFile& cof) const
+{
+  for (std::size_t i=0; i<job.splitSaves; ++i) {
+    const SplitSave& splitSave = m_splitSaves[i];
+    if (m_firstOpenedJob >= 0 &&
+        std::size_t(m_firstOpenedJob) <= splitSave.job) {
+      cof.splitLayers = (cof.splitLayers || splitSave.layers);
+      cof.splitTags = (cof.splitTags || splitSave.tags);
+      cof.splitSlices = (cof.splitSlices || splitSave.slices);
+    }
+  }
+
+  if (job.formatJob >= 0)
+    cof.filenameFormat = m_jobs[job.formatJob]->state.cof.filenameFormat;
+}
+
+// Opens the file of the job and processes its options (called from a
+// thread of the pool).
+void CliProcessor::runJob(Job& job)
+{
+  job.ctx = std::make_unique<Context>();
+
+  {
+    Console::RedirectOutput redirect(&job.openOutput);
+    loadFile(job.ctx.get(), job.batch, job.state.cof, job.summary);
+  }
+  job.openCof = job.state.cof;
+
+  // The options after a file that cannot be opened are processed in
+  // the main thread with the previous document (see collectJobs())
+  if (!job.state.cof.document)
+    return;
+
+  Console::RedirectOutput redirect(&job.output);
+  job.state.lastDoc = job.state.cof.document;
+  for (const Value* value : job.values)
+    processOption(job.ctx.get(), job.state, *value, job.summary);
+}
+
+// Collects the processed jobs in the CLI order until "n" jobs are
+// collected.
+void CliProcessor::collectJobs(Context* ctx, const std::size_t n)
+{
+  while (m_collectedJobs < n) {
+    Job& job = *m_jobs[m_collectedJobs];
+
+    if (job.done.valid()) {
+      base::Chrono chrono;
+      job.done.wait();
+      m_summary.waitTime += chrono.elapsed();
+    }
+
+    if (!job.needsState)
+      resolveState(job, job.state.cof);
+
+    // Same calls and output of openFile()
+    if (!job.skipped) {
+      if (!job.needsState)
+        resolveState(job, job.openCof);
+
+      CliOpenFile cof = job.openCof;
+      cof.document = nullptr;
+      m_delegate->beforeOpenFile(cof);
+
+      if (!job.openOutput.empty())
+        Console().printf("%s", job.openOutput.c_str());
+
+      markUsedFiles(job.batch.usedFiles());
+
+      if (m_exporter && job.openCof.document)
+        addDocumentSamples(job.openCof);
+
+      m_delegate->afterOpenFile(job.openCof);
+    }
+
+    if (!job.output.empty())
+      Console().printf("%s", job.output.c_str());
+
+    m_summary.openedFiles += job.summary.openedFiles;
+    m_summary.savedFiles += job.summary.savedFiles;
+    m_summary.loadTime += job.summary.loadTime;
+    m_summary.saveTime += job.summary.saveTime;
+
+    if (job.openCof.document) {
+      if (m_firstOpenedJob < 0)
+        m_firstOpenedJob = int(m_collectedJobs);
+
+      // The previous document is not needed anymore (only the last
+      // opened document is used by the options after a file that
+      // cannot be opened)
+      if (m_lastOpenedJob && !m_exporter)
+        m_lastOpenedJob->ctx.reset();
+      m_lastOpenedJob = &job;
+    }
+
+    ++m_collectedJobs;
+
+    // Rethrow the exception processing the options of this file
+    if (job.done.valid())
+      job.done.get();
+
+    // The options after a file that couldn't be opened are processed
+    // with the last opened document (as without --jobs)
+    if (!job.openCof.document) {
+      Context* lastCtx = ctx;
+      job.state.lastDoc = nullptr;
+      if (m_lastOpenedJob) {
+        lastCtx = m_lastOpenedJob->ctx.get();
+        job.state.lastDoc = m_lastOpenedJob->openCof.document;
+      }
+
+      for (const Value* value : job.values)
+        processOption(lastCtx, job.state, *value, m_summary);
+
+      if (!m_exporter)
+        job.ctx.reset();
+    }
+  }
+}
+
 } // namespace app
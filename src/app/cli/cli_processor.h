@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -11,9 +11,13 @@
 
 #include "app/cli/cli_delegate.h"
 #include "app/cli/cli_open_file.h"
+#include "app/commands/params.h"
 #include "app/doc_exporter.h"
+#include "app/sprite_sheet_type.h"
 #include "app/util/open_batch.h"
+#include "base/program_options.h"
 #include "doc/selected_layers.h"
+#include "render/dithering_algorithm.h"
 
 #include <memory>
 #include <set>
@@ -34,6 +38,7 @@ namespace app {
   public:
     CliProcessor(CliDelegate* delegate,
                  const AppOptions& options);
+    ~CliProcessor();
     int process(Context* ctx);
 
     // Public so it can be tested
@@ -44,8 +49,56 @@ namespace app {
                              doc::SelectedLayers& filteredLayers);
 
   private:
-    bool openFile(Context* ctx, CliOpenFile& cof);
-    void saveFile(Context* ctx, const CliOpenFile& cof);
+    typedef base::ProgramOptions::Value Value;
+
+    // Options processed so far (with --jobs each file has its own
+    // copy of the state)
+    struct State {
+      CliOpenFile cof;
+      Doc* lastDoc = nullptr;
+      DocExporter* exporter = nullptr; // Only in the main thread
+      SpriteSheetType sheetType = SpriteSheetType::None;
+      render::DitheringAlgorithm ditheringAlgorithm = render::DitheringAlgorithm::None;
+      std::string ditheringMatrix;
+#ifdef ENABLE_SCRIPTING
+      Params scriptParams;
+#endif
+    };
+
+    // A --save-as with {layer}, {tag} or {slice} in the filename,
+    // it enables the --split-* options for the next files only if
+    // there is a document to save (see processOption())
+    struct SplitSave {
+      std::size_t job;
+      bool layers, tags, slices;
+    };
+
+    // An input file processed in its own context with --jobs
+    struct Job;
+
+    int processOption(Context* ctx,
+                      State& state,
+                      const Value& value,
+                      CliSummary& summary);
+    bool openFile(Context* ctx, CliOpenFile& cof, CliSummary& summary);
+    Doc* loadFile(Context* ctx,
+                  OpenBatchOfFiles& batch,
+                  CliOpenFile& cof,
+                  CliSummary& summary);
+    void markUsedFiles(const base::paths& usedFiles);
+    void addDocumentSamples(const CliOpenFile& cof);
+    void saveFile(Context* ctx, const CliOpenFile& cof, CliSummary& summary);
+
+    bool canProcessJobs(Context* ctx) const;
+    void processJobs(Context* ctx, State& state);
+    bool planOption(Context* ctx,
+                    State& state,
+                    const Value& value,
+                    int& formatJob);
+    std::size_t jobDependencies(const Job& job, std::size_t index) const;
+    void resolveState(const Job& job, CliOpenFile& cof) const;
+    void runJob(Job& job);
+    void collectJobs(Context* ctx, std::size_t n);
 
     void filterLayers(const doc::Sprite* sprite,
                       const CliOpenFile& cof,
@@ -65,6 +118,15 @@ namespace app {
     // load a sequence of files) so we don't ask for them again.
     std::set<std::string> m_usedFiles;
     OpenBatchOfFiles m_batch;
+
+    // --jobs: files in the same order they are specified in the CLI
+    // (collected jobs are kept while their documents are needed).
+    std::vector<std::unique_ptr<Job>> m_jobs;
+    std::vector<SplitSave> m_splitSaves;
+    std::size_t m_collectedJobs;
+    int m_firstOpenedJob;
+    Job* m_lastOpenedJob;
+    CliSummary m_summary;
   };
 
 } // namespace app
@@ -8,10 +8,20 @@
 #include "tests/app_test.h"
 
 #include "app/cli/app_options.h"
+#include "app/cli/cli_open_file.h"
 #include "app/cli/cli_processor.h"
+#include "app/context.h"
+#include "app/doc.h"
 #include "app/doc_exporter.h"
+#include "app/file/file.h"
+#include "base/fs.h"
+#include "doc/tag.h"
 
+#include <algorithm>
 #include <initializer_list>
+#include <mutex>
+#include <string>
+#include <vector>
 
 using namespace app;
 
@@ -93,3 +103,183 @@ TEST(Cli, Version)
   p.process(nullptr);
   EXPECT_TRUE(d.versionWasShown());
 }
+
+// Records the opened/saved files (saveFile() can be called from
+// several threads with --jobs)
+class CliRecorderDelegate : public CliDelegate {
+public:
+  void afterOpenFile(const CliOpenFile& cof) override {
+    if (cof.document)
+      m_openedFiles.push_back(base::get_file_name(cof.filename));
+  }
+
+  void saveFile(Context* ctx, const CliOpenFile& cof) override {
+    Doc* doc = cof.document;
+    const std::string inputFn = doc->filename();
+    doc->setFilename(cof.filename);
+    save_document(ctx, doc);
+    doc->setFilename(inputFn);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_savedFiles.push_back(base::get_file_name(inputFn) + " -> " +
+                           base::get_file_name(cof.filename));
+  }
+
+  void showSummary(const CliSummary& summary) override {
+    m_summary = summary;
+  }
+
+#ifdef ENABLE_SCRIPTING
+  int execScript(const std::string& filename,
+                 const Params& params) override {
+    return 0;
+  }
+#endif
+
+  const std::vector<std::string>& openedFiles() const { return m_openedFiles; }
+  std::vector<std::string> sortedSavedFiles() const {
+    std::vector<std::string> files = m_savedFiles;
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+  const CliSummary& summary() const { return m_summary; }
+
+private:
+  std::mutex m_mutex;
+  std::vector<std::string> m_openedFiles;
+  std::vector<std::string> m_savedFiles;
+  CliSummary m_summary;
+};
+
+// Creates a RGB image of the given width (without trailing digits
+// in the filename, so it isn't loaded as a sequence of files)
+std::string create_test_file(const char* fn, const int width,
+                             const char* tagName = nullptr)
+{
+  app::Context ctx;
+  std::unique_ptr<Doc> doc(
+    ctx.documents().add(width, 8, doc::ColorMode::RGB, 256));
+  doc->setFilename(fn);
+  if (tagName) {
+    auto tag = new doc::Tag(0, 0);
+    tag->setName(tagName);
+    doc->sprite()->tags().add(tag);
+  }
+  save_document(&ctx, doc.get());
+  doc->close();
+  return fn;
+}
+
+int test_file_width(const std::string& fn)
+{
+  app::Context ctx;
+  std::unique_ptr<Doc> doc(load_document(&ctx, fn.c_str()));
+  if (!doc)
+    return 0;
+  const int width = doc->sprite()->width();
+  doc->close();
+  return width;
+}
+
+void delete_test_files(const std::vector<std::string>& files)
+{
+  for (const auto& fn : files) {
+    if (base::is_file(fn))
+      base::delete_file(fn);
+  }
+}
+
+TEST(Cli, JobsKeepOrder)
+{
+  const char* inputs[] = { "_cli_a.png", "_cli_b.png", "_cli_c.png",
+                           "_cli_d.png", "_cli_e.png", "_cli_f.png" };
+  const char* outputs[] = { "_cli_a_out.png", "_cli_b_out.png", "_cli_c_out.png",
+                            "_cli_d_out.png", "_cli_e_out.png", "_cli_f_out.png" };
+  std::vector<std::string> files;
+  for (int i=0; i<6; ++i)
+    files.push_back(create_test_file(inputs[i], 10+i));
+
+  std::vector<std::string> sortedSavedFiles[2];
+  for (int j=0; j<2; ++j) {
+    auto a = args({ "--batch", "--jobs", (j == 0 ? "1": "4"),
+                    inputs[0], "--save-as", outputs[0],
+                    inputs[1], "--save-as", outputs[1],
+                    inputs[2], "--save-as", outputs[2],
+                    inputs[3], "--save-as", outputs[3],
+                    inputs[4], "--save-as", outputs[4],
+                    inputs[5], "--save-as", outputs[5] });
+    app::Context ctx;
+    CliRecorderDelegate d;
+    CliProcessor p(&d, *a);
+    p.process(&ctx);
+
+    // Files are opened in the CLI order (also with --jobs)
+    ASSERT_EQ(6u, d.openedFiles().size());
+    for (int i=0; i<6; ++i)
+      EXPECT_EQ(inputs[i], d.openedFiles()[i]);
+
+    sortedSavedFiles[j] = d.sortedSavedFiles();
+    for (int i=0; i<6; ++i) {
+      EXPECT_EQ(10+i, test_file_width(outputs[i]));
+      files.push_back(outputs[i]);
+    }
+
+    EXPECT_EQ(j == 0 ? 1: 4, d.summary().jobs);
+    EXPECT_EQ(6, d.summary().openedFiles);
+    EXPECT_EQ(6, d.summary().savedFiles);
+    delete_test_files(std::vector<std::string>(outputs, outputs+6));
+  }
+
+  // Same files saved with and without --jobs
+  ASSERT_EQ(6u, sortedSavedFiles[0].size());
+  EXPECT_EQ(sortedSavedFiles[0], sortedSavedFiles[1]);
+  delete_test_files(files);
+}
+
+// An input file generated by a previous --save-as must be processed
+// after it's saved (and with the state modified by the --save-as,
+// e.g. the automatic --split-tags)
+TEST(Cli, JobsGeneratedInput)
+{
+  std::vector<std::string> files = {
+    create_test_file("_cli_in.png", 12, "t"),
+    "_cli_gen_t.png",
+    "_cli_gen_copy.png",
+  };
+
+  auto a = args({ "--batch", "--jobs", "4",
+                  "_cli_in.png", "--save-as", "_cli_gen_{tag}.png",
+                  "_cli_gen_t.png", "--save-as", "_cli_gen_copy.png" });
+  app::Context ctx;
+  CliRecorderDelegate d;
+  CliProcessor p(&d, *a);
+  p.process(&ctx);
+
+  ASSERT_EQ(2u, d.openedFiles().size());
+  EXPECT_EQ("_cli_in.png", d.openedFiles()[0]);
+  EXPECT_EQ("_cli_gen_t.png", d.openedFiles()[1]);
+  EXPECT_EQ(2, d.summary().savedFiles);
+  EXPECT_EQ(12, test_file_width("_cli_gen_t.png"));
+  EXPECT_EQ(12, test_file_width("_cli_gen_copy.png"));
+  delete_test_files(files);
+}
+
+#ifdef ENABLE_SCRIPTING
+// Scripts can access any sprite/file, so files are processed one by
+// one in the main thread
+TEST(Cli, JobsWithScripts)
+{
+  std::vector<std::string> files = { create_test_file("_cli_a.png", 10) };
+
+  auto a = args({ "--batch", "--jobs", "4",
+                  "_cli_a.png", "--script", "_cli_script.lua" });
+  app::Context ctx;
+  CliRecorderDelegate d;
+  CliProcessor p(&d, *a);
+  p.process(&ctx);
+
+  EXPECT_EQ(1, d.summary().jobs);
+  EXPECT_EQ(1, d.summary().openedFiles);
+  delete_test_files(files);
+}
+#endif
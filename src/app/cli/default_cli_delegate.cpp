@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2016-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -13,12 +13,16 @@
 
 #include "app/cli/app_options.h"
 #include "app/cli/cli_open_file.h"
-#include "app/commands/commands.h"
+#include "app/commands/command.h"
+#include "app/commands/command_factory.h"
 #include "app/commands/params.h"
 #include "app/console.h"
+#include "app/context_access.h"
 #include "app/doc.h"
+#include "app/doc_api.h"
 #include "app/doc_exporter.h"
 #include "app/file/palette_file.h"
+#include "app/tx.h"
 #include "app/ui_context.h"
 #include "base/convert_to.h"
 #include "doc/layer.h"
@@ -26,6 +30,7 @@
 #include "doc/slice.h"
 #include "doc/sprite.h"
 #include "doc/tag.h"
+#include "fmt/format.h"
 #include "ver/info.h"
 
 #ifdef ENABLE_SCRIPTING
@@ -80,7 +85,11 @@ void DefaultCliDelegate::afterOpenFile(const CliOpenFile& cof)
 
 void DefaultCliDelegate::saveFile(Context* ctx, const CliOpenFile& cof)
 {
-  Command* saveAsCommand = Commands::instance()->byId(CommandId::SaveFileCopyAs());
+  // A new command instance (instead of Commands::instance()) because
+  // commands keep their params and files can be saved from several
+  // threads with --jobs
+  std::unique_ptr<Command> saveAsCommand(
+    CommandFactory::createSaveFileCopyAsCommand());
   Params params;
   params.set("filename", cof.filename.c_str());
   params.set("filename-format", cof.filenameFormat.c_str());
@@ -99,7 +108,10 @@ void DefaultCliDelegate::saveFile(Context* ctx, const CliOpenFile& cof)
   if (cof.ignoreEmpty)
     params.set("ignoreEmpty", "true");
 
-  ctx->executeCommand(saveAsCommand, params);
+  if (cof.hasCompressionLevel())
+    params.set("compression-level", cof.compressionLevel.c_str());
+
+  ctx->executeCommand(saveAsCommand.get(), params);
 }
 
 void DefaultCliDelegate::loadPalette(Context* ctx,
@@ -108,11 +120,16 @@ void DefaultCliDelegate::loadPalette(Context* ctx,
 {
   std::unique_ptr<doc::Palette> palette(load_palette(filename.c_str()));
   if (palette) {
-    Command* loadPalCommand = Commands::instance()->byId(CommandId::LoadPalette());
-    Params params;
-    params.set("filename", filename.c_str());
-
-    ctx->executeCommand(loadPalCommand, params);
+    // Same as the LoadPalette command, but without using the global
+    // SetPalette command instance and the current palette (this can
+    // be called from several threads with --jobs)
+    ContextWriter writer(ctx);
+    if (writer.document()) {
+      Tx tx(writer.context(), "Load Palette");
+      writer.document()->getApi(tx)
+        .setPalette(writer.sprite(), writer.frame(), palette.get());
+      tx.commit();
+    }
   }
   else {
     Console().printf("Error loading palette in --palette '%s'\n",
@@ -133,6 +150,26 @@ void DefaultCliDelegate::exportFiles(Context* ctx, DocExporter& exporter)
   LOG("APP: Export sprite sheet: Done\n");
 }
 
+void DefaultCliDelegate::showSummary(const CliSummary& summary)
+{
+  // Printed in stderr so the stdout output (e.g. --list-layers) is
+  // the same with or without --jobs
+  std::cerr
+    << fmt::format("Jobs: {}\n"
+                   "Opened files: {} ({:.3f}s)\n"
+                   "Saved files: {} ({:.3f}s)\n"
+                   "Waiting jobs: {:.3f}s\n",
+                   summary.jobs,
+                   summary.openedFiles,
+                   summary.loadTime,
+                   summary.savedFiles,
+                   summary.saveTime,
+                   summary.waitTime);
+  if (summary.exportTime > 0.0)
+    std::cerr << fmt::format("Sprite sheet: {:.3f}s\n", summary.exportTime);
+  std::cerr << fmt::format("Total time: {:.3f}s\n", summary.totalTime);
+}
+
 #ifdef ENABLE_SCRIPTING
 int DefaultCliDelegate::execScript(const std::string& filename,
                                    const Params& params)
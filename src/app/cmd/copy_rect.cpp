@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -13,6 +14,7 @@
 #include "doc/image.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace app {
 namespace cmd {
@@ -29,9 +31,10 @@ CopyRect::CopyRect(Image* dst, const Image* src, const gfx::Clip& clip)
   // Fill m_data with "src" data
 
   int lineSize = src->getRowStrideSize(m_clip.size.w);
-  m_data.resize(lineSize * m_clip.size.h);
+  base::buffer& data = m_data.data();
+  data.resize(lineSize * m_clip.size.h);
 
-  auto it = m_data.begin();
+  auto it = data.begin();
   for (int v=0; v<m_clip.size.h; ++v) {
     uint8_t* addr = src->getPixelAddress(
       m_clip.dst.x, m_clip.dst.y+v);
@@ -65,7 +68,7 @@ void CopyRect::swap()
   int lineSize = this->lineSize();
   std::vector<uint8_t> tmp(lineSize);
 
-  auto it = m_data.begin();
+  auto it = m_data.data().begin();
   for (int v=0; v<m_clip.size.h; ++v) {
     uint8_t* addr = image->getPixelAddress(
       m_clip.dst.x, m_clip.dst.y+v);
@@ -78,6 +81,8 @@ void CopyRect::swap()
   }
 
   image->incrementVersion();
+
+  m_data.compressLater();
 }
 
 int CopyRect::lineSize()
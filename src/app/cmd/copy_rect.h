@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -10,9 +11,9 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_image.h"
+#include "app/util/undo_buffer.h"
 #include "gfx/clip.h"
 
-#include <vector>
 
 namespace doc {
   class Image;
@@ -32,7 +33,7 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) + m_data.size();
+      return sizeof(*this) + m_data.memSize();
     }
 
   private:
@@ -40,7 +41,7 @@ namespace cmd {
     int lineSize();
 
     gfx::Clip m_clip;
-    std::vector<uint8_t> m_data;
+    UndoBuffer m_data;
   };
 
 } // namespace cmd
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -39,13 +39,15 @@ CopyRegion::CopyRegion(Image* dst, const Image* src,
     m_region.createUnion(m_region, gfx::Region(clip.dstBounds()));
   }
 
-  save_image_region_in_buffer(m_region, src, dstPos, m_buffer);
+  save_image_region_in_buffer(m_region, src, dstPos, m_buffer.data());
 }
 
 void CopyRegion::onExecute()
 {
   if (!m_alreadyCopied)
     swap();
+  else
+    m_buffer.compressLater();
 }
 
 void CopyRegion::onUndo()
@@ -63,8 +65,10 @@ void CopyRegion::swap()
   Image* image = this->image();
   ASSERT(image);
 
-  swap_image_region_with_buffer(m_region, image, m_buffer);
+  swap_image_region_with_buffer(m_region, image, m_buffer.data());
   image->incrementVersion();
+
+  m_buffer.compressLater();
 }
 
 } // namespace cmd
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -11,7 +11,7 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_image.h"
-#include "base/buffer.h"
+#include "app/util/undo_buffer.h"
 #include "gfx/point.h"
 #include "gfx/region.h"
 
@@ -36,7 +36,7 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) + m_buffer.size();
+      return sizeof(*this) + m_buffer.memSize();
     }
 
   private:
@@ -44,7 +44,7 @@ namespace cmd {
 
     bool m_alreadyCopied;
     gfx::Region m_region;
-    base::buffer m_buffer;
+    UndoBuffer m_buffer;
   };
 
 } // namespace cmd
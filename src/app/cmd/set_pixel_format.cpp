@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -26,6 +26,11 @@
 #include "render/quantization.h"
 #include "render/task_delegate.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 namespace app {
 namespace cmd {
 
@@ -33,35 +38,47 @@ using namespace doc;
 
 namespace {
 
+// Delegate used by all threads that convert cels. Only the thread
+// that created the SetPixelFormat command reports the progress to the
+// original delegate, the other threads just check if the task was
+// canceled.
 class SuperDelegate : public render::TaskDelegate {
 public:
   SuperDelegate(int ncels, render::TaskDelegate* delegate)
     : m_ncels(ncels)
-    , m_curCel(0)
-    , m_delegate(delegate) {
+    , m_celsDone(0)
+    , m_canceled(false)
+    , m_delegate(delegate)
+    , m_mainThread(std::this_thread::get_id()) {
   }
 
   void notifyTaskProgress(double progress) override {
-    if (m_delegate)
+    if (m_delegate && isMainThread())
       m_delegate->notifyTaskProgress(
-        (progress + m_curCel) / m_ncels);
+        std::min(1.0, (progress + m_celsDone) / m_ncels));
   }
 
   bool continueTask() override {
-    if (m_delegate)
-      return m_delegate->continueTask();
-    else
-      return true;
+    if (m_delegate && isMainThread() && !m_delegate->continueTask())
+      m_canceled = true;
+    return !m_canceled;
   }
 
-  void nextCel() {
-    ++m_curCel;
+  void celDone() {
+    ++m_celsDone;
+    notifyTaskProgress(0.0);
   }
 
 private:
+  bool isMainThread() const {
+    return (std::this_thread::get_id() == m_mainThread);
+  }
+
   int m_ncels;
-  int m_curCel;
+  std::atomic<int> m_celsDone;
+  std::atomic<bool> m_canceled;
   TaskDelegate* m_delegate;
+  std::thread::id m_mainThread;
 };
 
 } // anonymous namespace
@@ -78,25 +95,70 @@ SetPixelFormat::SetPixelFormat(Sprite* sprite,
   if (sprite->pixelFormat() == newFormat)
     return;
 
-  SuperDelegate superDel(sprite->uniqueCels().size(), delegate);
-
-  for (Cel* cel : sprite->uniqueCels()) {
-    ImageRef old_image = cel->imageRef();
-    ImageRef new_image(
-      render::convert_pixel_format
-      (old_image.get(), nullptr, newFormat,
-       dithering,
-       sprite->rgbMap(cel->frame()),
-       sprite->palette(cel->frame()),
-       cel->layer()->isBackground(),
-       old_image->maskColor(),
-       toGray,
-       &superDel));
-
-    m_seq.add(new cmd::ReplaceImage(sprite, old_image, new_image));
-    superDel.nextCel();
+  std::vector<Cel*> cels;
+  for (Cel* cel : sprite->uniqueCels())
+    cels.push_back(cel);
+
+  std::vector<ImageRef> newImages(cels.size());
+  SuperDelegate superDel(int(cels.size()), delegate);
+
+  // Cels with the same palette are converted in several threads (the
+  // sprite RgbMap is regenerated only from this thread between each
+  // group of cels). This is specially useful for error diffusion,
+  // where each image must be converted in one thread.
+  for (std::size_t begin=0; begin<cels.size(); ) {
+    const frame_t frame = cels[begin]->frame();
+    const Palette* palette = sprite->palette(frame);
+    const RgbMap* rgbmap = sprite->rgbMap(frame);
+
+    std::size_t end = begin+1;
+    while (end < cels.size() &&
+           sprite->palette(cels[end]->frame()) == palette)
+      ++end;
+
+    // Each cel is converted in one thread, and the threads that are
+    // left (if there are fewer cels than CPU cores) are used to
+    // convert bands of each image.
+    const int ncores = std::max(1, int(std::thread::hardware_concurrency()));
+    const int nthreads = std::min(ncores, int(end - begin));
+    const int bandThreads = ncores / nthreads;
+
+    std::atomic<std::size_t> nextCel(begin);
+    auto convertCels = [&]() {
+      for (std::size_t i=nextCel++; i<end; i=nextCel++) {
+        const Cel* cel = cels[i];
+        const Image* old_image = cel->image();
+        newImages[i].reset(
+          render::convert_pixel_format
+          (old_image, nullptr, newFormat,
+           dithering,
+           rgbmap,
+           palette,
+           cel->layer()->isBackground(),
+           old_image->maskColor(),
+           toGray,
+           &superDel,
+           bandThreads));
+        superDel.celDone();
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads-1);
+    for (int i=1; i<nthreads; ++i)
+      threads.emplace_back(convertCels);
+
+    convertCels();
+
+    for (auto& thread : threads)
+      thread.join();
+
+    begin = end;
   }
 
+  for (std::size_t i=0; i<cels.size(); ++i)
+    m_seq.add(new cmd::ReplaceImage(sprite, cels[i]->imageRef(), newImages[i]));
+
   // Set all cels opacity to 100% if we are converting to indexed.
   // TODO remove this
   if (newFormat == IMAGE_INDEXED) {
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020 Igara Studio S.A.
+// Copyright (C) 2019-2022 Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -36,6 +36,10 @@ struct ColorQuantizationParams : public NewParams {
   Param<bool> withAlpha { this, true, "withAlpha" };
   Param<int> maxColors { this, 256, "maxColors" };
   Param<bool> useRange { this, false, "useRange" };
+  // Use only one of each N frames/pixels to create an approximate
+  // palette faster.
+  Param<int> frameStep { this, 1, "frameStep" };
+  Param<int> pixelStep { this, 1, "pixelStep" };
 };
 
 class ColorQuantizationCommand : public CommandWithNewParams<ColorQuantizationParams> {
@@ -142,13 +146,16 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
 
     SpriteJob job(reader, "Color Quantization");
     const bool newBlend = Preferences::instance().experimental.newBlend();
+    const int frameStep = std::max(1, params().frameStep());
+    const int pixelStep = std::max(1, params().pixelStep());
     job.startJobWithCallback(
-      [sprite, withAlpha, &tmpPalette, &job, newBlend]{
+      [sprite, withAlpha, &tmpPalette, &job, newBlend, frameStep, pixelStep]{
         render::create_palette_from_sprite(
           sprite, 0, sprite->lastFrame(),
           withAlpha, &tmpPalette,
-          &job,
-          newBlend);     // SpriteJob is a render::TaskDelegate
+          &job,          // SpriteJob is a render::TaskDelegate
+          newBlend,
+          frameStep, pixelStep);
       });
     job.waitJob();
     if (job.isCanceled())
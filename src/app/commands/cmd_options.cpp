@@ -49,6 +49,8 @@
 
 #include "options.xml.h"
 
+#include <algorithm>
+
 namespace app {
 
 namespace {
@@ -299,6 +301,10 @@ public:
     if (m_pref.general.showFullPath())
       showFullPath()->setSelected(true);
 
+    aseCompressionLevel()->setSelectedItemIndex(
+      std::max(0, aseCompressionLevel()->findItemIndexByValue(
+                    base::convert_to<std::string>(m_pref.ase.compressionLevel()))));
+
     dataRecoveryPeriod()->setSelectedItemIndex(
       dataRecoveryPeriod()->findItemIndexByValue(
         base::convert_to<std::string>(m_pref.general.dataRecoveryPeriod())));
@@ -596,6 +602,9 @@ public:
     m_pref.general.expandMenubarOnMouseover(expandOnMouseover);
     ui::MenuBar::setExpandOnMouseover(expandOnMouseover);
 
+    m_pref.ase.compressionLevel(
+      base::convert_to<int>(aseCompressionLevel()->getValue()));
+
     std::string warnings;
 
     double newPeriod = base::convert_to<double>(dataRecoveryPeriod()->getValue());
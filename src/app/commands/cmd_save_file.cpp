@@ -220,6 +220,9 @@ void SaveFileBaseCommand::saveDocumentInBackground(
   if (resizeOnTheFly == ResizeOnTheFly::On)
     fop->setOnTheFlyScale(scale);
 
+  if (params().compressionLevel.isSet())
+    fop->setAseCompressionLevel(params().compressionLevel());
+
   SaveFileJob job(fop.get());
   job.showProgressWindow();
 
@@ -31,6 +31,7 @@ namespace app {
     Param<doc::frame_t> toFrame { this, 0, { "toFrame", "to-frame" } };
     Param<bool> ignoreEmpty { this, false, "ignoreEmpty" };
     Param<double> scale { this, 1.0, "scale" };
+    Param<int> compressionLevel { this, -1, { "compressionLevel", "compression-level" } };
   };
 
   class SaveFileBaseCommand : public CommandWithNewParams<SaveFileParams> {
@@ -165,7 +165,11 @@ void UndoCommand::onExecute(Context* context)
 #ifdef ENABLE_UI
   update_screen_for_document(document);
 #endif
-  set_current_palette(writer.palette(), false);
+
+  // Like Transaction::commit(), the current palette is changed only
+  // for the app context
+  if (App::instance() && context == App::instance()->context())
+    set_current_palette(writer.palette(), false);
 }
 
 Command* CommandFactory::createUndoCommand()
@@ -82,8 +82,8 @@ private:
 
     // If we had a previous filter preview running in the background,
     // we explicitly request it be stopped. Otherwise, changing the
-    // size of the filter would cause a race condition on
-    // MedianFilter::m_channel field.
+    // size of the filter would cause a race condition on the
+    // MedianFilter histograms.
     stopPreview();
 
     m_filter.setSize(newSize.w, newSize.h);
@@ -34,21 +34,149 @@
 #include "doc/image.h"
 #include "doc/layer.h"
 #include "doc/mask.h"
+#include "doc/palette_picks.h"
 #include "doc/sprite.h"
 #include "filters/filter.h"
 #include "ui/manager.h"
 #include "ui/view.h"
 #include "ui/widget.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <set>
+#include <thread>
 
 namespace app {
 
 using namespace std;
 using namespace ui;
 
+namespace {
+
+// Minimum number of pixels of each band of rows that is filtered in
+// a different thread.
+const int kMinPixelsPerBand = 64*1024;
+
+// Applies the filter to a band of rows of one image. Unlike
+// FilterManagerImpl (which is a cursor of the whole process), it can
+// be used from any thread: the palettes, the RgbMap, and the palette
+// picks are taken in the thread that creates the worker threads
+// (FilterManagerImpl::getNewPalette() modifies the state of the
+// FilterManagerImpl, so it cannot be called from worker threads).
+class BandFilterManager : public FilterManager
+                        , public FilterIndexedData {
+public:
+  BandFilterManager(const doc::Palette* palette,
+                    const doc::Palette* newPalette,
+                    const doc::RgbMap* rgbmap,
+                    const doc::PalettePicks& picks,
+                    const doc::PixelFormat pixelFormat,
+                    const doc::Image* src,
+                    doc::Image* dst,
+                    const gfx::Rect& bounds,
+                    const doc::Mask* mask,
+                    const bool maskActive,
+                    const Target target)
+    : m_palette(palette)
+    , m_newPalette(newPalette)
+    , m_rgbmap(rgbmap)
+    , m_picks(picks)
+    , m_pixelFormat(pixelFormat)
+    , m_src(src)
+    , m_dst(dst)
+    , m_bounds(bounds)
+    , m_mask(mask && mask->bitmap() ? mask: nullptr)
+    , m_maskActive(maskActive)
+    , m_target(target)
+    , m_firstRow(0)
+    , m_row(0) {
+  }
+
+  // Applies the filter to rows [row1, row2) of the bounds (returns
+  // false if it was canceled).
+  bool applyToRows(Filter* filter, const int row1, const int row2,
+                   const std::atomic<bool>& canceled) {
+    for (m_row=m_firstRow=row1; m_row<row2; ++m_row) {
+      if (canceled)
+        return false;
+
+      // Same logic of FilterManagerImpl::applyStep()
+      if (m_mask) {
+        const int x = m_bounds.x - m_mask->bounds().x;
+        const int y = m_bounds.y - m_mask->bounds().y + m_row;
+        if ((x >= m_bounds.w) ||
+            (y >= m_bounds.h))
+          break;
+
+        m_maskBits = m_mask->bitmap()
+          ->lockBits<BitmapTraits>(Image::ReadLock,
+            gfx::Rect(x, y, m_bounds.w - x, m_bounds.h - y));
+
+        m_maskIterator = m_maskBits.begin();
+      }
+
+      switch (m_pixelFormat) {
+        case IMAGE_RGB:       filter->applyToRgba(this); break;
+        case IMAGE_GRAYSCALE: filter->applyToGrayscale(this); break;
+        case IMAGE_INDEXED:   filter->applyToIndexed(this); break;
+      }
+    }
+    return true;
+  }
+
+  // FilterManager implementation
+  doc::PixelFormat pixelFormat() const override { return m_pixelFormat; }
+  const void* getSourceAddress() override { return m_src->getPixelAddress(m_bounds.x, m_bounds.y+m_row); }
+  void* getDestinationAddress() override { return m_dst->getPixelAddress(m_bounds.x, m_bounds.y+m_row); }
+  int getWidth() override { return m_bounds.w; }
+  Target getTarget() override { return m_target; }
+  FilterIndexedData* getIndexedData() override { return this; }
+  bool skipPixel() override {
+    bool skip = false;
+    if (m_mask) {
+      if (!*m_maskIterator)
+        skip = true;
+      ++m_maskIterator;
+    }
+    return skip;
+  }
+  const doc::Image* getSourceImage() override { return m_src; }
+  int x() const override { return m_bounds.x; }
+  int y() const override { return m_bounds.y+m_row; }
+  bool isFirstRow() const override { return m_row == m_firstRow; }
+  bool isMaskActive() const override { return m_maskActive; }
+
+  // FilterIndexedData implementation (filters only read the new
+  // palette from worker threads, e.g. HueSaturationFilter uses it to
+  // replace RGB pixels that match palette entries, it's modified only
+  // in Filter::applyToPalette() from the main thread)
+  const doc::Palette* getPalette() const override { return m_palette; }
+  const doc::RgbMap* getRgbMap() const override { return m_rgbmap; }
+  doc::Palette* getNewPalette() override { return const_cast<doc::Palette*>(m_newPalette); }
+  doc::PalettePicks getPalettePicks() override { return m_picks; }
+
+private:
+  const doc::Palette* m_palette;
+  const doc::Palette* m_newPalette;
+  const doc::RgbMap* m_rgbmap;
+  const doc::PalettePicks& m_picks;
+  doc::PixelFormat m_pixelFormat;
+  const doc::Image* m_src;
+  doc::Image* m_dst;
+  gfx::Rect m_bounds;
+  const doc::Mask* m_mask;
+  bool m_maskActive;
+  Target m_target;
+  int m_firstRow;
+  int m_row;
+  doc::ImageBits<doc::BitmapTraits> m_maskBits;
+  doc::ImageBits<doc::BitmapTraits>::iterator m_maskIterator;
+};
+
+} // anonymous namespace
+
 FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   : m_reader(context)
   , m_site(*const_cast<Site*>(m_reader.site()))
@@ -220,27 +348,7 @@ void FilterManagerImpl::apply()
   }
 
   if (!cancelled) {
-    gfx::Rect output;
-    if (algorithm::shrink_bounds2(m_src.get(), m_dst.get(),
-                                  m_bounds, output)) {
-      if (m_cel->layer()->isBackground()) {
-        (*m_tx)(
-          new cmd::CopyRegion(
-            m_cel->image(),
-            m_dst.get(),
-            gfx::Region(output),
-            position()));
-      }
-      else {
-        // Patch "m_cel"
-        (*m_tx)(
-          new cmd::PatchCel(
-            m_cel, m_dst.get(),
-            gfx::Region(output),
-            position()));
-      }
-    }
-
+    patchCel();
     result = CommandResult(CommandResult::kOk);
   }
   else {
@@ -251,6 +359,30 @@ void FilterManagerImpl::apply()
   m_reader.context()->setCommandResult(result);
 }
 
+void FilterManagerImpl::patchCel()
+{
+  gfx::Rect output;
+  if (algorithm::shrink_bounds2(m_src.get(), m_dst.get(),
+                                m_bounds, output)) {
+    if (m_cel->layer()->isBackground()) {
+      (*m_tx)(
+        new cmd::CopyRegion(
+          m_cel->image(),
+          m_dst.get(),
+          gfx::Region(output),
+          position()));
+    }
+    else {
+      // Patch "m_cel"
+      (*m_tx)(
+        new cmd::PatchCel(
+          m_cel, m_dst.get(),
+          gfx::Region(output),
+          position()));
+    }
+  }
+}
+
 void FilterManagerImpl::applyToTarget()
 {
   applyToPaletteIfNeeded();
@@ -292,9 +424,6 @@ void FilterManagerImpl::applyToTarget()
   }
 
   m_progressBase = 0.0f;
-  m_progressWidth = (cels.size() > 0 ? 1.0f / cels.size(): 1.0f);
-
-  std::set<ObjectId> visited;
 
   // Palette change
   if (paletteChange) {
@@ -305,30 +434,151 @@ void FilterManagerImpl::applyToTarget()
                           m_site.frame(), &newPalette));
   }
 
-  // For each target image
-  for (auto it = cels.begin();
-       it != cels.end() && !cancelled;
-       ++it) {
-    Image* image = (*it)->image();
+  // Avoid applying the filter two times to the same image
+  CelList uniqueCels;
+  std::set<ObjectId> visited;
+  for (Cel* cel : cels) {
+    if (visited.insert(cel->image()->id()).second)
+      uniqueCels.push_back(cel);
+  }
+  m_progressWidth = (uniqueCels.size() > 0 ? 1.0f / uniqueCels.size(): 1.0f);
 
-    // Avoid applying the filter two times to the same image
-    if (visited.find(image->id()) == visited.end()) {
-      visited.insert(image->id());
+  const int nthreads = std::max(1, int(std::thread::hardware_concurrency()));
+  if (m_filter->isThreadSafe() && nthreads > 1 && !uniqueCels.empty()) {
+    applyToCelsInThreads(uniqueCels, nthreads);
+  }
+  else {
+    // For each target image
+    for (auto it = uniqueCels.begin();
+         it != uniqueCels.end() && !cancelled;
+         ++it) {
       applyToCel(*it);
-    }
 
-    // Is there a delegate to know if the process was cancelled by the user?
-    if (m_progressDelegate)
-      cancelled = m_progressDelegate->isCancelled();
+      // Is there a delegate to know if the process was cancelled by the user?
+      if (m_progressDelegate)
+        cancelled = m_progressDelegate->isCancelled();
 
-    // Make progress
-    m_progressBase += m_progressWidth;
+      // Make progress
+      m_progressBase += m_progressWidth;
+    }
   }
 
   // Reset m_oldPalette to avoid restoring the color palette
   m_oldPalette.reset(nullptr);
 }
 
+// Applies the filter to bands of rows of several cels at the same
+// time. The cels are processed in groups (one cel per thread) to
+// limit the memory used by copies of the images, and the cels are
+// patched (in the transaction) from this thread.
+void FilterManagerImpl::applyToCelsInThreads(const CelList& cels,
+                                             const int nthreads)
+{
+  // Same as applyStep() in the first row of each cel
+  applyToPaletteIfNeeded();
+
+  Doc* doc = m_site.document();
+  const doc::Mask* mask = (doc->isMaskVisible() ? doc->mask(): nullptr);
+  const bool maskActive = isMaskActive();
+  const doc::PixelFormat pixelFormat = this->pixelFormat();
+
+  // getNewPalette() backups the original palette the first time it's
+  // called, so we call it here instead of from the worker threads.
+  const doc::Palette* newPalette = getNewPalette();
+  const doc::Palette* palette = getPalette();
+  const doc::RgbMap* rgbmap = getRgbMap();
+  const doc::PalettePicks picks = getPalettePicks();
+  bool cancelled = false;
+
+  struct Job {
+    Cel* cel;
+    ImageRef src;
+    ImageRef dst;
+    Target target;
+  };
+
+  struct Band {
+    int job;
+    int row1, row2;
+  };
+
+  for (std::size_t begin=0; begin<cels.size() && !cancelled; ) {
+    const std::size_t end = std::min(cels.size(), begin+nthreads);
+
+    std::vector<Job> jobs;
+    for (std::size_t i=begin; i<end; ++i) {
+      init(cels[i]);
+      jobs.push_back(Job{ m_cel, m_src, m_dst, m_target });
+    }
+
+    // All cels have the same bounds (the sprite bounds or the mask bounds)
+    const int rowsPerBand = std::max(1, kMinPixelsPerBand / m_bounds.w);
+    std::vector<Band> bands;
+    for (int job=0; job<int(jobs.size()); ++job) {
+      for (int row=0; row<m_bounds.h; row+=rowsPerBand)
+        bands.push_back(Band{ job, row, std::min(row+rowsPerBand, m_bounds.h) });
+    }
+
+    // Only this thread reports the progress and asks the delegate if
+    // the process was cancelled
+    const std::thread::id mainThread = std::this_thread::get_id();
+    const int totalRows = int(jobs.size()) * m_bounds.h;
+    std::atomic<std::size_t> nextBand(0);
+    std::atomic<int> rowsDone(0);
+    std::atomic<bool> canceled(false);
+
+    auto applyBands = [&]() {
+      for (std::size_t i=nextBand++; i<bands.size(); i=nextBand++) {
+        const Band& band = bands[i];
+        const Job& job = jobs[band.job];
+        BandFilterManager bandMgr(palette, newPalette, rgbmap, picks,
+                                  pixelFormat,
+                                  job.src.get(), job.dst.get(),
+                                  m_bounds, mask, maskActive, job.target);
+        if (!bandMgr.applyToRows(m_filter, band.row1, band.row2, canceled))
+          break;
+        rowsDone += band.row2 - band.row1;
+
+        if (m_progressDelegate && std::this_thread::get_id() == mainThread) {
+          m_progressDelegate->reportProgress(
+            m_progressBase + m_progressWidth * jobs.size() * rowsDone / totalRows);
+          if (m_progressDelegate->isCancelled())
+            canceled = true;
+        }
+      }
+    };
+
+    const int nbandThreads = std::min(nthreads, int(bands.size()));
+    std::vector<std::thread> threads;
+    threads.reserve(nbandThreads-1);
+    for (int i=1; i<nbandThreads; ++i)
+      threads.emplace_back(applyBands);
+
+    applyBands();
+
+    for (auto& thread : threads)
+      thread.join();
+
+    cancelled = canceled;
+    if (!cancelled) {
+      for (Job& job : jobs) {
+        m_cel = job.cel;
+        m_src = job.src;
+        m_dst = job.dst;
+        patchCel();
+      }
+    }
+
+    m_progressBase += m_progressWidth * jobs.size();
+    begin = end;
+  }
+
+  ASSERT(m_reader.context());
+  m_reader.context()->setCommandResult(
+    CommandResult(cancelled ? CommandResult::kCanceled:
+                              CommandResult::kOk));
+}
+
 void FilterManagerImpl::initTransaction()
 {
   ASSERT(!m_tx);
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -14,6 +14,7 @@
 #include "app/site.h"
 #include "app/tx.h"
 #include "base/exception.h"
+#include "doc/cel_list.h"
 #include "doc/image_impl.h"
 #include "doc/image_ref.h"
 #include "doc/pixel_format.h"
@@ -67,9 +68,11 @@ namespace app {
       virtual ~IProgressDelegate() { }
 
       // Called to report the progress of the filter (with progress from 0.0 to 1.0).
+      // It's called only from the thread that calls applyToTarget().
       virtual void reportProgress(float progress) = 0;
 
       // Should return true if the user wants to cancel the filter.
+      // It's called only from the thread that calls applyToTarget().
       virtual bool isCancelled() = 0;
     };
 
@@ -130,6 +133,8 @@ namespace app {
     void init(doc::Cel* cel);
     void apply();
     void applyToCel(doc::Cel* cel);
+    void applyToCelsInThreads(const doc::CelList& cels, const int nthreads);
+    void patchCel();
     bool updateBounds(doc::Mask* mask);
 
     // Returns true if the palette was changed (true when the filter
@@ -33,6 +33,9 @@ using namespace ui;
 
 Console::ConsoleWindow* Console::m_console = nullptr;
 
+// Output of Console::printf() for the current thread (nullptr = stdout)
+static thread_local std::string* redirected_output = nullptr;
+
 class Console::ConsoleWindow final : public Window {
 public:
   ConsoleWindow() : Window(Window::WithTitleBar, "Console"),
@@ -240,6 +243,10 @@ void Console::printf(const char* format, ...)
   va_end(ap);
 
   if (!m_withUI || !m_console) {
+    if (redirected_output) {
+      redirected_output->append(msg);
+      return;
+    }
     fputs(msg.c_str(), stdout);
     fflush(stdout);
     return;
@@ -255,6 +262,17 @@ void Console::printf(const char* format, ...)
   m_console->addMessage(msg);
 }
 
+Console::RedirectOutput::RedirectOutput(std::string* output)
+  : m_oldOutput(redirected_output)
+{
+  redirected_output = output;
+}
+
+Console::RedirectOutput::~RedirectOutput()
+{
+  redirected_output = m_oldOutput;
+}
+
 // static
 void Console::showException(const std::exception& e)
 {
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <exception>
+#include <string>
 
 namespace app {
   class Context;
@@ -24,6 +25,18 @@ namespace app {
     static void showException(const std::exception& e);
     static void notifyNewDisplayConfiguration();
 
+    // Accumulates the text printed without UI in the current thread
+    // in the given string (instead of stdout) while this object is
+    // alive. Used to print the output of CLI files processed in
+    // other threads (--jobs) in the same order as they were given.
+    class RedirectOutput {
+    public:
+      RedirectOutput(std::string* output);
+      ~RedirectOutput();
+    private:
+      std::string* m_oldOutput;
+    };
+
   private:
     class ConsoleWindow;
 
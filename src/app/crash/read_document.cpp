@@ -124,10 +124,35 @@ private:
     if (m_images.find(imageId) != m_images.end())
       return m_images[imageId];
 
-    ImageRef image(loadObject<Image*>("img", imageId, &Reader::readImage));
+    ImageRef image(loadImage(imageId));
     return m_images[imageId] = image;
   }
 
+  // Images can be saved as a full image ("img" file) or as the
+  // modified tiles from a previous full image ("imgd" file).
+  Image* loadImage(ObjectId imageId) {
+    const ObjVersions& versions = m_objVersions[imageId];
+
+    for (size_t i=0; i<versions.size(); ++i) {
+      ObjectVersion ver = versions[i];
+      if (!ver)
+        continue;
+
+      Image* image = nullptr;
+      if (base::is_file(objectFilename("imgd", imageId, ver)))
+        image = loadObjectVersion<Image*>("imgd", imageId, ver, &Reader::readImageDelta);
+      else
+        image = loadObjectVersion<Image*>("img", imageId, ver, &Reader::readImage);
+      if (image)
+        return image;
+    }
+
+    if (!m_loadInfo)
+      Console().printf("Error loading object img #%d\n", imageId);
+
+    return nullptr;
+  }
+
   CelDataRef getCelDataRef(ObjectId celdataId) {
     if (m_celdatas.find(celdataId) != m_celdatas.end())
       return m_celdatas[celdataId];
@@ -145,26 +170,9 @@ private:
       if (!ver)
         continue;
 
-      TRACE("RECO: Restoring %s #%d v%d\n", prefix, id, ver);
-
-      std::string fn = prefix;
-      fn.push_back('-');
-      fn += base::convert_to<std::string>(id);
-      fn.push_back('.');
-      fn += base::convert_to<std::string>(ver);
-
-      std::ifstream s(FSTREAM_PATH(base::join_path(m_dir, fn)), std::ifstream::binary);
-      T obj = nullptr;
-      if (read32(s) == MAGIC_NUMBER)
-        obj = (this->*readMember)(s);
-
-      if (obj) {
-        TRACE("RECO: %s #%d v%d restored successfully\n", prefix, id, ver);
+      T obj = loadObjectVersion<T>(prefix, id, ver, readMember);
+      if (obj)
         return obj;
-      }
-      else {
-        TRACE("RECO: %s #%d v%d was not restored\n", prefix, id, ver);
-      }
     }
 
     // Show error only if we've failed to load all versions
@@ -174,6 +182,34 @@ private:
     return nullptr;
   }
 
+  template<typename T>
+  T loadObjectVersion(const char* prefix, ObjectId id, ObjectVersion ver,
+                      T (Reader::*readMember)(std::ifstream&)) {
+    TRACE("RECO: Restoring %s #%d v%d\n", prefix, id, ver);
+
+    std::ifstream s(FSTREAM_PATH(objectFilename(prefix, id, ver)), std::ifstream::binary);
+    T obj = nullptr;
+    if (read32(s) == MAGIC_NUMBER)
+      obj = (this->*readMember)(s);
+
+    if (obj) {
+      TRACE("RECO: %s #%d v%d restored successfully\n", prefix, id, ver);
+    }
+    else {
+      TRACE("RECO: %s #%d v%d was not restored\n", prefix, id, ver);
+    }
+    return obj;
+  }
+
+  std::string objectFilename(const char* prefix, ObjectId id, ObjectVersion ver) const {
+    std::string fn = prefix;
+    fn.push_back('-');
+    fn += base::convert_to<std::string>(id);
+    fn.push_back('.');
+    fn += base::convert_to<std::string>(ver);
+    return base::join_path(m_dir, fn);
+  }
+
   Doc* readDocument(std::ifstream& s) {
     ObjectId sprId = read32(s);
     std::string filename = read_string(s);
@@ -456,6 +492,24 @@ private:
     return read_image(s, false);
   }
 
+  // Reads the full image saved as the base of the delta, and then
+  // the modified tiles.
+  Image* readImageDelta(std::ifstream& s) {
+    ObjectId id = read32(s);
+    ObjectVersion baseVersion = read32(s);
+    color_t maskColor = read32(s);
+
+    std::unique_ptr<Image> image(
+      loadObjectVersion<Image*>("img", id, baseVersion, &Reader::readImage));
+    if (!image ||
+        image->pixelFormat() == IMAGE_BITMAP ||
+        !read_image_tiles(s, image.get()))
+      return nullptr;
+
+    image->setMaskColor(maskColor);
+    return image.release();
+  }
+
   Palette* readPalette(std::ifstream& s) {
     return read_palette(s);
   }
@@ -554,7 +608,7 @@ Doc* read_document_with_raw_images(const std::string& dir,
     if (t)
       t->set_progress((i++) / fns.size());
 
-    if (fn.compare(0, 3, "img") != 0)
+    if (fn.compare(0, 4, "img-") != 0)
       continue;
 
     std::ifstream s(FSTREAM_PATH(base::join_path(dir, fn)), std::ifstream::binary);
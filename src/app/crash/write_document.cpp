@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -28,6 +28,7 @@
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/palette_io.h"
+#include "doc/primitives.h"
 #include "doc/slice.h"
 #include "doc/slice_io.h"
 #include "doc/sprite.h"
@@ -39,6 +40,7 @@
 
 #include <fstream>
 #include <map>
+#include <vector>
 
 namespace app {
 namespace crash {
@@ -49,7 +51,33 @@ using namespace doc;
 
 namespace {
 
+// Size of the tiles used to detect the modified regions of images
+const int kImageTileSize = 64;
+
+// If the modified tiles are more than 1/kMaxDeltaFraction of the
+// image, the full image is saved again (compaction).
+const int kMaxDeltaFraction = 4;
+
+// zlib compression level for images (faster than the default level
+// to hold the document lock less time)
+const int kImageCompressionLevel = 1;
+
+// Information of the last full image saved in the backup, used to
+// save only the modified tiles in a "imgd" file (delta) for the next
+// versions of the image.
+struct ImageBackup {
+  ObjectVersion baseVersion = 0;
+  PixelFormat pixelFormat = IMAGE_RGB;
+  int width = 0;
+  int height = 0;
+  std::vector<uint64_t> tileHashes;
+  ObjectVersion deltaVersion = 0;
+};
+
+typedef std::map<ObjectId, ImageBackup> ImageBackupsMap;
+
 static std::map<ObjectId, ObjVersionsMap> g_docVersions;
+static std::map<ObjectId, ImageBackupsMap> g_docImageBackups;
 static std::map<ObjectId, base::paths> g_deleteFiles;
 
 class Writer {
@@ -58,6 +86,7 @@ public:
     : m_dir(dir)
     , m_doc(doc)
     , m_objVersions(g_docVersions[doc->id()])
+    , m_imageBackups(g_docImageBackups[doc->id()])
     , m_deleteFiles(g_deleteFiles[doc->id()])
     , m_cancel(cancel) {
   }
@@ -92,7 +121,7 @@ public:
         if (cel->link())        // Skip link
           continue;
 
-        if (!saveObject("img", cel->image(), &Writer::writeImage))
+        if (!saveImage(cel->image()))
           return false;
 
         if (!saveObject("celdata", cel->data(), &Writer::writeCelData))
@@ -255,7 +284,91 @@ private:
   }
 
   bool writeImage(std::ofstream& s, Image* img) {
-    return write_image(s, img, m_cancel);
+    return write_image(s, img, m_cancel, kImageCompressionLevel);
+  }
+
+  bool writeImageDelta(std::ofstream& s, Image* img) {
+    const ImageBackup& backup = m_imageBackups[img->id()];
+    write32(s, img->id());
+    write32(s, backup.baseVersion);
+    write32(s, img->maskColor());
+    return write_image_tiles(s, img, m_deltaTiles, m_cancel,
+                             kImageCompressionLevel);
+  }
+
+  // Saves the given image as a full image ("img" file), or only the
+  // tiles that are different from the last full image ("imgd"
+  // file). Deltas are cumulative, so we only need the last full
+  // image and the last delta to restore the image.
+  bool saveImage(Image* img) {
+    if (isCanceled())
+      return false;
+
+    if (!img->version())
+      img->incrementVersion();
+
+    ObjVersions& versions = m_objVersions[img->id()];
+    if (versions.newer() == img->version())
+      return true;
+
+    ImageBackup& backup = m_imageBackups[img->id()];
+    const int tilesW = (img->width()+kImageTileSize-1) / kImageTileSize;
+    const int tilesH = (img->height()+kImageTileSize-1) / kImageTileSize;
+    std::vector<uint64_t> tileHashes(tilesW*tilesH);
+    auto tileBounds = [img](int tx, int ty) {
+      return gfx::Rect(tx*kImageTileSize, ty*kImageTileSize,
+                       kImageTileSize, kImageTileSize).createIntersection(img->bounds());
+    };
+
+    m_deltaTiles.clear();
+    int i = 0;
+    for (int ty=0; ty<tilesH; ++ty) {
+      for (int tx=0; tx<tilesW; ++tx, ++i) {
+        tileHashes[i] = calculate_image_hash(img, tileBounds(tx, ty));
+        if (i < int(backup.tileHashes.size()) &&
+            tileHashes[i] != backup.tileHashes[i])
+          m_deltaTiles.push_back(tileBounds(tx, ty));
+      }
+      if (isCanceled())
+        return false;
+    }
+
+    const bool canSaveDelta =
+      (backup.baseVersion &&
+       img->pixelFormat() != IMAGE_BITMAP &&
+       img->pixelFormat() == backup.pixelFormat &&
+       img->width() == backup.width &&
+       img->height() == backup.height &&
+       m_deltaTiles.size()*kMaxDeltaFraction < tileHashes.size());
+
+    if (canSaveDelta) {
+      if (!saveObjectFile("imgd", img, img->version(), &Writer::writeImageDelta))
+        return false;
+
+      if (backup.deltaVersion)
+        deleteLater("imgd", img->id(), backup.deltaVersion);
+      backup.deltaVersion = img->version();
+    }
+    else {
+      if (!saveObjectFile("img", img, img->version(), &Writer::writeImage))
+        return false;
+
+      // Old full image and delta aren't needed anymore
+      if (backup.baseVersion)
+        deleteLater("img", img->id(), backup.baseVersion);
+      if (backup.deltaVersion)
+        deleteLater("imgd", img->id(), backup.deltaVersion);
+
+      backup.baseVersion = img->version();
+      backup.pixelFormat = img->pixelFormat();
+      backup.width = img->width();
+      backup.height = img->height();
+      backup.tileHashes = std::move(tileHashes);
+      backup.deltaVersion = 0;
+    }
+
+    versions.rotateRevisions(img->version());
+    return true;
   }
 
   bool writePalette(std::ofstream& s, Palette* pal) {
@@ -285,13 +398,22 @@ private:
     if (versions.newer() == obj->version())
       return true;
 
-    std::string fn = prefix;
-    fn.push_back('-');
-    fn += base::convert_to<std::string>(obj->id());
+    if (!saveObjectFile(prefix, obj, obj->version(), writeMember))
+      return false;
+
+    // Remove the older version
+    if (versions.older())
+      deleteLater(prefix, obj->id(), versions.older());
 
-    std::string fullfn = base::join_path(m_dir, fn);
-    std::string oldfn = fullfn + "." + base::convert_to<std::string>(versions.older());
-    fullfn += "." + base::convert_to<std::string>(obj->version());
+    // Rotate versions and add the latest one
+    versions.rotateRevisions(obj->version());
+    return true;
+  }
+
+  template<typename T>
+  bool saveObjectFile(const char* prefix, T* obj, ObjectVersion version,
+                      bool (Writer::*writeMember)(std::ofstream&, T*)) {
+    std::string fullfn = objectFilename(prefix, obj->id(), version);
 
     std::ofstream s(FSTREAM_PATH(fullfn), std::ofstream::binary);
     write32(s, 0);                // Leave a room for the magic number
@@ -306,15 +428,24 @@ private:
     s.seekp(0);
     write32(s, MAGIC_NUMBER);
 
-    // Remove the older version
-    if (versions.older() && base::is_file(oldfn))
-      m_deleteFiles.push_back(oldfn);
+    TRACE(" - Saved %s #%d v%d\n", prefix, obj->id(), version);
+    return true;
+  }
 
-    // Rotate versions and add the latest one
-    versions.rotateRevisions(obj->version());
+  std::string objectFilename(const char* prefix, ObjectId id, ObjectVersion version) const {
+    std::string fn = prefix;
+    fn.push_back('-');
+    fn += base::convert_to<std::string>(id);
+    fn.push_back('.');
+    fn += base::convert_to<std::string>(version);
+    return base::join_path(m_dir, fn);
+  }
 
-    TRACE(" - Saved %s #%d v%d\n", prefix, obj->id(), obj->version());
-    return true;
+  // Deletes the file after all files are correctly saved
+  void deleteLater(const char* prefix, ObjectId id, ObjectVersion version) {
+    std::string fn = objectFilename(prefix, id, version);
+    if (base::is_file(fn))
+      m_deleteFiles.push_back(fn);
   }
 
   void deleteOldVersions() {
@@ -335,8 +466,12 @@ private:
   std::string m_dir;
   Doc* m_doc;
   ObjVersionsMap& m_objVersions;
+  ImageBackupsMap& m_imageBackups;
   base::paths& m_deleteFiles;
   doc::CancelIO* m_cancel;
+
+  // Modified tiles of the image being saved by saveImage()
+  std::vector<gfx::Rect> m_deltaTiles;
 };
 
 } // anonymous namespace
@@ -363,6 +498,11 @@ void delete_document_internals(Doc* doc)
     if (it != g_docVersions.end())
       g_docVersions.erase(it);
   }
+  {
+    auto it = g_docImageBackups.find(doc->id());
+    if (it != g_docImageBackups.end())
+      g_docImageBackups.erase(it);
+  }
   {
     auto it = g_deleteFiles.find(doc->id());
     if (it != g_deleteFiles.end())
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -200,10 +200,11 @@ void Doc::notifyPaletteChanged()
   notify_observers<DocEvent&>(&DocObserver::onPaletteChanged, ev);
 }
 
-void Doc::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame)
+void Doc::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame, Layer* layer)
 {
   DocEvent ev(this);
   ev.sprite(sprite);
+  ev.layer(layer);
   ev.region(region);
   ev.frame(frame);
   notify_observers<DocEvent&>(&DocObserver::onSpritePixelsModified, ev);
@@ -332,23 +333,24 @@ void Doc::destroyMaskBoundaries()
 
 void Doc::generateMaskBoundaries(const Mask* mask)
 {
-  m_maskBoundaries.reset();
-
   // No mask specified? Use the current one in the document
   if (!mask) {
-    if (!isMaskVisible())       // The mask is hidden
+    if (!isMaskVisible()) {     // The mask is hidden
+      m_maskBoundaries.reset();
       return;                   // Done, without boundaries
+    }
     else
       mask = this->mask();      // Use the document mask
   }
 
   ASSERT(mask);
 
-  if (!mask->isEmpty()) {
-    m_maskBoundaries.regen(mask->bitmap());
-    m_maskBoundaries.offset(mask->bounds().x,
-                            mask->bounds().y);
-  }
+  // Only the modified rows of the mask are regenerated if its bounds
+  // didn't change since the last time
+  if (!mask->isEmpty())
+    m_maskBoundaries.update(mask->bitmap(), mask->bounds().origin());
+  else
+    m_maskBoundaries.reset();
 
   notifySelectionBoundariesChanged();
 }
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2020  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -107,7 +107,10 @@ namespace app {
     void notifyGeneralUpdate();
     void notifyColorSpaceChanged();
     void notifyPaletteChanged();
-    void notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame);
+    // The layer is optional, it's used when the pixels of a specific
+    // layer were modified (e.g. by the tool loop).
+    void notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame,
+                                    Layer* layer = nullptr);
     void notifyExposeSpritePixels(Sprite* sprite, const gfx::Region& region);
     void notifyLayerMergedDown(Layer* srcLayer, Layer* targetLayer);
     void notifyCelMoved(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, frame_t toFrame);
@@ -17,10 +17,12 @@
 #include "app/context.h"
 #include "app/doc_undo_observer.h"
 #include "app/pref/preferences.h"
+#include "app/util/undo_buffer.h"
 #include "base/mem_utils.h"
 #include "undo/undo_history.h"
 #include "undo/undo_state.h"
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
@@ -58,7 +60,8 @@ void DocUndo::add(CmdTransaction* cmd)
   }
 
   m_undoHistory.add(cmd);
-  m_totalUndoSize += cmd->memSize();
+  ASSERT(STATE_CMD(m_undoHistory.currentState()) == cmd);
+  updateStateSize(m_undoHistory.currentState());
 
   notify_observers(&DocUndoObserver::onAddUndoState, this);
   notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
@@ -101,14 +104,11 @@ bool DocUndo::canRedo() const
 void DocUndo::undo()
 {
   const size_t oldSize = m_totalUndoSize;
-  {
-    const undo::UndoState* state = nextUndo();
-    ASSERT(state);
-    const Cmd* cmd = STATE_CMD(state);
-    m_totalUndoSize -= cmd->memSize();
-    m_undoHistory.undo();
-    m_totalUndoSize += cmd->memSize();
-  }
+  const undo::UndoState* state = nextUndo();
+  ASSERT(state);
+  m_undoHistory.undo();
+  updateStateSize(state);
+
   // This notification could execute a script that modifies the sprite
   // again (e.g. a script that is listening the "change" event, check
   // the SpriteEvents class). If the sprite is modified, the "cmd" is
@@ -121,14 +121,11 @@ void DocUndo::undo()
 void DocUndo::redo()
 {
   const size_t oldSize = m_totalUndoSize;
-  {
-    const undo::UndoState* state = nextRedo();
-    ASSERT(state);
-    const Cmd* cmd = STATE_CMD(state);
-    m_totalUndoSize -= cmd->memSize();
-    m_undoHistory.redo();
-    m_totalUndoSize += cmd->memSize();
-  }
+  const undo::UndoState* state = nextRedo();
+  ASSERT(state);
+  m_undoHistory.redo();
+  updateStateSize(state);
+
   notify_observers(&DocUndoObserver::onCurrentUndoStateChange, this);
   if (m_totalUndoSize != oldSize)
     notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
@@ -232,18 +229,78 @@ void DocUndo::moveToState(const undo::UndoState* state)
   // sprite on its "change" event.
   notify_observers(&DocUndoObserver::onCurrentUndoStateChange, this);
 
-  // Recalculate the total undo size
+  // Recalculate the total undo size (several states could be
+  // undone/redone)
   size_t oldSize = m_totalUndoSize;
-  m_totalUndoSize = 0;
-  const undo::UndoState* s = m_undoHistory.firstState();
-  while (s) {
-    m_totalUndoSize += STATE_CMD(s)->memSize();
-    s = s->next();
-  }
+  recalcTotalUndoSize();
   if (m_totalUndoSize != oldSize)
     notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
 }
 
+size_t DocUndo::totalUndoSize() const
+{
+  // Include the current size of states that are being compressed
+  // (without modifying the recorded sizes, they are updated in the
+  // next add/undo/redo).
+  size_t total = m_totalUndoSize;
+  for (const undo::UndoState* state : m_unsettledStates)
+    total += STATE_CMD(state)->memSize() - m_stateSizes.at(state);
+  return total;
+}
+
+void DocUndo::recalcTotalUndoSize()
+{
+  m_totalUndoSize = 0;
+  m_stateSizes.clear();
+  m_unsettledStates.clear();
+
+  for (const undo::UndoState* s = m_undoHistory.firstState();
+       s; s = s->next()) {
+    const size_t size = STATE_CMD(s)->memSize();
+    m_stateSizes[s] = size;
+    m_totalUndoSize += size;
+  }
+}
+
+// Updates the size of a state that was added/undone/redone. Its
+// pixels could be compressed in a background thread later (see
+// UndoBuffer), so it's kept as unsettled until all the background
+// compression tasks finish.
+void DocUndo::updateStateSize(const undo::UndoState* state)
+{
+  updateUnsettledStateSizes();
+
+  const size_t size = STATE_CMD(state)->memSize();
+  size_t& oldSize = m_stateSizes[state];
+  m_totalUndoSize += size - oldSize;
+  oldSize = size;
+
+  if (UndoBuffer::HasPendingTasks() &&
+      std::find(m_unsettledStates.begin(),
+                m_unsettledStates.end(), state) == m_unsettledStates.end())
+    m_unsettledStates.push_back(state);
+}
+
+void DocUndo::updateUnsettledStateSizes()
+{
+  if (m_unsettledStates.empty())
+    return;
+
+  // Check this before the sizes, so if all tasks are finished now,
+  // the sizes we get are the final ones.
+  const bool settled = !UndoBuffer::HasPendingTasks();
+
+  for (const undo::UndoState* state : m_unsettledStates) {
+    const size_t size = STATE_CMD(state)->memSize();
+    size_t& oldSize = m_stateSizes[state];
+    m_totalUndoSize += size - oldSize;
+    oldSize = size;
+  }
+
+  if (settled)
+    m_unsettledStates.clear();
+}
+
 const undo::UndoState* DocUndo::nextUndo() const
 {
   return m_undoHistory.currentState();
@@ -268,7 +325,14 @@ void DocUndo::onDeleteUndoState(undo::UndoState* state)
              base::get_pretty_memory_size(cmd->memSize()).c_str(),
              base::get_pretty_memory_size(m_totalUndoSize).c_str());
 
-  m_totalUndoSize -= cmd->memSize();
+  auto it = m_stateSizes.find(state);
+  if (it != m_stateSizes.end()) {
+    m_totalUndoSize -= it->second;
+    m_stateSizes.erase(it);
+  }
+  m_unsettledStates.erase(
+    std::remove(m_unsettledStates.begin(), m_unsettledStates.end(), state),
+    m_unsettledStates.end());
   notify_observers(&DocUndoObserver::onDeleteUndoState, this, state);
 }
 
@@ -17,6 +17,8 @@
 
 #include <iosfwd>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace app {
   using namespace doc;
@@ -31,7 +33,7 @@ namespace app {
   public:
     DocUndo();
 
-    size_t totalUndoSize() const { return m_totalUndoSize; }
+    size_t totalUndoSize() const;
 
     void setContext(Context* ctx);
 
@@ -67,6 +69,9 @@ namespace app {
     void moveToState(const undo::UndoState* state);
 
   private:
+    void recalcTotalUndoSize();
+    void updateStateSize(const undo::UndoState* state);
+    void updateUnsettledStateSizes();
     const undo::UndoState* nextUndo() const;
     const undo::UndoState* nextRedo() const;
 
@@ -75,8 +80,15 @@ namespace app {
 
     undo::UndoHistory m_undoHistory;
     Context* m_ctx;
+    // Sum of the sizes in m_stateSizes.
     size_t m_totalUndoSize;
 
+    // Size of each state counted in m_totalUndoSize, and states that
+    // are being compressed in background (their sizes can change, see
+    // UndoBuffer).
+    std::unordered_map<const undo::UndoState*, size_t> m_stateSizes;
+    std::vector<const undo::UndoState*> m_unsettledStates;
+
     // This counter is equal to 0 if we are in the "saved state", i.e.
     // the document on memory is equal to the document on disk. This
     // value is less than 0 if we're in a past version of the document
@@ -15,6 +15,8 @@
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
 #include "app/pref/preferences.h"
+#include "app/thumbnails.h"
+#include "base/buffer.h"
 #include "base/cfile.h"
 #include "base/exception.h"
 #include "base/file_handle.h"
@@ -30,7 +32,13 @@
 #include "ver/info.h"
 #include "zlib.h"
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace app {
 
@@ -62,6 +70,10 @@ public:
     return m_fop->isOneFrame();
   }
 
+  bool decodeThumbnail() override {
+    return m_fop->isThumbnailOnly();
+  }
+
   doc::color_t defaultSliceColor() override {
     auto color = Preferences::instance().slices.defaultColor();
     return doc::rgba(color.getRed(),
@@ -74,6 +86,10 @@ public:
     m_sprite = sprite;
   }
 
+  void onThumbnail(const doc::ImageRef& thumbnail) override {
+    m_fop->setThumbnail(thumbnail);
+  }
+
   doc::Sprite* sprite() { return m_sprite; }
 
 private:
@@ -83,6 +99,8 @@ private:
 
 } // anonymous namespace
 
+class CelCompressor;
+
 static void ase_file_prepare_header(FILE* f, dio::AsepriteHeader* header, const Sprite* sprite,
                                     const frame_t firstFrame, const frame_t totalFrames);
 static void ase_file_write_header(FILE* f, dio::AsepriteHeader* header);
@@ -92,11 +110,16 @@ static void ase_file_prepare_frame_header(FILE* f, dio::AsepriteFrameHeader* fra
 static void ase_file_write_frame_header(FILE* f, dio::AsepriteFrameHeader* frame_header);
 
 static void ase_file_write_layers(FILE* f, dio::AsepriteFrameHeader* frame_header, const Layer* layer, int child_level);
+static void ase_file_collect_cel_images(const Layer* layer,
+                                        const frame_t frame,
+                                        const frame_t firstFrame,
+                                        std::vector<const Image*>& images);
 static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_header,
                                    const Sprite* sprite, const Layer* layer,
                                    layer_t layer_index,
                                    const frame_t frame,
-                                   const frame_t firstFrame);
+                                   const frame_t firstFrame,
+                                   CelCompressor& compressor);
 
 static void ase_file_write_padding(FILE* f, int bytes);
 static void ase_file_write_string(FILE* f, const std::string& string);
@@ -107,17 +130,27 @@ static void ase_file_write_close_chunk(FILE* f, dio::AsepriteChunk* chunk);
 static void ase_file_write_color2_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, const Palette* pal);
 static void ase_file_write_palette_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, const Palette* pal, int from, int to);
 static void ase_file_write_layer_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, const Layer* layer, int child_level);
+static const Cel* ase_file_get_link_cel(const Cel* cel,
+                                        const LayerImage* layer,
+                                        const frame_t firstFrame);
 static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header,
                                      const Cel* cel,
                                      const LayerImage* layer,
                                      const layer_t layer_index,
                                      const Sprite* sprite,
-                                     const frame_t firstFrame);
+                                     const frame_t firstFrame,
+                                     CelCompressor& compressor);
 static void ase_file_write_cel_extra_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header,
                                            const Cel* cel);
 static void ase_file_write_color_profile(FILE* f,
                                          dio::AsepriteFrameHeader* frame_header,
                                          const doc::Sprite* sprite);
+static void ase_file_write_thumbnail_chunk(FILE* f,
+                                           dio::AsepriteFrameHeader* frame_header,
+                                           const doc::Sprite* sprite,
+                                           const frame_t frame,
+                                           const bool toSRGB,
+                                           const int level);
 #if 0
 static void ase_file_write_mask_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, Mask* mask);
 #endif
@@ -201,6 +234,10 @@ bool AseFormat::onLoad(FileOp* fop)
   if (!decoder.decode())
     return false;
 
+  // Only the embedded thumbnail was loaded
+  if (fop->thumbnail())
+    return true;
+
   Sprite* sprite = delegate.sprite();
   fop->createDocument(sprite);
 
@@ -265,6 +302,15 @@ bool AseFormat::onSave(FileOp* fop)
                           fop->roi().frames());
   ase_file_write_header(f, &header);
 
+  // Cel images are compressed in worker threads in the same order
+  // they are written by ase_file_write_cels().
+  std::vector<const Image*> celImages;
+  for (frame_t frame : fop->roi().selectedFrames())
+    ase_file_collect_cel_images(sprite->root(), frame,
+                                fop->roi().fromFrame(), celImages);
+  CelCompressor compressor(std::move(celImages),
+                           fop->aseCompressionLevel());
+
   bool require_new_palette_chunk = false;
   for (Palette* pal : sprite->getPalettes()) {
     if (pal->size() != 256 || pal->hasAlpha()) {
@@ -283,6 +329,13 @@ bool AseFormat::onSave(FileOp* fop)
     // Frame duration
     frame_header.duration = sprite->frameDuration(frame);
 
+    // Save the thumbnail as the first chunk of the first frame (so
+    // it can be read without reading the rest of the file)
+    if (outputFrame == 0 && fop->aseEmbedThumbnail())
+      ase_file_write_thumbnail_chunk(f, &frame_header, sprite, frame,
+                                     fop->preserveColorProfile(),
+                                     fop->aseCompressionLevel());
+
     // Save color profile in first frame
     if (outputFrame == 0 && fop->preserveColorProfile())
       ase_file_write_color_profile(f, &frame_header, sprite);
@@ -326,7 +379,8 @@ bool AseFormat::onSave(FileOp* fop)
     // Write cel chunks
     ase_file_write_cels(f, &frame_header,
                         sprite, sprite->root(),
-                        0, frame, fop->roi().fromFrame());
+                        0, frame, fop->roi().fromFrame(),
+                        compressor);
 
     // Write the frame header
     ase_file_write_frame_header(f, &frame_header);
@@ -466,18 +520,43 @@ static void ase_file_write_layers(FILE* f, dio::AsepriteFrameHeader* frame_heade
   }
 }
 
+// Adds the images of the cels in the given frame that will be
+// compressed by ase_file_write_cel_chunk() (in the same order).
+static void ase_file_collect_cel_images(const Layer* layer,
+                                        const frame_t frame,
+                                        const frame_t firstFrame,
+                                        std::vector<const Image*>& images)
+{
+  if (layer->isImage()) {
+    const Cel* cel = layer->cel(frame);
+    if (cel &&
+        cel->image() &&
+        !ase_file_get_link_cel(cel, static_cast<const LayerImage*>(layer),
+                               firstFrame)) {
+      images.push_back(cel->image());
+    }
+  }
+
+  if (layer->isGroup()) {
+    for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers())
+      ase_file_collect_cel_images(child, frame, firstFrame, images);
+  }
+}
+
 static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_header,
                                    const Sprite* sprite, const Layer* layer,
                                    layer_t layer_index,
                                    const frame_t frame,
-                                   const frame_t firstFrame)
+                                   const frame_t firstFrame,
+                                   CelCompressor& compressor)
 {
   if (layer->isImage()) {
     const Cel* cel = layer->cel(frame);
     if (cel) {
       ase_file_write_cel_chunk(f, frame_header, cel,
                                static_cast<const LayerImage*>(layer),
-                               layer_index, sprite, firstFrame);
+                               layer_index, sprite, firstFrame,
+                               compressor);
 
       if (layer->isReference())
         ase_file_write_cel_extra_chunk(f, frame_header, cel);
@@ -497,7 +576,8 @@ static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_head
     for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers()) {
       layer_index =
         ase_file_write_cels(f, frame_header, sprite, child,
-                            layer_index, frame, firstFrame);
+                            layer_index, frame, firstFrame,
+                            compressor);
     }
   }
 
@@ -687,7 +767,8 @@ static void write_raw_image(FILE* f, const Image* image)
 //////////////////////////////////////////////////////////////////////
 
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, const Image* image)
+static void compress_image(const Image* image, const int level,
+                           base::buffer& output)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -696,12 +777,12 @@ static void write_compressed_image(FILE* f, const Image* image)
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-  err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+  err = deflateInit(&zstream, level);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateInit().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
+  const size_t kChunkSize = 4096;
 
   for (y=0; y<image->height(); y++) {
     typename ImageTraits::address_t address =
@@ -714,20 +795,19 @@ static void write_compressed_image(FILE* f, const Image* image)
     int flush = (y == image->height()-1 ? Z_FINISH: Z_NO_FLUSH);
 
     do {
-      zstream.next_out = (Bytef*)&compressed[0];
-      zstream.avail_out = compressed.size();
+      const size_t pos = output.size();
+      output.resize(pos + kChunkSize);
+      zstream.next_out = (Bytef*)&output[pos];
+      zstream.avail_out = kChunkSize;
 
       // Compress
       err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
         throw base::Exception("ZLib error %d in deflate().", err);
-
-      int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
       }
+
+      output.resize(pos + kChunkSize - zstream.avail_out);
     } while (zstream.avail_out == 0);
   }
 
@@ -736,19 +816,135 @@ static void write_compressed_image(FILE* f, const Image* image)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
 }
 
+static void compress_cel_image(const Image* image, const int level,
+                               base::buffer& output)
+{
+  switch (image->pixelFormat()) {
+
+    case IMAGE_RGB:
+      compress_image<RgbTraits>(image, level, output);
+      break;
+
+    case IMAGE_GRAYSCALE:
+      compress_image<GrayscaleTraits>(image, level, output);
+      break;
+
+    case IMAGE_INDEXED:
+      compress_image<IndexedTraits>(image, level, output);
+      break;
+  }
+}
+
+// Compresses cel images in worker threads. Images are compressed in
+// the given order, and only a few images ahead of the last written
+// one, so the main thread can write them with next() as soon as
+// they are ready without keeping all the compressed data in memory.
+class CelCompressor {
+public:
+  CelCompressor(std::vector<const Image*>&& images, const int level)
+    : m_items(images.size())
+    , m_level(level)
+    , m_nextToCompress(0)
+    , m_nextToWrite(0)
+    , m_stop(false) {
+    for (size_t i=0; i<images.size(); ++i)
+      m_items[i].image = images[i];
+
+    const int nthreads =
+      std::min<int>(m_items.size(),
+                    std::max<int>(1, std::thread::hardware_concurrency()));
+    m_window = 4*nthreads;
+    for (int i=0; i<nthreads; ++i)
+      m_threads.emplace_back([this]{ workerThread(); });
+  }
+
+  ~CelCompressor() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto& thread : m_threads)
+      thread.join();
+  }
+
+  // Returns the compressed data of the given image, which must be
+  // the next image in the vector given in the constructor.
+  void next(const Image* image, base::buffer& output) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ASSERT(m_nextToWrite < m_items.size());
+    Item& item = m_items[m_nextToWrite];
+    ASSERT(item.image == image);
+
+    m_cond.wait(lock, [&item]{ return item.ready; });
+    ++m_nextToWrite;
+    m_cond.notify_all();
+
+    if (!item.error.empty())
+      throw base::Exception(item.error);
+
+    output.swap(item.data);
+    base::buffer().swap(item.data);
+  }
+
+private:
+  void workerThread() {
+    while (true) {
+      size_t i;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]{
+          return (m_stop ||
+                  m_nextToCompress >= m_items.size() ||
+                  m_nextToCompress < m_nextToWrite + m_window);
+        });
+        if (m_stop || m_nextToCompress >= m_items.size())
+          return;
+        i = m_nextToCompress++;
+      }
+
+      Item& item = m_items[i];
+      try {
+        compress_cel_image(item.image, m_level, item.data);
+      }
+      catch (const std::exception& ex) {
+        item.error = ex.what();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        item.ready = true;
+      }
+      m_cond.notify_all();
+    }
+  }
+
+  struct Item {
+    const Image* image = nullptr;
+    base::buffer data;
+    std::string error;
+    bool ready = false;
+  };
+
+  std::vector<Item> m_items;
+  const int m_level;
+  size_t m_window;
+  size_t m_nextToCompress;
+  size_t m_nextToWrite;
+  bool m_stop;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::vector<std::thread> m_threads;
+};
+
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
 
-static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header,
-                                     const Cel* cel,
-                                     const LayerImage* layer,
-                                     const layer_t layer_index,
-                                     const Sprite* sprite,
-                                     const frame_t firstFrame)
+static const Cel* ase_file_get_link_cel(const Cel* cel,
+                                        const LayerImage* layer,
+                                        const frame_t firstFrame)
 {
-  ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
-
   const Cel* link = cel->link();
 
   // In case the original link is outside the ROI, we've to find the
@@ -763,7 +959,20 @@ static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_he
     if (link == cel)
       link = nullptr;
   }
+  return link;
+}
+
+static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header,
+                                     const Cel* cel,
+                                     const LayerImage* layer,
+                                     const layer_t layer_index,
+                                     const Sprite* sprite,
+                                     const frame_t firstFrame,
+                                     CelCompressor& compressor)
+{
+  ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
 
+  const Cel* link = ase_file_get_link_cel(cel, layer, firstFrame);
   int cel_type = (link ? ASE_FILE_LINK_CEL: ASE_FILE_COMPRESSED_CEL);
 
   fputw(layer_index, f);
@@ -820,21 +1029,13 @@ static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_he
         fputw(image->width(), f);
         fputw(image->height(), f);
 
-        // Pixel data
-        switch (image->pixelFormat()) {
-
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
-        }
+        // Pixel data (compressed in a worker thread)
+        base::buffer compressed;
+        compressor.next(image, compressed);
+        if (!compressed.empty() &&
+            ((fwrite(&compressed[0], 1, compressed.size(), f) != compressed.size())
+             || ferror(f)))
+          throw base::Exception("Error writing compressed image pixels.\n");
       }
       else {
         // Width and height
@@ -908,6 +1109,26 @@ static void ase_file_write_color_profile(FILE* f,
   }
 }
 
+static void ase_file_write_thumbnail_chunk(FILE* f,
+                                           dio::AsepriteFrameHeader* frame_header,
+                                           const doc::Sprite* sprite,
+                                           const frame_t frame,
+                                           const bool toSRGB,
+                                           const int level)
+{
+  doc::ImageRef thumbnail =
+    thumb::render_sprite_thumbnail(sprite, frame,
+                                   ASE_FILE_THUMBNAIL_MAX_SIZE, toSRGB);
+  base::buffer data;
+  compress_image<RgbTraits>(thumbnail.get(), level, data);
+
+  ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_THUMBNAIL);
+  fputw(thumbnail->width(), f);
+  fputw(thumbnail->height(), f);
+  ase_file_write_padding(f, 8);
+  fwrite(&data[0], 1, data.size(), f);
+}
+
 #if 0
 static void ase_file_write_mask_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, Mask* mask)
 {
@@ -29,10 +29,12 @@
 #include "app/tx.h"
 #include "app/ui/optional_alert.h"
 #include "app/ui/status_bar.h"
+#include "app/util/thread_pool.h"
 #include "base/fs.h"
 #include "base/mutex.h"
 #include "base/scoped_lock.h"
 #include "base/string.h"
+#include "base/thread_pool.h"
 #include "dio/detect_format.h"
 #include "doc/algorithm/resize_image.h"
 #include "doc/doc.h"
@@ -47,8 +49,12 @@
 #include "ask_for_color_profile.xml.h"
 #include "open_sequence.xml.h"
 
+#include <algorithm>
 #include <cstring>
 #include <cstdarg>
+#include <deque>
+#include <future>
+#include <utility>
 
 namespace app {
 
@@ -161,6 +167,10 @@ public:
     }
   }
 
+  const gfx::PointF& scale() const {
+    return m_scale;
+  }
+
   void setScale(const gfx::PointF& scale) {
     m_scale = scale;
     m_spec.setWidth(m_spec.width() * m_scale.x);
@@ -416,6 +426,7 @@ FileOp* FileOp::createLoadDocumentOperation(Context* context,
             fop->m_seq.flags = FILE_LOAD_SEQUENCE_YES;
           else
             fop->m_seq.flags = FILE_LOAD_SEQUENCE_NONE;
+          fop->m_seq.flags |= (flags & FILE_LOAD_SEQUENCE_LINK);
         }
 
         if (window.closer() == window.agree()) {
@@ -456,6 +467,10 @@ FileOp* FileOp::createLoadDocumentOperation(Context* context,
   if (flags & FILE_LOAD_ONE_FRAME)
     fop->m_oneframe = true;
 
+  // Load just the embedded thumbnail
+  if (flags & FILE_LOAD_THUMBNAIL)
+    fop->m_thumbnailOnly = true;
+
   if (flags & FILE_LOAD_CREATE_PALETTE)
     fop->m_createPaletteFromRgba = true;
 
@@ -755,120 +770,7 @@ void FileOp::operate(IFileOpProgress* progress)
       m_format->support(FILE_SUPPORT_LOAD)) {
     // Load a sequence
     if (isSequence()) {
-      // Default palette
-      m_seq.palette->makeBlack();
-
-      // Load the sequence
-      frame_t frames(m_seq.filename_list.size());
-      frame_t frame(0);
-      Image* old_image = nullptr;
-      gfx::Size canvasSize(0, 0);
-
-      // TODO setPalette for each frame???
-      auto add_image = [&]() {
-        canvasSize |= m_seq.image->size();
-
-        m_seq.last_cel->data()->setImage(m_seq.image);
-        m_seq.layer->addCel(m_seq.last_cel);
-
-        if (m_document->sprite()->palette(frame)
-            ->countDiff(m_seq.palette, NULL, NULL) > 0) {
-          m_seq.palette->setFrame(frame);
-          m_document->sprite()->setPalette(m_seq.palette, true);
-        }
-
-        old_image = m_seq.image.get();
-        m_seq.image.reset();
-        m_seq.last_cel = NULL;
-      };
-
-      m_seq.has_alpha = false;
-      m_seq.progress_offset = 0.0f;
-      m_seq.progress_fraction = 1.0f / (double)frames;
-
-      auto it = m_seq.filename_list.begin(),
-           end = m_seq.filename_list.end();
-      for (; it != end; ++it) {
-        m_filename = it->c_str();
-
-        // Call the "load" procedure to read the first bitmap.
-        bool loadres = m_format->load(this);
-        if (!loadres) {
-          setError("Error loading frame %d from file \"%s\"\n",
-                   frame+1, m_filename.c_str());
-        }
-
-        // For the first frame...
-        if (!old_image) {
-          // Error reading the first frame
-          if (!loadres || !m_document || !m_seq.last_cel) {
-            m_seq.image.reset();
-            delete m_seq.last_cel;
-            delete m_document;
-            m_document = nullptr;
-            break;
-          }
-          // Read ok
-          else {
-            // Add the keyframe
-            add_image();
-          }
-        }
-        // For other frames
-        else {
-          // All done (or maybe not enough memory)
-          if (!loadres || !m_seq.last_cel) {
-            m_seq.image.reset();
-            delete m_seq.last_cel;
-            break;
-          }
-
-          // Compare the old frame with the new one
-#if USE_LINK // TODO this should be configurable through a check-box
-          if (count_diff_between_images(old_image, m_seq.image)) {
-            add_image();
-          }
-          // We don't need this image
-          else {
-            delete m_seq.image;
-
-            // But add a link frame
-            m_seq.last_cel->image = image_index;
-            layer_add_frame(m_seq.layer, m_seq.last_cel);
-
-            m_seq.last_image = NULL;
-            m_seq.last_cel = NULL;
-          }
-#else
-          add_image();
-#endif
-        }
-
-        m_document->sprite()->setFrameDuration(frame, m_seq.duration);
-
-        ++frame;
-        m_seq.progress_offset += m_seq.progress_fraction;
-      }
-      m_filename = *m_seq.filename_list.begin();
-
-      // Final setup
-      if (m_document) {
-        // Configure the layer as the 'Background'
-        if (!m_seq.has_alpha)
-          m_seq.layer->configureAsBackground();
-
-        // Set the final canvas size (as the bigger loaded
-        // frame/image).
-        m_document->sprite()->setSize(canvasSize.w,
-                                      canvasSize.h);
-
-        // Set the frames range
-        m_document->sprite()->setTotalFrames(frame);
-
-        // Sets special options from the specific format (e.g. BMP
-        // file can contain the number of bits per pixel).
-        m_document->setFormatOptions(m_formatOptions);
-      }
+      loadSequence();
     }
     // Direct load from one file.
     else {
@@ -901,91 +803,7 @@ void FileOp::operate(IFileOpProgress* progress)
     // Save a sequence
     if (isSequence()) {
       ASSERT(m_format->support(FILE_SUPPORT_SEQUENCES));
-
-      Sprite* sprite = m_document->sprite();
-
-      // Create a temporary bitmap
-      m_seq.image.reset(Image::create(sprite->pixelFormat(),
-                                      sprite->width(),
-                                      sprite->height()));
-
-      m_seq.progress_offset = 0.0f;
-      m_seq.progress_fraction = 1.0f / (double)sprite->totalFrames();
-
-      // For each frame in the sprite.
-      render::Render render;
-      render.setNewBlend(m_config.newBlend);
-
-      frame_t outputFrame = 0;
-      for (frame_t frame : m_roi.selectedFrames()) {
-        // Draw the "frame" in "m_seq.image"
-        if (m_roi.slice()) {
-          const SliceKey* key = m_roi.slice()->getByFrame(frame);
-          if (!key || key->isEmpty())
-            continue;           // Skip frame because there is no slice key
-
-          if (m_abstractImage)
-            m_abstractImage->setSliceBounds(key->bounds());
-
-          m_seq.image.reset(
-            Image::create(sprite->pixelFormat(),
-                          key->bounds().w,
-                          key->bounds().h));
-
-          render.renderSprite(
-            m_seq.image.get(), sprite, frame,
-            gfx::Clip(gfx::Point(0, 0), key->bounds()));
-        }
-        else {
-          render.renderSprite(m_seq.image.get(), sprite, frame);
-        }
-
-        bool save = true;
-
-        // Check if we have to ignore empty frames
-        if (m_ignoreEmpty &&
-            !sprite->isOpaque() &&
-            doc::is_empty_image(m_seq.image.get())) {
-          save = false;
-        }
-
-        if (save) {
-          // Setup the palette.
-          sprite->palette(frame)->copyColorsTo(m_seq.palette);
-
-          // Setup the filename to be used.
-          m_filename = m_seq.filename_list[outputFrame];
-
-          // Make directories
-          {
-            std::string dir = base::get_file_path(m_filename);
-            try {
-              if (!base::is_directory(dir))
-                base::make_all_directories(dir);
-            }
-            catch (const std::exception& ex) {
-              // Ignore errors and make the delegate fail
-              setError("Error creating directory \"%s\"\n%s",
-                       dir.c_str(), ex.what());
-            }
-          }
-
-          // Call the "save" procedure... did it fail?
-          if (!m_format->save(this)) {
-            setError("Error saving frame %d in the file \"%s\"\n",
-                     outputFrame+1, m_filename.c_str());
-            break;
-          }
-        }
-
-        m_seq.progress_offset += m_seq.progress_fraction;
-        ++outputFrame;
-      }
-
-      m_filename = *m_seq.filename_list.begin();
-
-      // Destroy the image
-      m_seq.image.reset();
+      saveSequence();
     }
     // Direct save to a file.
     else {
@@ -1187,6 +1005,7 @@ void FileOp::setLoadedFormatOptions(const FormatOptionsPtr& opts)
 void FileOp::sequenceSetNColors(int ncolors)
 {
   m_seq.palette->resize(ncolors);
+  m_seq.ncolors = ncolors;
 }
 
 int FileOp::sequenceGetNColors() const
@@ -1197,6 +1016,7 @@ int FileOp::sequenceGetNColors() const
 void FileOp::sequenceSetColor(int index, int r, int g, int b)
 {
   m_seq.palette->setEntry(index, rgba(r, g, b, 255));
+  markSequenceColor(index);
 }
 
 void FileOp::sequenceGetColor(int index, int* r, int* g, int* b) const
@@ -1222,6 +1042,14 @@ void FileOp::sequenceSetAlpha(int index, int a)
   int b = rgba_getb(c);
 
   m_seq.palette->setEntry(index, rgba(r, g, b, a));
+  markSequenceColor(index);
+}
+
+void FileOp::markSequenceColor(int index)
+{
+  if (index >= m_seq.palette_set.size())
+    m_seq.palette_set.resize(index+1);
+  m_seq.palette_set[index] = true;
 }
 
 void FileOp::sequenceGetAlpha(int index, int* a) const
@@ -1332,7 +1160,7 @@ void FileOp::setProgress(double progress)
   }
 
   if (m_progressInterface)
-    m_progressInterface->ackFileOpProgress(progress);
+    m_progressInterface->ackFileOpProgress(m_progress);
 }
 
 void FileOp::getFilenameList(base::paths& output) const
@@ -1374,6 +1202,9 @@ bool FileOp::isStop() const
     scoped_lock lock(m_mutex);
     stop = m_stop;
   }
+  // Files of a sequence are stopped with the whole sequence
+  if (!stop && m_seqParent)
+    stop = m_seqParent->isStop();
   return stop;
 }
 
@@ -1389,10 +1220,12 @@ FileOp::FileOp(FileOpType type,
   , m_done(false)
   , m_stop(false)
   , m_oneframe(false)
+  , m_thumbnailOnly(false)
   , m_createPaletteFromRgba(false)
   , m_ignoreEmpty(false)
   , m_embeddedColorProfile(false)
   , m_embeddedGridBounds(false)
+  , m_seqParent(nullptr)
 {
   if (config)
     m_config = *config;
@@ -1403,6 +1236,7 @@ FileOp::FileOp(FileOpType type,
   }
 
   m_seq.palette = nullptr;
+  m_seq.ncolors = -1;
   m_seq.image.reset();
   m_seq.progress_offset = 0.0f;
   m_seq.progress_fraction = 0.0f;
@@ -1419,4 +1253,419 @@ void FileOp::prepareForSequence()
   m_formatOptions.reset();
 }
 
+// Maximum memory used by the frames of a sequence that are being
+// loaded/saved at the same time.
+static const std::size_t kMaxSequenceMemSize = 256*1024*1024;
+
+// The first file of the sequence is loaded in this FileOp (it
+// creates the document), then the rest of files are decoded in
+// shared_thread_pool() threads, each one with its own FileOp (with
+// its own temporary document, image, and palette). Decoded files are added
+// as frames in order, so the palette of each frame, the errors, and
+// the progress are the same as loading the files one by one.
+void FileOp::loadSequence()
+{
+  // Default palette
+  m_seq.palette->makeBlack();
+
+  frame_t frame(0);
+  Image* old_image = nullptr;
+  gfx::Size canvasSize(0, 0);
+
+  // TODO setPalette for each frame???
+  auto add_image = [&]() {
+    canvasSize |= m_seq.image->size();
+
+    m_seq.last_cel->data()->setImage(m_seq.image);
+    m_seq.layer->addCel(m_seq.last_cel);
+
+    if (m_document->sprite()->palette(frame)
+        ->countDiff(m_seq.palette, NULL, NULL) > 0) {
+      m_seq.palette->setFrame(frame);
+      m_document->sprite()->setPalette(m_seq.palette, true);
+    }
+
+    old_image = m_seq.image.get();
+    m_seq.image.reset();
+    m_seq.last_cel = NULL;
+  };
+
+  m_seq.has_alpha = false;
+  m_seq.progress_offset = 0.0f;
+  m_seq.progress_fraction = 1.0f / (double)m_seq.filename_list.size();
+
+  // Call the "load" procedure to read the first bitmap.
+  m_filename = *m_seq.filename_list.begin();
+  bool loadres = m_format->load(this);
+  if (!loadres) {
+    setError("Error loading frame %d from file \"%s\"\n",
+             frame+1, m_filename.c_str());
+  }
+
+  // Error reading the first frame
+  if (!loadres || !m_document || !m_seq.last_cel) {
+    m_seq.image.reset();
+    delete m_seq.last_cel;
+    m_seq.last_cel = nullptr;
+    delete m_document;
+    m_document = nullptr;
+    return;
+  }
+
+  // Add the keyframe
+  add_image();
+  m_document->sprite()->setFrameDuration(frame, m_seq.duration);
+  ++frame;
+  m_seq.progress_offset += m_seq.progress_fraction;
+
+  // Each decoded file (and its temporary document) uses the memory of
+  // the first one approximately.
+  const int maxAhead = int(std::clamp<std::size_t>(
+    kMaxSequenceMemSize / (2*std::max(1, old_image->getMemSize())),
+    1, 2*shared_thread_pool_size()));
+
+  struct Item {
+    std::unique_ptr<FileOp> fop;
+    std::future<bool> loaded;
+  };
+  std::deque<Item> pending;
+
+  // Destroys the temporary document of a decoded file
+  auto destroy_loaded = [](FileOp* fop) {
+    fop->m_seq.image.reset();
+    delete fop->m_seq.last_cel;
+    fop->m_seq.last_cel = nullptr;
+    delete fop->m_document;
+    fop->m_document = nullptr;
+  };
+
+  // Adds the next decoded file as a new frame, returns false if we
+  // have to stop loading files
+  auto add_next = [&]() -> bool {
+    Item item = std::move(pending.front());
+    pending.pop_front();
+
+    FileOp* fop = item.fop.get();
+    bool loadres = item.loaded.get();
+    if (fop->hasError())
+      setError("%s", fop->error().c_str());
+
+    // All files must have the same pixel format (the same check that
+    // sequenceImage() does when the document already exists)
+    if (loadres &&
+        fop->m_document &&
+        fop->m_document->sprite()->pixelFormat() !=
+        m_document->sprite()->pixelFormat()) {
+      loadres = false;
+    }
+    if (!loadres) {
+      setError("Error loading frame %d from file \"%s\"\n",
+               frame+1, fop->m_filename.c_str());
+    }
+
+    // All done (or maybe not enough memory)
+    if (!loadres || !fop->m_document || !fop->m_seq.last_cel) {
+      destroy_loaded(fop);
+      return false;
+    }
+
+    m_seq.image = fop->m_seq.image;
+    m_seq.last_cel = new Cel(m_seq.frame++, ImageRef(nullptr));
+
+    // Only the colors that were set by this file replace the colors
+    // of the previous frame (as when all files were decoded one after
+    // the other in the same palette)
+    if (fop->m_seq.ncolors >= 0)
+      m_seq.palette->resize(fop->m_seq.ncolors);
+    for (int i=0; i<fop->m_seq.palette_set.size(); ++i) {
+      if (fop->m_seq.palette_set[i] &&
+          i < fop->m_seq.palette->size() &&
+          i < m_seq.palette->size()) {
+        m_seq.palette->setEntry(i, fop->m_seq.palette->getEntry(i));
+      }
+    }
+    if (fop->m_seq.has_alpha)
+      m_seq.has_alpha = true;
+    if (fop->m_embeddedColorProfile)
+      m_embeddedColorProfile = true;
+    if (fop->m_embeddedGridBounds)
+      m_embeddedGridBounds = true;
+    if (fop->m_formatOptions)
+      m_formatOptions = fop->m_formatOptions;
+    destroy_loaded(fop);
+
+    // Link this frame to the previous one if they are identical
+    if ((m_seq.flags & FILE_LOAD_SEQUENCE_LINK) &&
+        count_diff_between_images(old_image, m_seq.image.get()) == 0 &&
+        m_document->sprite()->palette(frame)
+          ->countDiff(m_seq.palette, nullptr, nullptr) == 0) {
+      m_seq.layer->addCel(
+        Cel::MakeLink(frame, m_seq.layer->cel(frame-1)));
+
+      m_seq.image.reset();
+      delete m_seq.last_cel;
+      m_seq.last_cel = nullptr;
+    }
+    else {
+      add_image();
+    }
+
+    m_document->sprite()->setFrameDuration(frame, m_seq.duration);
+
+    setProgress(1.0);
+    ++frame;
+    m_seq.progress_offset += m_seq.progress_fraction;
+    return true;
+  };
+
+  bool ok = true;
+  auto it = m_seq.filename_list.begin()+1,
+       end = m_seq.filename_list.end();
+  for (; it != end; ++it) {
+    if (isStop())
+      break;
+
+    // FileOp to decode this file
+    std::unique_ptr<FileOp> fop(new FileOp(FileOpLoad, m_context, &m_config));
+    fop->m_seqParent = this;
+    fop->m_format = m_format;
+    fop->m_filename = *it;
+    fop->m_oneframe = m_oneframe;
+    fop->prepareForSequence();
+    fop->m_seq.has_alpha = false;
+    fop->m_seq.flags = m_seq.flags;
+
+    FileOp* fopPtr = fop.get();
+    auto task = std::make_shared<std::packaged_task<bool()>>(
+      [this, fopPtr]{
+        try {
+          return m_format->load(fopPtr);
+        }
+        catch (const std::exception& ex) {
+          fopPtr->setError("%s", ex.what());
+          return false;
+        }
+      });
+    pending.push_back(Item{ std::move(fop), task->get_future() });
+    shared_thread_pool().execute([task]{ (*task)(); });
+
+    while (ok && int(pending.size()) >= maxAhead)
+      ok = add_next();
+    if (!ok)
+      break;
+  }
+
+  // Add the rest of decoded files (or just wait them and discard
+  // them if there was an error)
+  while (!pending.empty()) {
+    if (ok)
+      ok = add_next();
+    else {
+      pending.front().loaded.wait();
+      destroy_loaded(pending.front().fop.get());
+      pending.pop_front();
+    }
+  }
+
+  m_filename = *m_seq.filename_list.begin();
+
+  // Final setup
+
+  // Configure the layer as the 'Background'
+  if (!m_seq.has_alpha)
+    m_seq.layer->configureAsBackground();
+
+  // Set the final canvas size (as the bigger loaded
+  // frame/image).
+  m_document->sprite()->setSize(canvasSize.w,
+                                canvasSize.h);
+
+  // Set the frames range
+  m_document->sprite()->setTotalFrames(frame);
+
+  // Sets special options from the specific format (e.g. BMP
+  // file can contain the number of bits per pixel).
+  m_document->setFormatOptions(m_formatOptions);
+}
+
+#ifdef ENABLE_SAVE
+
+// Each file of the sequence (e.g. numbered PNG files) is rendered and
+// saved in shared_thread_pool() threads using its own FileOp (with
+// its own image, palette, and filename). The results are collected in
+// order to report the progress and stop in the first error, so only a
+// few files are being saved ahead of the last finished one.
+void FileOp::saveSequence()
+{
+  const Sprite* sprite = m_document->sprite();
+
+  // FileAbstractImageImpl::setUnscaledImage() uses the RgbMap of the
+  // first frame to resize images, we generate it here so it's not
+  // regenerated from several threads at the same time.
+  if (m_format->support(FILE_ENCODE_ABSTRACT_IMAGE))
+    sprite->rgbMap(frame_t(0));
+
+  // Each file needs the frame render (and the scaled image or the
+  // encoder buffers)
+  const std::size_t frameSize =
+    std::size_t(sprite->width()) * sprite->height() * sizeof(color_t);
+  const int maxAhead = int(std::clamp<std::size_t>(
+    kMaxSequenceMemSize / (2*frameSize), 1, 2*shared_thread_pool_size()));
+
+  m_seq.progress_offset = 0.0f;
+  m_seq.progress_fraction = 1.0f / (double)m_roi.frames();
+
+  struct Item {
+    int outputFrame;
+    std::unique_ptr<FileOp> fop;
+    std::future<bool> saved;
+  };
+  std::deque<Item> pending;
+
+  auto waitNext = [this, &pending]() -> bool {
+    Item& item = pending.front();
+    const bool saved = item.saved.get();
+
+    setProgress(1.0);
+    m_seq.progress_offset += m_seq.progress_fraction;
+
+    if (item.fop->hasError())
+      setError("%s", item.fop->error().c_str());
+    if (!saved) {
+      setError("Error saving frame %d in the file \"%s\"\n",
+               item.outputFrame+1, item.fop->filename().c_str());
+    }
+    pending.pop_front();
+    return saved;
+  };
+
+  bool ok = true;
+  int outputFrame = 0;
+  for (frame_t frame : m_roi.selectedFrames()) {
+    // Skip frame because there is no slice key
+    if (m_roi.slice()) {
+      const SliceKey* key = m_roi.slice()->getByFrame(frame);
+      if (!key || key->isEmpty())
+        continue;
+    }
+
+    if (isStop())
+      break;
+
+    // FileOp to save this file
+    std::unique_ptr<FileOp> fop(new FileOp(FileOpSave, m_context, &m_config));
+    fop->m_seqParent = this;
+    fop->m_format = m_format;
+    fop->m_document = m_document;
+    fop->m_roi = m_roi;
+    ASSERT(outputFrame < int(m_seq.filename_list.size()));
+    fop->m_filename = m_seq.filename_list[outputFrame];
+    fop->prepareForSequence();
+    fop->m_formatOptions = m_formatOptions;
+
+    FileOp* fopPtr = fop.get();
+    auto task = std::make_shared<std::packaged_task<bool()>>(
+      [this, fopPtr, frame]{
+        return saveSequenceFile(fopPtr, frame);
+      });
+    pending.push_back(Item{ outputFrame, std::move(fop), task->get_future() });
+    shared_thread_pool().execute([task]{ (*task)(); });
+    ++outputFrame;
+
+    while (ok && int(pending.size()) >= maxAhead)
+      ok = waitNext();
+    if (!ok)
+      break;
+  }
+
+  // Wait the files that are being saved (even if there was an error
+  // or the operation was stopped, as they use this FileOp)
+  while (!pending.empty()) {
+    if (ok)
+      ok = waitNext();
+    else {
+      pending.front().saved.wait();
+      pending.pop_front();
+    }
+  }
+
+  m_filename = *m_seq.filename_list.begin();
+}
+
+// Renders the given frame in the sequence image of "fop" and saves
+// it. Called from shared_thread_pool() threads.
+bool FileOp::saveSequenceFile(FileOp* fop, const frame_t frame) const
+{
+  const Sprite* sprite = m_document->sprite();
+
+  try {
+    // Draw the "frame" in the sequence image
+    render::Render render;
+    render.setNewBlend(m_config.newBlend);
+
+    if (m_abstractImage)
+      fop->setOnTheFlyScale(m_abstractImage->scale());
+
+    if (m_roi.slice()) {
+      const SliceKey* key = m_roi.slice()->getByFrame(frame);
+      ASSERT(key && !key->isEmpty());
+
+      if (m_format->support(FILE_ENCODE_ABSTRACT_IMAGE)) {
+        fop->makeAbstractImage();
+        fop->m_abstractImage->setSliceBounds(key->bounds());
+      }
+
+      fop->m_seq.image.reset(
+        Image::create(sprite->pixelFormat(),
+                      key->bounds().w,
+                      key->bounds().h));
+
+      render.renderSprite(
+        fop->m_seq.image.get(), sprite, frame,
+        gfx::Clip(gfx::Point(0, 0), key->bounds()));
+    }
+    else {
+      fop->m_seq.image.reset(
+        Image::create(sprite->pixelFormat(),
+                      sprite->width(),
+                      sprite->height()));
+
+      render.renderSprite(fop->m_seq.image.get(), sprite, frame);
+    }
+
+    // Check if we have to ignore empty frames
+    if (m_ignoreEmpty &&
+        !sprite->isOpaque() &&
+        doc::is_empty_image(fop->m_seq.image.get())) {
+      return true;
+    }
+
+    // Setup the palette.
+    sprite->palette(frame)->copyColorsTo(fop->m_seq.palette);
+
+    // Make directories
+    {
+      std::string dir = base::get_file_path(fop->m_filename);
+      try {
+        if (!base::is_directory(dir))
+          base::make_all_directories(dir);
+      }
+      catch (const std::exception& ex) {
+        // Ignore errors and make the delegate fail
+        fop->setError("Error creating directory \"%s\"\n%s",
+                      dir.c_str(), ex.what());
+      }
+    }
+
+    // Call the "save" procedure
+    return m_format->save(fop);
+  }
+  catch (const std::exception& ex) {
+    fop->setError("%s", ex.what());
+    return false;
+  }
+}
+
+#endif // ENABLE_SAVE
+
 } // namespace app
@@ -18,6 +18,7 @@
 #include "base/paths.h"
 #include "doc/frame.h"
 #include "doc/image_ref.h"
+#include "doc/palette_picks.h"
 #include "doc/pixel_format.h"
 #include "doc/selected_frames.h"
 #include "os/color_space.h"
@@ -34,6 +35,8 @@
 #define FILE_LOAD_ONE_FRAME             0x00000010
 #define FILE_LOAD_DATA_FILE             0x00000020
 #define FILE_LOAD_CREATE_PALETTE        0x00000040
+#define FILE_LOAD_THUMBNAIL             0x00000080
+#define FILE_LOAD_SEQUENCE_LINK         0x00000100
 
 namespace doc {
   class Tag;
@@ -151,6 +154,7 @@ namespace app {
 
     bool isSequence() const { return !m_seq.filename_list.empty(); }
     bool isOneFrame() const { return m_oneframe; }
+    bool isThumbnailOnly() const { return m_thumbnailOnly; }
     bool preserveColorProfile() const { return m_config.preserveColorProfile; }
 
     const std::string& filename() const { return m_filename; }
@@ -258,6 +262,17 @@ namespace app {
 
     bool newBlend() const { return m_config.newBlend; }
 
+    int aseCompressionLevel() const { return m_config.aseCompressionLevel; }
+    void setAseCompressionLevel(const int level) {
+      m_config.aseCompressionLevel = level;
+    }
+    bool aseEmbedThumbnail() const { return m_config.aseEmbedThumbnail; }
+
+    // Thumbnail embedded in the file (an RGB image in sRGB color
+    // space) loaded instead of the document with FILE_LOAD_THUMBNAIL.
+    const ImageRef& thumbnail() const { return m_thumbnail; }
+    void setThumbnail(const ImageRef& thumbnail) { m_thumbnail = thumbnail; }
+
   private:
     FileOp();                   // Undefined
     FileOp(FileOpType type,
@@ -284,6 +299,8 @@ namespace app {
     bool m_oneframe;            // Load just one frame (in formats
                                 // that support animation like
                                 // GIF/FLI/ASE).
+    bool m_thumbnailOnly;       // Load just the embedded thumbnail
+                                // if the file has one.
     bool m_createPaletteFromRgba;
     bool m_ignoreEmpty;
 
@@ -295,6 +312,8 @@ namespace app {
 
     FileOpConfig m_config;
 
+    ImageRef m_thumbnail;
+
     // Options
     FormatOptionsPtr m_formatOptions;
 
@@ -302,6 +321,8 @@ namespace app {
     struct {
       base::paths filename_list;  // All file names to load/save.
       Palette* palette;           // Palette of the sequence.
+      int ncolors;                // Colors set with sequenceSetNColors() or -1.
+      PalettePicks palette_set;   // Entries set with sequenceSetColor/Alpha().
       ImageRef image;             // Image to be saved/loaded.
       // For the progress bar.
       double progress_offset;      // Progress offset from the current frame.
@@ -319,8 +340,18 @@ namespace app {
     class FileAbstractImageImpl;
     std::unique_ptr<FileAbstractImageImpl> m_abstractImage;
 
+    // FileOp of a sequence that created this FileOp to load/save one
+    // file of the sequence (see loadSequence() and saveSequence()).
+    const FileOp* m_seqParent;
+
     void prepareForSequence();
+    void markSequenceColor(int index);
+    void loadSequence();
     void makeAbstractImage();
+#ifdef ENABLE_SAVE
+    void saveSequence();
+    bool saveSequenceFile(FileOp* fop, const doc::frame_t frame) const;
+#endif
   };
 
   // Available extensions for each load/save operation.
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 //
 // This program is distributed under the terms of
 // the End-User License Agreement for Aseprite.
@@ -32,6 +32,15 @@ namespace app {
 
     app::Color defaultSliceColor = app::Color::fromRgb(0, 0, 255);
 
+    // zlib compression level (0-9 or -1 for the default level) used
+    // to save cels in .aseprite files.
+    int aseCompressionLevel = -1;
+
+    // True if a small preview of the first frame is saved in
+    // .aseprite files (so the file selector doesn't need to decode
+    // the cels to show the thumbnail).
+    bool aseEmbedThumbnail = false;
+
     void fillFromPreferences();
   };
 
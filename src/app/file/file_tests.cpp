@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -12,6 +12,8 @@
 #include "app/doc.h"
 #include "app/file/file.h"
 #include "app/file/file_formats_manager.h"
+#include "app/pref/preferences.h"
+#include "base/fs.h"
 #include "doc/doc.h"
 
 #include <cstdio>
@@ -78,3 +80,324 @@ TEST(File, SeveralSizes)
     }
   }
 }
+
+TEST(File, EmbeddedThumbnail)
+{
+  app::Context ctx;
+  const char* fn = "test_thumbnail.ase";
+  auto& embedThumbnail = Preferences::instance().ase.embedThumbnail;
+  const bool oldEmbedThumbnail = embedThumbnail();
+  embedThumbnail(true);
+
+  {
+    std::unique_ptr<Doc> doc(
+      ctx.documents().add(300, 150, doc::ColorMode::RGB, 256));
+    doc->setFilename(fn);
+
+    Layer* layer = doc->sprite()->root()->firstLayer();
+    ASSERT_TRUE(layer != nullptr);
+    clear_image(layer->cel(frame_t(0))->image(), rgba(255, 0, 0, 255));
+
+    save_document(&ctx, doc.get());
+    doc->close();
+  }
+  embedThumbnail(oldEmbedThumbnail);
+
+  // Load just the thumbnail
+  {
+    std::unique_ptr<FileOp> fop(
+      FileOp::createLoadDocumentOperation(
+        &ctx, fn,
+        FILE_LOAD_SEQUENCE_NONE |
+        FILE_LOAD_ONE_FRAME |
+        FILE_LOAD_THUMBNAIL));
+    ASSERT_TRUE(fop != nullptr);
+    fop->operate();
+    fop->done();
+
+    EXPECT_FALSE(fop->hasError());
+    EXPECT_EQ(nullptr, fop->document());
+    ImageRef thumbnail = fop->thumbnail();
+    ASSERT_TRUE(thumbnail != nullptr);
+    EXPECT_EQ(128, thumbnail->width());
+    EXPECT_EQ(64, thumbnail->height());
+    EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(thumbnail.get(), 64, 32));
+  }
+
+  // The whole document can be loaded anyway
+  {
+    std::unique_ptr<Doc> doc(load_document(&ctx, fn));
+    ASSERT_TRUE(doc != nullptr);
+    EXPECT_EQ(300, doc->sprite()->width());
+    EXPECT_EQ(150, doc->sprite()->height());
+    doc->close();
+  }
+}
+
+TEST(File, SaveAndLoadSequence)
+{
+  app::Context ctx;
+  const int nframes = 30;
+
+  {
+    std::unique_ptr<Doc> doc(
+      ctx.documents().add(16, 8, doc::ColorMode::RGB, 256));
+    doc->setFilename("_test_seq_00.png");
+
+    Sprite* sprite = doc->sprite();
+    auto layer = static_cast<LayerImage*>(sprite->root()->firstLayer());
+    ASSERT_TRUE(layer != nullptr);
+    sprite->setTotalFrames(frame_t(nframes));
+
+    // A different color in each frame
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      if (frame == 0) {
+        clear_image(layer->cel(frame)->image(), rgba(0, 0, 0, 255));
+      }
+      else {
+        ImageRef image(Image::create(IMAGE_RGB, 16, 8));
+        clear_image(image.get(), rgba(frame, 255-frame, 2*frame, 255));
+        layer->addCel(new Cel(frame, image));
+      }
+    }
+
+    ASSERT_EQ(0, save_document(&ctx, doc.get()));
+    doc->close();
+  }
+
+  // Load all files as one sprite
+  {
+    std::unique_ptr<FileOp> fop(
+      FileOp::createLoadDocumentOperation(
+        &ctx, "_test_seq_00.png",
+        FILE_LOAD_SEQUENCE_YES));
+    ASSERT_TRUE(fop != nullptr);
+    fop->operate();
+    fop->done();
+    fop->postLoad();
+    EXPECT_FALSE(fop->hasError()) << fop->error();
+
+    std::unique_ptr<Doc> doc(fop->releaseDocument());
+    ASSERT_TRUE(doc != nullptr);
+    EXPECT_EQ(16, doc->sprite()->width());
+    EXPECT_EQ(8, doc->sprite()->height());
+    ASSERT_EQ(nframes, doc->sprite()->totalFrames());
+
+    Layer* layer = doc->sprite()->root()->firstLayer();
+    ASSERT_TRUE(layer != nullptr);
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      const color_t expected =
+        (frame == 0 ? rgba(0, 0, 0, 255):
+                      rgba(frame, 255-frame, 2*frame, 255));
+      ASSERT_TRUE(layer->cel(frame) != nullptr) << frame;
+      EXPECT_EQ(expected, get_pixel(layer->cel(frame)->image(), 15, 7))
+        << frame;
+    }
+  }
+
+  for (frame_t frame=0; frame<nframes; ++frame) {
+    std::vector<char> fn(256);
+    std::sprintf(&fn[0], "_test_seq_%02d.png", frame);
+
+    std::unique_ptr<Doc> doc(load_document(&ctx, &fn[0]));
+    ASSERT_TRUE(doc != nullptr) << &fn[0];
+    EXPECT_EQ(16, doc->sprite()->width());
+    EXPECT_EQ(8, doc->sprite()->height());
+    EXPECT_EQ(1, doc->sprite()->totalFrames());
+
+    Layer* layer = doc->sprite()->root()->firstLayer();
+    ASSERT_TRUE(layer != nullptr);
+    const color_t expected =
+      (frame == 0 ? rgba(0, 0, 0, 255):
+                    rgba(frame, 255-frame, 2*frame, 255));
+    EXPECT_EQ(expected, get_pixel(layer->cel(frame_t(0))->image(), 15, 7))
+      << &fn[0];
+    doc->close();
+
+    base::delete_file(&fn[0]);
+  }
+}
+
+namespace {
+
+std::unique_ptr<Doc> load_sequence(app::Context* ctx,
+                                   const char* filename,
+                                   const int flags)
+{
+  std::unique_ptr<FileOp> fop(
+    FileOp::createLoadDocumentOperation(ctx, filename, flags));
+  if (!fop)
+    return nullptr;
+  fop->operate();
+  fop->done();
+  fop->postLoad();
+  EXPECT_FALSE(fop->hasError()) << fop->error();
+  return std::unique_ptr<Doc>(fop->releaseDocument());
+}
+
+void delete_sequence_files(const char* format, const int nframes)
+{
+  std::vector<char> fn(256);
+  for (int frame=0; frame<nframes; ++frame) {
+    std::sprintf(&fn[0], format, frame);
+    base::delete_file(&fn[0]);
+  }
+}
+
+} // anonymous namespace
+
+TEST(File, LoadSequenceLinkingIdenticalFrames)
+{
+  app::Context ctx;
+  const color_t colors[] = {
+    rgba(255, 0, 0, 255),
+    rgba(255, 0, 0, 255),
+    rgba(255, 0, 0, 255),
+    rgba(0, 255, 0, 255),
+    rgba(0, 255, 0, 255),
+    rgba(0, 0, 255, 255),
+  };
+  const int nframes = sizeof(colors) / sizeof(colors[0]);
+
+  {
+    std::unique_ptr<Doc> doc(
+      ctx.documents().add(16, 8, doc::ColorMode::RGB, 256));
+    doc->setFilename("_test_link_00.png");
+
+    Sprite* sprite = doc->sprite();
+    auto layer = static_cast<LayerImage*>(sprite->root()->firstLayer());
+    ASSERT_TRUE(layer != nullptr);
+    sprite->setTotalFrames(frame_t(nframes));
+
+    // Each frame has its own image (some of them with the same color)
+    clear_image(layer->cel(frame_t(0))->image(), colors[0]);
+    for (frame_t frame=1; frame<nframes; ++frame) {
+      ImageRef image(Image::create(IMAGE_RGB, 16, 8));
+      clear_image(image.get(), colors[frame]);
+      layer->addCel(new Cel(frame, image));
+    }
+
+    ASSERT_EQ(0, save_document(&ctx, doc.get()));
+    doc->close();
+  }
+
+  // Without FILE_LOAD_SEQUENCE_LINK each file is a different cel
+  {
+    std::unique_ptr<Doc> doc(
+      load_sequence(&ctx, "_test_link_00.png", FILE_LOAD_SEQUENCE_YES));
+    ASSERT_TRUE(doc != nullptr);
+    ASSERT_EQ(nframes, doc->sprite()->totalFrames());
+
+    Layer* layer = doc->sprite()->root()->firstLayer();
+    ASSERT_TRUE(layer != nullptr);
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      ASSERT_TRUE(layer->cel(frame) != nullptr) << frame;
+      EXPECT_EQ(colors[frame], get_pixel(layer->cel(frame)->image(), 15, 7))
+        << frame;
+      if (frame > 0) {
+        EXPECT_NE(layer->cel(frame-1)->data(), layer->cel(frame)->data())
+          << frame;
+      }
+    }
+    doc->close();
+  }
+
+  // Identical consecutive files are linked cels
+  {
+    std::unique_ptr<Doc> doc(
+      load_sequence(&ctx, "_test_link_00.png",
+                    FILE_LOAD_SEQUENCE_YES |
+                    FILE_LOAD_SEQUENCE_LINK));
+    ASSERT_TRUE(doc != nullptr);
+    ASSERT_EQ(nframes, doc->sprite()->totalFrames());
+
+    Layer* layer = doc->sprite()->root()->firstLayer();
+    ASSERT_TRUE(layer != nullptr);
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      ASSERT_TRUE(layer->cel(frame) != nullptr) << frame;
+      EXPECT_EQ(colors[frame], get_pixel(layer->cel(frame)->image(), 15, 7))
+        << frame;
+      if (frame > 0) {
+        EXPECT_EQ(colors[frame-1] == colors[frame],
+                  layer->cel(frame-1)->data() == layer->cel(frame)->data())
+          << frame;
+      }
+    }
+    doc->close();
+  }
+
+  delete_sequence_files("_test_link_%02d.png", nframes);
+}
+
+// Each file of an indexed sequence has its own palette, identical
+// images with different palettes must not be linked.
+TEST(File, LoadIndexedSequenceWithPalettes)
+{
+  app::Context ctx;
+  const color_t colors[] = {
+    rgba(255, 0, 0, 255),
+    rgba(0, 255, 0, 255),
+    rgba(0, 255, 0, 255),
+    rgba(0, 0, 255, 255),
+  };
+  const int nframes = sizeof(colors) / sizeof(colors[0]);
+
+  {
+    std::unique_ptr<Doc> doc(
+      ctx.documents().add(16, 8, doc::ColorMode::INDEXED, 256));
+    doc->setFilename("_test_pal_00.png");
+
+    Sprite* sprite = doc->sprite();
+    auto layer = static_cast<LayerImage*>(sprite->root()->firstLayer());
+    ASSERT_TRUE(layer != nullptr);
+    sprite->setTotalFrames(frame_t(nframes));
+
+    // All frames use the index 1, but it's a different color in
+    // each palette
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      if (frame == 0) {
+        clear_image(layer->cel(frame)->image(), 1);
+      }
+      else {
+        ImageRef image(Image::create(IMAGE_INDEXED, 16, 8));
+        clear_image(image.get(), 1);
+        layer->addCel(new Cel(frame, image));
+      }
+
+      Palette pal(*sprite->palette(frame_t(0)));
+      pal.setFrame(frame);
+      pal.setEntry(1, colors[frame]);
+      sprite->setPalette(&pal, true);
+    }
+
+    ASSERT_EQ(0, save_document(&ctx, doc.get()));
+    doc->close();
+  }
+
+  {
+    std::unique_ptr<Doc> doc(
+      load_sequence(&ctx, "_test_pal_00.png",
+                    FILE_LOAD_SEQUENCE_YES |
+                    FILE_LOAD_SEQUENCE_LINK));
+    ASSERT_TRUE(doc != nullptr);
+    EXPECT_EQ(IMAGE_INDEXED, doc->sprite()->pixelFormat());
+    ASSERT_EQ(nframes, doc->sprite()->totalFrames());
+
+    Layer* layer = doc->sprite()->root()->firstLayer();
+    ASSERT_TRUE(layer != nullptr);
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      ASSERT_TRUE(layer->cel(frame) != nullptr) << frame;
+      EXPECT_EQ(1, get_pixel(layer->cel(frame)->image(), 15, 7)) << frame;
+      EXPECT_EQ(colors[frame], doc->sprite()->palette(frame)->getEntry(1))
+        << frame;
+      if (frame > 0) {
+        EXPECT_EQ(colors[frame-1] == colors[frame],
+                  layer->cel(frame-1)->data() == layer->cel(frame)->data())
+          << frame;
+      }
+    }
+    doc->close();
+  }
+
+  delete_sequence_files("_test_pal_%02d.png", nframes);
+}
@@ -21,8 +21,10 @@
 #include "app/modules/gui.h"
 #include "app/pref/preferences.h"
 #include "app/util/autocrop.h"
+#include "app/util/thread_pool.h"
 #include "base/file_handle.h"
 #include "base/fs.h"
+#include "base/thread_pool.h"
 #include "doc/doc.h"
 #include "gfx/clip.h"
 #include "render/dithering.h"
@@ -34,6 +36,12 @@
 #include "gif_options.xml.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
+#include <vector>
 
 #include <gif_lib.h>
 
@@ -115,7 +123,9 @@ static int interlaced_jumps[] = { 8, 8, 4, 2 };
 // True if the GifEncoder should save the animation for Twitter:
 // * Frames duration >= 2, and
 // * Last frame 1/4 of its duration
-static bool fix_last_frame_duration = false;
+// (Atomic because several files can be saved at the same time from
+// the CLI with --jobs)
+static std::atomic<bool> fix_last_frame_duration(false);
 
 GifEncoderDurationFix::GifEncoderDurationFix(bool state)
 {
@@ -893,6 +903,23 @@ bool GifFormat::onLoad(FileOp* fop)
 
 #ifdef ENABLE_SAVE
 
+// Maximum memory used by frames that are rendered/quantized ahead of
+// time (each frame needs its full RGB render, and a copy of the area
+// that is quantized).
+static const std::size_t kMaxAheadMemSize = 256*1024*1024;
+
+template<typename T>
+static bool is_future_ready(const std::future<T>& future) {
+  return (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+}
+
+// The GIF frames are encoded in a pipeline: frames are rendered and
+// quantized (optimized palette + conversion to indexes) in
+// shared_thread_pool() threads, while the disposal method of each
+// frame (which depends on the previous one) is calculated and the
+// frames are written in order (LZW compression) in the caller thread. The
+// generated file is the same as encoding all steps of each frame
+// one after the other.
 class GifEncoder {
 public:
   typedef int gifframe_t;
@@ -964,9 +991,28 @@ public:
       m_images[i].reset(Image::create(IMAGE_RGB,
                                       m_spriteBounds.w,
                                       m_spriteBounds.h));
+
+    // FileAbstractImage::renderFrame() uses a temporary image (and the
+    // sprite RgbMap) when it has to scale the sprite, so in that case
+    // frames are rendered one at a time in this thread.
+    m_parallelRender = (m_spriteBounds.w == m_sprite->width() &&
+                        m_spriteBounds.h == m_sprite->height());
+
+    const std::size_t frameSize =
+      std::size_t(m_spriteBounds.w) * m_spriteBounds.h * sizeof(color_t);
+    m_aheadFrames = int(std::clamp<std::size_t>(
+      kMaxAheadMemSize / (2*frameSize), 1, 2*shared_thread_pool_size()));
   }
 
   ~GifEncoder() {
+    // Wait background tasks (they use this encoder) in case that the
+    // encoding was interrupted with an exception.
+    for (auto& future : m_renders)
+      if (future.valid())
+        future.wait();
+    for (auto& future : m_quantized)
+      future.wait();
+
     if (m_globalColormap)
       GifFreeMapObject(m_globalColormap);
   }
@@ -979,33 +1025,42 @@ public:
     // Previous and next images are used to decide the best disposal
     // method (e.g. if it's more convenient to restore the background
     // color or to restore the previous frame to reach the next one).
-    m_previousImage = m_images[0].get();
-    m_currentImage = m_images[1].get();
-    m_nextImage = m_images[2].get();
-
-    auto frame_beg = m_fop->roi().selectedFrames().begin();
-#if _DEBUG
-    auto frame_end = m_fop->roi().selectedFrames().end();
-#endif
-    auto frame_it = frame_beg;
+    m_previousImage = m_images[0];
+    m_currentImage = m_images[1];
+    m_nextImage = m_images[2];
 
     // In this code "gifFrame" will be the GIF frame, and "frame" will
     // be the doc::Sprite frame.
     gifframe_t nframes = totalFrames();
+    for (frame_t frame : m_fop->roi().selectedFrames()) {
+      if (int(m_frames.size()) == nframes)
+        break;
+      m_frames.push_back(frame);
+    }
+    ASSERT(int(m_frames.size()) == nframes);
+    m_renders.resize(nframes);
+
+    // The palette of the sprite is the same for all frames when we
+    // don't quantize each frame, so its RgbMap can be used from
+    // several threads at the same time.
+    const RgbMap* spriteRgbMap =
+      (m_quantizeColormaps ? nullptr: m_sprite->rgbMap(m_frames[0]));
+
     for (gifframe_t gifFrame=0; gifFrame<nframes; ++gifFrame) {
-      ASSERT(frame_it != frame_end);
-      frame_t frame = *frame_it;
-      ++frame_it;
+      frame_t frame = m_frames[gifFrame];
+
+      // Start rendering the next frames in background
+      requestRenders(std::min(nframes, gifFrame+2+m_aheadFrames));
 
       if (gifFrame == 0)
-        renderFrame(frame, m_nextImage);
+        m_nextImage = renderedFrame(0);
       else
         std::swap(m_previousImage, m_currentImage);
 
       // Render next frame
       std::swap(m_currentImage, m_nextImage);
       if (gifFrame+1 < nframes)
-        renderFrame(*frame_it, m_nextImage);
+        m_nextImage = renderedFrame(gifFrame+1);
 
       gfx::Rect frameBounds;
       DisposalMethod disposal;
@@ -1015,28 +1070,101 @@ public:
       if (frameBounds.isEmpty())
         frameBounds = gfx::Rect(0, 0, 1, 1);
 
-      writeImage(gifFrame, frame, frameBounds, disposal,
-                 // Only the last frame in the animation needs the fix
-                 (fix_last_frame_duration && gifFrame == nframes-1));
+      // Quantize the frame in background (we use a copy of the
+      // frameBounds area because m_currentImage is disposed below)
+      ImageRef frameImage(crop_image(m_currentImage.get(), frameBounds, 0));
+      // Only the last frame in the animation needs the fix
+      const bool fixDuration = (fix_last_frame_duration && gifFrame == nframes-1);
+      auto task = std::make_shared<std::packaged_task<QuantizedFramePtr()>>(
+        [this, gifFrame, frame, frameBounds, disposal, fixDuration,
+         frameImage, spriteRgbMap]{
+          return quantizeFrame(gifFrame, frame, frameBounds, disposal,
+                               fixDuration, frameImage.get(), spriteRgbMap);
+        });
+      m_quantized.push_back(task->get_future());
+      shared_thread_pool().execute([task]{ (*task)(); });
 
       // Dispose/clear frame content
-      process_disposal_method(m_previousImage,
-                              m_currentImage,
+      process_disposal_method(m_previousImage.get(),
+                              m_currentImage.get(),
                               disposal,
                               frameBounds,
                               m_clearColor);
 
-      m_fop->setProgress(double(gifFrame+1) / double(nframes));
+      // Write the frames that are ready (in order), or wait the
+      // oldest one if there are too many frames in the queue.
+      while (!m_quantized.empty() &&
+             (int(m_quantized.size()) > m_aheadFrames ||
+              is_future_ready(m_quantized.front()))) {
+        writeNextQuantizedFrame(nframes);
+      }
     }
+
+    while (!m_quantized.empty())
+      writeNextQuantizedFrame(nframes);
     return true;
   }
 
 private:
 
+  // Frame converted to the indexes that are stored in the GIF file.
+  struct QuantizedFrame {
+    gifframe_t gifFrame;
+    frame_t frame;
+    gfx::Rect frameBounds;
+    DisposalMethod disposal;
+    bool fixDuration;
+    ImageRef image;                   // Indexes of the frameBounds area
+    std::unique_ptr<Palette> palette; // Local colormap (or nullptr to use the global one)
+    int transparentIndex;
+  };
+  typedef std::shared_ptr<QuantizedFrame> QuantizedFramePtr;
+
   doc::frame_t totalFrames() const {
     return m_fop->roi().frames();
   }
 
+  // Starts rendering in background the frames until "gifFrameEnd"
+  // (not included).
+  void requestRenders(const gifframe_t gifFrameEnd) {
+    if (!m_parallelRender)
+      return;
+
+    for (; m_nextRender<gifFrameEnd; ++m_nextRender) {
+      const frame_t frame = m_frames[m_nextRender];
+      auto task = std::make_shared<std::packaged_task<ImageRef()>>(
+        [this, frame]{
+          ImageRef image(Image::create(IMAGE_RGB,
+                                       m_spriteBounds.w,
+                                       m_spriteBounds.h));
+          renderFrame(frame, image.get());
+          return image;
+        });
+      m_renders[m_nextRender] = task->get_future();
+      shared_thread_pool().execute([task]{ (*task)(); });
+    }
+  }
+
+  ImageRef renderedFrame(const gifframe_t gifFrame) {
+    if (m_renders[gifFrame].valid())
+      return m_renders[gifFrame].get();
+
+    ImageRef image(Image::create(IMAGE_RGB,
+                                 m_spriteBounds.w,
+                                 m_spriteBounds.h));
+    renderFrame(m_frames[gifFrame], image.get());
+    return image;
+  }
+
+  void writeNextQuantizedFrame(const gifframe_t nframes) {
+    QuantizedFramePtr q = m_quantized.front().get();
+    m_quantized.pop_front();
+
+    writeImage(*q);
+
+    m_fop->setProgress(double(q->gifFrame+1) / double(nframes));
+  }
+
   void writeHeader() {
     if (EGifPutScreenDesc(m_gifFile,
                           m_spriteBounds.w,
@@ -1141,11 +1269,11 @@ private:
       gfx::Rect prev, next;
 
       if (gifFrame-1 >= 0)
-        prev = calculateFrameBounds(m_currentImage, m_previousImage);
+        prev = calculateFrameBounds(m_currentImage.get(), m_previousImage.get());
 
       if (!m_hasBackground &&
           gifFrame+1 < totalFrames())
-        next = calculateFrameBounds(m_currentImage, m_nextImage);
+        next = calculateFrameBounds(m_currentImage.get(), m_nextImage.get());
 
       frameBounds = prev.createUnion(next);
 
@@ -1153,7 +1281,7 @@ private:
       // when we dispose the current one than clearing with the bg
       // color.
       if (m_hasBackground && !prev.isEmpty()) {
-        gfx::Rect prevNext = calculateFrameBounds(m_previousImage, m_nextImage);
+        gfx::Rect prevNext = calculateFrameBounds(m_previousImage.get(), m_nextImage.get());
         if (!prevNext.isEmpty() &&
             frameBounds.contains(prevNext) &&
             prevNext.w*prevNext.h < frameBounds.w*frameBounds.h) {
@@ -1168,38 +1296,46 @@ private:
     }
   }
 
-  void writeImage(const gifframe_t gifFrame,
-                  const frame_t frame,
-                  const gfx::Rect& frameBounds,
-                  const DisposalMethod disposal,
-                  const bool fixDuration) {
+  // Converts the given RGB image (the frameBounds area of the frame)
+  // to the indexes that must be stored in the GIF file. It's called
+  // from shared_thread_pool() threads.
+  QuantizedFramePtr quantizeFrame(const gifframe_t gifFrame,
+                                  const frame_t frame,
+                                  const gfx::Rect& frameBounds,
+                                  const DisposalMethod disposal,
+                                  const bool fixDuration,
+                                  const Image* image,
+                                  const RgbMap* spriteRgbMap) const {
+    auto q = std::make_shared<QuantizedFrame>();
+    q->gifFrame = gifFrame;
+    q->frame = frame;
+    q->frameBounds = frameBounds;
+    q->disposal = disposal;
+    q->fixDuration = fixDuration;
+
     std::unique_ptr<Palette> framePaletteRef;
     std::unique_ptr<RgbMap> rgbmapRef;
-    Palette* framePalette = m_sprite->palette(frame);
-    RgbMap* rgbmap = m_sprite->rgbMap(frame);
+    const Palette* framePalette = m_sprite->palette(frame);
+    const RgbMap* rgbmap = spriteRgbMap;
 
     // Create optimized palette for RGB/Grayscale images
     if (m_quantizeColormaps) {
-      framePaletteRef.reset(createOptimizedPalette(frameBounds));
+      framePaletteRef.reset(createOptimizedPalette(image));
       framePalette = framePaletteRef.get();
 
-      rgbmapRef.reset(new RgbMap);
+      rgbmapRef.reset(RgbMap::create(m_sprite->rgbMapAlgorithm()));
+      rgbmapRef->regenerate(framePalette, m_transparentIndex);
       rgbmap = rgbmapRef.get();
-      rgbmap->regenerate(framePalette, m_transparentIndex);
     }
 
     // We will store the frameBounds pixels in frameImage, with the
     // indexes that must be stored in the GIF file for this specific
     // frame.
-    if (!m_frameImageBuf)
-      m_frameImageBuf.reset(new ImageBuffer);
-
     ImageRef frameImage(Image::create(IMAGE_INDEXED,
                                       frameBounds.w,
-                                      frameBounds.h,
-                                      m_frameImageBuf));
+                                      frameBounds.h));
 
-    // Convert the frameBounds area of m_currentImage (RGB) to frameImage (Indexed)
+    // Convert the frameBounds area of the frame (RGB) to frameImage (Indexed)
     // bool needsTransparent = false;
     PalettePicks usedColors(framePalette->size());
 
@@ -1215,7 +1351,7 @@ private:
     }
 
     {
-      const LockImageBits<RgbTraits> srcBits(m_currentImage, frameBounds);
+      const LockImageBits<RgbTraits> srcBits(image);
       LockImageBits<IndexedTraits> dstBits(
         frameImage.get(), gfx::Rect(0, 0, frameBounds.w, frameBounds.h));
 
@@ -1272,19 +1408,17 @@ private:
       remap.map(i, i);
 
     int localTransparent = m_transparentIndex;
-    ColorMapObject* colormap = m_globalColormap;
-    if (!colormap) {
-      Palette reducedPalette(0, usedNColors);
+    if (!m_globalColormap) {
+      q->palette.reset(new Palette(0, usedNColors));
 
       for (int i=0, j=0; i<framePalette->size(); ++i) {
         if (usedColors[i]) {
-          reducedPalette.setEntry(j, framePalette->getEntry(i));
+          q->palette->setEntry(j, framePalette->getEntry(i));
           remap.map(i, j);
           ++j;
         }
       }
 
-      colormap = createColorMap(&reducedPalette);
       if (localTransparent >= 0)
         localTransparent = remap[localTransparent];
     }
@@ -1292,9 +1426,31 @@ private:
     if (localTransparent >= 0 && m_transparentIndex != localTransparent)
       remap.map(m_transparentIndex, localTransparent);
 
+    // Convert the indexes to the final ones (the local colormap ones)
+    for (int y=0; y<frameBounds.h; ++y) {
+      IndexedTraits::address_t addr =
+        (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
+
+      for (int i=0; i<frameBounds.w; ++i, ++addr)
+        *addr = remap[*addr];
+    }
+
+    q->image = frameImage;
+    q->transparentIndex = localTransparent;
+    return q;
+  }
+
+  void writeImage(const QuantizedFrame& q) {
+    const gifframe_t gifFrame = q.gifFrame;
+    const gfx::Rect& frameBounds = q.frameBounds;
+
+    ColorMapObject* colormap = m_globalColormap;
+    if (q.palette)
+      colormap = createColorMap(q.palette.get());
+
     // Write extension record.
-    writeExtension(gifFrame, frame, localTransparent,
-                   disposal, fixDuration);
+    writeExtension(gifFrame, q.frame, q.transparentIndex,
+                   q.disposal, q.fixDuration);
 
     // Write the image record.
     if (EGifPutImageDesc(m_gifFile,
@@ -1302,49 +1458,42 @@ private:
                          frameBounds.w, frameBounds.h,
                          m_interlaced ? 1: 0,
                          (colormap != m_globalColormap ? colormap: nullptr)) == GIF_ERROR) {
+      if (colormap != m_globalColormap)
+        GifFreeMapObject(colormap);
       throw Exception("Error writing GIF frame %d.\n", gifFrame);
     }
 
-    std::vector<uint8_t> scanline(frameBounds.w);
+    bool ok = true;
 
-    // Write the image data (pixels).
+    // Write the image data (pixels, already remapped to the colormap).
     if (m_interlaced) {
       // Need to perform 4 passes on the images.
-      for (int i=0; i<4; ++i)
-        for (int y=interlaced_offset[i]; y<frameBounds.h; y+=interlaced_jumps[i]) {
-          IndexedTraits::address_t addr =
-            (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
-
-          for (int i=0; i<frameBounds.w; ++i, ++addr)
-            scanline[i] = remap[*addr];
-
-          if (EGifPutLine(m_gifFile, &scanline[0], frameBounds.w) == GIF_ERROR)
-            throw Exception("Error writing GIF image scanlines for frame %d.\n", gifFrame);
+      for (int i=0; i<4 && ok; ++i)
+        for (int y=interlaced_offset[i]; y<frameBounds.h && ok; y+=interlaced_jumps[i]) {
+          ok = (EGifPutLine(m_gifFile, q.image->getPixelAddress(0, y),
+                            frameBounds.w) != GIF_ERROR);
         }
     }
     else {
       // Write all image scanlines (not interlaced in this case).
-      for (int y=0; y<frameBounds.h; ++y) {
-        IndexedTraits::address_t addr =
-          (IndexedTraits::address_t)frameImage->getPixelAddress(0, y);
-
-        for (int i=0; i<frameBounds.w; ++i, ++addr)
-          scanline[i] = remap[*addr];
-
-        if (EGifPutLine(m_gifFile, &scanline[0], frameBounds.w) == GIF_ERROR)
-          throw Exception("Error writing GIF image scanlines for frame %d.\n", gifFrame);
+      for (int y=0; y<frameBounds.h && ok; ++y) {
+        ok = (EGifPutLine(m_gifFile, q.image->getPixelAddress(0, y),
+                          frameBounds.w) != GIF_ERROR);
       }
     }
 
     if (colormap && colormap != m_globalColormap)
       GifFreeMapObject(colormap);
+
+    if (!ok)
+      throw Exception("Error writing GIF image scanlines for frame %d.\n", gifFrame);
   }
 
-  Palette* createOptimizedPalette(const gfx::Rect& frameBounds) {
+  Palette* createOptimizedPalette(const Image* image) const {
     render::PaletteOptimizer optimizer;
 
-    // Feed the palette optimizer with pixels inside frameBounds
-    for (const auto& color : LockImageBits<RgbTraits>(m_currentImage, frameBounds)) {
+    // Feed the palette optimizer with pixels of the frame
+    for (const auto& color : LockImageBits<RgbTraits>(image)) {
       if (rgba_geta(color) >= 128)
         optimizer.feedWithRgbaColor(
           rgba(rgba_getr(color),
@@ -1357,14 +1506,14 @@ private:
     return palette;
   }
 
-  void renderFrame(frame_t frame, Image* dst) {
+  void renderFrame(frame_t frame, Image* dst) const {
     clear_image(dst, m_clearColor);
     m_img->renderFrame(frame, dst);
   }
 
 private:
 
-  ColorMapObject* createColorMap(const Palette* palette) {
+  ColorMapObject* createColorMap(const Palette* palette) const {
     int n = 1 << GifBitSizeLimited(palette->size());
     ColorMapObject* colormap = GifMakeMapObject(n, nullptr);
 
@@ -1403,11 +1552,22 @@ private:
   bool m_quantizeColormaps;
   bool m_interlaced;
   int m_loop;
-  ImageBufferPtr m_frameImageBuf;
   ImageRef m_images[3];
-  Image* m_previousImage;
-  Image* m_currentImage;
-  Image* m_nextImage;
+  ImageRef m_previousImage;
+  ImageRef m_currentImage;
+  ImageRef m_nextImage;
+
+  // Sprite frames to save (one for each GIF frame).
+  std::vector<frame_t> m_frames;
+  // Frames rendered in background (only if m_parallelRender is true).
+  bool m_parallelRender;
+  std::vector<std::future<ImageRef>> m_renders;
+  gifframe_t m_nextRender = 0;
+  // Frames being quantized in background, in the same order they must
+  // be written in the file.
+  std::deque<std::future<QuantizedFramePtr>> m_quantized;
+  // Maximum number of frames rendered/quantized ahead of time.
+  int m_aheadFrames;
 };
 
 bool GifFormat::onSave(FileOp* fop)
@@ -20,6 +20,7 @@
 #include "doc/doc.h"
 #include "gfx/color_space.h"
 
+#include <atomic>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -77,7 +78,9 @@ static void report_png_error(png_structp png, png_const_charp error)
 }
 
 // TODO this should be information in FileOp parameter of onSave()
-static bool fix_one_alpha_pixel = false;
+// (Atomic because several files can be saved at the same time from
+// the CLI with --jobs)
+static std::atomic<bool> fix_one_alpha_pixel(false);
 
 PngEncoderOneAlphaPixel::PngEncoderOneAlphaPixel(bool state)
 {
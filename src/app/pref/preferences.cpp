@@ -15,6 +15,7 @@
 #include "app/resource_finder.h"
 #include "app/tools/ink.h"
 #include "app/tools/tool.h"
+#include "app/util/undo_buffer.h"
 #include "base/fs.h"
 #include "doc/sprite.h"
 #include "os/system.h"
@@ -64,6 +65,20 @@ Preferences::Preferences()
     });
   doc::Sprite::SetDefaultGridBounds(defPref.grid.bounds());
 
+  // Same for the algorithm used to create the RgbMap of new sprites
+  quantization.rgbmapAlgorithm.AfterChange.connect(
+    [](const doc::RgbMapAlgorithm& newValue){
+      doc::Sprite::SetDefaultRgbMapAlgorithm(newValue);
+    });
+  doc::Sprite::SetDefaultRgbMapAlgorithm(quantization.rgbmapAlgorithm());
+
+  // Compressed undo payloads can be moved to a temporary file
+  undo.spillToDisk.AfterChange.connect(
+    [](const bool& newValue){
+      UndoBuffer::SetSpillToDisk(newValue);
+    });
+  UndoBuffer::SetSpillToDisk(undo.spillToDisk());
+
   // Reset confusing defaults for a new instance of the program.
   defPref.grid.snap(false);
   if (selection.mode() != gen::SelectionMode::DEFAULT &&
@@ -0,0 +1,252 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/thumbnail_cache.h"
+
+#include "base/cfile.h"
+#include "base/convert_to.h"
+#include "base/file_handle.h"
+#include "base/fs.h"
+#include "base/process.h"
+#include "base/sha1.h"
+#include "base/time.h"
+#include "dio/aseprite_common.h"
+#include "doc/image.h"
+#include "doc/image_traits.h"
+#include "fmt/format.h"
+#include "zlib.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+#define CACHE_TRACE(...)
+
+namespace app {
+
+// Format of each entry:
+//   DWORD  Magic number
+//   WORD   Width
+//   WORD   Height
+//   WORD   Key length
+//   BYTE[] Key (to check that the entry is for the same file/version)
+//   DWORD  Compressed data length
+//   BYTE[] Compressed RGBA pixels (zlib)
+static const uint32_t kEntryMagic = 0x31485441; // "ATH1"
+static const char* kEntryExtension = "thumb";
+
+ThumbnailCache::ThumbnailCache(const std::string& dir)
+  : m_dir(dir)
+{
+}
+
+doc::ImageRef ThumbnailCache::load(const std::string& filename) const
+{
+  const std::string k = key(filename);
+  if (k.empty())
+    return nullptr;
+
+  base::FileHandle handle(base::open_file(entryFilename(k), "rb"));
+  FILE* f = handle.get();
+  if (!f)
+    return nullptr;
+
+  if (uint32_t(base::fgetl(f)) != kEntryMagic)
+    return nullptr;
+
+  // Thumbnails are not bigger than ASE_FILE_THUMBNAIL_MAX_SIZE (a
+  // broken entry shouldn't make us allocate a lot of memory)
+  const int w = base::fgetw(f);
+  const int h = base::fgetw(f);
+  const int keyLength = base::fgetw(f);
+  if (w < 1 || w > ASE_FILE_THUMBNAIL_MAX_SIZE ||
+      h < 1 || h > ASE_FILE_THUMBNAIL_MAX_SIZE ||
+      keyLength != int(k.size()))
+    return nullptr;
+
+  // Two different files with the same SHA1 of the key (or an old
+  // version of the same file).
+  std::string entryKey(keyLength, 0);
+  if (fread(&entryKey[0], 1, keyLength, f) != size_t(keyLength) ||
+      entryKey != k)
+    return nullptr;
+
+  const size_t pixelsSize = 4 * size_t(w) * size_t(h);
+  const size_t compressedSize = size_t(uint32_t(base::fgetl(f)));
+  if (compressedSize == 0 ||
+      compressedSize > compressBound(pixelsSize))
+    return nullptr;
+
+  std::vector<uint8_t> compressed(compressedSize);
+  if (fread(&compressed[0], 1, compressedSize, f) != compressedSize)
+    return nullptr;
+
+  std::vector<uint8_t> pixels(pixelsSize);
+  uLongf uncompressedSize = pixels.size();
+  if (uncompress(&pixels[0], &uncompressedSize,
+                 &compressed[0], compressedSize) != Z_OK ||
+      uncompressedSize != pixels.size())
+    return nullptr;
+
+  doc::ImageRef image(doc::Image::create(doc::IMAGE_RGB, w, h));
+  const uint8_t* src = &pixels[0];
+  for (int y=0; y<h; ++y) {
+    auto dst = (doc::RgbTraits::address_t)image->getPixelAddress(0, y);
+    for (int x=0; x<w; ++x, src+=4)
+      *(dst++) = doc::rgba(src[0], src[1], src[2], src[3]);
+  }
+
+  CACHE_TRACE("THUMB: Cache hit %s\n", filename.c_str());
+  return image;
+}
+
+void ThumbnailCache::save(const std::string& filename,
+                          const doc::Image* thumbnail) const
+{
+  ASSERT(thumbnail->pixelFormat() == doc::IMAGE_RGB);
+
+  const std::string k = key(filename);
+  if (k.empty() || m_dir.empty())
+    return;
+
+  // load() doesn't accept bigger thumbnails
+  const int w = thumbnail->width();
+  const int h = thumbnail->height();
+  if (w > ASE_FILE_THUMBNAIL_MAX_SIZE ||
+      h > ASE_FILE_THUMBNAIL_MAX_SIZE)
+    return;
+
+  std::vector<uint8_t> pixels(4 * size_t(w) * size_t(h));
+  uint8_t* dst = &pixels[0];
+  for (int y=0; y<h; ++y) {
+    auto src = (doc::RgbTraits::const_address_t)thumbnail->getPixelAddress(0, y);
+    for (int x=0; x<w; ++x, ++src) {
+      *(dst++) = doc::rgba_getr(*src);
+      *(dst++) = doc::rgba_getg(*src);
+      *(dst++) = doc::rgba_getb(*src);
+      *(dst++) = doc::rgba_geta(*src);
+    }
+  }
+
+  uLongf compressedSize = compressBound(pixels.size());
+  std::vector<uint8_t> compressed(compressedSize);
+  if (compress(&compressed[0], &compressedSize,
+               &pixels[0], pixels.size()) != Z_OK)
+    return;
+
+  // Write the entry in a temporary file and then rename it, so other
+  // threads (or other instances of the program) never read a
+  // partially written entry.
+  static std::atomic<int> tmpCounter(0);
+  const std::string fn = entryFilename(k);
+  const std::string tmpFn =
+    fmt::format("{}.{}-{}.tmp", fn,
+                base::get_current_process_id(), ++tmpCounter);
+  {
+    base::FileHandle handle(base::open_file(tmpFn, "wb"));
+    FILE* f = handle.get();
+    if (!f)
+      return;
+
+    base::fputl(kEntryMagic, f);
+    base::fputw(w, f);
+    base::fputw(h, f);
+    base::fputw(k.size(), f);
+    fwrite(k.c_str(), 1, k.size(), f);
+    base::fputl(compressedSize, f);
+    fwrite(&compressed[0], 1, compressedSize, f);
+    if (ferror(f)) {
+      handle.reset();
+      base::delete_file(tmpFn);
+      return;
+    }
+  }
+
+  try {
+    if (base::is_file(fn))
+      base::delete_file(fn);
+    base::move_file(tmpFn, fn);
+  }
+  catch (const std::exception& ex) {
+    CACHE_TRACE("THUMB: Error saving %s: %s\n", fn.c_str(), ex.what());
+    if (base::is_file(tmpFn))
+      base::delete_file(tmpFn);
+  }
+}
+
+void ThumbnailCache::prune()
+{
+  std::call_once(
+    m_pruned,
+    [this]{
+      struct Entry {
+        std::string fn;
+        size_t size;
+        base::Time time;
+      };
+      std::vector<Entry> entries;
+      size_t total = 0;
+
+      try {
+        for (const auto& item : base::list_files(m_dir)) {
+          if (base::get_file_extension(item) != kEntryExtension)
+            continue;
+
+          Entry entry;
+          entry.fn = base::join_path(m_dir, item);
+          entry.size = base::file_size(entry.fn);
+          entry.time = base::get_modification_time(entry.fn);
+          entries.push_back(entry);
+          total += entry.size;
+        }
+        if (total <= kMaxSize)
+          return;
+
+        // Remove the oldest entries first
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry& a, const Entry& b) {
+                    return a.time < b.time;
+                  });
+        for (const auto& entry : entries) {
+          if (total <= kMaxSize)
+            break;
+          base::delete_file(entry.fn);
+          total -= entry.size;
+        }
+      }
+      catch (const std::exception& ex) {
+        CACHE_TRACE("THUMB: Error pruning cache: %s\n", ex.what());
+      }
+    });
+}
+
+std::string ThumbnailCache::key(const std::string& filename) const
+{
+  if (!base::is_file(filename))
+    return std::string();
+
+  const base::Time time = base::get_modification_time(filename);
+  return fmt::format("{}\n{}\n{:04}{:02}{:02}{:02}{:02}{:02}",
+                     base::normalize_path(filename),
+                     base::file_size(filename),
+                     time.year, time.month, time.day,
+                     time.hour, time.minute, time.second);
+}
+
+std::string ThumbnailCache::entryFilename(const std::string& key) const
+{
+  return base::join_path(
+    m_dir,
+    base::convert_to<std::string>(base::Sha1::calculateFromString(key))
+    + "." + kEntryExtension);
+}
+
+} // namespace app
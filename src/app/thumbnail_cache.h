@@ -0,0 +1,57 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_THUMBNAIL_CACHE_H_INCLUDED
+#define APP_THUMBNAIL_CACHE_H_INCLUDED
+#pragma once
+
+#include "doc/image_ref.h"
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+namespace doc {
+  class Image;
+}
+
+namespace app {
+
+  // Thumbnails of the file selector saved in the user folder, so a
+  // thumbnail is generated just one time for each version of a file
+  // (even between different sessions). Each entry is identified by
+  // the file path, size, and modification time. All member functions
+  // can be called from any thread.
+  class ThumbnailCache {
+  public:
+    // Maximum size of all the entries of the cache
+    static const std::size_t kMaxSize = 64*1024*1024;
+
+    // Uses the given directory to store the cache entries
+    ThumbnailCache(const std::string& dir);
+
+    // Returns the thumbnail (an RGB image) of the given file or
+    // nullptr if the file isn't in the cache or it was modified.
+    doc::ImageRef load(const std::string& filename) const;
+
+    // Saves the thumbnail (an RGB image) of the given file.
+    void save(const std::string& filename, const doc::Image* thumbnail) const;
+
+    // Removes the oldest entries if the cache is bigger than
+    // kMaxSize. It does something only the first time it's called.
+    void prune();
+
+  private:
+    std::string key(const std::string& filename) const;
+    std::string entryFilename(const std::string& key) const;
+
+    std::string m_dir;
+    std::once_flag m_pruned;
+  };
+
+} // namespace app
+
+#endif
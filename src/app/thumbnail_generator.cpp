@@ -12,20 +12,18 @@
 #include "app/thumbnail_generator.h"
 
 #include "app/app.h"
-#include "app/cmd/convert_color_profile.h"
 #include "app/doc.h"
 #include "app/file/file.h"
 #include "app/file_system.h"
+#include "app/resource_finder.h"
+#include "app/thumbnail_cache.h"
+#include "app/thumbnails.h"
 #include "app/util/conversion_to_surface.h"
+#include "base/fs.h"
 #include "base/thread.h"
-#include "doc/algorithm/rotate.h"
 #include "doc/image.h"
-#include "doc/palette.h"
-#include "doc/primitives.h"
 #include "doc/sprite.h"
 #include "os/system.h"
-#include "render/projection.h"
-#include "render/render.h"
 #include "ui/system.h"
 
 #include <algorithm>
@@ -40,8 +38,10 @@ namespace app {
 
 class ThumbnailGenerator::Worker {
 public:
-  Worker(base::concurrent_queue<ThumbnailGenerator::Item>& queue)
+  Worker(base::concurrent_queue<ThumbnailGenerator::Item>& queue,
+         ThumbnailCache& cache)
     : m_queue(queue)
+    , m_cache(cache)
     , m_fop(nullptr)
     , m_isDone(false)
     , m_thread([this]{ loadBgThread(); }) {
@@ -88,73 +88,40 @@ private:
       THUMB_TRACE("FOP loading thumbnail: %s\n",
                   m_item.fileitem->fileName().c_str());
 
-      // Load the file
-      m_fop->operate(nullptr);
-
-      // Don't call post-load because postLoad() needs user interaction.
-      //m_fop->postLoad();
-
-      // Convert the loaded document into the os::Surface.
-      const Sprite* sprite =
-        (m_fop->document() &&
-         m_fop->document()->sprite() ?
-         m_fop->document()->sprite(): nullptr);
-
-      std::unique_ptr<Image> thumbnailImage;
-      std::unique_ptr<Palette> palette;
-      if (!m_fop->isStop() && sprite) {
-        // The palette to convert the Image
-        palette.reset(new Palette(*sprite->palette(frame_t(0))));
-
-        // Special case for indexed images:
-        // If the sprite is transparent -> set the transparent color index alpha = 0
-        if (sprite->colorMode() == ColorMode::INDEXED &&
-            !sprite->backgroundLayer()) {
-          int i = sprite->transparentColor();
-          if (i >= 0 && i < int(palette->size()))
-            palette->setEntry(i, doc::rgba(0, 0, 0, 0));
+      // Use the thumbnail generated in a previous session
+      doc::ImageRef thumbnailImage =
+        m_cache.load(m_fop->filename());
+
+      if (!thumbnailImage) {
+        // Load the file (or just its embedded thumbnail)
+        m_fop->operate(nullptr);
+
+        // Don't call post-load because postLoad() needs user interaction.
+        //m_fop->postLoad();
+
+        // Render the loaded document in an RGB image.
+        const Sprite* sprite =
+          (m_fop->document() &&
+           m_fop->document()->sprite() ?
+           m_fop->document()->sprite(): nullptr);
+
+        if (!m_fop->isStop()) {
+          if (m_fop->thumbnail())
+            thumbnailImage = m_fop->thumbnail();
+          else if (sprite)
+            thumbnailImage = thumb::render_sprite_thumbnail(
+              sprite, frame_t(0), MAX_THUMBNAIL_SIZE,
+              m_fop->preserveColorProfile());
+
+          if (thumbnailImage)
+            m_cache.save(m_fop->filename(),
+                         thumbnailImage.get());
         }
 
-        const int w = sprite->width()*sprite->pixelRatio().w;
-        const int h = sprite->height()*sprite->pixelRatio().h;
-
-        // Calculate the thumbnail size
-        int thumb_w = MAX_THUMBNAIL_SIZE * w / std::max(w, h);
-        int thumb_h = MAX_THUMBNAIL_SIZE * h / std::max(w, h);
-        if (std::max(thumb_w, thumb_h) > std::max(w, h)) {
-          thumb_w = w;
-          thumb_h = h;
-        }
-        thumb_w = std::clamp(thumb_w, 1, MAX_THUMBNAIL_SIZE);
-        thumb_h = std::clamp(thumb_h, 1, MAX_THUMBNAIL_SIZE);
-
-        // Stretch the 'image'
-        thumbnailImage.reset(
-          Image::create(
-            sprite->pixelFormat(), thumb_w, thumb_h));
-
-        render::Projection proj(sprite->pixelRatio(),
-                                render::Zoom(thumb_w, w));
-        render::Render render;
-        render.setBgOptions(render::BgOptions::MakeTransparent());
-        render.setProjection(proj);
-        render.renderSprite(
-          thumbnailImage.get(), sprite, frame_t(0),
-          gfx::Clip(0, 0, 0, 0, w, h));
-
-        // Convert the image to sRGB color space
-        auto cs = sprite->colorSpace();
-        if (m_fop->preserveColorProfile() &&
-            cs && !cs->nearlyEqual(*gfx::ColorSpace::MakeSRGB())) {
-          app::cmd::convert_color_profile(
-            thumbnailImage.get(), palette.get(),
-            cs, gfx::ColorSpace::MakeSRGB());
-        }
+        // Close file
+        delete m_fop->releaseDocument();
       }
 
-      // Close file
-      delete m_fop->releaseDocument();
-
       // Set the thumbnail of the file-item.
       if (thumbnailImage) {
         os::SurfaceRef thumbnail =
@@ -163,7 +130,7 @@ private:
             thumbnailImage->height());
 
         convert_image_to_surface(
-          thumbnailImage.get(), palette.get(), thumbnail.get(),
+          thumbnailImage.get(), nullptr, thumbnail.get(),
           0, 0, 0, 0, thumbnailImage->width(), thumbnailImage->height());
 
         {
@@ -206,6 +173,8 @@ private:
   }
 
   void loadBgThread() {
+    m_cache.prune();
+
     while (!m_queue.empty()) {
       bool success = true;
       while (success) {
@@ -222,6 +191,7 @@ private:
   }
 
   base::concurrent_queue<Item>& m_queue;
+  ThumbnailCache& m_cache;
   app::ThumbnailGenerator::Item m_item;
   FileOp* m_fop;
   mutable std::mutex m_mutex;
@@ -247,6 +217,16 @@ ThumbnailGenerator::ThumbnailGenerator()
   int n = std::thread::hardware_concurrency()-1;
   if (n < 1) n = 1;
   m_maxWorkers = n;
+
+  ResourceFinder rf;
+  rf.includeUserDir(base::join_path("thumbnails", ".").c_str());
+  m_cache = std::make_unique<ThumbnailCache>(rf.getFirstOrCreateDefault());
+}
+
+ThumbnailGenerator::~ThumbnailGenerator()
+{
+  // Workers must be destroyed before the cache
+  m_workers.clear();
 }
 
 bool ThumbnailGenerator::checkWorkers()
@@ -308,7 +288,8 @@ void ThumbnailGenerator::generateThumbnail(IFileItem* fileitem)
       nullptr,
       fileitem->fileName().c_str(),
       FILE_LOAD_SEQUENCE_NONE |
-      FILE_LOAD_ONE_FRAME));
+      FILE_LOAD_ONE_FRAME |
+      FILE_LOAD_THUMBNAIL));
   if (!fop || fop->hasError()) {
     // Set a nullptr thumbnail so we don't try to generate a thumbnail
     // for this fileitem again.
@@ -346,7 +327,7 @@ void ThumbnailGenerator::startWorker()
 {
   std::lock_guard<std::mutex> hold(m_workersAccess);
   if (m_workers.size() < m_maxWorkers) {
-    m_workers.push_back(std::make_unique<Worker>(m_remainingItems));
+    m_workers.push_back(std::make_unique<Worker>(m_remainingItems, *m_cache));
   }
 }
 
@@ -22,10 +22,13 @@ namespace base {
 namespace app {
   class FileOp;
   class IFileItem;
+  class ThumbnailCache;
 
   class ThumbnailGenerator {
     ThumbnailGenerator();
   public:
+    ~ThumbnailGenerator();
+
     static ThumbnailGenerator* instance();
 
     // Generate a thumbnail for the given file-item.  It must be called
@@ -64,6 +67,7 @@ namespace app {
     WorkerList m_workers;
     std::mutex m_workersAccess;
     base::concurrent_queue<Item> m_remainingItems;
+    std::unique_ptr<ThumbnailCache> m_cache;
   };
 
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2018  David Capello
 // Copyright (C) 2016  Carlo Caputo
 //
@@ -10,18 +10,41 @@
 #include "config.h"
 #endif
 
+#include "app/thumbnails.h"
+
+#include "app/cmd/convert_color_profile.h"
+#include "app/doc.h"
+#include "app/doc_access.h"
+#include "app/doc_event.h"
 #include "app/util/conversion_to_surface.h"
+#include "app/util/thread_pool.h"
+#include "base/thread_pool.h"
 #include "doc/blend_mode.h"
 #include "doc/cel.h"
+#include "doc/cel_data.h"
+#include "doc/image.h"
 #include "doc/layer.h"
 #include "doc/sprite.h"
 #include "os/surface.h"
 #include "os/system.h"
+#include "render/projection.h"
 #include "render/render.h"
+#include "ui/system.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
 
 namespace app {
 namespace thumb {
 
+// Maximum memory used by the thumbnails of each CelThumbnails
+static const std::size_t kMaxMemSize = 32*1024*1024;
+
+// Milliseconds to wait before retrying a thumbnail that couldn't be
+// generated because the document was locked
+static const int kRetryInterval = 100;
+
 os::SurfaceRef get_cel_thumbnail(const doc::Cel* cel,
                                  const gfx::Size& fitInSize)
 {
@@ -69,5 +92,261 @@ os::SurfaceRef get_cel_thumbnail(const doc::Cel* cel,
     return nullptr;
 }
 
+doc::ImageRef render_sprite_thumbnail(const doc::Sprite* sprite,
+                                      const doc::frame_t frame,
+                                      const int maxSize,
+                                      const bool toSRGB)
+{
+  const int w = sprite->width()*sprite->pixelRatio().w;
+  const int h = sprite->height()*sprite->pixelRatio().h;
+
+  // Calculate the thumbnail size
+  int thumb_w = maxSize * w / std::max(w, h);
+  int thumb_h = maxSize * h / std::max(w, h);
+  if (std::max(thumb_w, thumb_h) > std::max(w, h)) {
+    thumb_w = w;
+    thumb_h = h;
+  }
+  thumb_w = std::clamp(thumb_w, 1, maxSize);
+  thumb_h = std::clamp(thumb_h, 1, maxSize);
+
+  // Render the sprite in RGB (the transparent color of indexed
+  // sprites without background is rendered as transparent pixels)
+  doc::ImageRef thumbnailImage(
+    doc::Image::create(doc::IMAGE_RGB, thumb_w, thumb_h));
+
+  render::Projection proj(sprite->pixelRatio(),
+                          render::Zoom(thumb_w, w));
+  render::Render render;
+  render.setBgOptions(render::BgOptions::MakeTransparent());
+  render.setProjection(proj);
+  render.renderSprite(
+    thumbnailImage.get(), sprite, frame,
+    gfx::Clip(0, 0, 0, 0, w, h));
+
+  // Convert the image to sRGB color space
+  auto cs = sprite->colorSpace();
+  if (toSRGB &&
+      cs && !cs->nearlyEqual(*gfx::ColorSpace::MakeSRGB())) {
+    app::cmd::convert_color_profile(
+      thumbnailImage.get(), nullptr,
+      cs, gfx::ColorSpace::MakeSRGB());
+  }
+
+  return thumbnailImage;
+}
+
+struct CelThumbnails::Shared {
+  std::mutex mutex;
+  std::condition_variable runningCv;
+  // Document to generate thumbnails, it's set to nullptr when the
+  // CelThumbnails is destroyed (protected by "mutex").
+  Doc* doc;
+  // Number of thumbnails being generated right now (protected by
+  // "mutex").
+  int running;
+  // Only accessed from the UI thread.
+  CelThumbnails* owner;
+};
+
+bool CelThumbnails::Version::operator==(const Version& other) const
+{
+  return (imageId == other.imageId &&
+          imageVersion == other.imageVersion &&
+          celSize == other.celSize &&
+          docChanges == other.docChanges);
+}
+
+bool CelThumbnails::Key::operator<(const Key& other) const
+{
+  if (celDataId != other.celDataId) return celDataId < other.celDataId;
+  if (size.w != other.size.w) return size.w < other.size.w;
+  return size.h < other.size.h;
+}
+
+CelThumbnails::CelThumbnails(Doc* doc)
+  : m_doc(doc)
+  , m_shared(std::make_shared<Shared>())
+  , m_memSize(0)
+  , m_docChanges(0)
+  , m_retryTimer(kRetryInterval)
+{
+  m_shared->doc = doc;
+  m_shared->running = 0;
+  m_shared->owner = this;
+  m_doc->add_observer(this);
+
+  m_retryTimer.Tick.connect([this]{
+    m_retryTimer.stop();
+    ThumbnailReady();
+  });
+}
+
+CelThumbnails::~CelThumbnails()
+{
+  m_doc->remove_observer(this);
+
+  // Thumbnails that weren't started yet will be ignored, and we wait
+  // the ones that are being generated right now (they use the
+  // document).
+  std::unique_lock<std::mutex> lock(m_shared->mutex);
+  m_shared->doc = nullptr;
+  m_shared->owner = nullptr;
+  m_shared->runningCv.wait(lock, [this]{ return m_shared->running == 0; });
+}
+
+os::SurfaceRef CelThumbnails::getThumbnail(const doc::Cel* cel,
+                                           const gfx::Size& fitInSize)
+{
+  ui::assert_ui_thread();
+
+  const Key key = { cel->data()->id(), fitInSize };
+  const Version version = celVersion(cel);
+
+  Entries::iterator it;
+  auto indexIt = m_index.find(key);
+  if (indexIt != m_index.end()) {
+    it = indexIt->second;
+    // Move to the front (most recently used)
+    m_entries.splice(m_entries.begin(), m_entries, it);
+  }
+  else {
+    m_entries.push_front(Entry());
+    it = m_entries.begin();
+    it->key = key;
+    m_index[key] = it;
+  }
+
+  Entry& entry = *it;
+  if (entry.version != version && !entry.pending) {
+    entry.pending = true;
+
+    const doc::ObjectId celId = cel->id();
+    std::shared_ptr<Shared> shared = m_shared;
+    shared_thread_pool().execute(
+      [shared, celId, key, version]{
+        Doc* document;
+        {
+          std::lock_guard<std::mutex> lock(shared->mutex);
+          if (!shared->doc)
+            return;
+          document = shared->doc;
+          ++shared->running;
+        }
+
+        Version newVersion = version;
+        os::SurfaceRef surface;
+        try {
+          // Don't wait, if the document is locked for writing we'll
+          // try again later (see m_retryTimer).
+          DocReader reader(document, 0);
+
+          // The cel might be deleted (or modified) after the request
+          const doc::Cel* cel = doc::get<doc::Cel>(celId);
+          if (cel && cel->sprite() == document->sprite()) {
+            newVersion.imageId = cel->image()->id();
+            newVersion.imageVersion = cel->image()->version();
+            newVersion.celSize = cel->bounds().size();
+            surface = get_cel_thumbnail(cel, key.size);
+          }
+        }
+        catch (const LockedDocException&) {
+          newVersion = Version();
+        }
+
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        --shared->running;
+        shared->runningCv.notify_all();
+
+        ui::execute_from_ui_thread(
+          [shared, key, newVersion, surface]{
+            if (shared->owner)
+              shared->owner->onThumbnailGenerated(key, newVersion, surface);
+          });
+      });
+  }
+
+  return entry.surface;
+}
+
+void CelThumbnails::onPixelFormatChanged(DocEvent& ev)
+{
+  ++m_docChanges;
+}
+
+void CelThumbnails::onPaletteChanged(DocEvent& ev)
+{
+  ++m_docChanges;
+}
+
+void CelThumbnails::onSpriteTransparentColorChanged(DocEvent& ev)
+{
+  ++m_docChanges;
+}
+
+void CelThumbnails::onBeforeRemoveCel(DocEvent& ev)
+{
+  const doc::ObjectId celDataId = ev.cel()->data()->id();
+  for (auto it=m_entries.begin(); it!=m_entries.end(); ) {
+    if (it->key.celDataId == celDataId) {
+      m_memSize -= it->memSize;
+      m_index.erase(it->key);
+      it = m_entries.erase(it);
+    }
+    else
+      ++it;
+  }
+}
+
+void CelThumbnails::onThumbnailGenerated(const Key& key,
+                                         const Version& version,
+                                         const os::SurfaceRef& surface)
+{
+  auto indexIt = m_index.find(key);
+  if (indexIt == m_index.end())
+    return;
+
+  Entry& entry = *indexIt->second;
+  entry.pending = false;
+
+  // The document was locked, we keep the old thumbnail and notify
+  // the observers in a moment so they request it again
+  if (version.imageId == doc::NullId) {
+    if (!m_retryTimer.isRunning())
+      m_retryTimer.start();
+    return;
+  }
+
+  entry.version = version;
+  entry.surface = surface;
+
+  m_memSize -= entry.memSize;
+  entry.memSize = (surface ? 4 * surface->width() * surface->height(): 0);
+  m_memSize += entry.memSize;
+  removeOldEntries();
+
+  ThumbnailReady();
+}
+
+CelThumbnails::Version CelThumbnails::celVersion(const doc::Cel* cel) const
+{
+  Version version;
+  version.imageId = cel->image()->id();
+  version.imageVersion = cel->image()->version();
+  version.celSize = cel->bounds().size();
+  version.docChanges = m_docChanges;
+  return version;
+}
+
+void CelThumbnails::removeOldEntries()
+{
+  while (m_memSize > kMaxMemSize && !m_entries.empty()) {
+    const Entry& entry = m_entries.back();
+    m_memSize -= entry.memSize;
+    m_index.erase(entry.key);
+    m_entries.pop_back();
+  }
+}
+
 } // thumb
 } // app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019-2020  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2016  Carlo Caputo
 //
 // This program is distributed under the terms of
@@ -9,11 +9,24 @@
 #define APP_THUMBNAILS_H_INCLUDED
 #pragma once
 
+#include "app/doc_observer.h"
+#include "doc/frame.h"
+#include "doc/image_ref.h"
+#include "doc/object_id.h"
+#include "doc/object_version.h"
 #include "gfx/size.h"
+#include "obs/signal.h"
 #include "os/surface.h"
+#include "ui/timer.h"
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
 
 namespace doc {
   class Cel;
+  class Sprite;
 }
 
 namespace os {
@@ -21,11 +34,105 @@ namespace os {
 }
 
 namespace app {
+  class Doc;
+
 namespace thumb {
 
   os::SurfaceRef get_cel_thumbnail(const doc::Cel* cel,
                                    const gfx::Size& fitInSize);
 
+  // Renders the given sprite frame in an RGB image that fits in
+  // maxSize x maxSize (using the sprite pixel ratio). If toSRGB is
+  // true, the pixels are converted from the sprite color space to
+  // sRGB. Can be called from any thread.
+  doc::ImageRef render_sprite_thumbnail(const doc::Sprite* sprite,
+                                        const doc::frame_t frame,
+                                        const int maxSize,
+                                        const bool toSRGB);
+
+  // Cache of cel thumbnails of one document. Thumbnails are generated
+  // in background threads, and the least recently used ones are
+  // removed when the cache is full. All member functions must be
+  // called from the UI thread.
+  class CelThumbnails : public DocObserver {
+  public:
+    CelThumbnails(Doc* doc);
+    ~CelThumbnails();
+
+    Doc* document() const { return m_doc; }
+
+    // Returns the thumbnail of the given cel. If it isn't ready (or
+    // the cel was modified), it starts generating it in a background
+    // thread, and returns the previous thumbnail of the cel (or
+    // nullptr if there is no previous one). The ThumbnailReady signal
+    // is emitted when the new thumbnail is available.
+    os::SurfaceRef getThumbnail(const doc::Cel* cel,
+                                const gfx::Size& fitInSize);
+
+    obs::signal<void()> ThumbnailReady;
+
+  private:
+    // State of a cel used to generate its thumbnail.
+    struct Version {
+      doc::ObjectId imageId = doc::NullId;
+      doc::ObjectVersion imageVersion = 0;
+      gfx::Size celSize;
+      int docChanges = 0;
+
+      bool operator==(const Version& other) const;
+      bool operator!=(const Version& other) const {
+        return !operator==(other);
+      }
+    };
+
+    struct Key {
+      doc::ObjectId celDataId;
+      gfx::Size size;
+
+      bool operator<(const Key& other) const;
+    };
+
+    struct Entry {
+      Key key;
+      Version version;          // Version of "surface"
+      os::SurfaceRef surface;
+      bool pending = false;     // Generating a new thumbnail
+      std::size_t memSize = 0;
+    };
+
+    typedef std::list<Entry> Entries;
+
+    // Data shared with the background threads.
+    struct Shared;
+
+    // DocObserver impl
+    void onPixelFormatChanged(DocEvent& ev) override;
+    void onPaletteChanged(DocEvent& ev) override;
+    void onSpriteTransparentColorChanged(DocEvent& ev) override;
+    void onBeforeRemoveCel(DocEvent& ev) override;
+
+    void onThumbnailGenerated(const Key& key,
+                              const Version& version,
+                              const os::SurfaceRef& surface);
+    Version celVersion(const doc::Cel* cel) const;
+    void removeOldEntries();
+
+    Doc* m_doc;
+    std::shared_ptr<Shared> m_shared;
+    Entries m_entries;          // Most recently used entries first
+    std::map<Key, Entries::iterator> m_index;
+    std::size_t m_memSize;
+
+    // Number of changes in the document that modify all thumbnails
+    // (e.g. palette changes).
+    int m_docChanges;
+
+    // Emits ThumbnailReady some time after a thumbnail couldn't be
+    // generated because the document was locked, so it's requested
+    // again.
+    ui::Timer m_retryTimer;
+  };
+
 } // thumb
 } // app
 
@@ -11,6 +11,7 @@
 
 #include "app/transaction.h"
 
+#include "app/app.h"
 #include "app/cmd_transaction.h"
 #include "app/context_access.h"
 #include "app/doc.h"
@@ -104,7 +105,12 @@ void Transaction::commit()
   }
 
 #ifdef ENABLE_UI
-  if (int(m_changes) & int(Changes::kColorChange)) {
+  // The current palette follows the sprites of the app context only
+  // (not other contexts, e.g. the ones used in other threads to
+  // process CLI files with --jobs)
+  if ((int(m_changes) & int(Changes::kColorChange)) &&
+      App::instance() &&
+      m_ctx == App::instance()->context()) {
     ASSERT(m_doc);
     ASSERT(m_doc->sprite());
 
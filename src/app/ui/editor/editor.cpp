@@ -38,9 +38,11 @@
 #include "app/ui/editor/editor_customization_delegate.h"
 #include "app/ui/editor/editor_decorator.h"
 #include "app/ui/editor/editor_render.h"
+#include "app/ui/editor/editor_render_cache.h"
 #include "app/ui/editor/glue.h"
 #include "app/ui/editor/moving_pixels_state.h"
 #include "app/ui/editor/pixels_movement.h"
+#include "app/ui/editor/playback_frame_cache.h"
 #include "app/ui/editor/play_state.h"
 #include "app/ui/editor/scrolling_state.h"
 #include "app/ui/editor/standby_state.h"
@@ -68,6 +70,7 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <limits>
 #include <memory>
 
@@ -154,6 +157,7 @@ Editor::Editor(Doc* document, EditorFlags flags)
   , m_showGuidesThisCel(nullptr)
   , m_showAutoCelGuides(false)
   , m_tagFocusBand(-1)
+  , m_playbackCache(nullptr)
 {
   if (!m_renderEngine)
     m_renderEngine = new EditorRender;
@@ -203,6 +207,7 @@ Editor::Editor(Doc* document, EditorFlags flags)
       [this]{ onShowExtrasChange(); });
 
   m_document->add_observer(this);
+  m_renderCache.reset(new EditorRenderCache(m_document));
 
   m_state->onEnterState(this);
 }
@@ -615,6 +620,7 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
   }
 
   std::unique_ptr<Image> rendered(nullptr);
+  const Image* prerendered = nullptr;
   try {
     // Generate a "expose sprite pixels" notification. This is used by
     // tool managers that need to validate this region (copy pixels from
@@ -625,18 +631,22 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
     rendered.reset(Image::create(IMAGE_RGB, rc2.w, rc2.h,
                                  m_renderEngine->getRenderImageBuffer()));
 
+    const int nonactiveLayersOpacity =
+      ((m_flags & Editor::kUseNonactiveLayersOpacityWhenEnabled) ?
+       pref.experimental.nonactiveLayersOpacity(): 255);
+
     m_renderEngine->setNewBlendMethod(pref.experimental.newBlend());
     m_renderEngine->setRefLayersVisiblity(true);
     m_renderEngine->setSelectedLayer(m_layer);
-    if (m_flags & Editor::kUseNonactiveLayersOpacityWhenEnabled)
-      m_renderEngine->setNonactiveLayersOpacity(pref.experimental.nonactiveLayersOpacity());
-    else
-      m_renderEngine->setNonactiveLayersOpacity(255);
+    m_renderEngine->setNonactiveLayersOpacity(nonactiveLayersOpacity);
     m_renderEngine->setProjection(
       newEngine ? render::Projection(): m_proj);
     m_renderEngine->setupBackground(m_document, rendered->pixelFormat());
     m_renderEngine->disableOnionskin();
 
+    const bool onionskin =
+      ((m_flags & kShowOnionskin) == kShowOnionskin &&
+       m_docPref.onionskin.active());
     if ((m_flags & kShowOnionskin) == kShowOnionskin) {
       if (m_docPref.onionskin.active()) {
         OnionskinOptions opts(
@@ -672,10 +682,44 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
         m_layer, m_frame);
     }
 
-    m_renderEngine->renderSprite(
-      rendered.get(), m_sprite, m_frame, gfx::Clip(0, 0, rc2));
+    // Use the frame rendered ahead of time for the animation playback
+    // (only when there is nothing else to show over the sprite).
+    if (m_playbackCache &&
+        !onionskin &&
+        (!extraCel || extraCel->type() == render::ExtraType::NONE)) {
+      PlaybackFrameCache::Settings settings;
+      settings.proj = (newEngine ? render::Projection(): m_proj);
+      settings.bg = EditorRender::getBgOptions(m_document, IMAGE_RGB);
+      settings.selectedLayerId = (m_layer ? m_layer->id(): doc::NullId);
+      settings.nonactiveLayersOpacity = nonactiveLayersOpacity;
+      settings.newBlend = pref.experimental.newBlend();
+      m_playbackCache->setSettings(settings);
+
+      prerendered = m_playbackCache->frameImage(m_frame);
+    }
+
+    // The pre-rendered layers below/above the active layer can be
+    // used only with the new engine (1:1 projection) and when the
+    // onion skin isn't visible.
+    m_renderEngine->removeLayersCache();
+    if (newEngine &&
+        !onionskin &&
+        pref.experimental.newBlend() &&
+        pref.experimental.layersRenderCache()) {
+      m_renderCache->setupRender(*m_renderEngine, m_layer, m_frame,
+                                 nonactiveLayersOpacity);
+    }
+    else {
+      m_renderCache->clear();
+    }
+
+    if (!prerendered) {
+      m_renderEngine->renderSprite(
+        rendered.get(), m_sprite, m_frame, gfx::Clip(0, 0, rc2));
+    }
 
     m_renderEngine->removeExtraImage();
+    m_renderEngine->removeLayersCache();
 
     // If the checkered background is visible in this sprite, we save
     // all settings of the background for this document.
@@ -717,8 +761,14 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
         tmp->drawRect(gfx::Rect(0, 0, 1, 1), paint);
       }
 
-      convert_image_to_surface(rendered.get(), m_sprite->palette(m_frame),
-                               tmp.get(), 0, 0, 0, 0, rc2.w, rc2.h);
+      if (prerendered) {
+        convert_image_to_surface(prerendered, m_sprite->palette(m_frame),
+                                 tmp.get(), rc2.x, rc2.y, 0, 0, rc2.w, rc2.h);
+      }
+      else {
+        convert_image_to_surface(rendered.get(), m_sprite->palette(m_frame),
+                                 tmp.get(), 0, 0, 0, 0, rc2.w, rc2.h);
+      }
 
       if (newEngine) {
         os::Sampling sampling;
@@ -2104,6 +2154,10 @@ void Editor::onPaint(ui::PaintEvent& ev)
         sprintf(buf, "%c %.4gs",
                 Preferences::instance().experimental.newRenderEngine() ? 'N': 'O',
                 renderElapsed);
+        if (Preferences::instance().experimental.layersRenderCache()) {
+          sprintf(buf+std::strlen(buf), " cache %.2fMB",
+                  EditorRenderCache::memoryUsage() / 1024.0 / 1024.0);
+        }
         g->drawText(
           buf,
           gfx::rgba(255, 255, 255, 255),
@@ -2666,6 +2720,11 @@ bool Editor::isPlaying() const
   return m_isPlaying;
 }
 
+void Editor::setPlaybackFrameCache(PlaybackFrameCache* cache)
+{
+  m_playbackCache = cache;
+}
+
 void Editor::showAnimationSpeedMultiplierPopup(Option<bool>& playOnce,
                                                Option<bool>& playAll,
                                                const bool withStopBehaviorOptions)
@@ -37,6 +37,7 @@
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <memory>
 #include <set>
 
 namespace doc {
@@ -55,9 +56,11 @@ namespace ui {
 namespace app {
   class Context;
   class DocView;
+  class EditorRenderCache;
   class EditorCustomizationDelegate;
   class EditorRender;
   class PixelsMovement;
+  class PlaybackFrameCache;
   class Site;
 
   namespace tools {
@@ -265,6 +268,10 @@ namespace app {
     void stop();
     bool isPlaying() const;
 
+    // Frames rendered ahead of time by the PlayState (nullptr if
+    // they aren't used).
+    void setPlaybackFrameCache(PlaybackFrameCache* cache);
+
     // Shows a popup menu to change the editor animation speed.
     void showAnimationSpeedMultiplierPopup(Option<bool>& playOnce,
                                            Option<bool>& playAll,
@@ -463,6 +470,14 @@ namespace app {
     // For slices
     doc::SelectedObjects m_selectedSlices;
 
+    // Pre-rendered layers below/above the active layer (only when
+    // the "experimental.layers_render_cache" option is enabled).
+    std::unique_ptr<EditorRenderCache> m_renderCache;
+
+    // Frames pre-rendered for the animation playback (owned by the
+    // PlayState).
+    PlaybackFrameCache* m_playbackCache;
+
     // The render engine must be shared between all editors so when a
     // DrawingState is being used in one editor, other editors for the
     // same document can show the same preview image/stroke being drawn
@@ -15,6 +15,8 @@
 #include "app/pref/preferences.h"
 #include "render/render.h"
 
+#include <thread>
+
 namespace app {
 
 static doc::ImageBufferPtr g_renderBuffer;
@@ -23,6 +25,7 @@ EditorRender::EditorRender()
   : m_render(new render::Render)
 {
   m_render->setNewBlend(Preferences::instance().experimental.newBlend());
+  m_render->setRenderThreads(std::thread::hardware_concurrency());
 }
 
 EditorRender::~EditorRender()
@@ -51,6 +54,12 @@ void EditorRender::setProjection(const render::Projection& projection)
 }
 
 void EditorRender::setupBackground(Doc* doc, doc::PixelFormat pixelFormat)
+{
+  m_render->setBgOptions(getBgOptions(doc, pixelFormat));
+}
+
+// static
+render::BgOptions EditorRender::getBgOptions(Doc* doc, doc::PixelFormat pixelFormat)
 {
   DocumentPreferences& docPref = Preferences::instance().document(doc);
   render::BgType bgType;
@@ -92,7 +101,7 @@ void EditorRender::setupBackground(Doc* doc, doc::PixelFormat pixelFormat)
   bg.color1 = color_utils::color_for_image_without_alpha(docPref.bg.color1(), pixelFormat);
   bg.color2 = color_utils::color_for_image_without_alpha(docPref.bg.color2(), pixelFormat);
   bg.stripeSize = tile;
-  m_render->setBgOptions(bg);
+  return bg;
 }
 
 void EditorRender::setTransparentBackground()
@@ -146,6 +155,34 @@ void EditorRender::disableOnionskin()
   m_render->disableOnionskin();
 }
 
+void EditorRender::setLayersCache(const doc::Layer* layer,
+                                  const doc::Image* below,
+                                  const doc::Image* above)
+{
+  m_render->setLayersCache(layer, below, above);
+}
+
+void EditorRender::removeLayersCache()
+{
+  m_render->removeLayersCache();
+}
+
+void EditorRender::renderLayersBelow(doc::Image* dstImage,
+                                     const doc::Layer* layer,
+                                     doc::frame_t frame,
+                                     const gfx::Clip& area)
+{
+  m_render->renderLayersBelow(dstImage, layer, frame, area);
+}
+
+void EditorRender::renderLayersAbove(doc::Image* dstImage,
+                                     const doc::Layer* layer,
+                                     doc::frame_t frame,
+                                     const gfx::Clip& area)
+{
+  m_render->renderLayersAbove(dstImage, layer, frame, area);
+}
+
 void EditorRender::renderSprite(
   doc::Image* dstImage,
   const doc::Sprite* sprite,
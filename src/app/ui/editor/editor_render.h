@@ -16,6 +16,7 @@
 #include "doc/pixel_format.h"
 #include "gfx/clip.h"
 #include "gfx/point.h"
+#include "render/bg_options.h"
 #include "render/extra_type.h"
 #include "render/onionskin_options.h"
 #include "render/projection.h"
@@ -47,6 +48,7 @@ namespace app {
     void setProjection(const render::Projection& projection);
 
     void setupBackground(Doc* doc, doc::PixelFormat pixelFormat);
+    static render::BgOptions getBgOptions(Doc* doc, doc::PixelFormat pixelFormat);
     void setTransparentBackground();
 
     void setSelectedLayer(const doc::Layer* layer);
@@ -70,6 +72,19 @@ namespace app {
     void setOnionskin(const render::OnionskinOptions& options);
     void disableOnionskin();
 
+    void setLayersCache(const doc::Layer* layer,
+                        const doc::Image* below,
+                        const doc::Image* above);
+    void removeLayersCache();
+    void renderLayersBelow(doc::Image* dstImage,
+                           const doc::Layer* layer,
+                           doc::frame_t frame,
+                           const gfx::Clip& area);
+    void renderLayersAbove(doc::Image* dstImage,
+                           const doc::Layer* layer,
+                           doc::frame_t frame,
+                           const gfx::Clip& area);
+
     void renderSprite(
       doc::Image* dstImage,
       const doc::Sprite* sprite,
@@ -0,0 +1,281 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/editor_render_cache.h"
+
+#include "app/doc.h"
+#include "app/doc_event.h"
+#include "app/pref/preferences.h"
+#include "app/ui/editor/editor_render.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+#include "gfx/clip.h"
+
+#include <algorithm>
+
+namespace app {
+
+using namespace doc;
+
+// Memory used by all EditorRenderCache instances (only accessed from
+// the UI thread).
+static std::size_t g_memoryUsage = 0;
+
+bool EditorRenderCache::LayerState::operator==(const LayerState& other) const
+{
+  return (layer == other.layer &&
+          cel == other.cel &&
+          image == other.image &&
+          imageVersion == other.imageVersion &&
+          bounds == other.bounds &&
+          layerOpacity == other.layerOpacity &&
+          celOpacity == other.celOpacity &&
+          blendMode == other.blendMode &&
+          visible == other.visible);
+}
+
+EditorRenderCache::EditorRenderCache(Doc* doc)
+  : m_doc(doc)
+  , m_useCounter(0)
+{
+  m_doc->add_observer(this);
+}
+
+EditorRenderCache::~EditorRenderCache()
+{
+  m_doc->remove_observer(this);
+  clear();
+}
+
+// static
+std::size_t EditorRenderCache::memoryUsage()
+{
+  return g_memoryUsage;
+}
+
+bool EditorRenderCache::setupRender(EditorRender& render,
+                                    const Layer* layer,
+                                    const frame_t frame,
+                                    const int nonactiveLayersOpacity)
+{
+  if (!layer || !layer->isImage())
+    return false;
+
+  const Sprite* sprite = layer->sprite();
+  const LayerImage* bgLayer = sprite->backgroundLayer();
+  const bool bgLayerVisible = (bgLayer && bgLayer->isVisible());
+
+  LayerStates belowStates, aboveStates;
+  collectLayerStates(layer, frame, belowStates, aboveStates);
+  const bool flattenAbove = canFlattenLayers(aboveStates);
+
+  Entry* entry = findEntry(frame);
+  if (entry &&
+      (entry->layer != layer ||
+       entry->nonactiveLayersOpacity != nonactiveLayersOpacity ||
+       entry->bgLayerVisible != bgLayerVisible ||
+       (entry->above != nullptr) != flattenAbove ||
+       entry->below->size() != sprite->size())) {
+    removeEntry(entry);
+    entry = nullptr;
+  }
+
+  if (!entry) {
+    const ImageSpec spec(ColorMode::RGB, sprite->width(), sprite->height());
+    const std::size_t bytes =
+      (flattenAbove ? 2: 1) * spec.width() * spec.height() * sizeof(color_t);
+    if (!makeRoom(bytes))
+      return false;
+
+    Entry newEntry;
+    newEntry.frame = frame;
+    newEntry.layer = layer;
+    newEntry.nonactiveLayersOpacity = nonactiveLayersOpacity;
+    newEntry.bgLayerVisible = bgLayerVisible;
+    newEntry.below.reset(Image::create(spec));
+    if (flattenAbove)
+      newEntry.above.reset(Image::create(spec));
+    newEntry.dirty = gfx::Region(sprite->bounds());
+    newEntry.memSize = bytes;
+    newEntry.lastUse = 0;
+    m_entries.push_back(std::move(newEntry));
+    g_memoryUsage += bytes;
+
+    entry = &m_entries.back();
+  }
+  else {
+    addDirtyRegion(entry->belowStates, belowStates, sprite->bounds(), entry->dirty);
+    addDirtyRegion(entry->aboveStates, aboveStates, sprite->bounds(), entry->dirty);
+  }
+
+  entry->belowStates = std::move(belowStates);
+  entry->aboveStates = std::move(aboveStates);
+  entry->lastUse = ++m_useCounter;
+
+  // Re-render only the invalidated areas of the cached images
+  entry->dirty &= gfx::Region(sprite->bounds());
+  for (const gfx::Rect& rc : entry->dirty) {
+    render.renderLayersBelow(entry->below.get(), layer, frame, gfx::Clip(rc));
+    if (entry->above)
+      render.renderLayersAbove(entry->above.get(), layer, frame, gfx::Clip(rc));
+  }
+  entry->dirty.clear();
+
+  render.setLayersCache(layer, entry->below.get(), entry->above.get());
+  return true;
+}
+
+void EditorRenderCache::clear()
+{
+  for (const Entry& entry : m_entries)
+    g_memoryUsage -= entry.memSize;
+  m_entries.clear();
+}
+
+void EditorRenderCache::onPixelFormatChanged(DocEvent& ev) { clear(); }
+void EditorRenderCache::onPaletteChanged(DocEvent& ev) { clear(); }
+void EditorRenderCache::onAddLayer(DocEvent& ev) { clear(); }
+void EditorRenderCache::onAddFrame(DocEvent& ev) { clear(); }
+void EditorRenderCache::onAddCel(DocEvent& ev) { clear(); }
+void EditorRenderCache::onBeforeRemoveLayer(DocEvent& ev) { clear(); }
+void EditorRenderCache::onRemoveFrame(DocEvent& ev) { clear(); }
+void EditorRenderCache::onBeforeRemoveCel(DocEvent& ev) { clear(); }
+void EditorRenderCache::onSpriteSizeChanged(DocEvent& ev) { clear(); }
+void EditorRenderCache::onSpriteTransparentColorChanged(DocEvent& ev) { clear(); }
+void EditorRenderCache::onLayerRestacked(DocEvent& ev) { clear(); }
+void EditorRenderCache::onLayerMergedDown(DocEvent& ev) { clear(); }
+void EditorRenderCache::onCelMoved(DocEvent& ev) { clear(); }
+void EditorRenderCache::onCelCopied(DocEvent& ev) { clear(); }
+void EditorRenderCache::onCelFrameChanged(DocEvent& ev) { clear(); }
+
+void EditorRenderCache::onSpritePixelsModified(DocEvent& ev)
+{
+  // Notifications without a layer are about extra cels/previews of
+  // the active layer (e.g. the brush preview), which are not cached.
+  if (!ev.layer())
+    return;
+
+  for (Entry& entry : m_entries) {
+    if (entry.frame == ev.frame() &&
+        entry.layer != ev.layer())
+      entry.dirty |= ev.region();
+  }
+}
+
+EditorRenderCache::Entry* EditorRenderCache::findEntry(const frame_t frame)
+{
+  for (Entry& entry : m_entries) {
+    if (entry.frame == frame)
+      return &entry;
+  }
+  return nullptr;
+}
+
+void EditorRenderCache::removeEntry(Entry* entry)
+{
+  g_memoryUsage -= entry->memSize;
+  m_entries.erase(m_entries.begin() + (entry - &m_entries[0]));
+}
+
+bool EditorRenderCache::makeRoom(const std::size_t bytes)
+{
+  const std::size_t maxBytes = std::size_t(
+    std::max(0, Preferences::instance().experimental.layersRenderCacheSize()))
+    * 1024 * 1024;
+
+  // Remove the least recently used entries of this editor
+  while (!m_entries.empty() &&
+         g_memoryUsage + bytes > maxBytes) {
+    auto it = std::min_element(
+      m_entries.begin(), m_entries.end(),
+      [](const Entry& a, const Entry& b){
+        return a.lastUse < b.lastUse;
+      });
+    removeEntry(&(*it));
+  }
+
+  return (g_memoryUsage + bytes <= maxBytes);
+}
+
+// static
+void EditorRenderCache::collectLayerStates(const Layer* layer,
+                                           const frame_t frame,
+                                           LayerStates& below,
+                                           LayerStates& above)
+{
+  LayerStates* states = &below;
+  for (const Layer* child : layer->sprite()->allLayers()) {
+    if (child == layer) {
+      states = &above;
+      continue;
+    }
+    if (!child->isImage())
+      continue;
+
+    LayerState state;
+    state.layer = child;
+    state.cel = child->cel(frame);
+    state.image = (state.cel ? state.cel->image(): nullptr);
+    state.imageVersion = (state.image ? state.image->version(): 0);
+    state.bounds = (state.cel ? state.cel->bounds(): gfx::Rect());
+    state.layerOpacity = static_cast<const LayerImage*>(child)->opacity();
+    state.celOpacity = (state.cel ? state.cel->opacity(): 0);
+    state.blendMode = static_cast<const LayerImage*>(child)->blendMode();
+    state.visible = child->isVisibleHierarchy();
+    states->push_back(state);
+  }
+}
+
+// static
+bool EditorRenderCache::canFlattenLayers(const LayerStates& states)
+{
+  // The layers above can be composited in a transparent image and
+  // then over the active layer only with the normal blend mode.
+  for (const LayerState& state : states) {
+    if (state.visible &&
+        state.cel &&
+        state.blendMode != BlendMode::NORMAL)
+      return false;
+  }
+  return true;
+}
+
+// static
+void EditorRenderCache::addDirtyRegion(const LayerStates& oldStates,
+                                       const LayerStates& newStates,
+                                       const gfx::Rect& spriteBounds,
+                                       gfx::Region& dirty)
+{
+  if (oldStates.size() != newStates.size()) {
+    dirty = gfx::Region(spriteBounds);
+    return;
+  }
+
+  for (std::size_t i=0; i<newStates.size(); ++i) {
+    const LayerState& a = oldStates[i];
+    const LayerState& b = newStates[i];
+    if (a == b)
+      continue;
+
+    if (a.layer != b.layer) {
+      dirty = gfx::Region(spriteBounds);
+      return;
+    }
+
+    // Reference layers can be scaled/placed with sub-pixel precision
+    const gfx::Rect bounds =
+      (b.layer->isReference() ? spriteBounds: a.bounds | b.bounds);
+    dirty |= gfx::Region(bounds);
+  }
+}
+
+} // namespace app
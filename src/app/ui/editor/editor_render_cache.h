@@ -0,0 +1,135 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UI_EDITOR_RENDER_CACHE_H_INCLUDED
+#define APP_UI_EDITOR_RENDER_CACHE_H_INCLUDED
+#pragma once
+
+#include "app/doc_observer.h"
+#include "doc/blend_mode.h"
+#include "doc/frame.h"
+#include "doc/image_ref.h"
+#include "doc/object_version.h"
+#include "gfx/rect.h"
+#include "gfx/region.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace doc {
+  class Cel;
+  class Image;
+  class Layer;
+  class Sprite;
+}
+
+namespace app {
+  class Doc;
+  class EditorRender;
+
+  // Keeps the layers below and above the active layer of an editor
+  // pre-rendered (one pair of images per frame), so a repaint while
+  // the user is drawing in the active layer only composites these
+  // two images and the active layer.
+  //
+  // Cached images are invalidated by regions comparing the state of
+  // each layer/cel/image version between repaints, and from the
+  // DocObserver notifications (pixels modified by a tool loop in
+  // other layers, or structural changes in the sprite).
+  class EditorRenderCache : public DocObserver {
+  public:
+    EditorRenderCache(Doc* doc);
+    ~EditorRenderCache();
+
+    // Updates the cached images of the given layer/frame and sets
+    // them in the render engine (the render engine must be already
+    // configured to render the sprite with a 1:1 projection). Returns
+    // false if the cache cannot be used (e.g. there is not enough
+    // memory available for it).
+    bool setupRender(EditorRender& render,
+                     const doc::Layer* layer,
+                     const doc::frame_t frame,
+                     const int nonactiveLayersOpacity);
+
+    void clear();
+
+    // Memory used by the cached images of all editors.
+    static std::size_t memoryUsage();
+
+  private:
+    struct LayerState {
+      const doc::Layer* layer;
+      const doc::Cel* cel;
+      const doc::Image* image;
+      doc::ObjectVersion imageVersion;
+      gfx::Rect bounds;
+      int layerOpacity;
+      int celOpacity;
+      doc::BlendMode blendMode;
+      bool visible;
+
+      bool operator==(const LayerState& other) const;
+      bool operator!=(const LayerState& other) const {
+        return !operator==(other);
+      }
+    };
+
+    typedef std::vector<LayerState> LayerStates;
+
+    struct Entry {
+      doc::frame_t frame;
+      const doc::Layer* layer;
+      int nonactiveLayersOpacity;
+      bool bgLayerVisible;
+      doc::ImageRef below;
+      doc::ImageRef above;  // nullptr if the layers above cannot be flattened
+      LayerStates belowStates;
+      LayerStates aboveStates;
+      gfx::Region dirty;
+      std::size_t memSize;
+      std::size_t lastUse;
+    };
+
+    // DocObserver impl
+    void onPixelFormatChanged(DocEvent& ev) override;
+    void onPaletteChanged(DocEvent& ev) override;
+    void onAddLayer(DocEvent& ev) override;
+    void onAddFrame(DocEvent& ev) override;
+    void onAddCel(DocEvent& ev) override;
+    void onBeforeRemoveLayer(DocEvent& ev) override;
+    void onRemoveFrame(DocEvent& ev) override;
+    void onBeforeRemoveCel(DocEvent& ev) override;
+    void onSpriteSizeChanged(DocEvent& ev) override;
+    void onSpriteTransparentColorChanged(DocEvent& ev) override;
+    void onLayerRestacked(DocEvent& ev) override;
+    void onLayerMergedDown(DocEvent& ev) override;
+    void onCelMoved(DocEvent& ev) override;
+    void onCelCopied(DocEvent& ev) override;
+    void onCelFrameChanged(DocEvent& ev) override;
+    void onSpritePixelsModified(DocEvent& ev) override;
+
+    Entry* findEntry(const doc::frame_t frame);
+    void removeEntry(Entry* entry);
+    bool makeRoom(const std::size_t bytes);
+
+    static void collectLayerStates(const doc::Layer* layer,
+                                   const doc::frame_t frame,
+                                   LayerStates& below,
+                                   LayerStates& above);
+    static bool canFlattenLayers(const LayerStates& states);
+    static void addDirtyRegion(const LayerStates& oldStates,
+                               const LayerStates& newStates,
+                               const gfx::Rect& spriteBounds,
+                               gfx::Region& dirty);
+
+    Doc* m_doc;
+    std::vector<Entry> m_entries;
+    std::size_t m_useCounter;
+  };
+
+} // namespace app
+
+#endif
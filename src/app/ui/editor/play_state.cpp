@@ -18,6 +18,7 @@
 #include "app/tools/ink.h"
 #include "app/ui/editor/editor.h"
 #include "app/ui/editor/editor_customization_delegate.h"
+#include "app/ui/editor/playback_frame_cache.h"
 #include "app/ui/editor/scrolling_state.h"
 #include "app/ui/skin/skin_theme.h"
 #include "app/ui_context.h"
@@ -27,6 +28,9 @@
 #include "ui/message.h"
 #include "ui/system.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace app {
 
 using namespace ui;
@@ -90,6 +94,15 @@ void PlayState::onEnterState(Editor* editor)
   m_curFrameTick = base::current_tick();
   m_pingPongForward = true;
 
+  auto& pref = Preferences::instance();
+  if (pref.experimental.playbackFrameCache() && !m_frameCache) {
+    const std::size_t maxMemSize =
+      std::size_t(std::max(0, pref.experimental.playbackFrameCacheSize())) * 1024 * 1024;
+    m_frameCache.reset(new PlaybackFrameCache(m_editor->document(), maxMemSize));
+    m_editor->setPlaybackFrameCache(m_frameCache.get());
+  }
+  prefetchFrames();
+
   // Maybe we came from ScrollingState and the timer is already
   // running.
   if (!m_playTimer.isRunning())
@@ -103,6 +116,11 @@ EditorState::LeaveAction PlayState::onLeaveState(Editor* editor, EditorState* ne
   if (!m_toScroll) {
     m_playTimer.stop();
 
+    if (m_frameCache) {
+      m_editor->setPlaybackFrameCache(nullptr);
+      m_frameCache.reset();
+    }
+
     if (m_playOnce || Preferences::instance().general.rewindOnStop())
       m_editor->setFrame(m_refFrame);
   }
@@ -193,7 +211,12 @@ void PlayState::onPlaybackTick()
   if (m_nextFrameTime < 0)
     return;
 
-  m_nextFrameTime -= (base::current_tick() - m_curFrameTick);
+  // We use the same tick to calculate the elapsed time and as the
+  // reference for the next tick, so the time used to change frames
+  // isn't lost (the playback doesn't drift).
+  const base::tick_t tick = base::current_tick();
+  m_nextFrameTime -= (tick - m_curFrameTick);
+  m_curFrameTick = tick;
 
   doc::Sprite* sprite = m_editor->sprite();
 
@@ -233,7 +256,7 @@ void PlayState::onPlaybackTick()
     m_nextFrameTime += getNextFrameTime();
   }
 
-  m_curFrameTick = base::current_tick();
+  prefetchFrames();
 }
 
 // Before executing any command, we stop the animation
@@ -273,4 +296,33 @@ double PlayState::getNextFrameTime()
     / m_editor->getAnimationSpeedMultiplier(); // The "speed multiplier" is a "duration divider"
 }
 
+void PlayState::prefetchFrames()
+{
+  if (!m_frameCache || !m_editor->isPlaying())
+    return;
+
+  const int n = m_frameCache->capacity();
+  if (n <= 0)
+    return;
+
+  // The current frame and the next ones in the same order they will
+  // be played.
+  const doc::Sprite* sprite = m_editor->sprite();
+  doc::frame_t frame = m_editor->frame();
+  bool pingPongForward = m_pingPongForward;
+  std::vector<doc::frame_t> frames;
+  frames.reserve(n);
+  frames.push_back(frame);
+  while (int(frames.size()) < n) {
+    frame = calculate_next_frame(
+      sprite, frame, frame_t(1), m_tag,
+      pingPongForward);
+    if (std::find(frames.begin(), frames.end(), frame) != frames.end())
+      break;
+    frames.push_back(frame);
+  }
+
+  m_frameCache->prefetch(frames);
+}
+
 } // namespace app
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020-2021  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -15,6 +15,8 @@
 #include "obs/connection.h"
 #include "ui/timer.h"
 
+#include <memory>
+
 namespace doc {
   class Tag;
 }
@@ -22,6 +24,7 @@ namespace doc {
 namespace app {
 
   class CommandExecutionEvent;
+  class PlaybackFrameCache;
 
   class PlayState : public StateWithWheelBehavior {
   public:
@@ -49,6 +52,10 @@ namespace app {
 
     double getNextFrameTime();
 
+    // Starts rendering the next frames to be played in background
+    // threads (if the playback frame cache is enabled).
+    void prefetchFrames();
+
     Editor* m_editor;
     bool m_playOnce;
     bool m_playAll;
@@ -65,6 +72,10 @@ namespace app {
     doc::Tag* m_tag;
 
     obs::scoped_connection m_ctxConn;
+
+    // Frames rendered ahead of time (only when the
+    // "experimental.playback_frame_cache" option is enabled).
+    std::unique_ptr<PlaybackFrameCache> m_frameCache;
   };
 
 } // namespace app
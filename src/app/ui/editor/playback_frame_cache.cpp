@@ -0,0 +1,358 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/playback_frame_cache.h"
+
+#include "app/doc.h"
+#include "app/doc_access.h"
+#include "app/doc_event.h"
+#include "app/doc_undo.h"
+#include "app/util/thread_pool.h"
+#include "base/thread_pool.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/palette.h"
+#include "doc/sprite.h"
+#include "gfx/clip.h"
+#include "render/render.h"
+#include "ui/system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace app {
+
+using namespace doc;
+
+// Maximum number of frames rendered ahead of time
+static const int kMaxFrames = 32;
+
+struct PlaybackFrameCache::Shared {
+  std::mutex mutex;
+  std::condition_variable runningCv;
+  // Document to render, it's set to nullptr when the
+  // PlaybackFrameCache is destroyed (protected by "mutex").
+  Doc* doc;
+  // Number of frames being rendered right now (protected by "mutex").
+  int running;
+  // Current generation of the cache (see m_generation).
+  std::atomic<int> generation;
+  // Only accessed from the UI thread.
+  PlaybackFrameCache* owner;
+};
+
+bool PlaybackFrameCache::Settings::operator==(const Settings& other) const
+{
+  return (proj.zoom() == other.proj.zoom() &&
+          proj.pixelRatio() == other.proj.pixelRatio() &&
+          bg.type == other.bg.type &&
+          bg.zoom == other.bg.zoom &&
+          bg.color1 == other.bg.color1 &&
+          bg.color2 == other.bg.color2 &&
+          bg.stripeSize == other.bg.stripeSize &&
+          selectedLayerId == other.selectedLayerId &&
+          nonactiveLayersOpacity == other.nonactiveLayersOpacity &&
+          newBlend == other.newBlend);
+}
+
+bool PlaybackFrameCache::LayerState::operator==(const LayerState& other) const
+{
+  return (layerId == other.layerId &&
+          imageId == other.imageId &&
+          imageVersion == other.imageVersion &&
+          bounds == other.bounds &&
+          layerOpacity == other.layerOpacity &&
+          celOpacity == other.celOpacity &&
+          blendMode == other.blendMode &&
+          visible == other.visible);
+}
+
+PlaybackFrameCache::PlaybackFrameCache(Doc* doc, const std::size_t maxMemSize)
+  : m_doc(doc)
+  , m_shared(std::make_shared<Shared>())
+  , m_maxMemSize(maxMemSize)
+  , m_hasSettings(false)
+  , m_generation(0)
+{
+  m_shared->doc = doc;
+  m_shared->running = 0;
+  m_shared->generation = 0;
+  m_shared->owner = this;
+  m_doc->add_observer(this);
+  m_doc->undoHistory()->add_observer(this);
+}
+
+PlaybackFrameCache::~PlaybackFrameCache()
+{
+  m_doc->undoHistory()->remove_observer(this);
+  m_doc->remove_observer(this);
+
+  // Frames that weren't started yet will be ignored, and we wait the
+  // ones that are being rendered right now (they use the document).
+  std::unique_lock<std::mutex> lock(m_shared->mutex);
+  m_shared->doc = nullptr;
+  m_shared->owner = nullptr;
+  m_shared->runningCv.wait(lock, [this]{ return m_shared->running == 0; });
+}
+
+void PlaybackFrameCache::setSettings(const Settings& settings)
+{
+  if (m_hasSettings && m_settings == settings)
+    return;
+
+  clear();
+  m_settings = settings;
+  m_hasSettings = true;
+}
+
+int PlaybackFrameCache::capacity() const
+{
+  if (!m_hasSettings)
+    return 0;
+
+  const gfx::Rect bounds = m_settings.proj.apply(m_doc->sprite()->bounds());
+  const std::size_t frameSize =
+    std::size_t(std::max(1, bounds.w)) * std::max(1, bounds.h) * sizeof(color_t);
+  return int(std::min<std::size_t>(kMaxFrames, m_maxMemSize / frameSize));
+}
+
+void PlaybackFrameCache::prefetch(const std::vector<frame_t>& frames)
+{
+  ui::assert_ui_thread();
+
+  const int n = std::min(int(frames.size()), capacity());
+  auto begin = frames.begin();
+  auto end = frames.begin()+std::max(0, n);
+
+  // Discard frames that will not be played soon
+  m_entries.erase(
+    std::remove_if(m_entries.begin(), m_entries.end(),
+                   [begin, end](const Entry& entry){
+                     return (std::find(begin, end, entry.frame) == end);
+                   }),
+    m_entries.end());
+
+  for (auto it=begin; it!=end; ++it) {
+    const frame_t frame = *it;
+    if (findEntry(frame))
+      continue;
+
+    Entry entry;
+    entry.frame = frame;
+    m_entries.push_back(entry);
+
+    const int generation = m_generation;
+    const Settings settings = m_settings;
+    std::shared_ptr<Shared> shared = m_shared;
+    shared_thread_pool().execute(
+      [shared, generation, settings, frame]{
+        Doc* doc;
+        {
+          std::lock_guard<std::mutex> lock(shared->mutex);
+          if (!shared->doc || shared->generation != generation)
+            return;
+          doc = shared->doc;
+          ++shared->running;
+        }
+
+        ImageRef image;
+        FrameState state;
+        try {
+          // Don't wait, if the document is locked for writing the
+          // Editor will render this frame by itself.
+          DocReader reader(doc, 0);
+
+          // The settings (e.g. the selected layer) are valid only if
+          // the cache wasn't cleared after this request.
+          const Sprite* sprite = doc->sprite();
+          if (shared->generation == generation &&
+              frame < sprite->totalFrames()) {
+            const gfx::Rect bounds = settings.proj.apply(sprite->bounds());
+            image.reset(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+
+            render::Render render;
+            render.setNewBlend(settings.newBlend);
+            render.setRefLayersVisiblity(true);
+            render.setSelectedLayer(get<Layer>(settings.selectedLayerId));
+            render.setNonactiveLayersOpacity(settings.nonactiveLayersOpacity);
+            render.setProjection(settings.proj);
+            render.setBgOptions(settings.bg);
+            render.renderSprite(image.get(), sprite, frame,
+                                gfx::Clip(0, 0, bounds));
+
+            collectFrameState(sprite, frame, state);
+          }
+        }
+        catch (const LockedDocException&) {
+          image.reset();
+        }
+
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        --shared->running;
+        shared->runningCv.notify_all();
+
+        ui::execute_from_ui_thread(
+          [shared, generation, frame, image, state]{
+            if (shared->owner)
+              shared->owner->onFrameRendered(generation, frame, image, state);
+          });
+      });
+  }
+}
+
+const Image* PlaybackFrameCache::frameImage(const frame_t frame)
+{
+  ui::assert_ui_thread();
+
+  Entry* entry = findEntry(frame);
+  if (!entry || !entry->image)
+    return nullptr;
+
+  // Check that nothing was changed in the frame since it was
+  // rendered (this is fast compared to rendering the frame).
+  FrameState state;
+  collectFrameState(m_doc->sprite(), frame, state);
+  if (entry->state != state) {
+    m_entries.erase(m_entries.begin() + (entry - &m_entries[0]));
+    return nullptr;
+  }
+
+  return entry->image.get();
+}
+
+void PlaybackFrameCache::clear()
+{
+  m_entries.clear();
+  m_shared->generation = ++m_generation;
+}
+
+void PlaybackFrameCache::onGeneralUpdate(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onColorSpaceChanged(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onPixelFormatChanged(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onPaletteChanged(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onBeforeRemoveLayer(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onRemoveFrame(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onSpriteSizeChanged(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onSpriteTransparentColorChanged(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onSpritePixelsModified(DocEvent& ev)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onAddUndoState(DocUndo* history)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onCurrentUndoStateChange(DocUndo* history)
+{
+  clear();
+}
+
+void PlaybackFrameCache::onFrameRendered(const int generation,
+                                         const frame_t frame,
+                                         const ImageRef& image,
+                                         const FrameState& state)
+{
+  if (generation != m_generation)
+    return;
+
+  Entry* entry = findEntry(frame);
+  if (!entry)
+    return;
+
+  // The document was locked, we remove the entry so the frame can
+  // be requested again in the next prefetch().
+  if (!image) {
+    m_entries.erase(m_entries.begin() + (entry - &m_entries[0]));
+    return;
+  }
+
+  entry->image = image;
+  entry->state = state;
+}
+
+PlaybackFrameCache::Entry* PlaybackFrameCache::findEntry(const frame_t frame)
+{
+  for (Entry& entry : m_entries) {
+    if (entry.frame == frame)
+      return &entry;
+  }
+  return nullptr;
+}
+
+// static
+void PlaybackFrameCache::collectFrameState(const Sprite* sprite,
+                                           const frame_t frame,
+                                           FrameState& state)
+{
+  for (const Layer* layer : sprite->allLayers()) {
+    LayerState s;
+    s.layerId = layer->id();
+    s.imageId = NullId;
+    s.imageVersion = 0;
+    s.layerOpacity = 255;
+    s.celOpacity = 255;
+    s.blendMode = BlendMode::NORMAL;
+    s.visible = layer->isVisible();
+
+    if (layer->isImage()) {
+      auto layerImage = static_cast<const LayerImage*>(layer);
+      s.layerOpacity = layerImage->opacity();
+      s.blendMode = layerImage->blendMode();
+
+      if (const Cel* cel = layer->cel(frame)) {
+        s.imageId = cel->image()->id();
+        s.imageVersion = cel->image()->version();
+        s.bounds = cel->bounds();
+        s.celOpacity = cel->opacity();
+      }
+    }
+    state.layers.push_back(s);
+  }
+  state.paletteModifications = sprite->palette(frame)->getModifications();
+}
+
+} // namespace app
@@ -0,0 +1,169 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UI_EDITOR_PLAYBACK_FRAME_CACHE_H_INCLUDED
+#define APP_UI_EDITOR_PLAYBACK_FRAME_CACHE_H_INCLUDED
+#pragma once
+
+#include "app/doc_observer.h"
+#include "app/doc_undo_observer.h"
+#include "doc/blend_mode.h"
+#include "doc/frame.h"
+#include "doc/image_ref.h"
+#include "doc/object_id.h"
+#include "doc/object_version.h"
+#include "gfx/rect.h"
+#include "render/bg_options.h"
+#include "render/projection.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace doc {
+  class Image;
+  class Sprite;
+}
+
+namespace app {
+  class Doc;
+
+  // Frames of a sprite rendered ahead of time in background threads
+  // for the animation playback (PlayState). It's a bounded ring of
+  // full sprite images rendered with the same settings/projection
+  // used by the Editor, so the Editor can blit them directly instead
+  // of compositing all layers again in each frame.
+  //
+  // Rendered frames are discarded when the document is modified. All
+  // member functions must be called from the UI thread.
+  class PlaybackFrameCache : public DocObserver
+                           , public DocUndoObserver {
+  public:
+    // Settings used by the Editor to render the sprite.
+    struct Settings {
+      render::Projection proj;
+      render::BgOptions bg;
+      doc::ObjectId selectedLayerId = doc::NullId;
+      int nonactiveLayersOpacity = 255;
+      bool newBlend = false;
+
+      bool operator==(const Settings& other) const;
+      bool operator!=(const Settings& other) const {
+        return !operator==(other);
+      }
+    };
+
+    PlaybackFrameCache(Doc* doc, const std::size_t maxMemSize);
+    ~PlaybackFrameCache();
+
+    // Sets the settings used to render frames. All rendered frames
+    // are discarded if the settings are different from the previous
+    // ones.
+    void setSettings(const Settings& settings);
+
+    // Maximum number of frames that can be kept in the cache with the
+    // current settings (0 if we don't know the settings yet or one
+    // frame doesn't fit in the memory limit).
+    int capacity() const;
+
+    // Starts rendering the given frames (in the order they will be
+    // played) and discards all other rendered frames. Only the first
+    // capacity() frames are rendered.
+    void prefetch(const std::vector<doc::frame_t>& frames);
+
+    // Returns the rendered image of the given frame (with the size of
+    // proj.apply(sprite->bounds())), or nullptr if the frame is not
+    // ready yet or it's outdated.
+    const doc::Image* frameImage(const doc::frame_t frame);
+
+    void clear();
+
+  private:
+    // State of a layer in a frame, used to know if the rendered image
+    // of a frame is still valid (e.g. in case that some change in the
+    // sprite didn't generate a DocObserver/DocUndoObserver
+    // notification, like hiding a layer).
+    struct LayerState {
+      doc::ObjectId layerId;
+      doc::ObjectId imageId;
+      doc::ObjectVersion imageVersion;
+      gfx::Rect bounds;
+      int layerOpacity;
+      int celOpacity;
+      doc::BlendMode blendMode;
+      bool visible;
+
+      bool operator==(const LayerState& other) const;
+      bool operator!=(const LayerState& other) const {
+        return !operator==(other);
+      }
+    };
+
+    typedef std::vector<LayerState> LayerStates;
+
+    struct FrameState {
+      LayerStates layers;
+      int paletteModifications = 0;
+
+      bool operator==(const FrameState& other) const {
+        return (layers == other.layers &&
+                paletteModifications == other.paletteModifications);
+      }
+      bool operator!=(const FrameState& other) const {
+        return !operator==(other);
+      }
+    };
+
+    struct Entry {
+      doc::frame_t frame;
+      doc::ImageRef image;      // nullptr while it's being rendered
+      FrameState state;         // State of the sprite when "image" was rendered
+    };
+
+    // Data shared with the background threads.
+    struct Shared;
+
+    // DocObserver impl
+    void onGeneralUpdate(DocEvent& ev) override;
+    void onColorSpaceChanged(DocEvent& ev) override;
+    void onPixelFormatChanged(DocEvent& ev) override;
+    void onPaletteChanged(DocEvent& ev) override;
+    void onBeforeRemoveLayer(DocEvent& ev) override;
+    void onRemoveFrame(DocEvent& ev) override;
+    void onSpriteSizeChanged(DocEvent& ev) override;
+    void onSpriteTransparentColorChanged(DocEvent& ev) override;
+    void onSpritePixelsModified(DocEvent& ev) override;
+
+    // DocUndoObserver impl
+    void onAddUndoState(DocUndo* history) override;
+    void onCurrentUndoStateChange(DocUndo* history) override;
+
+    void onFrameRendered(const int generation,
+                         const doc::frame_t frame,
+                         const doc::ImageRef& image,
+                         const FrameState& state);
+    Entry* findEntry(const doc::frame_t frame);
+
+    static void collectFrameState(const doc::Sprite* sprite,
+                                  const doc::frame_t frame,
+                                  FrameState& state);
+
+    Doc* m_doc;
+    std::shared_ptr<Shared> m_shared;
+    std::size_t m_maxMemSize;
+    Settings m_settings;
+    bool m_hasSettings;
+    std::vector<Entry> m_entries;
+
+    // Incremented each time all rendered frames are discarded, so
+    // frames that were being rendered with the old settings/document
+    // state are ignored.
+    int m_generation;
+  };
+
+} // namespace app
+
+#endif
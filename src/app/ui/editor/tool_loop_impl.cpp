@@ -350,7 +350,7 @@ public:
 #endif
 
     m_document->notifySpritePixelsModified(
-      m_sprite, dirtyArea, m_frame);
+      m_sprite, dirtyArea, m_frame, m_layer);
   }
 
   void updateStatusBar(const char* text) override {
@@ -277,6 +277,7 @@ Timeline::~Timeline()
   m_clipboard_timer.stop();
 
   detachDocument();
+  m_thumbnails.reset();
   m_context->documents().remove_observer(this);
   m_context->remove_observer(this);
   delete m_confPopup;
@@ -354,6 +355,14 @@ void Timeline::updateUsingEditor(Editor* editor)
 
   site.document()->add_observer(this);
 
+  // Thumbnails are kept while the document is the same (even if the
+  // timeline is detached/attached to another editor of the document)
+  if (!m_thumbnails || m_thumbnails->document() != site.document()) {
+    m_thumbnails = std::make_unique<thumb::CelThumbnails>(site.document());
+    m_thumbnailsReadyConn = m_thumbnails->ThumbnailReady.connect(
+      [this]{ invalidate(); });
+  }
+
   Doc* app_document = site.document();
   DocumentPreferences& docPref = Preferences::instance().document(app_document);
 
@@ -1726,6 +1735,10 @@ void Timeline::onRemoveDocument(Doc* document)
   if (document == m_document) {
     detachDocument();
   }
+  if (m_thumbnails && m_thumbnails->document() == document) {
+    m_thumbnailsReadyConn.disconnect();
+    m_thumbnails.reset();
+  }
 }
 
 void Timeline::onGeneralUpdate(DocEvent& ev)
@@ -2252,11 +2265,13 @@ void Timeline::drawCel(ui::Graphics* g, layer_t layerIndex, frame_t frame, Cel*
       gfx::Rect(bounds).shrink(
         skinTheme()->calcBorder(this, style));
 
-    if (!thumb_bounds.isEmpty()) {
-      if (os::SurfaceRef surface = thumb::get_cel_thumbnail(cel, thumb_bounds.size())) {
-        const int t = std::clamp(thumb_bounds.w/8, 4, 16);
-        draw_checkered_grid(g, thumb_bounds, gfx::Size(t, t), docPref());
+    if (!thumb_bounds.isEmpty() && m_thumbnails) {
+      // The checkered background is the placeholder until the
+      // thumbnail is generated
+      const int t = std::clamp(thumb_bounds.w/8, 4, 16);
+      draw_checkered_grid(g, thumb_bounds, gfx::Size(t, t), docPref());
 
+      if (os::SurfaceRef surface = m_thumbnails->getThumbnail(cel, thumb_bounds.size())) {
         g->drawRgbaSurface(surface.get(),
                            thumb_bounds.center().x-surface->width()/2,
                            thumb_bounds.center().y-surface->height()/2);
@@ -2340,16 +2355,19 @@ void Timeline::drawCelOverlay(ui::Graphics* g)
   if (!clip)
     return;
 
+  if (!m_thumbnails)
+    return;
+
   gfx::Rect rc = m_sprite->bounds().fitIn(
     gfx::Rect(m_thumbnailsOverlayBounds).shrink(1));
-  if (os::SurfaceRef surface = thumb::get_cel_thumbnail(cel, rc.size())) {
-    draw_checkered_grid(g, rc, gfx::Size(8, 8)*ui::guiscale(), docPref());
+  draw_checkered_grid(g, rc, gfx::Size(8, 8)*ui::guiscale(), docPref());
 
+  if (os::SurfaceRef surface = m_thumbnails->getThumbnail(cel, rc.size())) {
     g->drawRgbaSurface(surface.get(),
                        rc.center().x-surface->width()/2,
                        rc.center().y-surface->height()/2);
-    g->drawRect(gfx::rgba(0, 0, 0, 128), m_thumbnailsOverlayBounds);
   }
+  g->drawRect(gfx::rgba(0, 0, 0, 128), m_thumbnailsOverlayBounds);
 }
 
 void Timeline::drawCelLinkDecorators(ui::Graphics* g, const gfx::Rect& bounds,
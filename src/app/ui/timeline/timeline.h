@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2018-2021  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -29,6 +29,7 @@
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <memory>
 #include <vector>
 
 namespace doc {
@@ -49,6 +50,10 @@ namespace app {
     class SkinTheme;
   }
 
+  namespace thumb {
+    class CelThumbnails;
+  }
+
   using namespace doc;
 
   class CommandExecutionEvent;
@@ -418,6 +423,8 @@ namespace app {
     Hit m_thumbnailsOverlayHit;
     gfx::Point m_thumbnailsOverlayDirection;
     obs::connection m_thumbnailsPrefConn;
+    std::unique_ptr<thumb::CelThumbnails> m_thumbnails;
+    obs::scoped_connection m_thumbnailsReadyConn;
 
     // Temporal data used to move the range.
     struct MoveRange {
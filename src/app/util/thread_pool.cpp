@@ -0,0 +1,31 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/thread_pool.h"
+
+#include "base/thread_pool.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace app {
+
+base::thread_pool& shared_thread_pool()
+{
+  static base::thread_pool pool(shared_thread_pool_size());
+  return pool;
+}
+
+int shared_thread_pool_size()
+{
+  return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+} // namespace app
@@ -0,0 +1,32 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UTIL_THREAD_POOL_H_INCLUDED
+#define APP_UTIL_THREAD_POOL_H_INCLUDED
+#pragma once
+
+namespace base {
+  class thread_pool;
+}
+
+namespace app {
+
+// Pool of threads shared by all the features that split CPU work in
+// background threads (cel thumbnails, playback frames, GIF encoding,
+// image sequences, etc.). It has one thread per CPU core and it's
+// created the first time it's used.
+//
+// Tasks executed in this pool must not wait for other tasks of the
+// same pool (all threads could end up waiting).
+base::thread_pool& shared_thread_pool();
+
+// Number of threads of shared_thread_pool() (it doesn't create the
+// pool).
+int shared_thread_pool_size();
+
+} // namespace app
+
+#endif
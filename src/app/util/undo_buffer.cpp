@@ -0,0 +1,311 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/undo_buffer.h"
+
+#include "base/debug.h"
+#include "base/thread_pool.h"
+
+#include "zlib.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+namespace app {
+
+namespace {
+
+// Small buffers aren't worth compressing.
+const size_t kMinSizeToCompress = 4096;
+
+std::atomic<bool> spill_to_disk(false);
+
+// Number of compressLater() tasks that weren't finished yet
+std::atomic<int> pending_tasks(0);
+
+// fseek() uses a long offset, which is 32-bit on Windows (so the
+// spill file would be limited to 2GB).
+int seek_file(std::FILE* f, const int64_t offset)
+{
+#ifdef _WIN32
+  return _fseeki64(f, offset, SEEK_SET);
+#else
+  return fseeko(f, off_t(offset), SEEK_SET);
+#endif
+}
+
+// Per-session file where compressed payloads are spilled. It's
+// deleted automatically when the program ends. Regions of deleted
+// payloads are reused (best fit), and the file is closed (deleted)
+// when there are no more payloads in it.
+class SpillFile {
+public:
+  SpillFile() : m_file(nullptr), m_failed(false), m_size(0) { }
+  ~SpillFile() {
+    if (m_file)
+      std::fclose(m_file);
+  }
+
+  bool write(const base::buffer& buf, int64_t& offset) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file && !m_failed) {
+      m_file = std::tmpfile();
+      m_failed = (m_file == nullptr);
+    }
+    if (!m_file)
+      return false;
+
+    const int64_t size = int64_t(buf.size());
+    int64_t pos = allocRegion(size);
+    if (seek_file(m_file, pos) != 0 ||
+        std::fwrite(&buf[0], 1, buf.size(), m_file) != buf.size()) {
+      freeRegion(pos, size);
+      return false;
+    }
+    offset = pos;
+    return true;
+  }
+
+  void free(const int64_t offset, const size_t size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    freeRegion(offset, int64_t(size));
+
+    // The whole file is free, we can delete it
+    if (m_size == 0 && m_file) {
+      std::fclose(m_file);
+      m_file = nullptr;
+    }
+  }
+
+  bool read(const int64_t offset, base::buffer& buf) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (m_file &&
+            seek_file(m_file, offset) == 0 &&
+            std::fread(&buf[0], 1, buf.size(), m_file) == buf.size());
+  }
+
+private:
+  int64_t allocRegion(const int64_t size) {
+    auto best = m_free.end();
+    for (auto it=m_free.begin(); it!=m_free.end(); ++it) {
+      if (it->second >= size &&
+          (best == m_free.end() || it->second < best->second))
+        best = it;
+    }
+    if (best == m_free.end()) {
+      const int64_t pos = m_size;
+      m_size += size;
+      return pos;
+    }
+
+    const int64_t pos = best->first;
+    const int64_t rest = best->second - size;
+    m_free.erase(best);
+    if (rest > 0)
+      m_free[pos+size] = rest;
+    return pos;
+  }
+
+  void freeRegion(int64_t offset, int64_t size) {
+    // Merge with the next and previous free regions
+    auto next = m_free.find(offset+size);
+    if (next != m_free.end()) {
+      size += next->second;
+      m_free.erase(next);
+    }
+    auto it = m_free.lower_bound(offset);
+    if (it != m_free.begin()) {
+      auto prev = std::prev(it);
+      if (prev->first + prev->second == offset) {
+        offset = prev->first;
+        size += prev->second;
+        m_free.erase(prev);
+      }
+    }
+
+    // Free region at the end of the file
+    if (offset + size == m_size)
+      m_size = offset;
+    else
+      m_free[offset] = size;
+  }
+
+  std::mutex m_mutex;
+  std::FILE* m_file;
+  bool m_failed;
+  int64_t m_size;
+  std::map<int64_t, int64_t> m_free; // Free regions (offset -> size)
+};
+
+SpillFile spill_file;
+
+// Only one thread to compress payloads, so the UI thread is never
+// competing with several threads. It's defined after spill_file so
+// it's destroyed (and its thread joined) before the file is closed.
+base::thread_pool undo_pool(1);
+
+} // anonymous namespace
+
+// The data is in "raw" (State::Raw), or compressed in "compressed"
+// (State::Compressed) or in the spill file (State::OnDisk).
+struct UndoBuffer::Payload {
+  enum class State { Raw, Compressed, OnDisk };
+
+  std::mutex mutex;
+  State state = State::Raw;
+  bool pending = false;         // compressLater() was called
+  base::buffer raw;
+  base::buffer compressed;
+  size_t rawSize = 0;           // Size of the uncompressed data
+  size_t compressedSize = 0;
+  int64_t fileOffset = 0;
+  std::atomic<size_t> memSize { 0 };
+
+  ~Payload() {
+    discardCopy();
+  }
+
+  void compress() {
+    if (!pending || state != State::Raw)
+      return;
+    pending = false;
+
+    uLongf size = compressBound(uLong(raw.size()));
+    compressed.resize(size);
+    if (compress2(&compressed[0], &size,
+                  &raw[0], uLong(raw.size()),
+                  Z_BEST_SPEED) != Z_OK ||
+        size >= raw.size()) {
+      base::buffer().swap(compressed);
+      return;
+    }
+
+    compressed.resize(size);
+    compressed.shrink_to_fit();
+    rawSize = raw.size();
+    compressedSize = size;
+    state = State::Compressed;
+
+    if (spill_to_disk &&
+        spill_file.write(compressed, fileOffset)) {
+      base::buffer().swap(compressed);
+      state = State::OnDisk;
+    }
+    base::buffer().swap(raw);
+    memSize = compressed.capacity();
+  }
+
+  // Uncompresses the data (the compressed copy is discarded, as the
+  // caller of UndoBuffer::data() can modify the data).
+  void restore() {
+    pending = false;
+    if (state == State::Raw)
+      return;
+
+    base::buffer fromDisk;
+    const base::buffer* src = &compressed;
+    if (state == State::OnDisk) {
+      fromDisk.resize(compressedSize);
+      if (!spill_file.read(fileOffset, fromDisk)) {
+        ASSERT(false);
+        fromDisk.clear();
+      }
+      src = &fromDisk;
+    }
+
+    raw.resize(rawSize);
+    uLongf size = uLongf(rawSize);
+    if (src->empty() ||
+        uncompress(&raw[0], &size,
+                   &(*src)[0], uLong(src->size())) != Z_OK) {
+      ASSERT(false);
+    }
+    ASSERT(size == rawSize);
+
+    discardCopy();
+    memSize = raw.capacity();
+  }
+
+  // Discards the compressed data (the region in the spill file can be
+  // reused).
+  void discardCopy() {
+    if (state == State::OnDisk)
+      spill_file.free(fileOffset, compressedSize);
+    base::buffer().swap(compressed);
+    state = State::Raw;
+  }
+};
+
+UndoBuffer::UndoBuffer()
+  : m_payload(std::make_shared<Payload>())
+{
+}
+
+UndoBuffer::~UndoBuffer()
+{
+}
+
+base::buffer& UndoBuffer::data()
+{
+  std::lock_guard<std::mutex> lock(m_payload->mutex);
+  // This cancels a pending compression too, so the background thread
+  // will not touch "raw" until compressLater() is called again.
+  m_payload->restore();
+  return m_payload->raw;
+}
+
+void UndoBuffer::compressLater()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_payload->mutex);
+    if (m_payload->state != Payload::State::Raw)
+      return;
+    m_payload->memSize = m_payload->raw.capacity();
+    if (m_payload->raw.size() < kMinSizeToCompress)
+      return;
+    m_payload->pending = true;
+  }
+
+  // The task keeps a weak reference so the payload can be deleted
+  // (e.g. the undo history is discarded) before it's compressed.
+  std::weak_ptr<Payload> weak = m_payload;
+  ++pending_tasks;
+  undo_pool.execute(
+    [weak]{
+      if (std::shared_ptr<Payload> payload = weak.lock()) {
+        std::lock_guard<std::mutex> lock(payload->mutex);
+        payload->compress();
+      }
+      --pending_tasks;
+    });
+}
+
+size_t UndoBuffer::memSize() const
+{
+  return m_payload->memSize;
+}
+
+// static
+void UndoBuffer::SetSpillToDisk(const bool state)
+{
+  spill_to_disk = state;
+}
+
+// static
+bool UndoBuffer::HasPendingTasks()
+{
+  return (pending_tasks > 0);
+}
+
+} // namespace app
@@ -0,0 +1,64 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UTIL_UNDO_BUFFER_H_INCLUDED
+#define APP_UTIL_UNDO_BUFFER_H_INCLUDED
+#pragma once
+
+#include "base/buffer.h"
+#include "base/disable_copying.h"
+
+#include <memory>
+
+namespace app {
+
+  // Buffer of pixels used by undo commands. When the command doesn't
+  // need the data (e.g. after it was executed), compressLater() must
+  // be called to compress the data in a background thread (and move
+  // it to a temporary file if SetSpillToDisk(true) was called). The
+  // data is restored (uncompressed/read from disk) when data() is
+  // used again.
+  class UndoBuffer {
+  public:
+    UndoBuffer();
+    ~UndoBuffer();
+
+    // Returns the uncompressed data. It waits the background thread
+    // if the data is being compressed right now. As the data can be
+    // modified, its compressed copy (in memory or in the temporary
+    // file) is discarded.
+    //
+    // The returned reference can be used until compressLater() is
+    // called: it's the only function that hands over the data to
+    // the background thread, so the reference must not be kept
+    // after calling it (call data() again to get the new one).
+    base::buffer& data();
+
+    // Compresses the data in a background thread. The reference
+    // returned by data() is invalid after this call.
+    void compressLater();
+
+    // Returns the memory used by this buffer right now (which can be
+    // the compressed size, or 0 if the data is on disk). It's updated
+    // in compressLater() and when the compression finishes.
+    size_t memSize() const;
+
+    static void SetSpillToDisk(const bool state);
+
+    // Returns true if there are buffers waiting to be compressed (so
+    // the memSize() of some buffers can change).
+    static bool HasPendingTasks();
+
+  private:
+    struct Payload;
+    std::shared_ptr<Payload> m_payload;
+
+    DISABLE_COPYING(UndoBuffer);
+  };
+
+} // namespace app
+
+#endif
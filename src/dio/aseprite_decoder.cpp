@@ -21,14 +21,212 @@
 #include "dio/file_interface.h"
 #include "dio/pixel_io.h"
 #include "doc/doc.h"
+#include "doc/image_loader.h"
 #include "fixmath/fixmath.h"
 #include "fmt/format.h"
 #include "zlib.h"
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace dio {
 
+//////////////////////////////////////////////////////////////////////
+// Compressed Image
+//////////////////////////////////////////////////////////////////////
+
+template<typename ImageTraits>
+void inflate_image(const uint8_t* compressed,
+                   const size_t compressed_size,
+                   doc::Image* image)
+{
+  PixelIO<ImageTraits> pixel_io;
+  z_stream zstream;
+  int y, err;
+
+  zstream.zalloc = (alloc_func)0;
+  zstream.zfree  = (free_func)0;
+  zstream.opaque = (voidpf)0;
+
+  err = inflateInit(&zstream);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in inflateInit().", err);
+
+  const size_t rowStride = ImageTraits::getRowStrideBytes(image->width());
+  std::vector<uint8_t> uncompressed(image->height() * rowStride);
+
+  zstream.next_in = (Bytef*)compressed;
+  zstream.avail_in = compressed_size;
+  zstream.next_out = (Bytef*)&uncompressed[0];
+  zstream.avail_out = uncompressed.size();
+
+  err = inflate(&zstream, Z_FINISH);
+  inflateEnd(&zstream);
+
+  // Z_BUF_ERROR means that the compressed data is incomplete (we
+  // use the pixels that were decoded), or that there are more
+  // pixels than expected.
+  const bool overflow = (err == Z_BUF_ERROR &&
+                         zstream.avail_out == 0 &&
+                         zstream.avail_in > 0);
+  if (err != Z_STREAM_END && err != Z_BUF_ERROR)
+    throw base::Exception("ZLib error %d in inflate().", err);
+
+  for (y=0; y<image->height(); y++) {
+    typename ImageTraits::address_t address =
+      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
+
+    pixel_io.read_scanline(address, image->width(), &uncompressed[y*rowStride]);
+  }
+
+  if (overflow)
+    throw base::Exception("Bad compressed image.");
+}
+
+// Decodes the compressed pixels of a cel image in a CelDecoder worker
+// thread, or in the thread that uses the image first (see
+// doc::CelData::setImageLoader()).
+class CompressedImageLoader : public doc::ImageLoader {
+public:
+  CompressedImageLoader(std::vector<uint8_t>&& compressed)
+    : m_compressed(std::move(compressed)) {
+  }
+
+  // Must be called after the image was loaded.
+  const std::string& error() const { return m_error; }
+
+protected:
+  void onLoadImage(doc::Image* image) override {
+    const uint8_t* data = (m_compressed.empty() ? nullptr: &m_compressed[0]);
+    try {
+      switch (image->pixelFormat()) {
+
+        case doc::IMAGE_RGB:
+          inflate_image<doc::RgbTraits>(data, m_compressed.size(), image);
+          break;
+
+        case doc::IMAGE_GRAYSCALE:
+          inflate_image<doc::GrayscaleTraits>(data, m_compressed.size(), image);
+          break;
+
+        case doc::IMAGE_INDEXED:
+          inflate_image<doc::IndexedTraits>(data, m_compressed.size(), image);
+          break;
+      }
+    }
+    catch (const std::exception& e) {
+      m_error = e.what();
+    }
+
+    // We don't need the compressed data anymore
+    std::vector<uint8_t>().swap(m_compressed);
+  }
+
+private:
+  std::vector<uint8_t> m_compressed;
+  std::string m_error;
+};
+
+// Decodes the compressed cels in worker threads while the rest of
+// the file is read. If the decoder needs the pixels of a cel before
+// (e.g. to copy a linked cel), the image is decoded in the calling
+// thread (see CompressedImageLoader).
+class CelDecoder {
+public:
+  CelDecoder()
+    : m_stop(false) {
+  }
+
+  ~CelDecoder() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto& thread : m_threads)
+      thread.join();
+  }
+
+  void add(const doc::CelDataRef& celData,
+           std::vector<uint8_t>&& compressed) {
+    auto loader = std::make_shared<CompressedImageLoader>(
+      std::move(compressed));
+    celData->setImageLoader(loader);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queue.push_back(celData);
+      m_loaders.push_back(loader);
+    }
+    m_cond.notify_one();
+
+    if (m_threads.empty()) {
+      const int nthreads =
+        std::max<int>(1, std::thread::hardware_concurrency());
+      for (int i=0; i<nthreads; ++i)
+        m_threads.emplace_back([this]{ workerThread(); });
+    }
+  }
+
+  // Waits all cels to be decoded and reports decoding errors.
+  void waitAll(DecodeDelegate* delegate) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this]{ return m_queue.empty() && m_working == 0; });
+    }
+    for (const auto& loader : m_loaders) {
+      if (!loader->error().empty())
+        delegate->error(loader->error());
+    }
+    m_loaders.clear();
+  }
+
+private:
+  void workerThread() {
+    while (true) {
+      doc::CelDataRef celData;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]{ return m_stop || !m_queue.empty(); });
+        if (m_stop)
+          return;
+        celData = m_queue.front();
+        m_queue.pop_front();
+        ++m_working;
+      }
+
+      // Calling image() decodes the image using the loader (or
+      // waits the main thread if it's already decoding it).
+      celData->image();
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_working;
+      }
+      m_cond.notify_all();
+    }
+  }
+
+  bool m_stop;
+  int m_working = 0;
+  std::deque<doc::CelDataRef> m_queue;
+  std::vector<std::shared_ptr<CompressedImageLoader>> m_loaders;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::vector<std::thread> m_threads;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Decoder
+//////////////////////////////////////////////////////////////////////
+
 bool AsepriteDecoder::decode()
 {
   bool ignore_old_color_chunks = false;
@@ -85,6 +283,9 @@ bool AsepriteDecoder::decode()
   int current_level = -1;
   doc::LayerList allLayers;
 
+  // Compressed cels are decoded in parallel
+  CelDecoder celDecoder;
+
   // Just one frame?
   doc::frame_t nframes = sprite->totalFrames();
   if (nframes > 1 && delegate()->decodeOneFrame())
@@ -160,7 +361,8 @@ bool AsepriteDecoder::decode()
             doc::Cel* cel =
               readCelChunk(sprite.get(), allLayers, frame,
                            sprite->pixelFormat(), &header,
-                           chunk_pos+chunk_size);
+                           chunk_pos+chunk_size,
+                           celDecoder);
             if (cel) {
               last_cel = cel;
               last_object_with_user_data = cel->data();
@@ -222,6 +424,19 @@ bool AsepriteDecoder::decode()
             break;
           }
 
+          case ASE_FILE_CHUNK_THUMBNAIL: {
+            // The sprite isn't needed if we can use the thumbnail
+            if (delegate()->decodeThumbnail()) {
+              doc::ImageRef thumbnail =
+                readThumbnailChunk(chunk_pos+chunk_size);
+              if (thumbnail) {
+                delegate()->onThumbnail(thumbnail);
+                return true;
+              }
+            }
+            break;
+          }
+
           default:
             delegate()->error(
               fmt::format("Warning: Unsupported chunk type {0} (skipping)", chunk_type));
@@ -240,6 +455,8 @@ bool AsepriteDecoder::decode()
       break;
   }
 
+  celDecoder.waitAll(delegate());
+
   delegate()->onSprite(sprite.release());
   return true;
 }
@@ -519,99 +736,6 @@ void read_raw_image(FileInterface* f,
   }
 }
 
-//////////////////////////////////////////////////////////////////////
-// Compressed Image
-//////////////////////////////////////////////////////////////////////
-
-template<typename ImageTraits>
-void read_compressed_image(FileInterface* f,
-                           DecodeDelegate* delegate,
-                           doc::Image* image,
-                           const size_t chunk_end,
-                           const AsepriteHeader* header)
-{
-  PixelIO<ImageTraits> pixel_io;
-  z_stream zstream;
-  int y, err;
-
-  zstream.zalloc = (alloc_func)0;
-  zstream.zfree  = (free_func)0;
-  zstream.opaque = (voidpf)0;
-
-  err = inflateInit(&zstream);
-  if (err != Z_OK)
-    throw base::Exception("ZLib error %d in inflateInit().", err);
-
-  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> uncompressed(image->height() * ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
-
-  while (true) {
-    size_t input_bytes;
-
-    if (f->tell()+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - f->tell(); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
-
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
-    }
-    else
-      input_bytes = compressed.size();
-
-    size_t bytes_read = f->readBytes(&compressed[0], input_bytes);
-
-    // Error reading "input_bytes" bytes, broken file? chunk without
-    // enough compressed data?
-    if (bytes_read == 0) {
-      delegate->error(
-        fmt::format("Error reading {} bytes of compressed data",
-                    input_bytes));
-      break;
-    }
-
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
-
-    do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
-
-      err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in inflate().", err);
-
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
-
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
-
-        uncompressed_offset += uncompressed_bytes;
-      }
-    } while (zstream.avail_out == 0);
-
-    delegate->progress((float)f->tell() / (float)header->size);
-  }
-
-  uncompressed_offset = 0;
-  for (y=0; y<image->height(); y++) {
-    typename ImageTraits::address_t address =
-      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
-
-    pixel_io.read_scanline(address, image->width(), &uncompressed[uncompressed_offset]);
-
-    uncompressed_offset += ImageTraits::getRowStrideBytes(image->width());
-  }
-
-  err = inflateEnd(&zstream);
-  if (err != Z_OK)
-    throw base::Exception("ZLib error %d in inflateEnd().", err);
-}
-
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
@@ -621,7 +745,8 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
                                         doc::frame_t frame,
                                         doc::PixelFormat pixelFormat,
                                         AsepriteHeader* header,
-                                        size_t chunk_end)
+                                        size_t chunk_end,
+                                        CelDecoder& celDecoder)
 {
   // Read chunk data
   doc::layer_t layer_index = read16();
@@ -717,35 +842,29 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
       if (w > 0 && h > 0) {
         doc::ImageRef image(doc::Image::create(pixelFormat, w, h));
 
-        // Try to read pixel data
-        try {
-          switch (image->pixelFormat()) {
-
-            case doc::IMAGE_RGB:
-              read_compressed_image<doc::RgbTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
-
-            case doc::IMAGE_GRAYSCALE:
-              read_compressed_image<doc::GrayscaleTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
-
-            case doc::IMAGE_INDEXED:
-              read_compressed_image<doc::IndexedTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
+        // Read the compressed pixels, they will be decoded by the
+        // CelDecoder in a worker thread.
+        const size_t pos = f()->tell();
+        const size_t input_bytes = (chunk_end > pos ? chunk_end - pos: 0);
+        std::vector<uint8_t> compressed(input_bytes);
+        if (input_bytes > 0) {
+          size_t bytes_read = f()->readBytes(&compressed[0], input_bytes);
+
+          // Error reading "input_bytes" bytes, broken file? chunk
+          // without enough compressed data? We decode what we've got.
+          if (bytes_read < input_bytes) {
+            delegate()->error(
+              fmt::format("Error reading {} bytes of compressed data",
+                          input_bytes));
+            compressed.resize(bytes_read);
           }
         }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          delegate()->error(e.what());
-        }
 
         cel.reset(new doc::Cel(frame, image));
         cel->setPosition(x, y);
         cel->setOpacity(opacity);
+
+        celDecoder.add(cel->dataRef(), std::move(compressed));
       }
       break;
     }
@@ -954,4 +1073,34 @@ doc::Slice* AsepriteDecoder::readSliceChunk(doc::Slices& slices)
   return slice.release();
 }
 
+doc::ImageRef AsepriteDecoder::readThumbnailChunk(const size_t chunk_end)
+{
+  const int w = read16();
+  const int h = read16();
+  readPadding(8);
+
+  if (w < 1 || h < 1 ||
+      w > ASE_FILE_THUMBNAIL_MAX_SIZE ||
+      h > ASE_FILE_THUMBNAIL_MAX_SIZE)
+    return nullptr;
+
+  const size_t pos = f()->tell();
+  const size_t input_bytes = (chunk_end > pos ? chunk_end - pos: 0);
+  std::vector<uint8_t> compressed(input_bytes);
+  if (input_bytes == 0 ||
+      f()->readBytes(&compressed[0], input_bytes) < input_bytes)
+    return nullptr;
+
+  // A broken thumbnail is not an error, the caller can still decode
+  // the whole sprite.
+  doc::ImageRef image(doc::Image::create(doc::IMAGE_RGB, w, h));
+  try {
+    inflate_image<doc::RgbTraits>(&compressed[0], input_bytes, image.get());
+  }
+  catch (const std::exception&) {
+    return nullptr;
+  }
+  return image;
+}
+
 } // namespace dio
@@ -1,5 +1,5 @@
 // Aseprite Document IO Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,6 +11,7 @@
 
 #include "dio/decoder.h"
 #include "doc/frame.h"
+#include "doc/image_ref.h"
 #include "doc/layer_list.h"
 #include "doc/pixel_format.h"
 #include "doc/slices.h"
@@ -32,6 +33,7 @@ namespace dio {
 
 struct AsepriteHeader;
 struct AsepriteFrameHeader;
+class CelDecoder;
 
 class AsepriteDecoder : public Decoder {
 public:
@@ -51,7 +53,8 @@ private:
                          doc::frame_t frame,
                          doc::PixelFormat pixelFormat,
                          AsepriteHeader* header,
-                         size_t chunk_end);
+                         size_t chunk_end,
+                         CelDecoder& celDecoder);
   void readCelExtraChunk(doc::Cel* cel);
   void readColorProfile(doc::Sprite* sprite);
   doc::Mask* readMaskChunk();
@@ -59,6 +62,7 @@ private:
   void readSlicesChunk(doc::Slices& slices);
   doc::Slice* readSliceChunk(doc::Slices& slices);
   void readUserDataChunk(doc::UserData* userData);
+  doc::ImageRef readThumbnailChunk(size_t chunk_end);
 };
 
 } // namespace dio
@@ -1,4 +1,5 @@
 // Aseprite Document IO Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,6 +11,7 @@
 
 #include "doc/color.h"
 #include "doc/frame.h"
+#include "doc/image_ref.h"
 #include "doc/sprite.h"
 
 #include <string>
@@ -33,6 +35,11 @@ public:
   // to generate a thumbnail)
   virtual bool decodeOneFrame() { return false; }
 
+  // Return true if you want just the embedded thumbnail of the file
+  // (if it has one) instead of the whole sprite. If the thumbnail is
+  // found, onThumbnail() is called and onSprite() is not.
+  virtual bool decodeThumbnail() { return false; }
+
   // Default color for slices without user data
   virtual doc::color_t defaultSliceColor() {
     return doc::rgba(0, 0, 255, 255);
@@ -44,6 +51,10 @@ public:
     // sprite and then discard it when you don't need it anymore.
     delete sprite;
   }
+
+  // Called with the embedded thumbnail (an RGB image in sRGB color
+  // space) when decodeThumbnail() returns true
+  virtual void onThumbnail(const doc::ImageRef& thumbnail) { }
 };
 
 } // namespace dio
@@ -1,54 +1,60 @@
-// The floodfill routine.
-// By Shawn Hargreaves.
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+// Copyright (c) 2001-2017 David Capello
 //
-// Changes by David Capello:
-// - Adapted to Aseprite
-// - Added non-contiguous mode
-// - Added mask parameter
+// Originally based on the floodfill routine of Allegro by Shawn
+// Hargreaves.
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
-//
-// TODO rewrite this algorithm from scratch
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#include "doc/algorithm/floodfill.h"
+
 #include "base/base.h"
-#include "doc/algo.h"
 #include "doc/image.h"
+#include "doc/image_traits.h"
 #include "doc/mask.h"
 #include "doc/primitives.h"
 #include "doc/primitives_fast.h"
+#include "gfx/rect.h"
 
-#include <climits>
-#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
 #include <vector>
 
-namespace doc {
-namespace algorithm {
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_FLOODFILL_SSE2 1
+  #include <emmintrin.h>
+#endif
 
-struct FLOODED_LINE {   // store segments which have been flooded
-  short flags;          // status of the segment
-  short lpos, rpos;     // left and right ends of segment
-  short y;              // y coordinate of the segment
-  int next;             // linked list if several per line
-};
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
 
-/* Note: a 'short' is not sufficient for 'next' above in some corner cases. */
+namespace doc {
+namespace algorithm {
 
+namespace {
 
-static std::vector<FLOODED_LINE> flood_buf;
-static int flood_count;          /* number of flooded segments */
+// Minimum number of pixels compared by each thread in the
+// non-contiguous mode.
+const int kMinPixelsPerThread = 256*1024;
 
-#define FLOOD_IN_USE             1
-#define FLOOD_TODO_ABOVE         2
-#define FLOOD_TODO_BELOW         4
+// Approximated number of pixels compared by each thread before all
+// the found spans are sent to the AlgoHLine (so we don't keep the
+// spans of the whole image in memory).
+const int kPixelsPerThreadBatch = 1024*1024;
 
-#define FLOOD_LINE(c)            (&flood_buf[c])
+struct Span {
+  int x1, y, x2;
+};
 
-static inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
+inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
 {
   if (tolerance == 0)
     return (c1 == c2) || (rgba_geta(c1) == 0 && rgba_geta(c2) == 0);
@@ -72,7 +78,7 @@ static inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
   }
 }
 
-static inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
+inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
 {
   if (tolerance == 0)
     return (c1 == c2) || (graya_geta(c1) == 0 && graya_geta(c2) == 0);
@@ -90,7 +96,7 @@ static inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
   }
 }
 
-static inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
+inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
 {
   if (tolerance == 0)
     return (c1 == c2);
@@ -99,7 +105,7 @@ static inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
 }
 
 template<typename ImageTraits>
-static inline bool color_equal(color_t c1, color_t c2, int tolerance)
+inline bool color_equal(color_t c1, color_t c2, int tolerance)
 {
   static_assert(false && sizeof(ImageTraits), "Invalid color comparison");
   return false;
@@ -123,222 +129,430 @@ inline bool color_equal<IndexedTraits>(color_t c1, color_t c2, int tolerance)
   return color_equal_8(c1, c2, tolerance);
 }
 
+#if DOC_FLOODFILL_SSE2
+inline int first_bit(const uint32_t bits)
+{
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, bits);
+  return int(i);
+#else
+  return __builtin_ctz(bits);
+#endif
+}
+#endif
 
+// Compares runs of pixels of each row with the source color (with
+// the same rules used by color_equal<ImageTraits>). With SSE2, 16
+// bytes of pixels are compared at the same time (each channel
+// difference is compared with the tolerance).
+template<typename ImageTraits>
+class RowMatcher {
+public:
+  typedef typename ImageTraits::pixel_t pixel_t;
+
+  RowMatcher(const Image* image,
+             const color_t srcColor,
+             const int tolerance)
+    : m_image(image)
+    , m_srcColor(srcColor)
+    , m_tolerance(tolerance) {
+#if DOC_FLOODFILL_SSE2
+    m_tolerancev = _mm_set1_epi8(char(std::clamp(tolerance, 0, 255)));
+    if constexpr (ImageTraits::pixel_format == IMAGE_RGB) {
+      m_srcColorv = _mm_set1_epi32(int(srcColor));
+      m_alphaMaskv = _mm_set1_epi32(int(rgba_a_mask));
+      m_transparentSrc = (rgba_geta(srcColor) == 0);
+    }
+    else if constexpr (ImageTraits::pixel_format == IMAGE_GRAYSCALE) {
+      m_srcColorv = _mm_set1_epi16(short(srcColor));
+      m_alphaMaskv = _mm_set1_epi16(short(graya_a_mask));
+      m_transparentSrc = (graya_geta(srcColor) == 0);
+    }
+    else {
+      m_srcColorv = _mm_set1_epi8(char(srcColor));
+      m_alphaMaskv = _mm_setzero_si128();
+      m_transparentSrc = false;
+    }
+#endif
+  }
 
-/* flooder:
- *  Fills a horizontal line around the specified position, and adds it
- *  to the list of drawn segments. Returns the first x coordinate after
- *  the part of the line which it has dealt with.
- */
-static int flooder(const Image* image,
-                   const Mask* mask,
-                   int x, int y,
-                   const gfx::Rect& bounds,
-                   color_t src_color, int tolerance, void *data, AlgoHLine proc)
-{
-#define MASKED(u, v)                                                    \
-        (mask &&                                                        \
-         (!mask->bounds().contains(u, v) ||                             \
-          (mask->bitmap() &&                                            \
-           !get_pixel_fast<BitmapTraits>(mask->bitmap(),                \
-                                         (u)-mask->bounds().x,          \
-                                         (v)-mask->bounds().y))))
-
-  FLOODED_LINE *p;
-  int left = 0, right = 0;
-  int c;
+  bool match(const int x, const int y) const {
+    return color_equal<ImageTraits>(
+      get_pixel_fast<ImageTraits>(m_image, x, y), m_srcColor, m_tolerance);
+  }
 
-  switch (image->pixelFormat()) {
+  // Returns the first pixel in [x, x2) of the row "y" that doesn't
+  // match the source color (or x2 if all pixels match).
+  int runEnd(const int x, const int x2, const int y) const {
+    return find<true>(x, x2, y);
+  }
 
-    case IMAGE_RGB:
-      {
-        uint32_t* address = reinterpret_cast<uint32_t*>(image->getPixelAddress(0, y));
-
-        // Check start pixel
-        if (!color_equal_32((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_32((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_32((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
+  // Returns the first pixel in [x, x2) of the row "y" that matches
+  // the source color (or x2 if there is no matching pixel).
+  int nextMatch(const int x, const int x2, const int y) const {
+    return find<false>(x, x2, y);
+  }
 
-    case IMAGE_GRAYSCALE:
-      {
-        uint16_t* address = reinterpret_cast<uint16_t*>(image->getPixelAddress(0, y));
-
-        // Check start pixel
-        if (!color_equal_16((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_16((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_16((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
+private:
+  // Returns the first pixel in [x, x2) where the comparison with
+  // the source color is different than "matching".
+  template<bool matching>
+  int find(int x, const int x2, const int y) const {
+    const pixel_t* row =
+      reinterpret_cast<const pixel_t*>(m_image->getPixelAddress(0, y));
+
+#if DOC_FLOODFILL_SSE2
+    const int n = 16 / int(sizeof(pixel_t));
+    for (; x+n <= x2; x += n) {
+      int bits = matchMask(row+x);
+      if (matching)
+        bits = ~bits & 0xffff;
+      if (bits)
+        return x + first_bit(bits) / int(sizeof(pixel_t));
+    }
+#endif
 
-    case IMAGE_INDEXED:
-      {
-        uint8_t* address = image->getPixelAddress(0, y);
-
-        // Check start pixel
-        if (!color_equal_8((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_8((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_8((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
+    for (; x<x2; ++x) {
+      if (color_equal<ImageTraits>(row[x], m_srcColor, m_tolerance) != matching)
+        return x;
+    }
+    return x2;
+  }
 
-    default:
-      // Check start pixel
-      if (get_pixel(image, x, y) != src_color || MASKED(x, y))
-        return x+1;
-
-      // Work left from starting point
-      for (left=x-1; left>=bounds.x; left--) {
-        if (get_pixel(image, left, y) != src_color || MASKED(left, y))
-          break;
-      }
+#if DOC_FLOODFILL_SSE2
+  // Returns a 16-bit mask with the bytes of the matching pixels set.
+  int matchMask(const pixel_t* p) const {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i diff = _mm_or_si128(_mm_subs_epu8(v, m_srcColorv),
+                                      _mm_subs_epu8(m_srcColorv, v));
+    // 0xff in each byte (channel) where diff <= tolerance
+    __m128i eq = _mm_cmpeq_epi8(_mm_max_epu8(diff, m_tolerancev),
+                                m_tolerancev);
+
+    if constexpr (ImageTraits::pixel_format == IMAGE_RGB) {
+      eq = _mm_cmpeq_epi32(eq, _mm_set1_epi32(-1));
+      // Two transparent pixels are equal
+      if (m_transparentSrc)
+        eq = _mm_or_si128(
+          eq, _mm_cmpeq_epi32(_mm_and_si128(v, m_alphaMaskv),
+                              _mm_setzero_si128()));
+    }
+    else if constexpr (ImageTraits::pixel_format == IMAGE_GRAYSCALE) {
+      eq = _mm_cmpeq_epi16(eq, _mm_set1_epi16(-1));
+      if (m_transparentSrc)
+        eq = _mm_or_si128(
+          eq, _mm_cmpeq_epi16(_mm_and_si128(v, m_alphaMaskv),
+                              _mm_setzero_si128()));
+    }
 
-      // Work right from starting point
-      for (right=x+1; right<bounds.x2(); right++) {
-        if (get_pixel(image, right, y) != src_color || MASKED(right, y))
-          break;
-      }
-      break;
+    return _mm_movemask_epi8(eq);
   }
+#endif
 
-  left++;
-  right--;
+  const Image* m_image;
+  color_t m_srcColor;
+  int m_tolerance;
+#if DOC_FLOODFILL_SSE2
+  __m128i m_srcColorv;
+  __m128i m_tolerancev;
+  __m128i m_alphaMaskv;
+  bool m_transparentSrc;
+#endif
+};
 
-  /* draw the line */
-  (*proc)(left, y, right, data);
+// Exact comparison for other pixel formats (e.g. bitmaps or
+// tilemaps).
+class GenericMatcher {
+public:
+  GenericMatcher(const Image* image,
+                 const color_t srcColor,
+                 const int tolerance)
+    : m_image(image)
+    , m_srcColor(srcColor) {
+  }
 
-  /* store it in the list of flooded segments */
-  c = y;
-  p = FLOOD_LINE(c);
+  bool match(const int x, const int y) const {
+    return (get_pixel(m_image, x, y) == m_srcColor);
+  }
 
-  if (p->flags) {
-    while (p->next) {
-      c = p->next;
-      p = FLOOD_LINE(c);
-    }
+  int runEnd(int x, const int x2, const int y) const {
+    while (x < x2 && match(x, y))
+      ++x;
+    return x;
+  }
 
-    p->next = c = flood_count++;
-    flood_buf.resize(flood_count);
-    p = FLOOD_LINE(c);
+  int nextMatch(int x, const int x2, const int y) const {
+    while (x < x2 && !match(x, y))
+      ++x;
+    return x;
   }
 
-  p->flags = FLOOD_IN_USE;
-  p->lpos = left;
-  p->rpos = right;
-  p->y = y;
-  p->next = 0;
+private:
+  const Image* m_image;
+  color_t m_srcColor;
+};
 
-  if (y > bounds.y)
-    p->flags |= FLOOD_TODO_ABOVE;
+// Span-based flood fill: each filled span (a run of fillable pixels
+// in a row) pushes the ranges of the adjacent rows that must be
+// scanned to a stack. A bitmap of visited pixels avoids filling the
+// same span twice.
+template<typename Matcher>
+class SpanFiller {
+public:
+  SpanFiller(const Matcher& matcher,
+             const Mask* mask,
+             const gfx::Rect& bounds,
+             const bool isEightConnected,
+             void* data,
+             AlgoHLine proc)
+    : m_matcher(matcher)
+    , m_mask(mask && mask->bitmap() ? mask: nullptr)
+    , m_bounds(bounds)
+    , m_e(isEightConnected ? 1: 0)
+    , m_data(data)
+    , m_proc(proc) {
+    // Pixels outside the mask bounds cannot be filled
+    if (mask)
+      m_bounds &= mask->bounds();
+
+    if (!m_bounds.isEmpty())
+      m_visited.resize((std::size_t(m_bounds.w)*m_bounds.h + 31) / 32, 0);
+  }
 
-  if (y+1 < bounds.y2())
-    p->flags |= FLOOD_TODO_BELOW;
+  void fill(const int x, const int y) {
+    if (!m_bounds.contains(gfx::Point(x, y)) ||
+        !isFillable(x, y))
+      return;
 
-  return right+2;
-}
+    // Scan the row of the starting point (dy=0 to check the rows
+    // above and below the first span).
+    scan({ y, x, x, 0 });
 
+    while (!m_stack.empty()) {
+      const Segment seg = m_stack.back();
+      m_stack.pop_back();
+      scan(seg);
+    }
+  }
 
+private:
+  // Range [x1, x2] of the row "y" to scan, the span that generated
+  // this segment is in the row y-dy (dy=0 for the starting point).
+  struct Segment {
+    int y, x1, x2, dy;
+  };
+
+  bool isMasked(const int x, const int y) const {
+    return (m_mask &&
+            !get_pixel_fast<BitmapTraits>(m_mask->bitmap(),
+                                          x - m_mask->bounds().x,
+                                          y - m_mask->bounds().y));
+  }
 
-/* check_flood_line:
- *  Checks a line segment, using the scratch buffer is to store a list of
- *  segments which have already been drawn in order to minimise the required
- *  number of tests.
- */
-static int check_flood_line(const Image* image,
-                            const Mask* mask,
-                            int y, int left, int right,
-                            const gfx::Rect& bounds,
-                            int src_color, int tolerance, void *data, AlgoHLine proc)
-{
-  int c;
-  FLOODED_LINE *p;
-  int ret = false;
+  bool isFillable(const int x, const int y) const {
+    return m_matcher.match(x, y) && !isMasked(x, y);
+  }
 
-  while (left <= right) {
-    c = y;
+  // Returns the first not fillable pixel in [x, x2)
+  int runEnd(const int x, const int x2, const int y) const {
+    const int end = m_matcher.runEnd(x, x2, y);
+    if (m_mask) {
+      for (int u=x; u<end; ++u)
+        if (isMasked(u, y))
+          return u;
+    }
+    return end;
+  }
 
+  // Returns the first fillable pixel in [x, x2)
+  int nextFillable(int x, const int x2, const int y) const {
     for (;;) {
-      p = FLOOD_LINE(c);
+      x = m_matcher.nextMatch(x, x2, y);
+      if (x >= x2 || !isMasked(x, y))
+        return x;
+      ++x;
+    }
+  }
+
+  std::size_t visitedIndex(const int x, const int y) const {
+    return std::size_t(y - m_bounds.y) * m_bounds.w + (x - m_bounds.x);
+  }
+
+  bool isVisited(const int x, const int y) const {
+    const std::size_t i = visitedIndex(x, y);
+    return (m_visited[i >> 5] & (uint32_t(1) << (i & 31))) != 0;
+  }
+
+  void setVisited(const int x1, const int x2, const int y) {
+    std::size_t i = visitedIndex(x1, y);
+    const std::size_t end = i + (x2 - x1 + 1);
+    for (; i < end && (i & 31); ++i)
+      m_visited[i >> 5] |= (uint32_t(1) << (i & 31));
+    for (; i+32 <= end; i += 32)
+      m_visited[i >> 5] = 0xffffffff;
+    for (; i < end; ++i)
+      m_visited[i >> 5] |= (uint32_t(1) << (i & 31));
+  }
 
-      if ((left >= p->lpos) && (left <= p->rpos)) {
-        left = p->rpos+2;
+  void push(const int y, int x1, int x2, const int dy) {
+    if (y < m_bounds.y || y >= m_bounds.y2())
+      return;
+    x1 = std::max(x1, m_bounds.x);
+    x2 = std::min(x2, m_bounds.x2()-1);
+    if (x1 <= x2)
+      m_stack.push_back({ y, x1, x2, dy });
+  }
+
+  void scan(const Segment& seg) {
+    const int y = seg.y;
+    const int x2 = seg.x2+1;
+    int x = seg.x1;
+
+    while (x < x2) {
+      x = nextFillable(x, x2, y);
+      if (x >= x2)
         break;
+
+      // The whole run of fillable pixels was already filled
+      if (isVisited(x, y)) {
+        x = runEnd(x, m_bounds.x2(), y) + 1;
+        continue;
       }
 
-      c = p->next;
+      int left = x;
+      while (left > m_bounds.x && isFillable(left-1, y))
+        --left;
+      const int right = runEnd(x+1, m_bounds.x2(), y) - 1;
 
-      if (!c) {
-        left = flooder(image, mask, left, y, bounds, src_color, tolerance, data, proc);
-        ret = true;
-        break;
+      setVisited(left, right, y);
+      (*m_proc)(left, y, right, m_data);
+
+      if (seg.dy == 0) {
+        push(y-1, left-m_e, right+m_e, -1);
+        push(y+1, left-m_e, right+m_e, 1);
+      }
+      else {
+        // Continue in the same direction, and go back only to check
+        // the pixels that aren't adjacent to the previous span.
+        push(y+seg.dy, left-m_e, right+m_e, seg.dy);
+        if (left-m_e < seg.x1)
+          push(y-seg.dy, left-m_e, seg.x1+m_e-1, -seg.dy);
+        if (right+m_e > seg.x2)
+          push(y-seg.dy, seg.x2-m_e+1, right+m_e, -seg.dy);
       }
+
+      x = right+2;
     }
   }
 
-  return ret;
+  const Matcher& m_matcher;
+  const Mask* m_mask;           // Only when it has a bitmap
+  gfx::Rect m_bounds;
+  const int m_e;                // Extra pixel to check in 8-connectivity
+  void* m_data;
+  AlgoHLine m_proc;
+  std::vector<Segment> m_stack;
+  std::vector<uint32_t> m_visited;
+};
+
+template<typename Matcher>
+void contiguous_fill(const Matcher& matcher,
+                     const Mask* mask,
+                     const int x, const int y,
+                     const gfx::Rect& bounds,
+                     const bool isEightConnected,
+                     void* data,
+                     AlgoHLine proc)
+{
+  SpanFiller<Matcher> filler(matcher, mask, bounds, isEightConnected,
+                             data, proc);
+  filler.fill(x, y);
 }
 
 template<typename ImageTraits>
-static void replace_color(const Image* image, const gfx::Rect& bounds, int src_color, int tolerance, void* data, AlgoHLine proc)
+void collect_row_spans(const RowMatcher<ImageTraits>& matcher,
+                       const gfx::Rect& bounds,
+                       const int y,
+                       std::vector<Span>& spans)
 {
-  typename ImageTraits::address_t address;
-
-  for (int y=bounds.y; y<bounds.y2(); ++y) {
-    address = reinterpret_cast<typename ImageTraits::address_t>(image->getPixelAddress(bounds.x, y));
-
-    for (int x=bounds.x; x<bounds.x2(); ++x, ++address) {
-      int right = -1;
-
-      if (color_equal<ImageTraits>((int)(*address), src_color, tolerance)) {
-        ++address;
-        for (right=x+1; right<bounds.x2(); ++right, ++address) {
-          if (!color_equal<ImageTraits>((int)(*address), src_color, tolerance))
-            break;
-        }
-        (*proc)(x, y, right-1, data);
-        x = right;
-      }
+  const int x2 = bounds.x2();
+  int x = bounds.x;
+  while (x < x2) {
+    x = matcher.nextMatch(x, x2, y);
+    if (x >= x2)
+      break;
+
+    const int right = matcher.runEnd(x+1, x2, y);
+    spans.push_back({ x, y, right-1 });
+    x = right+1;
+  }
+}
+
+// Non-contiguous case: all the pixels inside the bounds that are
+// similar to the source color are filled. Bands of rows are compared
+// in several threads, and the found spans are sent to the AlgoHLine
+// from this thread (in the same order as if they were found
+// sequentially).
+template<typename ImageTraits>
+void replace_color(const Image* image,
+                   const gfx::Rect& bounds,
+                   const color_t src_color,
+                   const int tolerance,
+                   void* data,
+                   AlgoHLine proc)
+{
+  if (bounds.isEmpty())
+    return;
+
+  const RowMatcher<ImageTraits> matcher(image, src_color, tolerance);
+  const int nthreads =
+    std::clamp(int(std::thread::hardware_concurrency()), 1,
+               std::max(1, bounds.w * bounds.h / kMinPixelsPerThread));
+
+  std::vector<Span> spans;
+  if (nthreads == 1) {
+    for (int y=bounds.y; y<bounds.y2(); ++y) {
+      spans.clear();
+      collect_row_spans(matcher, bounds, y, spans);
+      for (const Span& span : spans)
+        (*proc)(span.x1, span.y, span.x2, data);
     }
+    return;
+  }
+
+  const int rowsPerThread = std::max(1, kPixelsPerThreadBatch / bounds.w);
+  std::vector<std::vector<Span>> threadSpans(nthreads);
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads-1);
+
+  for (int y=bounds.y; y<bounds.y2(); y+=rowsPerThread*nthreads) {
+    const int y2 = std::min(y+rowsPerThread*nthreads, bounds.y2());
+    const int h = y2 - y;
+
+    auto collectBand =
+      [&matcher, &bounds, &threadSpans, y, h, nthreads](const int i){
+        std::vector<Span>& spans = threadSpans[i];
+        spans.clear();
+        for (int v=y+h*i/nthreads; v<y+h*(i+1)/nthreads; ++v)
+          collect_row_spans(matcher, bounds, v, spans);
+      };
+
+    threads.clear();
+    for (int i=1; i<nthreads; ++i)
+      threads.emplace_back(collectBand, i);
+    collectBand(0);
+    for (auto& thread : threads)
+      thread.join();
+
+    for (const auto& spans : threadSpans)
+      for (const Span& span : spans)
+        (*proc)(span.x1, span.y, span.x2, data);
   }
 }
 
-/* floodfill:
- *  Fills an enclosed area (starting at point x, y) with the specified color.
- */
+} // anonymous namespace
+
 void floodfill(const Image* image,
                const Mask* mask,
                const int x, const int y,
@@ -355,132 +569,42 @@ void floodfill(const Image* image,
       (y < 0) || (y >= image->height()))
     return;
 
+  const gfx::Rect imageBounds = bounds & image->bounds();
+
   // Non-contiguous case, we replace colors in the whole image.
   if (!contiguous) {
     switch (image->pixelFormat()) {
       case IMAGE_RGB:
-        replace_color<RgbTraits>(image, bounds, src_color, tolerance, data, proc);
+        replace_color<RgbTraits>(image, imageBounds, src_color, tolerance, data, proc);
         break;
       case IMAGE_GRAYSCALE:
-        replace_color<GrayscaleTraits>(image, bounds, src_color, tolerance, data, proc);
+        replace_color<GrayscaleTraits>(image, imageBounds, src_color, tolerance, data, proc);
         break;
       case IMAGE_INDEXED:
-        replace_color<IndexedTraits>(image, bounds, src_color, tolerance, data, proc);
+        replace_color<IndexedTraits>(image, imageBounds, src_color, tolerance, data, proc);
         break;
     }
     return;
   }
 
-  /* set up the list of flooded segments */
-  flood_buf.resize(image->height());
-  flood_count = image->height();
-  FLOODED_LINE* p = (FLOODED_LINE*)&flood_buf[0];
-  for (int c=0; c<flood_count; c++) {
-    p[c].flags = 0;
-    p[c].lpos = SHRT_MAX;
-    p[c].rpos = SHRT_MIN;
-    p[c].y = y;
-    p[c].next = 0;
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      contiguous_fill(RowMatcher<RgbTraits>(image, src_color, tolerance),
+                      mask, x, y, imageBounds, isEightConnected, data, proc);
+      break;
+    case IMAGE_GRAYSCALE:
+      contiguous_fill(RowMatcher<GrayscaleTraits>(image, src_color, tolerance),
+                      mask, x, y, imageBounds, isEightConnected, data, proc);
+      break;
+    case IMAGE_INDEXED:
+      contiguous_fill(RowMatcher<IndexedTraits>(image, src_color, tolerance),
+                      mask, x, y, imageBounds, isEightConnected, data, proc);
+      break;
+    default:
+      contiguous_fill(GenericMatcher(image, src_color, tolerance),
+                      mask, x, y, imageBounds, isEightConnected, data, proc);
+      break;
   }
-
-  // Start up the flood algorithm
-  flooder(image, mask, x, y, bounds, src_color, tolerance, data, proc);
-
-  // Continue as long as there are some segments still to test
-  bool done;
-  do {
-    done = true;
-
-    // For each line on the screen
-    for (int c=0; c<flood_count; c++) {
-      p = FLOOD_LINE(c);
-
-      // Check below the segment?
-      if (p->flags & FLOOD_TODO_BELOW) {
-        p->flags &= ~FLOOD_TODO_BELOW;
-
-        if (isEightConnected) {
-          if (p->lpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y+1, p->lpos+1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->lpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y+1, p->lpos-1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y+1, p->lpos, p->rpos+1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y+1, p->lpos, p->rpos-1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-        }
-
-        if (check_flood_line(image, mask, p->y+1, p->lpos, p->rpos, bounds,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-          p = FLOOD_LINE(c);
-        }
-      }
-
-      // Check above the segment?
-      if (p->flags & FLOOD_TODO_ABOVE) {
-        p->flags &= ~FLOOD_TODO_ABOVE;
-
-        if (isEightConnected) {
-          if (p->lpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y-1, p->lpos+1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->lpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y-1, p->lpos-1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y-1, p->lpos, p->rpos+1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y-1, p->lpos, p->rpos-1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-        }
-
-        if (check_flood_line(image, mask, p->y-1, p->lpos, p->rpos, bounds,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-
-          // Special case shortcut for going backwards
-          if ((c > bounds.y) && (c < bounds.y2()))
-            c -= 2;
-        }
-      }
-    }
-  } while (!done);
 }
 
 } // namespace algorithm
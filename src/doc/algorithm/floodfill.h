@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -19,6 +20,10 @@ namespace doc {
 
   namespace algorithm {
 
+    // Calls "proc" for each span of pixels similar to "srcColor"
+    // (each pixel is filled only once). In the non-contiguous mode
+    // the image is compared in several threads, but "proc" is always
+    // called from the caller thread.
     void floodfill(const Image* image,
                    const Mask* mask,
                    const int x, const int y,
@@ -0,0 +1,90 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/algorithm/floodfill.h"
+
+#include "doc/color.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+// Creates an image with a background with slightly different colors
+// (so the tolerance matters) and a grid of broken lines (so the fill
+// has to go around them).
+static ImageRef create_grid_image(const PixelFormat pixelFormat,
+                                  const int w, const int h)
+{
+  ImageRef image(Image::create(pixelFormat, w, h));
+  uint32_t seed = 1;
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      seed = seed*1103515245 + 12345;
+      const bool line = ((x % 97 == 0 && y % 61 != 0) ||
+                         (y % 89 == 0 && x % 53 != 0));
+      const int v = (line ? 200: int((seed >> 16) & 7));
+      color_t c = 0;
+      switch (pixelFormat) {
+        case IMAGE_RGB: c = rgba(v, v, v, 255); break;
+        case IMAGE_GRAYSCALE: c = graya(v, 255); break;
+        case IMAGE_INDEXED: c = v; break;
+      }
+      put_pixel(image.get(), x, y, c);
+    }
+  }
+  return image;
+}
+
+static void count_hline(int x1, int y, int x2, void* data)
+{
+  *((int*)data) += x2 - x1 + 1;
+}
+
+// state.range(0) = pixel format, state.range(1) = image size,
+// state.range(2) = tolerance
+static void run_floodfill(benchmark::State& state, const bool contiguous)
+{
+  const PixelFormat pixelFormat = (PixelFormat)state.range(0);
+  const int size = state.range(1);
+  const int tolerance = state.range(2);
+  const ImageRef image = create_grid_image(pixelFormat, size, size);
+
+  for (auto _ : state) {
+    int pixels = 0;
+    floodfill(image.get(), nullptr, 1, 1, image->bounds(),
+              get_pixel(image.get(), 1, 1), tolerance,
+              contiguous, false, &pixels, count_hline);
+    benchmark::DoNotOptimize(pixels);
+  }
+  state.SetItemsProcessed(state.iterations() * size * size);
+}
+
+static void BM_FloodFill(benchmark::State& state) {
+  run_floodfill(state, true);
+}
+
+static void BM_ReplaceColor(benchmark::State& state) {
+  run_floodfill(state, false);
+}
+
+BENCHMARK(BM_FloodFill)
+  ->ArgsProduct({ { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }, { 1024, 8192 }, { 0, 16 } })
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+BENCHMARK(BM_ReplaceColor)
+  ->ArgsProduct({ { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }, { 1024, 8192 }, { 0, 16 } })
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,216 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/floodfill.h"
+#include "doc/color.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+struct FillResult {
+  int width;
+  std::vector<int> pixels;      // Times that each pixel was filled
+};
+
+static void fill_hline(int x1, int y, int x2, void* data)
+{
+  auto result = (FillResult*)data;
+  for (int x=x1; x<=x2; ++x)
+    ++result->pixels[y*result->width + x];
+}
+
+static FillResult fill(const Image* image,
+                       const Mask* mask,
+                       const int x, const int y,
+                       const int tolerance,
+                       const bool contiguous,
+                       const bool isEightConnected)
+{
+  FillResult result;
+  result.width = image->width();
+  result.pixels.resize(image->width()*image->height(), 0);
+  floodfill(image, mask, x, y, image->bounds(),
+            get_pixel(image, x, y), tolerance,
+            contiguous, isEightConnected,
+            &result, fill_hline);
+  return result;
+}
+
+// Same comparison as the floodfill() one, pixel by pixel
+static bool similar_color(const PixelFormat pixelFormat,
+                          const color_t c1, const color_t c2,
+                          const int tolerance)
+{
+  switch (pixelFormat) {
+    case IMAGE_RGB:
+      if (rgba_geta(c1) == 0 && rgba_geta(c2) == 0)
+        return true;
+      return (std::abs(int(rgba_getr(c1)) - int(rgba_getr(c2))) <= tolerance &&
+              std::abs(int(rgba_getg(c1)) - int(rgba_getg(c2))) <= tolerance &&
+              std::abs(int(rgba_getb(c1)) - int(rgba_getb(c2))) <= tolerance &&
+              std::abs(int(rgba_geta(c1)) - int(rgba_geta(c2))) <= tolerance);
+    case IMAGE_GRAYSCALE:
+      if (graya_geta(c1) == 0 && graya_geta(c2) == 0)
+        return true;
+      return (std::abs(int(graya_getv(c1)) - int(graya_getv(c2))) <= tolerance &&
+              std::abs(int(graya_geta(c1)) - int(graya_geta(c2))) <= tolerance);
+    default:
+      return (std::abs(int(c1) - int(c2)) <= tolerance);
+  }
+}
+
+// Pixel by pixel flood fill used as reference
+static std::vector<int> expected_fill(const Image* image,
+                                      const Mask* mask,
+                                      const int x, const int y,
+                                      const int tolerance,
+                                      const bool contiguous,
+                                      const bool isEightConnected)
+{
+  const int w = image->width();
+  const int h = image->height();
+  const color_t srcColor = get_pixel(image, x, y);
+  std::vector<int> pixels(w*h, 0);
+
+  auto fillable = [=](int u, int v) {
+    return (similar_color(image->pixelFormat(),
+                          get_pixel(image, u, v), srcColor, tolerance) &&
+            (!mask || mask->containsPoint(u, v)));
+  };
+
+  if (!contiguous) {
+    for (int v=0; v<h; ++v)
+      for (int u=0; u<w; ++u)
+        if (similar_color(image->pixelFormat(),
+                          get_pixel(image, u, v), srcColor, tolerance))
+          pixels[v*w+u] = 1;
+    return pixels;
+  }
+
+  if (!fillable(x, y))
+    return pixels;
+
+  std::vector<gfx::Point> stack;
+  stack.push_back(gfx::Point(x, y));
+  pixels[y*w+x] = 1;
+  while (!stack.empty()) {
+    const gfx::Point pt = stack.back();
+    stack.pop_back();
+    for (int dy=-1; dy<=1; ++dy) {
+      for (int dx=-1; dx<=1; ++dx) {
+        if ((dx == 0 && dy == 0) ||
+            (!isEightConnected && dx != 0 && dy != 0))
+          continue;
+        const int u = pt.x+dx;
+        const int v = pt.y+dy;
+        if (u < 0 || v < 0 || u >= w || v >= h ||
+            pixels[v*w+u] || !fillable(u, v))
+          continue;
+        pixels[v*w+u] = 1;
+        stack.push_back(gfx::Point(u, v));
+      }
+    }
+  }
+  return pixels;
+}
+
+TEST(FloodFill, Connectivity)
+{
+  // A diagonal line of 1s over 0s
+  ImageRef image(Image::create(IMAGE_INDEXED, 4, 4));
+  clear_image(image.get(), 0);
+  for (int i=0; i<4; ++i)
+    put_pixel(image.get(), i, i, 1);
+
+  FillResult r4 = fill(image.get(), nullptr, 0, 0, 0, true, false);
+  EXPECT_EQ(1, r4.pixels[0]);
+  EXPECT_EQ(0, r4.pixels[1*4+1]);
+  EXPECT_EQ(0, r4.pixels[3*4+3]);
+
+  FillResult r8 = fill(image.get(), nullptr, 0, 0, 0, true, true);
+  for (int i=0; i<4; ++i)
+    EXPECT_EQ(1, r8.pixels[i*4+i]);
+  EXPECT_EQ(0, r8.pixels[1]);
+}
+
+TEST(FloodFill, TransparentPixelsAreEqual)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 3, 1));
+  put_pixel(image.get(), 0, 0, rgba(255, 0, 0, 0));
+  put_pixel(image.get(), 1, 0, rgba(0, 255, 0, 0));
+  put_pixel(image.get(), 2, 0, rgba(0, 0, 255, 255));
+
+  FillResult r = fill(image.get(), nullptr, 0, 0, 0, true, false);
+  EXPECT_EQ(1, r.pixels[0]);
+  EXPECT_EQ(1, r.pixels[1]);
+  EXPECT_EQ(0, r.pixels[2]);
+}
+
+TEST(FloodFill, RandomImages)
+{
+  std::mt19937 random(1);
+  for (int i=0; i<600; ++i) {
+    const PixelFormat pixelFormat = PixelFormat(i % 3); // RGB, Grayscale, Indexed
+    const int w = 1 + random() % 70;
+    const int h = 1 + random() % 40;
+    const int colors = 2 + random() % 3;
+
+    ImageRef image(Image::create(pixelFormat, w, h));
+    for (int y=0; y<h; ++y) {
+      for (int x=0; x<w; ++x) {
+        const int c = random() % colors;
+        const int a = (random() % 4 == 0 ? 0: 255);
+        switch (pixelFormat) {
+          case IMAGE_RGB: put_pixel(image.get(), x, y, rgba(c*10, c*5, c*3, a)); break;
+          case IMAGE_GRAYSCALE: put_pixel(image.get(), x, y, graya(c*10, a)); break;
+          case IMAGE_INDEXED: put_pixel(image.get(), x, y, c*3); break;
+        }
+      }
+    }
+
+    std::unique_ptr<Mask> mask;
+    if (random() % 3 == 0) {
+      mask.reset(new Mask);
+      mask->add(gfx::Rect(0, 0, w, h));
+      for (int j=0; j<4; ++j)
+        mask->subtract(gfx::Rect(random() % w, random() % h,
+                                 1 + random() % 8, 1 + random() % 8));
+    }
+
+    const int x = random() % w;
+    const int y = random() % h;
+    const int tolerance = (i % 4 == 0 ? 0: random() % 40);
+    const bool contiguous = (random() % 4 != 0);
+    const bool isEightConnected = (random() % 2 == 0);
+
+    FillResult r = fill(image.get(), mask.get(), x, y, tolerance,
+                        contiguous, isEightConnected);
+    std::vector<int> expected = expected_fill(image.get(), mask.get(), x, y, tolerance,
+                                              contiguous, isEightConnected);
+    ASSERT_EQ(expected, r.pixels) << "Image " << i;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -18,30 +18,232 @@
 #include "doc/rgbmap.h"
 #include "gfx/point.h"
 
-#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_RESIZE_SSE2 1
+  #include <emmintrin.h>
+#endif
 
 namespace doc {
 namespace algorithm {
 
+namespace {
+
+// Minimum number of destination pixels resized by each thread.
+const int kMinPixelsPerThread = 64*1024;
+
+// Position of a destination column/row in the source image for the
+// bilinear interpolation.
+struct Sample {
+  int i1, i2;                   // Source columns/rows to interpolate
+  int w;                        // Weight of i2 in [0, 65536]
+};
+
+// Calls func(y1, y2) for bands of rows of the destination image in
+// several threads (each row is calculated independently).
+template<typename Func>
+void for_each_band(const Image* dst, Func func)
+{
+  const int h = dst->height();
+  const int maxThreads =
+    int(std::min<int64_t>(h, int64_t(dst->width()) * h / kMinPixelsPerThread));
+  const int nthreads =
+    std::clamp(int(std::thread::hardware_concurrency()), 1,
+               std::max(1, maxThreads));
+
+  auto resizeBand = [&](const int i) {
+    func(h * i / nthreads, h * (i+1) / nthreads);
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads-1);
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(resizeBand, i);
+
+  resizeBand(0);
+
+  for (auto& thread : threads)
+    thread.join();
+}
+
+// Fixed-point positions (with 16 bits for the fractional part) of
+// each destination column/row, the first and last ones match the
+// first and last source columns/rows.
+std::vector<Sample> create_samples(const int srcSize, const int dstSize)
+{
+  std::vector<Sample> samples(dstSize);
+  for (int i=0; i<dstSize; ++i) {
+    const int64_t pos =
+      (dstSize > 1 ? (int64_t(i) * (srcSize-1) * 65536 + (dstSize-1)/2) / (dstSize-1): 0);
+    samples[i].i1 = int(pos >> 16);
+    samples[i].i2 = std::min(samples[i].i1+1, srcSize-1);
+    samples[i].w = int(pos & 0xffff);
+  }
+  return samples;
+}
+
+// Interpolates each byte of two rows with a 14-bit weight "w" for
+// the second row, the result has 8 bits for the fractional part:
+//   out = (a*(16384-w) + b*w) / 64
+void lerp_rows(const uint8_t* a, const uint8_t* b, const int w,
+               const int n, uint32_t* out)
+{
+  const int wa = 16384 - w;
+  int i = 0;
+#if DOC_RESIZE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weights = _mm_set1_epi32((w << 16) | wa);
+  const __m128i round = _mm_set1_epi32(32);
+  for (; i+16<=n; i+=16) {
+    const __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+    const __m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+    // Pairs of (a, b) values in 16-bit lanes
+    const __m128i ab_lo = _mm_unpacklo_epi8(va, vb);
+    const __m128i ab_hi = _mm_unpackhi_epi8(va, vb);
+    const __m128i ab[4] = {
+      _mm_unpacklo_epi8(ab_lo, zero), _mm_unpackhi_epi8(ab_lo, zero),
+      _mm_unpacklo_epi8(ab_hi, zero), _mm_unpackhi_epi8(ab_hi, zero) };
+    for (int j=0; j<4; ++j) {
+      const __m128i v = _mm_madd_epi16(ab[j], weights);
+      _mm_storeu_si128((__m128i*)(out+i+4*j),
+                       _mm_srli_epi32(_mm_add_epi32(v, round), 6));
+    }
+  }
+#endif
+  for (; i<n; ++i)
+    out[i] = (a[i]*wa + b[i]*w + 32) >> 6;
+}
+
+// Interpolates the pixels (of N bytes) of a row returned by
+// lerp_rows() for each destination column (with 15-bit weights).
+template<int N>
+void lerp_columns(const uint32_t* row, const Sample* xs, const int w,
+                  uint8_t* dst)
+{
+  for (int x=0; x<w; ++x, dst+=N) {
+    const uint32_t* p1 = row + xs[x].i1*N;
+    const uint32_t* p2 = row + xs[x].i2*N;
+    const uint32_t w2 = (xs[x].w + 1) >> 1;
+    const uint32_t w1 = 32768 - w2;
+    for (int c=0; c<N; ++c)
+      dst[c] = (p1[c]*w1 + p2[c]*w2) >> 23;
+  }
+}
+
 template<typename ImageTraits>
 void resize_image_nearest(const Image* src, Image* dst)
 {
-  double x_ratio = double(src->width()) / double(dst->width());
-  double y_ratio = double(src->height()) / double(dst->height());
-  double px, py;
+  using pixel_t = typename ImageTraits::pixel_t;
+
+  std::vector<int> srcX(dst->width());
+  for (int x=0; x<dst->width(); ++x)
+    srcX[x] = int(int64_t(x) * src->width() / dst->width());
+
+  for_each_band(
+    dst, [src, dst, &srcX](const int y1, const int y2) {
+      for (int y=y1; y<y2; ++y) {
+        const int py = int(int64_t(y) * src->height() / dst->height());
+        auto srcRow = (const pixel_t*)src->getPixelAddress(0, py);
+        auto dstRow = (pixel_t*)dst->getPixelAddress(0, y);
+        for (int x=0; x<dst->width(); ++x)
+          dstRow[x] = srcRow[srcX[x]];
+      }
+    });
+}
 
-  LockImageBits<ImageTraits> dstBits(dst);
+template<>
+void resize_image_nearest<BitmapTraits>(const Image* src, Image* dst)
+{
+  LockImageBits<BitmapTraits> dstBits(dst);
   auto dstIt = dstBits.begin();
 
   for (int y=0; y<dst->height(); ++y) {
-    py = std::floor(y * y_ratio);
+    const int py = int(int64_t(y) * src->height() / dst->height());
     for (int x=0; x<dst->width(); ++x, ++dstIt) {
-      px = std::floor(x * x_ratio);
-      *dstIt = get_pixel_fast<ImageTraits>(src, int(px), int(py));
+      const int px = int(int64_t(x) * src->width() / dst->width());
+      *dstIt = get_pixel_fast<BitmapTraits>(src, px, py);
     }
   }
 }
 
+// Bilinear interpolation of RGB/grayscale images where each channel
+// is one byte: each destination row is calculated interpolating two
+// whole source rows, and then the columns of that row.
+template<typename ImageTraits>
+void resize_image_bilinear(const Image* src, Image* dst)
+{
+  const int N = ImageTraits::bytes_per_pixel;
+  const std::vector<Sample> xs = create_samples(src->width(), dst->width());
+  const std::vector<Sample> ys = create_samples(src->height(), dst->height());
+  const int n = src->width()*N;
+
+  for_each_band(
+    dst, [src, dst, &xs, &ys, n](const int y1, const int y2) {
+      std::vector<uint32_t> row(n);
+      for (int y=y1; y<y2; ++y) {
+        lerp_rows(src->getPixelAddress(0, ys[y].i1),
+                  src->getPixelAddress(0, ys[y].i2),
+                  (ys[y].w + 2) >> 2, n, &row[0]);
+        lerp_columns<N>(&row[0], &xs[0], dst->width(),
+                        dst->getPixelAddress(0, y));
+      }
+    });
+}
+
+// Same as resize_image_bilinear() converting the indexes to RGBA
+// values, and the interpolated RGBA values to indexes with the
+// RgbMap.
+void resize_image_bilinear_indexed(const Image* src,
+                                   Image* dst,
+                                   const Palette* pal,
+                                   const RgbMap* rgbmap,
+                                   const color_t maskColor)
+{
+  const std::vector<Sample> xs = create_samples(src->width(), dst->width());
+  const std::vector<Sample> ys = create_samples(src->height(), dst->height());
+  const int sw = src->width();
+  const int dw = dst->width();
+
+  auto toRgba = [src, pal, maskColor, sw](const int y, color_t* out) {
+    auto srcRow = (const IndexedTraits::pixel_t*)src->getPixelAddress(0, y);
+    for (int x=0; x<sw; ++x) {
+      if (srcRow[x] == maskColor)
+        out[x] = pal->getEntry(srcRow[x]) & rgba_rgb_mask; // Set alpha = 0
+      else
+        out[x] = pal->getEntry(srcRow[x]);
+    }
+  };
+
+  for_each_band(
+    dst, [&](const int y1, const int y2) {
+      std::vector<color_t> rgbaRow1(sw), rgbaRow2(sw), dstRow(dw);
+      std::vector<uint32_t> row(sw*4);
+      for (int y=y1; y<y2; ++y) {
+        toRgba(ys[y].i1, &rgbaRow1[0]);
+        toRgba(ys[y].i2, &rgbaRow2[0]);
+        lerp_rows((const uint8_t*)&rgbaRow1[0],
+                  (const uint8_t*)&rgbaRow2[0],
+                  (ys[y].w + 2) >> 2, sw*4, &row[0]);
+        lerp_columns<4>(&row[0], &xs[0], dw, (uint8_t*)&dstRow[0]);
+
+        auto dstIt = (IndexedTraits::address_t)dst->getPixelAddress(0, y);
+        for (int x=0; x<dw; ++x, ++dstIt) {
+          const color_t c = dstRow[x];
+          *dstIt = rgbmap->mapColor(rgba_getr(c),
+                                    rgba_getg(c),
+                                    rgba_getb(c),
+                                    rgba_geta(c));
+        }
+      }
+    });
+}
+
+} // anonymous namespace
+
 void resize_image(const Image* src,
                   Image* dst,
                   const ResizeMethod method,
@@ -51,7 +253,6 @@ void resize_image(const Image* src,
 {
   switch (method) {
 
-    // TODO optimize this
     case RESIZE_METHOD_NEAREST_NEIGHBOR: {
       ASSERT(src->pixelFormat() == dst->pixelFormat());
 
@@ -64,111 +265,28 @@ void resize_image(const Image* src,
       break;
     }
 
-    // TODO optimize this
     case RESIZE_METHOD_BILINEAR: {
-      uint32_t color[4], dst_color = 0;
-      double u, v, du, dv;
-      int u_floor, u_floor2;
-      int v_floor, v_floor2;
-      int x, y;
-
-      // We cannot do interpolations between RGB values on indexed
-      // images without a palette/rgbmap.
-      if (dst->pixelFormat() == IMAGE_INDEXED &&
-          (!pal || !rgbmap)) {
-        resize_image(
-          src, dst,
-          RESIZE_METHOD_NEAREST_NEIGHBOR,
-          pal, rgbmap, maskColor);
-        return;
-      }
-
-      u = v = 0.0;
-      du = (src->width()-1) * 1.0 / (dst->width()-1);
-      dv = (src->height()-1) * 1.0 / (dst->height()-1);
-      for (y=0; y<dst->height(); ++y) {
-        for (x=0; x<dst->width(); ++x) {
-          u_floor = (int)std::floor(u);
-          v_floor = (int)std::floor(v);
-
-          if (u_floor > src->width()-1) {
-            u_floor = src->width()-1;
-            u_floor2 = src->width()-1;
-          }
-          else if (u_floor == src->width()-1)
-            u_floor2 = u_floor;
-          else
-            u_floor2 = u_floor+1;
+      ASSERT(src->pixelFormat() == dst->pixelFormat());
 
-          if (v_floor > src->height()-1) {
-            v_floor = src->height()-1;
-            v_floor2 = src->height()-1;
-          }
-          else if (v_floor == src->height()-1)
-            v_floor2 = v_floor;
+      switch (dst->pixelFormat()) {
+        case IMAGE_RGB:
+          resize_image_bilinear<RgbTraits>(src, dst);
+          break;
+        case IMAGE_GRAYSCALE:
+          resize_image_bilinear<GrayscaleTraits>(src, dst);
+          break;
+        case IMAGE_INDEXED:
+          // We cannot do interpolations between RGB values on indexed
+          // images without a palette/rgbmap.
+          if (pal && rgbmap)
+            resize_image_bilinear_indexed(src, dst, pal, rgbmap, maskColor);
           else
-            v_floor2 = v_floor+1;
-
-          // get the four colors
-          color[0] = src->getPixel(u_floor,  v_floor);
-          color[1] = src->getPixel(u_floor2, v_floor);
-          color[2] = src->getPixel(u_floor,  v_floor2);
-          color[3] = src->getPixel(u_floor2, v_floor2);
-
-          // calculate the interpolated color
-          double u1 = u - u_floor;
-          double v1 = v - v_floor;
-          double u2 = 1 - u1;
-          double v2 = 1 - v1;
-
-          switch (dst->pixelFormat()) {
-            case IMAGE_RGB: {
-              int r = int((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
-                          (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
-              int g = int((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
-                          (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
-              int b = int((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
-                          (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
-              int a = int((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
-                          (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
-              dst_color = rgba(r, g, b, a);
-              break;
-            }
-            case IMAGE_GRAYSCALE: {
-              int v = int((graya_getv(color[0])*u2 + graya_getv(color[1])*u1)*v2 +
-                          (graya_getv(color[2])*u2 + graya_getv(color[3])*u1)*v1);
-              int a = int((graya_geta(color[0])*u2 + graya_geta(color[1])*u1)*v2 +
-                          (graya_geta(color[2])*u2 + graya_geta(color[3])*u1)*v1);
-              dst_color = graya(v, a);
-              break;
-            }
-            case IMAGE_INDEXED: {
-              // Convert index to RGBA values
-              for (int i=0; i<4; ++i) {
-                if (color[i] == maskColor)
-                  color[i] = pal->getEntry(color[i]) & rgba_rgb_mask; // Set alpha = 0
-                else
-                  color[i] = pal->getEntry(color[i]);
-              }
-
-              int r = int((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
-                          (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
-              int g = int((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
-                          (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
-              int b = int((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
-                          (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
-              int a = int((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
-                          (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
-              dst_color = rgbmap->mapColor(r, g, b, a);
-              break;
-            }
-          }
-
-          dst->putPixel(x, y, dst_color);
-          u += du;
-        }
-        u = 0.0;
-        v += dv;
+            resize_image_nearest<IndexedTraits>(src, dst);
+          break;
+        case IMAGE_BITMAP:
+          // There are no intermediate values between bits
+          resize_image_nearest<BitmapTraits>(src, dst);
+          break;
       }
       break;
     }
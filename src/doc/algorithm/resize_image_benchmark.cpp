@@ -0,0 +1,152 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/algorithm/resize_image.h"
+
+#include "doc/color.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap_rgb5a3.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+
+using namespace doc;
+using namespace doc::algorithm;
+
+static ImageRef create_noise_image(const PixelFormat pixelFormat,
+                                   const int w, const int h)
+{
+  ImageRef image(Image::create(pixelFormat, w, h));
+  uint32_t seed = 1;
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      seed = seed*1103515245 + 12345;
+      color_t c = seed >> 8;
+      switch (pixelFormat) {
+        case IMAGE_RGB: c = rgba(c & 255, (c >> 8) & 255, (c >> 16) & 255, 255); break;
+        case IMAGE_GRAYSCALE: c = graya(c & 255, 255); break;
+        case IMAGE_INDEXED: c &= 255; break;
+      }
+      put_pixel(image.get(), x, y, c);
+    }
+  }
+  return image;
+}
+
+// Old RESIZE_METHOD_BILINEAR implementation for RGB images (with
+// doubles and getPixel/putPixel for each pixel).
+static void legacy_resize_image_bilinear(const Image* src, Image* dst)
+{
+  uint32_t color[4];
+  double u, v, du, dv;
+  int u_floor, u_floor2;
+  int v_floor, v_floor2;
+
+  u = v = 0.0;
+  du = (src->width()-1) * 1.0 / (dst->width()-1);
+  dv = (src->height()-1) * 1.0 / (dst->height()-1);
+  for (int y=0; y<dst->height(); ++y) {
+    for (int x=0; x<dst->width(); ++x) {
+      u_floor = (int)std::floor(u);
+      v_floor = (int)std::floor(v);
+      u_floor2 = std::min(u_floor+1, src->width()-1);
+      v_floor2 = std::min(v_floor+1, src->height()-1);
+
+      color[0] = src->getPixel(u_floor,  v_floor);
+      color[1] = src->getPixel(u_floor2, v_floor);
+      color[2] = src->getPixel(u_floor,  v_floor2);
+      color[3] = src->getPixel(u_floor2, v_floor2);
+
+      double u1 = u - u_floor;
+      double v1 = v - v_floor;
+      double u2 = 1 - u1;
+      double v2 = 1 - v1;
+
+      int r = int((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
+                  (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
+      int g = int((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
+                  (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
+      int b = int((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
+                  (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
+      int a = int((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
+                  (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
+      dst->putPixel(x, y, rgba(r, g, b, a));
+      u += du;
+    }
+    u = 0.0;
+    v += dv;
+  }
+}
+
+// Resizes an image of NxN pixels to 2Nx2N (state.range(1) = N)
+static void run_resize(benchmark::State& state, const ResizeMethod method)
+{
+  const PixelFormat pixelFormat = (PixelFormat)state.range(0);
+  const int size = state.range(1);
+  const ImageRef src = create_noise_image(pixelFormat, size, size);
+  ImageRef dst(Image::create(pixelFormat, 2*size, 2*size));
+
+  Palette::initBestfit();
+  Palette pal(frame_t(0), 256);
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba(i, 255-i, (i*7) & 255, 255));
+  RgbMapRGB5A3 rgbmap;
+  rgbmap.regenerate(&pal, -1);
+
+  for (auto _ : state) {
+    resize_image(src.get(), dst.get(), method, &pal, &rgbmap, -1);
+  }
+  state.SetItemsProcessed(state.iterations() * dst->width() * dst->height());
+}
+
+static void BM_ResizeNearest(benchmark::State& state) {
+  run_resize(state, RESIZE_METHOD_NEAREST_NEIGHBOR);
+}
+
+static void BM_ResizeBilinear(benchmark::State& state) {
+  run_resize(state, RESIZE_METHOD_BILINEAR);
+}
+
+static void BM_ResizeRotSprite(benchmark::State& state) {
+  run_resize(state, RESIZE_METHOD_ROTSPRITE);
+}
+
+static void BM_LegacyResizeBilinear(benchmark::State& state) {
+  const int size = state.range(0);
+  const ImageRef src = create_noise_image(IMAGE_RGB, size, size);
+  ImageRef dst(Image::create(IMAGE_RGB, 2*size, 2*size));
+
+  for (auto _ : state) {
+    legacy_resize_image_bilinear(src.get(), dst.get());
+  }
+  state.SetItemsProcessed(state.iterations() * dst->width() * dst->height());
+}
+
+BENCHMARK(BM_ResizeNearest)
+  ->ArgsProduct({ { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }, { 64, 256, 1024 } })
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+BENCHMARK(BM_LegacyResizeBilinear)
+  ->Arg(64)->Arg(256)->Arg(1024)
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ResizeBilinear)
+  ->ArgsProduct({ { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }, { 64, 256, 1024 } })
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+BENCHMARK(BM_ResizeRotSprite)
+  ->ArgsProduct({ { IMAGE_RGB, IMAGE_INDEXED }, { 32, 128 } })
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -23,108 +23,47 @@ namespace algorithm {
 // http://en.wikipedia.org/wiki/Pixel_art_scaling_algorithms#EPX.2FScale2.C3.97.2FAdvMAME2.C3.97
 // http://scale2x.sourceforge.net/algorithm.html
 // http://scale2x.sourceforge.net/scale2xandepx.html
+//
+// Each source row is scaled using pointers to the previous, current
+// and next rows (A, P, and D) to generate two destination rows.
 template<typename ImageTraits>
 static void image_scale2x_tpl(Image* dst, const Image* src, int src_w, int src_h)
 {
-#if 0      // TODO complete this implementation that should be faster
-           // than using a lot of get/put_pixel_fast calls.
-  int dst_w = src_w*2;
-  int dst_h = src_h*2;
-
-  LockImageBits<ImageTraits> dstBits(dst, Image::WriteLock, gfx::Rect(0, 0, dst_w, dst_h));
-  const LockImageBits<ImageTraits> srcBits(src);
-
-  LockImageBits<ImageTraits>::iterator dstRow0_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow1_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow0_end = dstBits.end();
-  LockImageBits<ImageTraits>::iterator dstRow1_end = dstBits.end();
-
-  // Iterators:
-  //   A
-  // C P B
-  //   D
-  //
-  // These iterators are displaced through src image and are modified in this way:
-  //
-  // P: is the simplest one, we just start from (0, 0) to srcEnd.
-  // A: starts from row 0 (so A = P in the first row), then we start
-  //    again from the row 0.
-  // B: It starts from (1, row) and in the last pixel we don't moved it.
-  // C: It starts from (0, 0) and then it is moved with a delay.
-  // D: It starts from row 1 and continues until we reach the last
-  //    row, in that case we start D iterator again.
-  //
-  LockImageBits<ImageTraits>::const_iterator itP, itA, itB, itC, itD, savedD;
-  LockImageBits<ImageTraits>::const_iterator srcEnd = srcBits.end();
-  color_t P, A, B, C, D;
-
-  // Adjust iterators
-  itP = itA = itB = itC = itD = savedD = srcBits.begin();
-  dstRow1_it += dst_w;
-  itD += src->width();
+  using pixel_t = typename ImageTraits::pixel_t;
 
   for (int y=0; y<src_h; ++y) {
-    if (y == 1) itA = srcBits.begin();
-    if (y == src_h-2) savedD = itD;
-    if (y == src_h-1) itD = savedD;
-    ++itB;
+    auto rowA = (const pixel_t*)src->getPixelAddress(0, std::max(y-1, 0));
+    auto rowP = (const pixel_t*)src->getPixelAddress(0, y);
+    auto rowD = (const pixel_t*)src->getPixelAddress(0, std::min(y+1, src_h-1));
+    auto dstRow0 = (pixel_t*)dst->getPixelAddress(0, 2*y);
+    auto dstRow1 = (pixel_t*)dst->getPixelAddress(0, 2*y+1);
 
     for (int x=0; x<src_w; ++x) {
-      ASSERT(itP != srcEnd);
-      ASSERT(itA != srcEnd);
-      ASSERT(itB != srcEnd);
-      ASSERT(itC != srcEnd);
-      ASSERT(itD != srcEnd);
-      ASSERT(dstRow0_it != dstRow0_end);
-      ASSERT(dstRow1_it != dstRow1_end);
-
-      P = *itP;
-      A = *itA;                 // y-1
-      B = *itB;                 // x+1
-      C = *itC;                 // x-1
-      D = *itD;                 // y+1
-
-      *dstRow0_it = (C == A && C != D && A != B ? A: P);
-      ++dstRow0_it;
-      *dstRow0_it = (A == B && A != C && B != D ? B: P);
-      ++dstRow0_it;
-
-      *dstRow1_it = (D == C && D != B && C != A ? C: P);
-      ++dstRow1_it;
-      *dstRow1_it = (B == D && B != A && D != C ? D: P);
-      ++dstRow1_it;
-
-      ++itP;
-      ++itA;
-      if (x < src_w-2) ++itB;
-      if (x > 0) ++itC;
-      ++itD;
+      const pixel_t P = rowP[x];
+      const pixel_t A = rowA[x];
+      const pixel_t B = (x < src_w-1 ? rowP[x+1]: P);
+      const pixel_t C = (x > 0 ? rowP[x-1]: P);
+      const pixel_t D = rowD[x];
+
+      *(dstRow0++) = (C == A && C != D && A != B ? A: P);
+      *(dstRow0++) = (A == B && A != C && B != D ? B: P);
+      *(dstRow1++) = (D == C && D != B && C != A ? C: P);
+      *(dstRow1++) = (B == D && B != A && D != C ? D: P);
     }
-
-    // Adjust iterators for the next two rows.
-    ++itB;
-    ++itC;
-    dstRow0_it += dst_w;
-    if (y < src_h-1)
-      dstRow1_it += dst_w;
   }
+}
 
-  // ASSERT(itP == srcEnd);
-  // ASSERT(itA == srcEnd);
-  // ASSERT(itB == srcEnd);
-  // ASSERT(itC == srcEnd);
-  // ASSERT(itD == srcEnd);
-  ASSERT(dstRow0_it == dstRow0_end);
-  ASSERT(dstRow1_it == dstRow1_end);
-#else
-
+// Bits are packed in bytes, so we cannot use pointers to pixels.
+template<>
+void image_scale2x_tpl<BitmapTraits>(Image* dst, const Image* src, int src_w, int src_h)
+{
 #define A c[0]
 #define B c[1]
 #define C c[2]
 #define D c[3]
 #define P c[4]
 
-  LockImageBits<ImageTraits> dstBits(dst, gfx::Rect(0, 0, src_w*2, src_h*2));
+  LockImageBits<BitmapTraits> dstBits(dst, gfx::Rect(0, 0, src_w*2, src_h*2));
   auto dstIt = dstBits.begin();
   auto dstIt2 = dstIt;
 
@@ -132,11 +71,11 @@ static void image_scale2x_tpl(Image* dst, const Image* src, int src_w, int src_h
   for (int y=0; y<src_h; ++y) {
     dstIt2 += src_w*2;
     for (int x=0; x<src_w; ++x) {
-      P = get_pixel_fast<ImageTraits>(src, x, y);
-      A = (y > 0 ? get_pixel_fast<ImageTraits>(src, x, y-1): P);
-      B = (x < src_w-1 ? get_pixel_fast<ImageTraits>(src, x+1, y): P);
-      C = (x > 0 ? get_pixel_fast<ImageTraits>(src, x-1, y): P);
-      D = (y < src_h-1 ? get_pixel_fast<ImageTraits>(src, x, y+1): P);
+      P = get_pixel_fast<BitmapTraits>(src, x, y);
+      A = (y > 0 ? get_pixel_fast<BitmapTraits>(src, x, y-1): P);
+      B = (x < src_w-1 ? get_pixel_fast<BitmapTraits>(src, x+1, y): P);
+      C = (x > 0 ? get_pixel_fast<BitmapTraits>(src, x-1, y): P);
+      D = (y < src_h-1 ? get_pixel_fast<BitmapTraits>(src, x, y+1): P);
 
       *dstIt = (C == A && C != D && A != B ? A: P);
       ++dstIt;
@@ -151,7 +90,11 @@ static void image_scale2x_tpl(Image* dst, const Image* src, int src_w, int src_h
     dstIt += src_w*2;
   }
 
-#endif
+#undef A
+#undef B
+#undef C
+#undef D
+#undef P
 }
 
 static void image_scale2x(Image* dst, const Image* src, int src_w, int src_h)
@@ -168,7 +111,8 @@ void rotsprite_image(Image* bmp, const Image* spr, const Image* mask,
   int x1, int y1, int x2, int y2,
   int x3, int y3, int x4, int y4)
 {
-  static ImageBufferPtr buf[3]; // TODO non-thread safe
+  // Buffers are reused between calls from the same thread
+  thread_local ImageBufferPtr buf[3];
 
   for (int i=0; i<3; ++i)
     if (!buf[i])
@@ -196,13 +140,15 @@ void rotsprite_image(Image* bmp, const Image* spr, const Image* mask,
   tmp_copy->setMaskColor(maskColor);
   spr_copy->setMaskColor(maskColor);
 
-  spr_copy->clear(maskColor);
-  spr_copy->copy(spr, gfx::Clip(spr->bounds()));
+  // Scale the sprite 2x three times alternating between tmp_copy and
+  // spr_copy (to finish with the result in spr_copy) instead of
+  // copying each intermediate result.
+  tmp_copy->copy(spr, gfx::Clip(spr->bounds()));
 
   for (int i=0; i<3; ++i) {
-    // clear_image(tmp_copy, maskColor);
-    image_scale2x(tmp_copy.get(), spr_copy.get(), spr->width()*(1<<i), spr->height()*(1<<i));
-    spr_copy->copy(tmp_copy.get(), gfx::Clip(tmp_copy->bounds()));
+    Image* from = (i == 1 ? spr_copy.get(): tmp_copy.get());
+    Image* to = (i == 1 ? tmp_copy.get(): spr_copy.get());
+    image_scale2x(to, from, spr->width()*(1<<i), spr->height()*(1<<i));
   }
 
   if (mask) {
@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -12,6 +13,8 @@
 
 #include <benchmark/benchmark.h>
 
+#include <vector>
+
 using namespace doc;
 
 static void CustomArguments(benchmark::internal::Benchmark* b) {
@@ -53,4 +56,50 @@ BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_saturation)->Apply(CustomArguments)
 BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_color)->Apply(CustomArguments);
 BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_luminosity)->Apply(CustomArguments);
 
+// Blends a whole row of pixels using the scalar blender (pixel by
+// pixel through a BlendFunc pointer) or the vectorized row blender.
+template<BlendMode blendMode, bool rowBlender>
+void BM_RgbaRow(benchmark::State& state) {
+  const int n = state.range(0);
+  std::vector<color_t> dst(n), src(n);
+  for (int i=0; i<n; ++i) {
+    dst[i] = rgba(i & 255, (i*3) & 255, (i*7) & 255, (i*11) & 255);
+    src[i] = rgba((i*5) & 255, (i*13) & 255, i & 255, (i*17) & 255);
+  }
+  const color_t maskColor = 0;
+  const int opacity = 200;
+  BlendFunc func = get_rgba_blender(blendMode, true);
+  BlendRowFunc rowFunc = get_rgba_row_blender(blendMode, true);
+
+  while (state.KeepRunning()) {
+    if (rowBlender) {
+      rowFunc(&dst[0], &src[0], n, maskColor, opacity);
+    }
+    else {
+      for (int i=0; i<n; ++i) {
+        if (src[i] != maskColor)
+          dst[i] = func(dst[i], src[i], opacity);
+      }
+    }
+    benchmark::DoNotOptimize(&dst[0]);
+  }
+
+  state.counters["MPixels/s"] = benchmark::Counter(
+    double(state.iterations()) * n / 1000000.0,
+    benchmark::Counter::kIsRate);
+}
+
+#define BENCHMARK_ROW(mode)                                             \
+  BENCHMARK_TEMPLATE(BM_RgbaRow, mode, false)->Arg(4096);               \
+  BENCHMARK_TEMPLATE(BM_RgbaRow, mode, true)->Arg(4096);
+
+BENCHMARK_ROW(BlendMode::NORMAL)
+BENCHMARK_ROW(BlendMode::MULTIPLY)
+BENCHMARK_ROW(BlendMode::SCREEN)
+BENCHMARK_ROW(BlendMode::OVERLAY)
+BENCHMARK_ROW(BlendMode::DARKEN)
+BENCHMARK_ROW(BlendMode::LIGHTEN)
+BENCHMARK_ROW(BlendMode::DIFFERENCE)
+BENCHMARK_ROW(BlendMode::ADDITION)
+
 BENCHMARK_MAIN();
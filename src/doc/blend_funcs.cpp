@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019-2020 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -21,10 +21,15 @@
 
 #include "base/debug.h"
 #include "doc/blend_internals.h"
+#include "doc/blend_row_kernels.h"
 
 #include <algorithm>
 #include <cmath>
 
+#if DOC_BLEND_AVX2 && defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
 namespace  {
 
 #define blend_multiply(b, s, t)   (MUL_UN8((b), (s), (t)))
@@ -791,6 +796,67 @@ BlendFunc get_rgba_blender(BlendMode blendmode, const bool newBlend)
   return rgba_blender_src;
 }
 
+template<BlendFunc blend>
+static void rgba_blend_row(color_t* dst, const color_t* src, int n,
+                           color_t maskColor, int opacity)
+{
+  for (; n > 0; --n, ++dst, ++src) {
+    if (*src != maskColor)
+      *dst = blend(*dst, *src, opacity);
+  }
+}
+
+#if DOC_BLEND_AVX2
+bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+
+  // The OS must support AVX registers (OSXSAVE + AVX bits, and the
+  // XMM/YMM states enabled in XCR0)
+  const int osxsaveAndAvx = (1 << 27) | (1 << 28);
+  __cpuid(info, 1);
+  if ((info[2] & osxsaveAndAvx) != osxsaveAndAvx ||
+      (_xgetbv(0) & 6) != 6)
+    return false;
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+BlendRowFunc get_rgba_row_blender(BlendMode blendmode, const bool newBlend)
+{
+#if DOC_BLEND_AVX2
+  static const bool avx2 = cpu_supports_avx2();
+  if (avx2)
+    return blend_rows::get_rgba_row_blender_avx2(blendmode, newBlend);
+#endif
+
+#if DOC_BLEND_SSE2
+  return blend_rows::get_rgba_row_blender_sse2(blendmode, newBlend);
+#else
+  switch (blendmode) {
+    case BlendMode::NORMAL:     return rgba_blend_row<rgba_blender_normal>;
+    case BlendMode::MULTIPLY:   return newBlend? rgba_blend_row<rgba_blender_multiply_n>: rgba_blend_row<rgba_blender_multiply>;
+    case BlendMode::SCREEN:     return newBlend? rgba_blend_row<rgba_blender_screen_n>: rgba_blend_row<rgba_blender_screen>;
+    case BlendMode::OVERLAY:    return newBlend? rgba_blend_row<rgba_blender_overlay_n>: rgba_blend_row<rgba_blender_overlay>;
+    case BlendMode::DARKEN:     return newBlend? rgba_blend_row<rgba_blender_darken_n>: rgba_blend_row<rgba_blender_darken>;
+    case BlendMode::LIGHTEN:    return newBlend? rgba_blend_row<rgba_blender_lighten_n>: rgba_blend_row<rgba_blender_lighten>;
+    case BlendMode::DIFFERENCE: return newBlend? rgba_blend_row<rgba_blender_difference_n>: rgba_blend_row<rgba_blender_difference>;
+    case BlendMode::ADDITION:   return newBlend? rgba_blend_row<rgba_blender_addition_n>: rgba_blend_row<rgba_blender_addition>;
+    default:
+      return nullptr;
+  }
+#endif
+}
+
 BlendFunc get_graya_blender(BlendMode blendmode, const bool newBlend)
 {
   switch (blendmode) {
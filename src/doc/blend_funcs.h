@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -16,6 +16,11 @@ namespace doc {
 
   typedef color_t (*BlendFunc)(color_t backdrop, color_t src, int opacity);
 
+  // Blends a whole row of pixels: dst[i] = blend(dst[i], src[i],
+  // opacity) for each src[i] != maskColor.
+  typedef void (*BlendRowFunc)(color_t* dst, const color_t* src, int n,
+                               color_t maskColor, int opacity);
+
   color_t rgba_blender_src(color_t backdrop, color_t src, int opacity);
   color_t rgba_blender_merge(color_t backdrop, color_t src, int opacity);
   color_t rgba_blender_neg_bw(color_t backdrop, color_t src, int opacity);
@@ -68,6 +73,16 @@ namespace doc {
   BlendFunc get_graya_blender(BlendMode blendmode, const bool newBlend);
   BlendFunc get_indexed_blender(BlendMode blendmode, const bool newBlend);
 
+  // Returns a vectorized (SSE2/AVX2, selected in runtime) row blender
+  // for the given RGBA blend mode, or a scalar one if the CPU doesn't
+  // support it. Returns nullptr if the blend mode doesn't have a row
+  // blender (in that case get_rgba_blender() must be used per pixel).
+  BlendRowFunc get_rgba_row_blender(BlendMode blendmode, const bool newBlend);
+
+  // Returns true if the CPU supports AVX2 (only defined in x86 builds,
+  // where the AVX2 code is compiled).
+  bool cpu_supports_avx2();
+
 } // namespace doc
 
 #endif
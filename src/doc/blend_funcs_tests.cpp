@@ -0,0 +1,93 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/blend_funcs.h"
+
+#include <random>
+#include <vector>
+
+using namespace doc;
+
+static color_t random_color(std::mt19937& rnd)
+{
+  std::uniform_int_distribution<int> dist(0, 255);
+  int a;
+  switch (dist(rnd) % 4) {
+    case 0: a = 0; break;
+    case 1: a = 255; break;
+    default: a = dist(rnd); break;
+  }
+  return rgba(dist(rnd), dist(rnd), dist(rnd), a);
+}
+
+TEST(BlendFuncs, RowBlendersAreEqualToPixelBlenders)
+{
+  const BlendMode modes[] = {
+    BlendMode::NORMAL,
+    BlendMode::MULTIPLY,
+    BlendMode::SCREEN,
+    BlendMode::OVERLAY,
+    BlendMode::DARKEN,
+    BlendMode::LIGHTEN,
+    BlendMode::DIFFERENCE,
+    BlendMode::ADDITION,
+  };
+  const int opacities[] = { 0, 1, 64, 127, 128, 200, 254, 255 };
+  const color_t maskColor = 0;
+
+  // Use an odd number of pixels to test the remaining pixels at the
+  // end of each row
+  std::mt19937 rnd(1234);
+  std::vector<color_t> dst(4099), src(dst.size());
+  for (color_t& c : dst) c = random_color(rnd);
+  for (color_t& c : src) c = random_color(rnd);
+  src[3] = src[10] = maskColor;
+
+  for (const bool newBlend : { false, true }) {
+    for (const BlendMode mode : modes) {
+      BlendFunc blend = get_rgba_blender(mode, newBlend);
+      BlendRowFunc blendRow = get_rgba_row_blender(mode, newBlend);
+      ASSERT_TRUE(blendRow != nullptr);
+
+      for (const int opacity : opacities) {
+        std::vector<color_t> expected(dst);
+        for (size_t i=0; i<expected.size(); ++i) {
+          if (src[i] != maskColor)
+            expected[i] = blend(expected[i], src[i], opacity);
+        }
+
+        std::vector<color_t> result(dst);
+        blendRow(&result[0], &src[0], int(result.size()), maskColor, opacity);
+
+        for (size_t i=0; i<expected.size(); ++i) {
+          ASSERT_EQ(expected[i], result[i])
+            << " mode=" << int(mode)
+            << " newBlend=" << newBlend
+            << " opacity=" << opacity
+            << " dst=" << std::hex << dst[i]
+            << " src=" << src[i];
+        }
+      }
+    }
+  }
+}
+
+TEST(BlendFuncs, RowBlenderWithoutVectorizedVersion)
+{
+  EXPECT_EQ(nullptr, get_rgba_row_blender(BlendMode::HSL_HUE, true));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
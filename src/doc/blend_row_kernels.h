@@ -0,0 +1,305 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_BLEND_ROW_KERNELS_H_INCLUDED
+#define DOC_BLEND_ROW_KERNELS_H_INCLUDED
+#pragma once
+
+// Vectorized RGBA row blenders shared by the SSE2 and AVX2
+// implementations. Each kernel is a template of an "Ops" struct that
+// wraps the intrinsics of a specific instruction set, where a vector
+// (Ops::V) contains Ops::N pixels/channels in 32-bit lanes.
+//
+// The kernels produce exactly the same results as the scalar
+// rgba_blender_*() functions from blend_funcs.cpp (same integer
+// arithmetic, and divisions are done with floats which are exact for
+// the range of values involved).
+
+#include "doc/blend_funcs.h"
+#include "doc/color.h"
+
+namespace doc {
+namespace blend_rows {
+
+  BlendRowFunc get_rgba_row_blender_sse2(BlendMode blendmode, const bool newBlend);
+  BlendRowFunc get_rgba_row_blender_avx2(BlendMode blendmode, const bool newBlend);
+
+  // Separated channels of Ops::N pixels
+  template<typename Ops>
+  struct Pixels {
+    typename Ops::V r, g, b, a;
+  };
+
+  template<typename Ops>
+  inline Pixels<Ops> unpack(const typename Ops::V p) {
+    const auto ff = Ops::set1(0xff);
+    return Pixels<Ops>{
+      Ops::and_(p, ff),
+      Ops::and_(Ops::srli(p, rgba_g_shift), ff),
+      Ops::and_(Ops::srli(p, rgba_b_shift), ff),
+      Ops::srli(p, rgba_a_shift) };
+  }
+
+  template<typename Ops>
+  inline typename Ops::V pack(const typename Ops::V r,
+                              const typename Ops::V g,
+                              const typename Ops::V b,
+                              const typename Ops::V a) {
+    return Ops::or_(Ops::or_(r, Ops::slli(g, rgba_g_shift)),
+                    Ops::or_(Ops::slli(b, rgba_b_shift),
+                             Ops::slli(a, rgba_a_shift)));
+  }
+
+  // Same as MUL_UN8(a, b, t) where a is in [-255, 255] and b in [0, 255]
+  template<typename Ops>
+  inline typename Ops::V mul_un8(const typename Ops::V a,
+                                 const typename Ops::V b) {
+    const auto t = Ops::add(Ops::mul(a, b), Ops::set1(0x80));
+    return Ops::srai(Ops::add(Ops::srai(t, 8), t), 8);
+  }
+
+  template<typename Ops>
+  inline typename Ops::V select(const typename Ops::V mask,
+                                const typename Ops::V a,
+                                const typename Ops::V b) {
+    return Ops::or_(Ops::and_(mask, a), Ops::andnot(mask, b));
+  }
+
+  // rgba_blender_normal()
+  template<typename Ops>
+  inline typename Ops::V normal(const typename Ops::V backdrop,
+                                const Pixels<Ops>& B,
+                                const typename Ops::V src,
+                                const Pixels<Ops>& S,
+                                const typename Ops::V opacity) {
+    const auto zero = Ops::set1(0);
+    const auto Sa = mul_un8<Ops>(S.a, opacity);
+    const auto Ra = Ops::sub(Ops::add(Sa, B.a), mul_un8<Ops>(B.a, Sa));
+
+    // Ra is 0 only when Ba is 0, and that case is handled below
+    const auto div = Ops::max(Ra, Ops::set1(1));
+    const auto Rr = Ops::add(B.r, Ops::div(Ops::mul(Ops::sub(S.r, B.r), Sa), div));
+    const auto Rg = Ops::add(B.g, Ops::div(Ops::mul(Ops::sub(S.g, B.g), Sa), div));
+    const auto Rb = Ops::add(B.b, Ops::div(Ops::mul(Ops::sub(S.b, B.b), Sa), div));
+
+    // Transparent backdrop: (src & rgba_rgb_mask) | Sa
+    const auto transparentBackdrop =
+      Ops::or_(Ops::and_(src, Ops::set1(int(rgba_rgb_mask))),
+               Ops::slli(Sa, rgba_a_shift));
+
+    return select<Ops>(
+      Ops::cmpeq(B.a, zero),
+      transparentBackdrop,
+      select<Ops>(Ops::cmpeq(S.a, zero),
+                  backdrop,
+                  pack<Ops>(Rr, Rg, Rb, Ra)));
+  }
+
+  // rgba_blender_merge() with a different opacity for each pixel
+  template<typename Ops>
+  inline typename Ops::V merge(const Pixels<Ops>& B,
+                               const Pixels<Ops>& S,
+                               const typename Ops::V opacity) {
+    const auto zero = Ops::set1(0);
+    const auto Bzero = Ops::cmpeq(B.a, zero);
+    const auto Szero = Ops::cmpeq(S.a, zero);
+    auto Rr = Ops::add(B.r, mul_un8<Ops>(Ops::sub(S.r, B.r), opacity));
+    auto Rg = Ops::add(B.g, mul_un8<Ops>(Ops::sub(S.g, B.g), opacity));
+    auto Rb = Ops::add(B.b, mul_un8<Ops>(Ops::sub(S.b, B.b), opacity));
+    Rr = select<Ops>(Bzero, S.r, select<Ops>(Szero, B.r, Rr));
+    Rg = select<Ops>(Bzero, S.g, select<Ops>(Szero, B.g, Rg));
+    Rb = select<Ops>(Bzero, S.b, select<Ops>(Szero, B.b, Rb));
+
+    const auto Ra = Ops::add(B.a, mul_un8<Ops>(Ops::sub(S.a, B.a), opacity));
+    const auto Rzero = Ops::cmpeq(Ra, zero);
+    return Ops::andnot(Rzero, pack<Ops>(Rr, Rg, Rb, Ra));
+  }
+
+  // Channel blend functions (the "blend_*" macros of blend_funcs.cpp)
+
+  template<typename Ops>
+  struct Multiply {
+    static typename Ops::V blend(const typename Ops::V b,
+                                 const typename Ops::V s) {
+      return mul_un8<Ops>(b, s);
+    }
+  };
+
+  template<typename Ops>
+  struct Screen {
+    static typename Ops::V blend(const typename Ops::V b,
+                                 const typename Ops::V s) {
+      return Ops::sub(Ops::add(b, s), mul_un8<Ops>(b, s));
+    }
+  };
+
+  template<typename Ops>
+  struct Overlay {
+    // blend_hard_light(s, b)
+    static typename Ops::V blend(const typename Ops::V b,
+                                 const typename Ops::V s) {
+      const auto b2 = Ops::slli(b, 1);
+      return select<Ops>(
+        Ops::cmplt(b, Ops::set1(128)),
+        Multiply<Ops>::blend(s, b2),
+        Screen<Ops>::blend(s, Ops::sub(b2, Ops::set1(255))));
+    }
+  };
+
+  template<typename Ops>
+  struct Darken {
+    static typename Ops::V blend(const typename Ops::V b,
+                                 const typename Ops::V s) {
+      return Ops::min(b, s);
+    }
+  };
+
+  template<typename Ops>
+  struct Lighten {
+    static typename Ops::V blend(const typename Ops::V b,
+                                 const typename Ops::V s) {
+      return Ops::max(b, s);
+    }
+  };
+
+  template<typename Ops>
+  struct Difference {
+    static typename Ops::V blend(const typename Ops::V b,
+                                 const typename Ops::V s) {
+      return Ops::sub(Ops::max(b, s), Ops::min(b, s));
+    }
+  };
+
+  template<typename Ops>
+  struct Addition {
+    static typename Ops::V blend(const typename Ops::V b,
+                                 const typename Ops::V s) {
+      return Ops::min(Ops::add(b, s), Ops::set1(255));
+    }
+  };
+
+  // Normal blend mode
+  template<typename Ops>
+  struct NormalKernel {
+    static typename Ops::V blend(const typename Ops::V backdrop,
+                                 const typename Ops::V src,
+                                 const typename Ops::V opacity) {
+      return normal<Ops>(backdrop, unpack<Ops>(backdrop),
+                         src, unpack<Ops>(src), opacity);
+    }
+  };
+
+  // Old blend method: blend the RGB channels and then compose the
+  // result with the "normal" blend mode.
+  template<typename Ops, template<typename> class Channel>
+  struct SeparableKernel {
+    static typename Ops::V blend(const typename Ops::V backdrop,
+                                 const typename Ops::V src,
+                                 const typename Ops::V opacity) {
+      const Pixels<Ops> B = unpack<Ops>(backdrop);
+      const Pixels<Ops> S = unpack<Ops>(src);
+      const Pixels<Ops> X = { Channel<Ops>::blend(B.r, S.r),
+                              Channel<Ops>::blend(B.g, S.g),
+                              Channel<Ops>::blend(B.b, S.b),
+                              S.a };
+      return normal<Ops>(backdrop, B,
+                         pack<Ops>(X.r, X.g, X.b, X.a), X,
+                         opacity);
+    }
+  };
+
+  // New blend method (RGBA_BLENDER_N macro in blend_funcs.cpp)
+  template<typename Ops, template<typename> class Channel>
+  struct SeparableKernelN {
+    static typename Ops::V blend(const typename Ops::V backdrop,
+                                 const typename Ops::V src,
+                                 const typename Ops::V opacity) {
+      const Pixels<Ops> B = unpack<Ops>(backdrop);
+      const Pixels<Ops> S = unpack<Ops>(src);
+      const Pixels<Ops> X = { Channel<Ops>::blend(B.r, S.r),
+                              Channel<Ops>::blend(B.g, S.g),
+                              Channel<Ops>::blend(B.b, S.b),
+                              S.a };
+
+      const auto normalPixel = normal<Ops>(backdrop, B, src, S, opacity);
+      const auto blendPixel = normal<Ops>(backdrop, B,
+                                          pack<Ops>(X.r, X.g, X.b, X.a), X,
+                                          opacity);
+      const Pixels<Ops> N = unpack<Ops>(normalPixel);
+      const Pixels<Ops> X2 = unpack<Ops>(blendPixel);
+
+      const auto normalToBlendMerge = merge<Ops>(N, X2, B.a);
+      const auto srcTotalAlpha = mul_un8<Ops>(S.a, opacity);
+      const auto compositeAlpha = mul_un8<Ops>(B.a, srcTotalAlpha);
+      const auto result = merge<Ops>(unpack<Ops>(normalToBlendMerge), X2,
+                                     compositeAlpha);
+
+      return select<Ops>(Ops::cmpeq(B.a, Ops::set1(0)),
+                         normalPixel, result);
+    }
+  };
+
+  template<typename Ops, typename Kernel>
+  void blend_row(color_t* dst, const color_t* src, int n,
+                 color_t maskColor, int opacity)
+  {
+    const auto opacityV = Ops::set1(opacity);
+    const auto maskV = Ops::set1(int(maskColor));
+
+    for (; n >= Ops::N; n -= Ops::N, dst += Ops::N, src += Ops::N) {
+      const auto d = Ops::load(dst);
+      const auto s = Ops::load(src);
+      const auto r = Kernel::blend(d, s, opacityV);
+      Ops::store(dst, select<Ops>(Ops::cmpeq(s, maskV), d, r));
+    }
+
+    // Remaining pixels (use a temporary full vector)
+    if (n > 0) {
+      // Plain loops instead of std::copy() to avoid instantiating
+      // inline functions with AVX2 code that might be shared with
+      // other translation units.
+      color_t dstTail[Ops::N], srcTail[Ops::N];
+      for (int i=0; i<Ops::N; ++i) {
+        dstTail[i] = (i < n ? dst[i]: 0);
+        srcTail[i] = (i < n ? src[i]: maskColor);
+      }
+
+      const auto d = Ops::load(dstTail);
+      const auto s = Ops::load(srcTail);
+      const auto r = Kernel::blend(d, s, opacityV);
+      Ops::store(dstTail, select<Ops>(Ops::cmpeq(s, maskV), d, r));
+      for (int i=0; i<n; ++i)
+        dst[i] = dstTail[i];
+    }
+  }
+
+  template<typename Ops>
+  BlendRowFunc get_rgba_row_blender_templ(BlendMode blendmode, const bool newBlend)
+  {
+#define DOC_SEPARABLE_ROW_BLENDER(Channel)                                 \
+    (newBlend ? blend_row<Ops, SeparableKernelN<Ops, Channel>>:            \
+                blend_row<Ops, SeparableKernel<Ops, Channel>>)
+
+    switch (blendmode) {
+      case BlendMode::NORMAL:     return blend_row<Ops, NormalKernel<Ops>>;
+      case BlendMode::MULTIPLY:   return DOC_SEPARABLE_ROW_BLENDER(Multiply);
+      case BlendMode::SCREEN:     return DOC_SEPARABLE_ROW_BLENDER(Screen);
+      case BlendMode::OVERLAY:    return DOC_SEPARABLE_ROW_BLENDER(Overlay);
+      case BlendMode::DARKEN:     return DOC_SEPARABLE_ROW_BLENDER(Darken);
+      case BlendMode::LIGHTEN:    return DOC_SEPARABLE_ROW_BLENDER(Lighten);
+      case BlendMode::DIFFERENCE: return DOC_SEPARABLE_ROW_BLENDER(Difference);
+      case BlendMode::ADDITION:   return DOC_SEPARABLE_ROW_BLENDER(Addition);
+      default:
+        return nullptr;
+    }
+
+#undef DOC_SEPARABLE_ROW_BLENDER
+  }
+
+} // namespace blend_rows
+} // namespace doc
+
+#endif
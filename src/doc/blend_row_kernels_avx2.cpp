@@ -0,0 +1,65 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+//
+// This file must be compiled with AVX2 support (-mavx2 or
+// /arch:AVX2), get_rgba_row_blender() calls this code only if the
+// CPU supports AVX2.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/blend_row_kernels.h"
+
+#include <immintrin.h>
+
+namespace doc {
+namespace blend_rows {
+
+namespace {
+
+// 8 pixels/channels in 32-bit lanes
+struct Avx2Ops {
+  typedef __m256i V;
+  static const int N = 8;
+
+  static V load(const color_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+  static void store(color_t* p, const V a) { _mm256_storeu_si256((__m256i*)p, a); }
+  static V set1(const int v) { return _mm256_set1_epi32(v); }
+  static V and_(const V a, const V b) { return _mm256_and_si256(a, b); }
+  static V or_(const V a, const V b) { return _mm256_or_si256(a, b); }
+  static V andnot(const V mask, const V b) { return _mm256_andnot_si256(mask, b); }
+  static V srli(const V a, const int n) { return _mm256_srli_epi32(a, n); }
+  static V srai(const V a, const int n) { return _mm256_srai_epi32(a, n); }
+  static V slli(const V a, const int n) { return _mm256_slli_epi32(a, n); }
+  static V add(const V a, const V b) { return _mm256_add_epi32(a, b); }
+  static V sub(const V a, const V b) { return _mm256_sub_epi32(a, b); }
+  static V cmpeq(const V a, const V b) { return _mm256_cmpeq_epi32(a, b); }
+  static V cmplt(const V a, const V b) { return _mm256_cmpgt_epi32(b, a); }
+
+  // a*b where a is in [-32768, 32767] and b in [0, 32767] (the 16-bit
+  // multiply-add is faster than _mm256_mullo_epi32())
+  static V mul(const V a, const V b) { return _mm256_madd_epi16(a, b); }
+
+  static V min(const V a, const V b) { return _mm256_min_epi32(a, b); }
+  static V max(const V a, const V b) { return _mm256_max_epi32(a, b); }
+
+  // Integer division truncating to zero
+  static V div(const V a, const V b) {
+    return _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(a),
+                                             _mm256_cvtepi32_ps(b)));
+  }
+};
+
+} // anonymous namespace
+
+BlendRowFunc get_rgba_row_blender_avx2(BlendMode blendmode, const bool newBlend)
+{
+  return get_rgba_row_blender_templ<Avx2Ops>(blendmode, newBlend);
+}
+
+} // namespace blend_rows
+} // namespace doc
@@ -0,0 +1,63 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/blend_row_kernels.h"
+
+#include <emmintrin.h>
+
+namespace doc {
+namespace blend_rows {
+
+namespace {
+
+// 4 pixels/channels in 32-bit lanes
+struct Sse2Ops {
+  typedef __m128i V;
+  static const int N = 4;
+
+  static V load(const color_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+  static void store(color_t* p, const V a) { _mm_storeu_si128((__m128i*)p, a); }
+  static V set1(const int v) { return _mm_set1_epi32(v); }
+  static V and_(const V a, const V b) { return _mm_and_si128(a, b); }
+  static V or_(const V a, const V b) { return _mm_or_si128(a, b); }
+  static V andnot(const V mask, const V b) { return _mm_andnot_si128(mask, b); }
+  static V srli(const V a, const int n) { return _mm_srli_epi32(a, n); }
+  static V srai(const V a, const int n) { return _mm_srai_epi32(a, n); }
+  static V slli(const V a, const int n) { return _mm_slli_epi32(a, n); }
+  static V add(const V a, const V b) { return _mm_add_epi32(a, b); }
+  static V sub(const V a, const V b) { return _mm_sub_epi32(a, b); }
+  static V cmpeq(const V a, const V b) { return _mm_cmpeq_epi32(a, b); }
+  static V cmplt(const V a, const V b) { return _mm_cmplt_epi32(a, b); }
+
+  // a*b where a is in [-32768, 32767] and b in [0, 32767] (SSE2
+  // doesn't have a 32-bit multiplication, but we can use the 16-bit
+  // multiply-add as the high 16-bits of b are zero)
+  static V mul(const V a, const V b) { return _mm_madd_epi16(a, b); }
+
+  // Only for values in [0, 32767] (the high 16-bits are zero)
+  static V min(const V a, const V b) { return _mm_min_epi16(a, b); }
+  static V max(const V a, const V b) { return _mm_max_epi16(a, b); }
+
+  // Integer division truncating to zero
+  static V div(const V a, const V b) {
+    return _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(a),
+                                       _mm_cvtepi32_ps(b)));
+  }
+};
+
+} // anonymous namespace
+
+BlendRowFunc get_rgba_row_blender_sse2(BlendMode blendmode, const bool newBlend)
+{
+  return get_rgba_row_blender_templ<Sse2Ops>(blendmode, newBlend);
+}
+
+} // namespace blend_rows
+} // namespace doc
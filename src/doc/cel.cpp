@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -148,8 +148,8 @@ void Cel::setParentLayer(LayerImage* layer)
 void Cel::fixupImage()
 {
   // Change the mask color to the sprite mask color
-  if (m_layer && image())
-    image()->setMaskColor(m_layer->sprite()->transparentColor());
+  if (m_layer && peekImage())
+    peekImage()->setMaskColor(m_layer->sprite()->transparentColor());
 }
 
 } // namespace doc
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2019 Igara Studio S.A.
+// Copyright (c) 2019-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -41,6 +41,7 @@ namespace doc {
 
     LayerImage* layer() const { return m_layer; }
     Image* image() const { return m_data->image(); }
+    Image* peekImage() const { return m_data->peekImage(); }
     ImageRef imageRef() const { return m_data->imageRef(); }
     CelData* data() const { return const_cast<CelData*>(m_data.get()); }
     CelDataRef dataRef() const { return m_data; }
@@ -16,8 +16,13 @@
 #include "doc/layer.h"
 #include "doc/sprite.h"
 
+#include <mutex>
+
 namespace doc {
 
+// Protects the CelData::m_imageLoader field of all cels
+static std::mutex g_imageLoaderMutex;
+
 CelData::CelData(const ImageRef& image)
   : WithUserData(ObjectType::CelData)
   , m_image(image)
@@ -26,16 +31,18 @@ CelData::CelData(const ImageRef& image)
              image ? image->width(): 0,
              image ? image->height(): 0)
   , m_boundsF(nullptr)
+  , m_hasImageLoader(false)
 {
 }
 
 CelData::CelData(const CelData& celData)
   : WithUserData(ObjectType::CelData)
-  , m_image(celData.m_image)
+  , m_image(celData.imageRef())
   , m_opacity(celData.m_opacity)
   , m_bounds(celData.m_bounds)
   , m_boundsF(celData.m_boundsF ? std::make_unique<gfx::RectF>(*celData.m_boundsF):
                                   nullptr)
+  , m_hasImageLoader(false)
 {
 }
 
@@ -47,9 +54,46 @@ void CelData::setImage(const ImageRef& image)
 {
   ASSERT(image.get());
 
+  {
+    std::lock_guard<std::mutex> lock(g_imageLoaderMutex);
+    m_imageLoader.reset();
+    m_hasImageLoader.store(false, std::memory_order_release);
+  }
+
   m_image = image;
   m_bounds.w = image->width();
   m_bounds.h = image->height();
 }
 
+void CelData::setImageLoader(const ImageLoaderRef& loader)
+{
+  ASSERT(m_image);
+
+  std::lock_guard<std::mutex> lock(g_imageLoaderMutex);
+  m_imageLoader = loader;
+  m_hasImageLoader.store(loader != nullptr, std::memory_order_release);
+}
+
+void CelData::loadImage() const
+{
+  ImageLoaderRef loader;
+  {
+    std::lock_guard<std::mutex> lock(g_imageLoaderMutex);
+    loader = m_imageLoader;
+  }
+  // The image was already loaded by other thread
+  if (!loader)
+    return;
+
+  // If other thread is loading the image, this waits until it's
+  // ready.
+  loader->loadImage(m_image.get());
+
+  std::lock_guard<std::mutex> lock(g_imageLoaderMutex);
+  if (m_imageLoader == loader) {
+    m_imageLoader.reset();
+    m_hasImageLoader.store(false, std::memory_order_release);
+  }
+}
+
 } // namespace doc
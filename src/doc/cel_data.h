@@ -9,11 +9,13 @@
 #define DOC_CEL_DATA_H_INCLUDED
 #pragma once
 
+#include "doc/image_loader.h"
 #include "doc/image_ref.h"
 #include "doc/object.h"
 #include "doc/with_user_data.h"
 #include "gfx/rect.h"
 
+#include <atomic>
 #include <memory>
 
 namespace doc {
@@ -27,11 +29,29 @@ namespace doc {
     gfx::Point position() const { return m_bounds.origin(); }
     const gfx::Rect& bounds() const { return m_bounds; }
     int opacity() const { return m_opacity; }
-    Image* image() const { return const_cast<Image*>(m_image.get()); };
-    ImageRef imageRef() const { return m_image; }
+    Image* image() const {
+      loadImageIfNeeded();
+      return const_cast<Image*>(m_image.get());
+    };
+    ImageRef imageRef() const {
+      loadImageIfNeeded();
+      return m_image;
+    }
+
+    // Returns the image without loading its pixels (see
+    // setImageLoader()). Only to use properties of the image that
+    // don't depend on its pixels (id, size, mask color, etc.).
+    Image* peekImage() const { return const_cast<Image*>(m_image.get()); }
 
     void setImage(const ImageRef& image);
 
+    // Sets an object to fill the pixels of the image the first time
+    // image() or imageRef() is called (from any thread).
+    void setImageLoader(const ImageLoaderRef& loader);
+    bool hasImageLoader() const {
+      return m_hasImageLoader.load(std::memory_order_acquire);
+    }
+
     void setPosition(const gfx::Point& pos) {
       m_bounds.setOrigin(pos);
       if (m_boundsF)
@@ -77,6 +97,12 @@ namespace doc {
     }
 
   private:
+    void loadImageIfNeeded() const {
+      if (hasImageLoader())
+        loadImage();
+    }
+    void loadImage() const;
+
     ImageRef m_image;
     int m_opacity;
     gfx::Rect m_bounds;
@@ -84,6 +110,11 @@ namespace doc {
     // Special bounds for reference layers that can have subpixel
     // position.
     mutable std::unique_ptr<gfx::RectF> m_boundsF;
+
+    // Loader of the image pixels (m_image) in case that they weren't
+    // loaded yet.
+    mutable ImageLoaderRef m_imageLoader;
+    mutable std::atomic<bool> m_hasImageLoader;
   };
 
   typedef std::shared_ptr<CelData> CelDataRef;
@@ -0,0 +1,124 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/cel.h"
+#include "doc/cel_data.h"
+#include "doc/image.h"
+#include "doc/image_loader.h"
+#include "doc/primitives.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace doc;
+
+namespace {
+
+class FillLoader : public ImageLoader {
+public:
+  FillLoader(color_t color) : m_color(color) { }
+  int calls() const { return m_calls; }
+protected:
+  void onLoadImage(Image* image) override {
+    ++m_calls;
+    clear_image(image, m_color);
+  }
+private:
+  color_t m_color;
+  std::atomic<int> m_calls { 0 };
+};
+
+} // anonymous namespace
+
+TEST(CelData, ImageLoader)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 4, 4));
+  clear_image(image.get(), rgba(0, 0, 0, 0));
+
+  Cel cel(0, image);
+  auto loader = std::make_shared<FillLoader>(rgba(255, 0, 0, 255));
+  cel.data()->setImageLoader(loader);
+  EXPECT_TRUE(cel.data()->hasImageLoader());
+  EXPECT_EQ(0, loader->calls());
+
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(cel.image(), 2, 2));
+  EXPECT_FALSE(cel.data()->hasImageLoader());
+  EXPECT_EQ(1, loader->calls());
+
+  cel.image();
+  cel.imageRef();
+  EXPECT_EQ(1, loader->calls());
+}
+
+TEST(CelData, CopyLoadsImage)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 4, 4));
+  clear_image(image.get(), rgba(0, 0, 0, 0));
+
+  CelData celData(image);
+  auto loader = std::make_shared<FillLoader>(rgba(0, 255, 0, 255));
+  celData.setImageLoader(loader);
+
+  CelData copy(celData);
+  EXPECT_FALSE(celData.hasImageLoader());
+  EXPECT_FALSE(copy.hasImageLoader());
+  EXPECT_EQ(1, loader->calls());
+  EXPECT_EQ(rgba(0, 255, 0, 255), get_pixel(copy.image(), 0, 0));
+}
+
+TEST(CelData, SetImageDiscardsLoader)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 4, 4));
+  ImageRef image2(Image::create(IMAGE_RGB, 8, 8));
+  clear_image(image2.get(), rgba(0, 0, 255, 255));
+
+  CelData celData(image);
+  auto loader = std::make_shared<FillLoader>(rgba(0, 255, 0, 255));
+  celData.setImageLoader(loader);
+  celData.setImage(image2);
+
+  EXPECT_FALSE(celData.hasImageLoader());
+  EXPECT_EQ(rgba(0, 0, 255, 255), get_pixel(celData.image(), 0, 0));
+  EXPECT_EQ(0, loader->calls());
+}
+
+TEST(CelData, LoadImageFromSeveralThreads)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 256, 256));
+  clear_image(image.get(), rgba(0, 0, 0, 0));
+
+  CelData celData(image);
+  auto loader = std::make_shared<FillLoader>(rgba(255, 255, 0, 255));
+  celData.setImageLoader(loader);
+
+  std::atomic<int> ok(0);
+  std::vector<std::thread> threads;
+  for (int i=0; i<8; ++i) {
+    threads.emplace_back([&celData, &ok]{
+      if (get_pixel(celData.image(), 255, 255) == rgba(255, 255, 0, 255))
+        ++ok;
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  EXPECT_EQ(8, ok);
+  EXPECT_EQ(1, loader->calls());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018-2020 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -23,6 +23,9 @@ namespace doc {
 Image::Image(const ImageSpec& spec)
   : Object(ObjectType::Image)
   , m_spec(spec)
+  , m_hash(0)
+  , m_hashVersion(0)
+  , m_hashValid(false)
 {
 }
 
@@ -45,6 +48,16 @@ int Image::getRowStrideSize(int pixels_per_row) const
   return calculate_rowstride_bytes(pixelFormat(), pixels_per_row);
 }
 
+uint64_t Image::contentHash() const
+{
+  if (!m_hashValid || m_hashVersion != version()) {
+    m_hash = calculate_image_hash(this, bounds());
+    m_hashVersion = version();
+    m_hashValid = true;
+  }
+  return m_hash;
+}
+
 // static
 Image* Image::create(PixelFormat format, int width, int height,
                      const ImageBufferPtr& buffer)
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018-2020 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -85,11 +85,22 @@ namespace doc {
     virtual void fillRect(int x1, int y1, int x2, int y2, color_t color) = 0;
     virtual void blendRect(int x1, int y1, int x2, int y2, color_t color, int opacity) = 0;
 
+    // Returns calculate_image_hash() of the whole image. The value is
+    // cached until the image version changes, so incrementVersion()
+    // must be called after modifying the pixels of an image that was
+    // already hashed.
+    uint64_t contentHash() const;
+
   protected:
     Image(const ImageSpec& spec);
 
   private:
     ImageSpec m_spec;
+
+    // Cached contentHash() value and the version it was calculated for.
+    mutable uint64_t m_hash;
+    mutable ObjectVersion m_hashVersion;
+    mutable bool m_hashValid;
   };
 
 } // namespace doc
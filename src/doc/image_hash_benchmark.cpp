@@ -0,0 +1,122 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/image_impl.h"
+#include "doc/images_map.h"
+#include "doc/primitives.h"
+
+#include <benchmark/benchmark.h>
+
+#include <set>
+#include <vector>
+
+using namespace doc;
+
+// Old calculate_image_hash() implementation (shifts the hash one bit
+// per channel, so only the last pixels of the image are relevant).
+static uint32_t legacy_image_hash(const Image* image)
+{
+  uint32_t hash = 0;
+  for (int y=0; y<image->height(); ++y) {
+    auto p = (RgbTraits::address_t)image->getPixelAddress(0, y);
+    for (int x=0; x<image->width(); ++x, ++p) {
+      uint32_t value = *p;
+      uint32_t mask = rgba_rgb_mask;
+      while (mask) {
+        hash += value & mask & 0xff;
+        hash <<= 1;
+        value >>= 8;
+        mask >>= 8;
+      }
+    }
+  }
+  return hash;
+}
+
+struct legacy_hash {
+  size_t operator()(const ImageRef& i) const {
+    return legacy_image_hash(i.get());
+  }
+};
+
+typedef std::unordered_map<ImageRef,
+                           uint32_t,
+                           legacy_hash,
+                           details::image_eq> LegacyImagesMap;
+
+// Creates the frames of a sprite sheet where each frame has a
+// different sprite in the top-left corner but all frames end with
+// the same pixels (e.g. the same ground/background).
+static std::vector<ImageRef> create_sheet_frames(const int nframes)
+{
+  const int w = 64, h = 64;
+  std::vector<ImageRef> frames;
+  frames.reserve(nframes);
+  for (int i=0; i<nframes; ++i) {
+    ImageRef image(Image::create(IMAGE_RGB, w, h));
+    clear_image(image.get(), rgba(0, 0, 0, 0));
+    fill_rect(image.get(), 0, h-8, w-1, h-1, rgba(64, 128, 32, 255));
+    const int x = i % 32;
+    const int y = (i / 32) % 32;
+    fill_rect(image.get(), x, y, x+3, y+3, rgba(255, i % 256, 0, 255));
+    frames.push_back(image);
+  }
+  return frames;
+}
+
+template<typename Map, typename Hash>
+static void BM_MergeDuplicates(benchmark::State& state) {
+  const std::vector<ImageRef> frames = create_sheet_frames(state.range(0));
+
+  std::set<size_t> hashes;
+  Hash hash;
+  for (const auto& frame : frames)
+    hashes.insert(hash(frame));
+
+  int unique = 0;
+  while (state.KeepRunning()) {
+    Map duplicates;
+    for (uint32_t i=0; i<frames.size(); ++i) {
+      // Simulate a new rendered sample in each iteration
+      frames[i]->incrementVersion();
+      if (duplicates.find(frames[i]) == duplicates.end())
+        duplicates[frames[i]] = i;
+    }
+    unique = int(duplicates.size());
+  }
+
+  state.counters["unique_images"] = unique;
+  state.counters["collisions"] = unique - int(hashes.size());
+  state.SetItemsProcessed(state.iterations() * frames.size());
+}
+
+static void BM_HashImage(benchmark::State& state) {
+  const int w = state.range(0);
+  const int h = state.range(0);
+  ImageRef image(Image::create(IMAGE_RGB, w, h));
+  clear_image(image.get(), rgba(32, 64, 128, 255));
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(calculate_image_hash(image.get(), image->bounds()));
+  }
+  state.SetBytesProcessed(state.iterations() * w * h * sizeof(RgbTraits::pixel_t));
+}
+
+BENCHMARK_TEMPLATE(BM_MergeDuplicates, LegacyImagesMap, legacy_hash)
+  ->Arg(2000)
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MergeDuplicates, ImagesMap, details::image_hash)
+  ->Arg(2000)
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK(BM_HashImage)
+  ->Arg(64)->Arg(256)->Arg(1024);
+
+BENCHMARK_MAIN();
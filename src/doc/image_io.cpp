@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2020 Igara Studio S.A.
+// Copyright (c) 2020-2022 Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -20,6 +20,7 @@
 #include <algorithm>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 namespace doc {
 
@@ -28,7 +29,8 @@ using namespace base::serialization::little_endian;
 
 // TODO Create a zlib wrapper for iostreams
 
-bool write_image(std::ostream& os, const Image* image, CancelIO* cancel)
+bool write_image(std::ostream& os, const Image* image, CancelIO* cancel,
+                 int compressionLevel)
 {
   write32(os, image->id());
   write8(os, image->pixelFormat());    // Pixel format
@@ -51,7 +53,7 @@ bool write_image(std::ostream& os, const Image* image, CancelIO* cancel)
     zstream.zalloc = (alloc_func)0;
     zstream.zfree  = (free_func)0;
     zstream.opaque = (voidpf)0;
-    int err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+    int err = deflateInit(&zstream, compressionLevel);
     if (err != Z_OK)
       throw base::Exception("ZLib error %d in deflateInit().", err);
 
@@ -194,4 +196,130 @@ Image* read_image(std::istream& is, bool setId)
   return image.release();
 }
 
+bool write_image_tiles(std::ostream& os, const Image* image,
+                       const std::vector<gfx::Rect>& tiles,
+                       CancelIO* cancel,
+                       int compressionLevel)
+{
+  ASSERT(image->pixelFormat() != IMAGE_BITMAP);
+
+  write32(os, tiles.size());
+  for (const gfx::Rect& tile : tiles) {
+    ASSERT(image->bounds().contains(tile));
+    write32(os, tile.x);
+    write32(os, tile.y);
+    write32(os, tile.w);
+    write32(os, tile.h);
+  }
+
+  std::ostream::pos_type total_output_pos = os.tellp();
+  write32(os, 0);    // Compressed size (we update this value later)
+
+  z_stream zstream;
+  zstream.zalloc = (alloc_func)0;
+  zstream.zfree  = (free_func)0;
+  zstream.opaque = (voidpf)0;
+  int err = deflateInit(&zstream, compressionLevel);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in deflateInit().", err);
+
+  std::vector<uint8_t> compressed(4096);
+  int total_output_bytes = 0;
+
+  // Each row of each tile is added to the same zlib stream
+  for (size_t i=0; i<tiles.size(); ++i) {
+    const gfx::Rect& tile = tiles[i];
+    const int rowSize = image->getRowStrideSize(tile.w);
+
+    if (cancel && cancel->isCanceled()) {
+      deflateEnd(&zstream);
+      return false;
+    }
+
+    for (int y=0; y<tile.h; ++y) {
+      zstream.next_in = (Bytef*)image->getPixelAddress(tile.x, tile.y+y);
+      zstream.avail_in = rowSize;
+      int flush = (i == tiles.size()-1 && y == tile.h-1 ? Z_FINISH: Z_NO_FLUSH);
+
+      do {
+        zstream.next_out = (Bytef*)&compressed[0];
+        zstream.avail_out = compressed.size();
+
+        err = deflate(&zstream, flush);
+        if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+          throw base::Exception("ZLib error %d in deflate().", err);
+
+        int output_bytes = compressed.size() - zstream.avail_out;
+        if (output_bytes > 0) {
+          if (os.write((char*)&compressed[0], output_bytes).fail())
+            throw base::Exception("Error writing compressed image pixels.\n");
+
+          total_output_bytes += output_bytes;
+        }
+      } while (zstream.avail_out == 0);
+    }
+  }
+
+  err = deflateEnd(&zstream);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in deflateEnd().", err);
+
+  std::ostream::pos_type bak = os.tellp();
+  os.seekp(total_output_pos);
+  write32(os, total_output_bytes);
+  os.seekp(bak);
+  return true;
+}
+
+bool read_image_tiles(std::istream& is, Image* image)
+{
+  ASSERT(image->pixelFormat() != IMAGE_BITMAP);
+
+  const int ntiles = read32(is);
+  if (ntiles < 0)
+    return false;
+
+  std::vector<gfx::Rect> tiles(ntiles);
+  size_t uncompressed_size = 0;
+  for (gfx::Rect& tile : tiles) {
+    tile.x = int(read32(is));
+    tile.y = int(read32(is));
+    tile.w = int(read32(is));
+    tile.h = int(read32(is));
+    if (tile.isEmpty() || !image->bounds().contains(tile))
+      return false;
+
+    uncompressed_size += size_t(image->getRowStrideSize(tile.w)) * tile.h;
+  }
+
+  const int avail_bytes = read32(is);
+  if (avail_bytes < 0)
+    return false;
+  if (tiles.empty())
+    return true;
+
+  std::vector<uint8_t> compressed(avail_bytes);
+  if (avail_bytes > 0 &&
+      is.read((char*)&compressed[0], avail_bytes).fail())
+    throw base::Exception("Error reading stream to restore image");
+
+  std::vector<uint8_t> uncompressed(uncompressed_size);
+  uLongf dest_size = uncompressed.size();
+  int err = uncompress(&uncompressed[0], &dest_size,
+                       (compressed.empty() ? nullptr: &compressed[0]),
+                       compressed.size());
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in uncompress().", err);
+  if (dest_size != uncompressed.size())
+    throw base::Exception("Bad compressed image.");
+
+  const uint8_t* src = &uncompressed[0];
+  for (const gfx::Rect& tile : tiles) {
+    const int rowSize = image->getRowStrideSize(tile.w);
+    for (int y=0; y<tile.h; ++y, src+=rowSize)
+      std::copy(src, src+rowSize, image->getPixelAddress(tile.x, tile.y+y));
+  }
+  return true;
+}
+
 }
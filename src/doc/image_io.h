@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -8,16 +9,30 @@
 #define DOC_IMAGE_IO_H_INCLUDED
 #pragma once
 
+#include "gfx/rect.h"
+
 #include <iosfwd>
+#include <vector>
 
 namespace doc {
 
   class CancelIO;
   class Image;
 
-  bool write_image(std::ostream& os, const Image* image, CancelIO* cancel = nullptr);
+  // The compressionLevel is the zlib level (-1 is the default level)
+  bool write_image(std::ostream& os, const Image* image, CancelIO* cancel = nullptr,
+                   int compressionLevel = -1);
   Image* read_image(std::istream& is, bool setId = true);
 
+  // Writes/reads the pixels of the given rectangles of an image
+  // (e.g. to save just the modified regions of an existing image).
+  // Bitmap images are not supported.
+  bool write_image_tiles(std::ostream& os, const Image* image,
+                         const std::vector<gfx::Rect>& tiles,
+                         CancelIO* cancel = nullptr,
+                         int compressionLevel = -1);
+  bool read_image_tiles(std::istream& is, Image* image);
+
 } // namespace doc
 
 #endif
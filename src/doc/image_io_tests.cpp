@@ -0,0 +1,82 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_io.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+
+#include <sstream>
+
+using namespace doc;
+
+TEST(ImageIO, WriteReadImage)
+{
+  ImageRef a(Image::create(IMAGE_RGB, 33, 17));
+  for (int y=0; y<a->height(); ++y)
+    for (int x=0; x<a->width(); ++x)
+      put_pixel(a.get(), x, y, rgba(x, y, x+y, 255));
+
+  std::stringstream s;
+  EXPECT_TRUE(write_image(s, a.get(), nullptr, 1));
+
+  ImageRef b(read_image(s, false));
+  ASSERT_TRUE(b != nullptr);
+  EXPECT_EQ(0, count_diff_between_images(a.get(), b.get()));
+}
+
+TEST(ImageIO, WriteReadImageTiles)
+{
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    ImageRef a(Image::create(format, 100, 70));
+    ImageRef b(Image::create(format, 100, 70));
+    clear_image(a.get(), 0);
+    clear_image(b.get(), 0);
+
+    const std::vector<gfx::Rect> tiles = {
+      gfx::Rect(0, 0, 64, 64),
+      gfx::Rect(64, 64, 36, 6),
+      gfx::Rect(10, 65, 3, 1) };
+    for (const gfx::Rect& tile : tiles)
+      for (int y=tile.y; y<tile.y2(); ++y)
+        for (int x=tile.x; x<tile.x2(); ++x)
+          put_pixel(a.get(), x, y, (x+y*3) & 0x7f);
+
+    // This pixel is outside the tiles, so it isn't copied
+    put_pixel(a.get(), 99, 0, 1);
+
+    std::stringstream s;
+    EXPECT_TRUE(write_image_tiles(s, a.get(), tiles));
+    EXPECT_TRUE(read_image_tiles(s, b.get()));
+
+    EXPECT_EQ(0, get_pixel(b.get(), 99, 0));
+    put_pixel(a.get(), 99, 0, 0);
+    EXPECT_EQ(0, count_diff_between_images(a.get(), b.get()));
+  }
+}
+
+TEST(ImageIO, ReadImageTilesOutsideBounds)
+{
+  ImageRef a(Image::create(IMAGE_RGB, 32, 32));
+  ImageRef b(Image::create(IMAGE_RGB, 16, 16));
+  clear_image(a.get(), 0);
+
+  std::stringstream s;
+  EXPECT_TRUE(write_image_tiles(s, a.get(), { gfx::Rect(0, 0, 32, 32) }));
+  EXPECT_FALSE(read_image_tiles(s, b.get()));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,44 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_IMAGE_LOADER_H_INCLUDED
+#define DOC_IMAGE_LOADER_H_INCLUDED
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+namespace doc {
+
+  class Image;
+
+  // Fills the pixels of an image the first time they are needed
+  // (e.g. to decode the compressed pixels of a cel loaded from a
+  // file). See CelData::setImageLoader().
+  class ImageLoader {
+  public:
+    virtual ~ImageLoader() { }
+
+    // Calls onLoadImage() just one time even if this function is
+    // called from several threads at the same time (the other
+    // threads wait until the image is loaded).
+    void loadImage(Image* image) {
+      std::call_once(m_once, [this, image]{ onLoadImage(image); });
+    }
+
+  protected:
+    // Must not throw exceptions.
+    virtual void onLoadImage(Image* image) = 0;
+
+  private:
+    std::once_flag m_once;
+  };
+
+  typedef std::shared_ptr<ImageLoader> ImageLoaderRef;
+
+} // namespace doc
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -153,6 +153,67 @@ TEST(Image, DiffRgbImages)
   ASSERT_FALSE(is_same_image(a.get(), b.get()));
 }
 
+TEST(Image, HashRgbImages)
+{
+  std::unique_ptr<Image> a(Image::create(IMAGE_RGB, 31, 17));
+  std::unique_ptr<Image> b(Image::create(IMAGE_RGB, 31, 17));
+
+  clear_image(a.get(), rgba(0, 0, 0, 0));
+  clear_image(b.get(), rgba(0, 0, 0, 0));
+  EXPECT_EQ(a->contentHash(), b->contentHash());
+
+  // Same hash because alpha=0
+  put_pixel(a.get(), 0, 0, rgba(255, 0, 0, 0));
+  a->incrementVersion();
+  EXPECT_EQ(a->contentHash(), b->contentHash());
+
+  // Only the first pixel is different
+  put_pixel(a.get(), 0, 0, rgba(255, 0, 0, 255));
+  a->incrementVersion();
+  EXPECT_NE(a->contentHash(), b->contentHash());
+
+  put_pixel(b.get(), 0, 0, rgba(255, 0, 0, 255));
+  b->incrementVersion();
+  EXPECT_EQ(a->contentHash(), b->contentHash());
+
+  // The cached hash is used until the version changes
+  const uint64_t oldHash = a->contentHash();
+  put_pixel(a.get(), 30, 16, rgba(0, 0, 255, 128));
+  EXPECT_EQ(oldHash, a->contentHash());
+  a->incrementVersion();
+  EXPECT_NE(oldHash, a->contentHash());
+  EXPECT_EQ(calculate_image_hash(a.get(), a->bounds()), a->contentHash());
+}
+
+TYPED_TEST(ImageAllTypes, HashDependsOnEachPixel)
+{
+  typedef TypeParam ImageTraits;
+
+  std::unique_ptr<Image> a(Image::create(ImageTraits::pixel_format, 19, 7));
+  std::unique_ptr<Image> b(Image::create(ImageTraits::pixel_format, 19, 7));
+  clear_image(a.get(), 0);
+  clear_image(b.get(), 0);
+  const uint64_t emptyHash = calculate_image_hash(a.get(), a->bounds());
+
+  for (int y=0; y<a->height(); ++y) {
+    for (int x=0; x<a->width(); ++x) {
+      put_pixel(a.get(), x, y, ImageTraits::max_value);
+      EXPECT_NE(emptyHash, calculate_image_hash(a.get(), a->bounds()));
+      EXPECT_NE(calculate_image_hash(a.get(), a->bounds()),
+                calculate_image_hash(b.get(), b->bounds()));
+      put_pixel(b.get(), x, y, get_pixel(a.get(), x, y));
+      EXPECT_EQ(calculate_image_hash(a.get(), a->bounds()),
+                calculate_image_hash(b.get(), b->bounds()));
+    }
+  }
+
+  // Same pixels in a sub-rectangle
+  const gfx::Rect rc(3, 2, 9, 4);
+  std::unique_ptr<Image> c(crop_image(a.get(), rc, 0));
+  EXPECT_EQ(calculate_image_hash(a.get(), rc),
+            calculate_image_hash(c.get(), c->bounds()));
+}
+
 TYPED_TEST(ImageAllTypes, DrawHLine)
 {
   typedef TypeParam ImageTraits;
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2020-2021  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -325,9 +325,9 @@ void LayerImage::addCel(Cel* cel)
 {
   ASSERT(cel);
   ASSERT(cel->data() && "The cel doesn't contain CelData");
-  ASSERT(cel->image());
+  ASSERT(cel->peekImage());
   ASSERT(sprite());
-  ASSERT(cel->image()->pixelFormat() == sprite()->pixelFormat());
+  ASSERT(cel->peekImage()->pixelFormat() == sprite()->pixelFormat());
 
   CelIterator it = findFirstCelIteratorAfter(cel->frame());
   m_cels.insert(it, cel);
@@ -14,35 +14,250 @@
 #include "base/memory.h"
 #include "doc/image_impl.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_MASK_USE_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace doc {
 
 namespace {
 
-  template<typename Func>
-  void for_each_mask_pixel(Mask& a, const Mask& b, Func f) {
-    a.reserve(b.bounds());
-
-    {
-      LockImageBits<BitmapTraits> aBits(a.bitmap());
-      auto aIt = aBits.begin();
-
-      auto bounds = a.bounds();
-      for (int y=0; y<bounds.h; ++y) {
-        for (int x=0; x<bounds.w; ++x, ++aIt) {
-          color_t aColor = *aIt;
-          color_t bColor = (b.containsPoint(bounds.x+x,
-                                            bounds.y+y) ? 1: 0);
-          *aIt = f(aColor, bColor);
-        }
+  // Bitmap rows contain 8 pixels per byte, where the pixel "x" is the
+  // bit (x % 8) of the byte (x / 8). The following functions process
+  // up to 56 pixels at the same time using 64-bit words.
+
+  // Returns the 8 bytes of the row starting at "byte" (bytes outside
+  // the row are zero).
+  inline uint64_t load_bits(const uint8_t* row, const int rowBytes, const int byte) {
+    uint64_t bits = 0;
+    if (byte+8 <= rowBytes) {
+      for (int i=0; i<8; ++i)
+        bits |= uint64_t(row[byte+i]) << (8*i);
+    }
+    else {
+      for (int i=0; i<rowBytes-byte; ++i)
+        bits |= uint64_t(row[byte+i]) << (8*i);
+    }
+    return bits;
+  }
+
+  inline void store_bits(uint8_t* row, const int rowBytes, const int byte, const uint64_t bits) {
+    if (byte+8 <= rowBytes) {
+      for (int i=0; i<8; ++i)
+        row[byte+i] = uint8_t(bits >> (8*i));
+    }
+    else {
+      for (int i=0; i<rowBytes-byte; ++i)
+        row[byte+i] = uint8_t(bits >> (8*i));
+    }
+  }
+
+  // Replaces "n" pixels of the "dst" row starting at "dstX" with
+  // op(dst, src), where "src" are "n" pixels of the "src" row
+  // starting at "srcX". Pixels outside the range are not modified.
+  template<typename Op>
+  void combine_bits(uint8_t* dst, const int dstRowBytes, int dstX,
+                    const uint8_t* src, const int srcRowBytes, int srcX,
+                    int n, Op op) {
+    while (n > 0) {
+      const int k = std::min(n, 56);
+      const uint64_t kmask = (uint64_t(1) << k) - 1;
+      const int shift = (dstX & 7);
+      const uint64_t s = (load_bits(src, srcRowBytes, srcX >> 3) >> (srcX & 7));
+      uint64_t d = load_bits(dst, dstRowBytes, dstX >> 3);
+      const uint64_t r = (op(d >> shift, s) & kmask);
+      d = (d & ~(kmask << shift)) | (r << shift);
+      store_bits(dst, dstRowBytes, dstX >> 3, d);
+
+      dstX += k;
+      srcX += k;
+      n -= k;
+    }
+  }
+
+  inline void clear_bits(uint8_t* row, const int rowBytes, const int x, const int n) {
+    combine_bits(row, rowBytes, x, row, rowBytes, x, n,
+                 [](uint64_t, uint64_t) -> uint64_t { return 0; });
+  }
+
+  // Returns the first/last pixels of the row with a 1 (or false if
+  // all the pixels of the row are 0).
+  bool row_bits_range(const uint8_t* row, const int rowBytes, const int w,
+                      int& first, int& last) {
+    first = last = -1;
+    for (int x=0; x<w; x+=64) {
+      uint64_t bits = load_bits(row, rowBytes, x >> 3);
+      if (w-x < 64)
+        bits &= (uint64_t(1) << (w-x)) - 1;
+      if (bits) {
+        int i = 0;
+        while (!(bits & (uint64_t(1) << i)))
+          ++i;
+        first = x+i;
+        break;
       }
     }
+    if (first < 0)
+      return false;
+
+    for (int x=((w-1) & ~63); x>=0; x-=64) {
+      uint64_t bits = load_bits(row, rowBytes, x >> 3);
+      if (w-x < 64)
+        bits &= (uint64_t(1) << (w-x)) - 1;
+      if (bits) {
+        int i = 63;
+        while (!(bits & (uint64_t(1) << i)))
+          --i;
+        last = x+i;
+        break;
+      }
+    }
+    return true;
+  }
+
+  // Combines the pixels of "a" that are inside the "b" bounds with
+  // the "b" pixels (a = op(a, b)).
+  template<typename Op>
+  void combine_masks(Mask& a, const Mask& b, Op op) {
+    const gfx::Rect bounds = a.bounds().createIntersection(b.bounds());
+    if (bounds.isEmpty())
+      return;
+
+    Image* aBitmap = a.bitmap();
+    const Image* bBitmap = b.bitmap();
+    const int aRowBytes = BitmapTraits::getRowStrideBytes(aBitmap->width());
+    const int bRowBytes = BitmapTraits::getRowStrideBytes(bBitmap->width());
+
+    for (int y=bounds.y; y<bounds.y2(); ++y) {
+      combine_bits(aBitmap->getPixelAddress(0, y-a.bounds().y), aRowBytes,
+                   bounds.x-a.bounds().x,
+                   bBitmap->getPixelAddress(0, y-b.bounds().y), bRowBytes,
+                   bounds.x-b.bounds().x,
+                   bounds.w, op);
+    }
+  }
+
+  // Functions used by Mask::byColor() to convert one row of pixels to
+  // one row of the mask bitmap, a pixel is selected if the difference
+  // of each channel with the given color is <= fuzziness.
+
+  inline bool match_rgb(const color_t c, const color_t color, const int fuzziness) {
+    return (std::abs(int(rgba_getr(c)) - int(rgba_getr(color))) <= fuzziness &&
+            std::abs(int(rgba_getg(c)) - int(rgba_getg(color))) <= fuzziness &&
+            std::abs(int(rgba_getb(c)) - int(rgba_getb(color))) <= fuzziness &&
+            std::abs(int(rgba_geta(c)) - int(rgba_geta(color))) <= fuzziness);
+  }
+
+  inline bool match_gray(const color_t c, const color_t color, const int fuzziness) {
+    return (std::abs(int(graya_getv(c)) - int(graya_getv(color))) <= fuzziness &&
+            std::abs(int(graya_geta(c)) - int(graya_geta(color))) <= fuzziness);
+  }
 
-    a.shrink();
+  inline bool match_index(const color_t c, const color_t color, const int fuzziness) {
+    return (std::abs(int(c) - int(color)) <= fuzziness);
   }
 
+  // Writes the bits of the pixels from "x" to "w" using the given
+  // per pixel function ("x" must be a multiple of 8).
+  template<typename Traits, typename Match>
+  void match_row_tail(const typename Traits::pixel_t* src, uint8_t* dst,
+                      int x, const int w,
+                      const color_t color, const int fuzziness, Match match) {
+    ASSERT((x & 7) == 0);
+    for (; x<w; x+=8) {
+      uint8_t bits = 0;
+      for (int i=0; i<8 && x+i<w; ++i) {
+        if (match(src[x+i], color, fuzziness))
+          bits |= (1 << i);
+      }
+      dst[x >> 3] = bits;
+    }
+  }
+
+#if DOC_MASK_USE_SSE2
+
+  // Returns 0xff in each byte where |a - b| <= fuzz (SIMD versions
+  // are used only with fuzziness >= 0, saturated to 255 in "fuzz").
+  inline __m128i sse2_match_bytes(const __m128i a, const __m128i b, const __m128i fuzz) {
+    const __m128i diff = _mm_or_si128(_mm_subs_epu8(a, b),
+                                      _mm_subs_epu8(b, a));
+    // diff <= fuzz  <=>  max(diff, fuzz) == fuzz
+    return _mm_cmpeq_epi8(_mm_max_epu8(diff, fuzz), fuzz);
+  }
+
+  void match_rgb_row(const uint32_t* src, uint8_t* dst, const int w,
+                     const color_t color, const int fuzziness) {
+    const __m128i c = _mm_set1_epi32(int(color));
+    const __m128i fuzz = _mm_set1_epi8(char(std::clamp(fuzziness, 0, 255)));
+    const __m128i ones = _mm_set1_epi8(char(0xff));
+    int x = 0;
+    for (; fuzziness >= 0 && x+8<=w; x+=8) {
+      // A pixel matches if its 4 channels match (the 32-bit lane is
+      // all ones).
+      const __m128i m0 = _mm_cmpeq_epi32(
+        sse2_match_bytes(_mm_loadu_si128((const __m128i*)(src+x)), c, fuzz), ones);
+      const __m128i m1 = _mm_cmpeq_epi32(
+        sse2_match_bytes(_mm_loadu_si128((const __m128i*)(src+x+4)), c, fuzz), ones);
+      dst[x >> 3] = uint8_t(_mm_movemask_ps(_mm_castsi128_ps(m0)) |
+                            (_mm_movemask_ps(_mm_castsi128_ps(m1)) << 4));
+    }
+    match_row_tail<RgbTraits>(src, dst, x, w, color, fuzziness, match_rgb);
+  }
+
+  void match_gray_row(const uint16_t* src, uint8_t* dst, const int w,
+                      const color_t color, const int fuzziness) {
+    const __m128i c = _mm_set1_epi16(short(color));
+    const __m128i fuzz = _mm_set1_epi8(char(std::clamp(fuzziness, 0, 255)));
+    const __m128i ones = _mm_set1_epi8(char(0xff));
+    int x = 0;
+    for (; fuzziness >= 0 && x+8<=w; x+=8) {
+      const __m128i m = _mm_cmpeq_epi16(
+        sse2_match_bytes(_mm_loadu_si128((const __m128i*)(src+x)), c, fuzz), ones);
+      // Pack the 16-bit lanes (0 or -1) in the 8 lower bytes
+      dst[x >> 3] = uint8_t(_mm_movemask_epi8(_mm_packs_epi16(m, _mm_setzero_si128())));
+    }
+    match_row_tail<GrayscaleTraits>(src, dst, x, w, color, fuzziness, match_gray);
+  }
+
+  void match_index_row(const uint8_t* src, uint8_t* dst, const int w,
+                       const color_t color, const int fuzziness) {
+    const __m128i c = _mm_set1_epi8(char(color));
+    const __m128i fuzz = _mm_set1_epi8(char(std::clamp(fuzziness, 0, 255)));
+    int x = 0;
+    for (; fuzziness >= 0 && x+16<=w; x+=16) {
+      const int m = _mm_movemask_epi8(
+        sse2_match_bytes(_mm_loadu_si128((const __m128i*)(src+x)), c, fuzz));
+      dst[x >> 3] = uint8_t(m);
+      dst[(x >> 3)+1] = uint8_t(m >> 8);
+    }
+    match_row_tail<IndexedTraits>(src, dst, x, w, color, fuzziness, match_index);
+  }
+
+#else
+
+  void match_rgb_row(const uint32_t* src, uint8_t* dst, const int w,
+                     const color_t color, const int fuzziness) {
+    match_row_tail<RgbTraits>(src, dst, 0, w, color, fuzziness, match_rgb);
+  }
+
+  void match_gray_row(const uint16_t* src, uint8_t* dst, const int w,
+                      const color_t color, const int fuzziness) {
+    match_row_tail<GrayscaleTraits>(src, dst, 0, w, color, fuzziness, match_gray);
+  }
+
+  void match_index_row(const uint8_t* src, uint8_t* dst, const int w,
+                       const color_t color, const int fuzziness) {
+    match_row_tail<IndexedTraits>(src, dst, 0, w, color, fuzziness, match_index);
+  }
+
+#endif
+
 } // namespace namespace
 
 Mask::Mask()
@@ -100,12 +315,17 @@ bool Mask::isRectangular() const
   if (!m_bitmap)
     return false;
 
-  LockImageBits<BitmapTraits> bits(m_bitmap.get());
-  LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
+  const int w = m_bitmap->width();
+  const int rowBytes = BitmapTraits::getRowStrideBytes(w);
 
-  for (; it != end; ++it) {
-    if (*it == 0)
-      return false;
+  for (int y=0; y<m_bitmap->height(); ++y) {
+    const uint8_t* row = m_bitmap->getPixelAddress(0, y);
+    for (int x=0; x<w; x+=56) {
+      const int n = std::min(w-x, 56);
+      const uint64_t nmask = (uint64_t(1) << n) - 1;
+      if (((load_bits(row, rowBytes, x >> 3) >> (x & 7)) & nmask) != nmask)
+        return false;
+    }
   }
 
   return true;
@@ -145,11 +365,14 @@ void Mask::invert()
   if (!m_bitmap)
     return;
 
-  LockImageBits<BitmapTraits> bits(m_bitmap.get());
-  LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
+  const int w = m_bitmap->width();
+  const int rowBytes = BitmapTraits::getRowStrideBytes(w);
 
-  for (; it != end; ++it)
-    *it = (*it ? 0: 1);
+  for (int y=0; y<m_bitmap->height(); ++y) {
+    uint8_t* row = m_bitmap->getPixelAddress(0, y);
+    combine_bits(row, rowBytes, 0, row, rowBytes, 0, w,
+                 [](uint64_t a, uint64_t) -> uint64_t { return ~a; });
+  }
 
   shrink();
 }
@@ -164,32 +387,65 @@ void Mask::replace(const gfx::Rect& bounds)
 
 void Mask::add(const doc::Mask& mask)
 {
-  for_each_mask_pixel(
+  if (!mask.bitmap())
+    return;
+
+  reserve(mask.bounds());
+  combine_masks(
     *this, mask,
-    [](color_t a, color_t b) -> color_t {
+    [](uint64_t a, uint64_t b) -> uint64_t {
       return a | b;
     });
+  shrink();
 }
 
 void Mask::subtract(const doc::Mask& mask)
 {
-  for_each_mask_pixel(
+  if (!m_bitmap || !mask.bitmap())
+    return;
+
+  combine_masks(
     *this, mask,
-    [](color_t a, color_t b) -> color_t {
-      if (a)
-        return a - b;
-      else
-        return 0;
+    [](uint64_t a, uint64_t b) -> uint64_t {
+      return a & ~b;
     });
+  shrink();
 }
 
 void Mask::intersect(const doc::Mask& mask)
 {
-  for_each_mask_pixel(
+  if (!m_bitmap)
+    return;
+
+  if (!mask.bitmap()) {
+    clear_image(m_bitmap.get(), 0);
+    shrink();
+    return;
+  }
+
+  // Clear the pixels outside the "mask" bounds
+  const gfx::Rect bounds = m_bounds.createIntersection(mask.bounds());
+  const int w = m_bitmap->width();
+  const int rowBytes = BitmapTraits::getRowStrideBytes(w);
+  for (int y=0; y<m_bitmap->height(); ++y) {
+    uint8_t* row = m_bitmap->getPixelAddress(0, y);
+    if (bounds.isEmpty() ||
+        y+m_bounds.y < bounds.y ||
+        y+m_bounds.y >= bounds.y2()) {
+      std::memset(row, 0, rowBytes);
+    }
+    else {
+      clear_bits(row, rowBytes, 0, bounds.x-m_bounds.x);
+      clear_bits(row, rowBytes, bounds.x2()-m_bounds.x, m_bounds.x2()-bounds.x2());
+    }
+  }
+
+  combine_masks(
     *this, mask,
-    [](color_t a, color_t b) -> color_t {
+    [](uint64_t a, uint64_t b) -> uint64_t {
       return a & b;
     });
+  shrink();
 }
 
 void Mask::add(const gfx::Rect& bounds)
@@ -251,100 +507,26 @@ void Mask::byColor(const Image *src, int color, int fuzziness)
   replace(src->bounds());
 
   Image* dst = m_bitmap.get();
-
-  switch (src->pixelFormat()) {
-
-    case IMAGE_RGB: {
-      const LockImageBits<RgbTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<RgbTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      int src_r, src_g, src_b, src_a;
-      int dst_r, dst_g, dst_b, dst_a;
-      color_t c;
-
-      dst_r = rgba_getr(color);
-      dst_g = rgba_getg(color);
-      dst_b = rgba_getb(color);
-      dst_a = rgba_geta(color);
-
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        src_r = rgba_getr(c);
-        src_g = rgba_getg(c);
-        src_b = rgba_getb(c);
-        src_a = rgba_geta(c);
-
-        if (!((src_r >= dst_r-fuzziness) && (src_r <= dst_r+fuzziness) &&
-              (src_g >= dst_g-fuzziness) && (src_g <= dst_g+fuzziness) &&
-              (src_b >= dst_b-fuzziness) && (src_b <= dst_b+fuzziness) &&
-              (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
-      break;
-    }
-
-    case IMAGE_GRAYSCALE: {
-      const LockImageBits<GrayscaleTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<GrayscaleTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      int src_k, src_a;
-      int dst_k, dst_a;
-      color_t c;
-
-      dst_k = graya_getv(color);
-      dst_a = graya_geta(color);
-
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        src_k = graya_getv(c);
-        src_a = graya_geta(c);
-
-        if (!((src_k >= dst_k-fuzziness) && (src_k <= dst_k+fuzziness) &&
-              (src_a >= dst_a-fuzziness) && (src_a <= dst_a+fuzziness)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
-      break;
-    }
-
-    case IMAGE_INDEXED: {
-      const LockImageBits<IndexedTraits> srcBits(src);
-      LockImageBits<BitmapTraits> dstBits(dst, Image::WriteLock);
-      LockImageBits<IndexedTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-      LockImageBits<BitmapTraits>::iterator dst_it = dstBits.begin();
-#ifdef _DEBUG
-      LockImageBits<BitmapTraits>::iterator dst_end = dstBits.end();
-#endif
-      color_t c, min, max;
-
-      for (; src_it != src_end; ++src_it, ++dst_it) {
-        ASSERT(dst_it != dst_end);
-        c = *src_it;
-
-        if (color > fuzziness)
-          min = color-fuzziness;
-        else
-          min = 0;
-        max = color + fuzziness;
-
-        if (!((c >= min) && (c <= max)))
-          *dst_it = 0;
-      }
-      ASSERT(dst_it == dst_end);
-      break;
+  const int w = src->width();
+
+  // Each row of the bitmap is completely overwritten (8 pixels per
+  // byte at the same time)
+  for (int y=0; y<src->height(); ++y) {
+    uint8_t* dstRow = dst->getPixelAddress(0, y);
+
+    switch (src->pixelFormat()) {
+      case IMAGE_RGB:
+        match_rgb_row((const uint32_t*)src->getPixelAddress(0, y),
+                      dstRow, w, color, fuzziness);
+        break;
+      case IMAGE_GRAYSCALE:
+        match_gray_row((const uint16_t*)src->getPixelAddress(0, y),
+                       dstRow, w, color, fuzziness);
+        break;
+      case IMAGE_INDEXED:
+        match_index_row((const uint8_t*)src->getPixelAddress(0, y),
+                        dstRow, w, color, fuzziness);
+        break;
     }
   }
 
@@ -447,61 +629,39 @@ void Mask::shrink()
   if (m_freeze_count > 0)
     return;
 
-#define SHRINK_SIDE(u_begin, u_op, u_final, u_add,                      \
-                    v_begin, v_op, v_final, v_add, U, V, var)           \
-  {                                                                     \
-    for (u = u_begin; u u_op u_final; u u_add) {                        \
-      for (v = v_begin; v v_op v_final; v v_add) {                      \
-        if (get_pixel_fast<BitmapTraits>(m_bitmap.get(), U, V))         \
-          break;                                                        \
-      }                                                                 \
-      if (v == v_final)                                                 \
-        var;                                                            \
-      else                                                              \
-        break;                                                          \
-    }                                                                   \
+  // Look for the first/last non-zero pixels of each row (scanning 64
+  // pixels at the same time)
+  const int w = m_bounds.w;
+  const int rowBytes = BitmapTraits::getRowStrideBytes(w);
+  int x1 = w, y1 = -1, x2 = -1, y2 = -1;
+
+  for (int v=0; v<m_bounds.h; ++v) {
+    const uint8_t* row = m_bitmap->getPixelAddress(0, v);
+    int first, last;
+    if (row_bits_range(row, rowBytes, w, first, last)) {
+      if (y1 < 0)
+        y1 = v;
+      y2 = v;
+      x1 = std::min(x1, first);
+      x2 = std::max(x2, last);
+    }
   }
 
-  int u, v, x1, y1, x2, y2;
-
-  x1 = m_bounds.x;
-  y1 = m_bounds.y;
-  x2 = m_bounds.x+m_bounds.w-1;
-  y2 = m_bounds.y+m_bounds.h-1;
-
-  SHRINK_SIDE(0, <, m_bounds.w, ++,
-              0, <, m_bounds.h, ++, u, v, x1++);
-
-  SHRINK_SIDE(0, <, m_bounds.h, ++,
-              0, <, m_bounds.w, ++, v, u, y1++);
-
-  SHRINK_SIDE(m_bounds.w-1, >, 0, --,
-              0, <, m_bounds.h, ++, u, v, x2--);
-
-  SHRINK_SIDE(m_bounds.h-1, >, 0, --,
-              0, <, m_bounds.w, ++, v, u, y2--);
-
-  if ((x1 > x2) || (y1 > y2)) {
+  if (y1 < 0) {
     clear();
   }
-  else if ((x1 != m_bounds.x) || (x2 != m_bounds.x+m_bounds.w-1) ||
-           (y1 != m_bounds.y) || (y2 != m_bounds.y+m_bounds.h-1)) {
-    u = m_bounds.x;
-    v = m_bounds.y;
-
-    m_bounds.x = x1;
-    m_bounds.y = y1;
-    m_bounds.w = x2 - x1 + 1;
-    m_bounds.h = y2 - y1 + 1;
-
+  else if (x1 != 0 || x2 != m_bounds.w-1 ||
+           y1 != 0 || y2 != m_bounds.h-1) {
     Image* image = crop_image(
       m_bitmap.get(),
-      m_bounds.x-u, m_bounds.y-v,
-      m_bounds.w, m_bounds.h, 0);
+      x1, y1, x2-x1+1, y2-y1+1, 0);
     m_bitmap.reset(image);
-  }
 
-#undef SHRINK_SIDE
+    m_bounds.x += x1;
+    m_bounds.y += y1;
+    m_bounds.w = x2 - x1 + 1;
+    m_bounds.h = y2 - y1 + 1;
+  }
 }
 
 } // namespace doc
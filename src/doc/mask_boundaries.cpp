@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,6 +12,10 @@
 #include "doc/mask_boundaries.h"
 
 #include "doc/image_impl.h"
+#include "doc/primitives_fast.h"
+
+#include <algorithm>
+#include <cstring>
 
 namespace doc {
 
@@ -19,6 +24,7 @@ void MaskBoundaries::reset()
   m_segs.clear();
   if (!m_path.isEmpty())
     m_path.rewind();
+  m_bitmap.reset();
 }
 
 void MaskBoundaries::regen(const Image* bitmap)
@@ -339,12 +345,176 @@ void MaskBoundaries::regen(const Image* bitmap)
   ASSERT(prevIt == bits.end());
 }
 
+void MaskBoundaries::update(const Image* bitmap, const gfx::Point& origin)
+{
+  ASSERT(bitmap->pixelFormat() == IMAGE_BITMAP);
+
+  const int w = bitmap->width();
+  const int h = bitmap->height();
+
+  if (!m_bitmap ||
+      m_bitmap->width() != w ||
+      m_bitmap->height() != h ||
+      m_origin != origin) {
+    regen(bitmap);
+    offset(origin.x, origin.y);
+
+    m_bitmap.reset(Image::createCopy(bitmap));
+    m_origin = origin;
+    return;
+  }
+
+  // Look for the rows that were modified since the last update()
+  const int rowBytes = BitmapTraits::getRowStrideBytes(w);
+  int y1 = -1, y2 = -1;
+  for (int y=0; y<h; ++y) {
+    if (std::memcmp(m_bitmap->getPixelAddress(0, y),
+                    bitmap->getPixelAddress(0, y), rowBytes) != 0) {
+      if (y1 < 0)
+        y1 = y;
+      y2 = y;
+    }
+  }
+  if (y1 < 0)
+    return;
+
+  regenRows(bitmap, y1, y2);
+
+  for (int y=y1; y<=y2; ++y)
+    std::memcpy(m_bitmap->getPixelAddress(0, y),
+                bitmap->getPixelAddress(0, y), rowBytes);
+
+  if (!m_path.isEmpty())
+    m_path.rewind();
+}
+
+// Regenerates the segments in the rows y1...y2 of the bitmap (and the
+// horizontal segments in the lines y1...y2+1 between those rows). The
+// result is the same as regenerating the whole bitmap (vertical
+// segments are joined with the ones from the rows above/below).
+void MaskBoundaries::regenRows(const Image* bitmap, const int y1, const int y2)
+{
+  const int w = bitmap->width();
+  const int h = bitmap->height();
+  const int ox = m_origin.x;
+  const int oy = m_origin.y;
+
+  // Remove horizontal segments between the modified rows and cut
+  // vertical segments that cross them.
+  {
+    list_type segs;
+    segs.reserve(m_segs.size());
+    for (const Segment& seg : m_segs) {
+      const gfx::Rect& rc = seg.bounds();
+      const int y = rc.y - oy;
+      if (seg.horizontal()) {
+        if (y < y1 || y > y2+1)
+          segs.push_back(seg);
+      }
+      else {
+        if (y < y1)
+          segs.push_back(Segment(seg.open(),
+                                 gfx::Rect(rc.x, rc.y, 0, std::min(y+rc.h, y1)-y)));
+        if (y+rc.h > y2+1) {
+          const int v = std::max(y, y2+1);
+          segs.push_back(Segment(seg.open(),
+                                 gfx::Rect(rc.x, v+oy, 0, y+rc.h-v)));
+        }
+      }
+    }
+    m_segs.swap(segs);
+  }
+
+  // Vertical segments being expanded from the previous row (starting
+  // with the ones that end just above y1), and vertical segments that
+  // start just below y2.
+  std::vector<int> vertSegs(w+1, -1);
+  std::vector<int> belowSegs(w+1, -1);
+  for (int i=0; i<int(m_segs.size()); ++i) {
+    const Segment& seg = m_segs[i];
+    if (seg.vertical()) {
+      const int x = seg.bounds().x - ox;
+      const int y = seg.bounds().y - oy;
+      if (y+seg.bounds().h == y1)
+        vertSegs[x] = i;
+      else if (y == y2+1)
+        belowSegs[x] = i;
+    }
+  }
+
+  auto pixel = [bitmap, w, h](const int x, const int y) -> bool {
+    return (x >= 0 && x < w && y >= 0 && y < h &&
+            get_pixel_fast<BitmapTraits>(bitmap, x, y));
+  };
+
+  // Horizontal segments, they are open if the pixel below is selected
+  for (int y=y1; y<=y2+1; ++y) {
+    int horzSeg = -1;
+    for (int x=0; x<w; ++x) {
+      const bool above = pixel(x, y-1);
+      const bool below = pixel(x, y);
+      if (above == below) {
+        horzSeg = -1;
+      }
+      else if (horzSeg >= 0 && m_segs[horzSeg].open() == below) {
+        ++m_segs[horzSeg].m_bounds.w;
+      }
+      else {
+        m_segs.push_back(Segment(below, gfx::Rect(x+ox, y+oy, 1, 0)));
+        horzSeg = int(m_segs.size()-1);
+      }
+    }
+  }
+
+  // Vertical segments, they are open if the pixel at the right side
+  // is selected
+  for (int y=y1; y<=y2; ++y) {
+    bool left = false;
+    for (int x=0; x<=w; ++x) {
+      const bool right = pixel(x, y);
+      if (left == right) {
+        vertSegs[x] = -1;
+      }
+      else if (vertSegs[x] >= 0 && m_segs[vertSegs[x]].open() == right) {
+        ++m_segs[vertSegs[x]].m_bounds.h;
+      }
+      else {
+        m_segs.push_back(Segment(right, gfx::Rect(x+ox, y+oy, 0, 1)));
+        vertSegs[x] = int(m_segs.size()-1);
+      }
+      left = right;
+    }
+  }
+
+  // Join the vertical segments that continue below y2
+  bool joined = false;
+  for (int x=0; x<=w; ++x) {
+    if (vertSegs[x] >= 0 && belowSegs[x] >= 0) {
+      Segment& seg = m_segs[vertSegs[x]];
+      Segment& below = m_segs[belowSegs[x]];
+      if (seg.open() == below.open()) {
+        seg.m_bounds.h += below.m_bounds.h;
+        below.m_bounds.h = -1;  // Mark to remove it
+        joined = true;
+      }
+    }
+  }
+  if (joined) {
+    m_segs.erase(
+      std::remove_if(m_segs.begin(), m_segs.end(),
+                     [](const Segment& seg){ return seg.m_bounds.h < 0; }),
+      m_segs.end());
+  }
+}
+
 void MaskBoundaries::offset(int x, int y)
 {
   for (Segment& seg : m_segs)
     seg.offset(x, y);
 
   m_path.offset(x, y);
+  m_origin.x += x;
+  m_origin.y += y;
 }
 
 void MaskBoundaries::createPathIfNeeeded()
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2020 Igara Studio S.A.
+// Copyright (c) 2020-2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -9,7 +9,9 @@
 #define DOC_MASK_BOUNDARIES_H_INCLUDED
 #pragma once
 
+#include "doc/image_ref.h"
 #include "gfx/path.h"
+#include "gfx/point.h"
 #include "gfx/rect.h"
 
 #include <vector>
@@ -47,6 +49,12 @@ namespace doc {
     void reset();
     void regen(const Image* bitmap);
 
+    // Regenerates the boundaries of the given bitmap placed at
+    // "origin" (in sprite coordinates). If the previous call to
+    // update() was for a bitmap with the same size and origin, only
+    // the rows that were modified since then are regenerated.
+    void update(const Image* bitmap, const gfx::Point& origin);
+
     const_iterator begin() const { return m_segs.begin(); }
     const_iterator end() const { return m_segs.end(); }
     iterator begin() { return m_segs.begin(); }
@@ -58,8 +66,15 @@ namespace doc {
     void createPathIfNeeeded();
 
   private:
+    void regenRows(const Image* bitmap, const int y1, const int y2);
+
     list_type m_segs;
     gfx::Path m_path;
+
+    // Copy of the bitmap used in the last update() call and its
+    // origin, to know which rows were modified in the next update().
+    ImageRef m_bitmap;
+    gfx::Point m_origin;
   };
 
 } // namespace doc
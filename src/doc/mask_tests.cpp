@@ -0,0 +1,236 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/color.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask.h"
+#include "doc/mask_boundaries.h"
+#include "doc/primitives.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace doc;
+
+typedef std::set<std::pair<int, int>> Pixels;
+
+// Selected pixels of the mask (in sprite coordinates)
+static Pixels mask_pixels(const Mask& mask)
+{
+  Pixels pixels;
+  if (!mask.bitmap())
+    return pixels;
+
+  const gfx::Rect& bounds = mask.bounds();
+  for (int y=0; y<bounds.h; ++y)
+    for (int x=0; x<bounds.w; ++x)
+      if (get_pixel(mask.bitmap(), x, y))
+        pixels.insert(std::make_pair(bounds.x+x, bounds.y+y));
+  return pixels;
+}
+
+// Checks that the mask bounds are the smallest rectangle that
+// contains all the given pixels (i.e. the mask was shrunk)
+static void expect_shrunk(const Mask& mask, const Pixels& pixels)
+{
+  if (pixels.empty()) {
+    EXPECT_TRUE(mask.isEmpty());
+    return;
+  }
+
+  gfx::Rect bounds;
+  for (const auto& pt : pixels)
+    bounds = bounds.createUnion(gfx::Rect(pt.first, pt.second, 1, 1));
+  EXPECT_EQ(bounds, mask.bounds());
+}
+
+static void random_mask(std::mt19937& random, Mask& mask)
+{
+  mask.clear();
+  for (int i=random()%4; i>0; --i)
+    mask.add(gfx::Rect(int(random() % 150) - 20, int(random() % 40) - 10,
+                       1 + random() % 130, 1 + random() % 20));
+  for (int i=0; i<3; ++i)
+    mask.subtract(gfx::Rect(int(random() % 150) - 20, int(random() % 40) - 10,
+                            1 + random() % 30, 1 + random() % 10));
+}
+
+TEST(Mask, BooleanOps)
+{
+  std::mt19937 random(1);
+  for (int i=0; i<500; ++i) {
+    Mask a, b;
+    random_mask(random, a);
+    random_mask(random, b);
+    const Pixels aPixels = mask_pixels(a);
+    const Pixels bPixels = mask_pixels(b);
+
+    Pixels expected;
+    Mask r(a);
+    r.add(b);
+    std::set_union(aPixels.begin(), aPixels.end(),
+                   bPixels.begin(), bPixels.end(),
+                   std::inserter(expected, expected.begin()));
+    ASSERT_EQ(expected, mask_pixels(r)) << "Add " << i;
+    expect_shrunk(r, expected);
+
+    expected.clear();
+    r.copyFrom(&a);
+    r.subtract(b);
+    std::set_difference(aPixels.begin(), aPixels.end(),
+                        bPixels.begin(), bPixels.end(),
+                        std::inserter(expected, expected.begin()));
+    ASSERT_EQ(expected, mask_pixels(r)) << "Subtract " << i;
+    expect_shrunk(r, expected);
+
+    expected.clear();
+    r.copyFrom(&a);
+    r.intersect(b);
+    std::set_intersection(aPixels.begin(), aPixels.end(),
+                          bPixels.begin(), bPixels.end(),
+                          std::inserter(expected, expected.begin()));
+    ASSERT_EQ(expected, mask_pixels(r)) << "Intersect " << i;
+    expect_shrunk(r, expected);
+
+    if (!a.isEmpty()) {
+      const gfx::Rect bounds = a.bounds();
+      EXPECT_EQ(int(aPixels.size()) == bounds.w*bounds.h, a.isRectangular());
+
+      expected.clear();
+      for (int y=bounds.y; y<bounds.y2(); ++y)
+        for (int x=bounds.x; x<bounds.x2(); ++x)
+          if (!aPixels.count(std::make_pair(x, y)))
+            expected.insert(std::make_pair(x, y));
+      r.copyFrom(&a);
+      r.invert();
+      ASSERT_EQ(expected, mask_pixels(r)) << "Invert " << i;
+      expect_shrunk(r, expected);
+    }
+  }
+}
+
+TEST(Mask, ByColor)
+{
+  std::mt19937 random(2);
+  for (int i=0; i<300; ++i) {
+    const PixelFormat pixelFormat = PixelFormat(i % 3); // RGB, Grayscale, Indexed
+    const int w = 1 + random() % 70;
+    const int h = 1 + random() % 5;
+
+    ImageRef image(Image::create(pixelFormat, w, h));
+    for (int y=0; y<h; ++y) {
+      for (int x=0; x<w; ++x) {
+        const int v = random() % 4;
+        switch (pixelFormat) {
+          case IMAGE_RGB: put_pixel(image.get(), x, y, rgba(v*10, v*5, v*3, (v & 1 ? 255: 128))); break;
+          case IMAGE_GRAYSCALE: put_pixel(image.get(), x, y, graya(v*10, (v & 1 ? 255: 128))); break;
+          case IMAGE_INDEXED: put_pixel(image.get(), x, y, v*3); break;
+        }
+      }
+    }
+
+    const color_t color = get_pixel(image.get(), random() % w, random() % h);
+    const int fuzziness = (i % 7 == 0 ? -1: i % 5 == 0 ? 300: int(random() % 40));
+
+    Pixels expected;
+    for (int y=0; y<h; ++y) {
+      for (int x=0; x<w; ++x) {
+        const color_t c = get_pixel(image.get(), x, y);
+        bool match = false;
+        switch (pixelFormat) {
+          case IMAGE_RGB:
+            match = (std::abs(int(rgba_getr(c)) - int(rgba_getr(color))) <= fuzziness &&
+                     std::abs(int(rgba_getg(c)) - int(rgba_getg(color))) <= fuzziness &&
+                     std::abs(int(rgba_getb(c)) - int(rgba_getb(color))) <= fuzziness &&
+                     std::abs(int(rgba_geta(c)) - int(rgba_geta(color))) <= fuzziness);
+            break;
+          case IMAGE_GRAYSCALE:
+            match = (std::abs(int(graya_getv(c)) - int(graya_getv(color))) <= fuzziness &&
+                     std::abs(int(graya_geta(c)) - int(graya_geta(color))) <= fuzziness);
+            break;
+          case IMAGE_INDEXED:
+            match = (std::abs(int(c) - int(color)) <= fuzziness);
+            break;
+        }
+        if (match)
+          expected.insert(std::make_pair(x, y));
+      }
+    }
+
+    Mask mask;
+    mask.byColor(image.get(), color, fuzziness);
+    ASSERT_EQ(expected, mask_pixels(mask)) << "Image " << i;
+    expect_shrunk(mask, expected);
+  }
+}
+
+typedef std::tuple<bool, bool, int, int, int, int> SegmentTuple;
+
+static std::vector<SegmentTuple> sorted_segments(const MaskBoundaries& boundaries)
+{
+  std::vector<SegmentTuple> segs;
+  for (const auto& seg : boundaries) {
+    const gfx::Rect& rc = seg.bounds();
+    segs.push_back(SegmentTuple(seg.vertical(), seg.open(), rc.x, rc.y, rc.w, rc.h));
+  }
+  std::sort(segs.begin(), segs.end());
+  return segs;
+}
+
+TEST(MaskBoundaries, UpdateModifiedRows)
+{
+  std::mt19937 random(3);
+  for (int i=0; i<200; ++i) {
+    Mask mask;
+    mask.add(gfx::Rect(random() % 10, random() % 10,
+                       5 + random() % 60, 5 + random() % 40));
+
+    MaskBoundaries boundaries;
+    for (int step=0; step<20 && !mask.isEmpty(); ++step) {
+      // Modify a rectangle inside the mask bounds (so most of the
+      // times the boundaries are updated incrementally)
+      const gfx::Rect bounds = mask.bounds();
+      const gfx::Rect rc =
+        gfx::Rect(bounds.x + int(random() % bounds.w),
+                  bounds.y + int(random() % bounds.h),
+                  1 + random() % 12, 1 + random() % 6).createIntersection(bounds);
+      mask.freeze();
+      if (random() % 2)
+        mask.subtract(rc);
+      else
+        mask.add(rc);
+      mask.unfreeze();
+      if (mask.isEmpty())
+        break;
+
+      boundaries.update(mask.bitmap(), mask.bounds().origin());
+
+      MaskBoundaries expected;
+      expected.regen(mask.bitmap());
+      expected.offset(mask.bounds().x, mask.bounds().y);
+      ASSERT_EQ(sorted_segments(expected), sorted_segments(boundaries))
+        << "Mask " << i << " step " << step;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
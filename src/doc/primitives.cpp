@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018-2021 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -414,49 +414,162 @@ void remap_image(Image* image, const Remap& remap)
   }
 }
 
-// TODO test this hash routine and find a better alternative
+namespace {
 
-template <typename ImageTraits, uint32_t Mask>
-static uint32_t calculate_image_hash_templ(const Image* image,
-                                           const gfx::Rect& bounds)
-{
-  uint32_t hash = 0;
-  for (int y=0; y<bounds.h; ++y) {
-    auto p = (typename ImageTraits::address_t)image->getPixelAddress(bounds.x, bounds.y+y);
-    for (int x=0; x<bounds.w; ++x, ++p) {
-      uint32_t value = *p;
-      uint32_t mask = Mask;
-      while (mask) {
-        hash += value & mask & 0xff;
-        hash <<= 1;
-        value >>= 8;
-        mask >>= 8;
-      }
+// 64-bit hash of a stream of 64-bit words, based on the XXH64 round
+// and avalanche functions. It uses four independent accumulators so
+// consecutive words can be processed in parallel by the CPU.
+class ImageHasher {
+public:
+  ImageHasher(const uint64_t seed) : m_n(0), m_total(0) {
+    m_acc[0] = seed + kPrime1 + kPrime2;
+    m_acc[1] = seed + kPrime2;
+    m_acc[2] = seed;
+    m_acc[3] = seed - kPrime1;
+  }
+
+  void add(const uint64_t word) {
+    m_buf[m_n++] = word;
+    if (m_n == 4) {
+      m_acc[0] = round(m_acc[0], m_buf[0]);
+      m_acc[1] = round(m_acc[1], m_buf[1]);
+      m_acc[2] = round(m_acc[2], m_buf[2]);
+      m_acc[3] = round(m_acc[3], m_buf[3]);
+      m_n = 0;
     }
+    ++m_total;
+  }
+
+  uint64_t hash() const {
+    uint64_t h = rotl(m_acc[0], 1) + rotl(m_acc[1], 7) +
+                 rotl(m_acc[2], 12) + rotl(m_acc[3], 18);
+    for (int i=0; i<4; ++i)
+      h = (h ^ round(0, m_acc[i])) * kPrime1 + kPrime4;
+    h += m_total * 8;
+    for (int i=0; i<m_n; ++i)
+      h = rotl(h ^ round(0, m_buf[i]), 27) * kPrime1 + kPrime4;
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+  }
+
+private:
+  static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+  static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+  static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+  static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+
+  static uint64_t rotl(const uint64_t x, const int r) {
+    return (x << r) | (x >> (64 - r));
   }
-  return hash;
+
+  static uint64_t round(uint64_t acc, const uint64_t word) {
+    acc += word * kPrime2;
+    acc = rotl(acc, 31);
+    return acc * kPrime1;
+  }
+
+  uint64_t m_acc[4];
+  uint64_t m_buf[4];
+  int m_n;
+  uint64_t m_total;
+};
+
+// Returns the value used to hash the given pixel. Two pixels that
+// are equal for is_same_image() (e.g. two RGBA pixels with alpha=0)
+// must return the same value.
+template<typename ImageTraits>
+inline uint64_t hash_value(const typename ImageTraits::pixel_t c) {
+  return c;
+}
+
+template<>
+inline uint64_t hash_value<RgbTraits>(const RgbTraits::pixel_t c) {
+  return (rgba_geta(c) ? c: 0);
+}
+
+template<>
+inline uint64_t hash_value<GrayscaleTraits>(const GrayscaleTraits::pixel_t c) {
+  return (graya_geta(c) ? c: 0);
 }
 
-uint32_t calculate_image_hash(const Image* img, const gfx::Rect& bounds)
+inline uint64_t hash_seed(const Image* image, const gfx::Rect& bounds)
 {
-  switch (img->pixelFormat()) {
-    case IMAGE_RGB:       return calculate_image_hash_templ<RgbTraits, rgba_rgb_mask>(img, bounds);
-    case IMAGE_GRAYSCALE: return calculate_image_hash_templ<GrayscaleTraits, graya_v_mask>(img, bounds);
-    case IMAGE_INDEXED:   return calculate_image_hash_templ<IndexedTraits, 0xff>(img, bounds);
-    case IMAGE_BITMAP:    return calculate_image_hash_templ<BitmapTraits, 1>(img, bounds);
+  return (uint64_t(image->pixelFormat()) << 56) ^
+         (uint64_t(bounds.w) << 28) ^
+         uint64_t(bounds.h);
+}
+
+// Packs as many pixels as possible in each 64-bit word, each row is
+// started in a new word.
+template<typename ImageTraits>
+uint64_t calculate_image_hash_templ(const Image* image,
+                                    const gfx::Rect& bounds)
+{
+  using pixel_t = typename ImageTraits::pixel_t;
+  const int kPixelsPerWord = 8 / sizeof(pixel_t);
+  const int kBitsPerPixel = 8 * sizeof(pixel_t);
+
+  ImageHasher hasher(hash_seed(image, bounds));
+  for (int y=0; y<bounds.h; ++y) {
+    auto p = (const pixel_t*)image->getPixelAddress(bounds.x, bounds.y+y);
+    int x = 0;
+    for (; x+kPixelsPerWord <= bounds.w; x+=kPixelsPerWord, p+=kPixelsPerWord) {
+      uint64_t word = 0;
+      for (int i=0; i<kPixelsPerWord; ++i)
+        word |= hash_value<ImageTraits>(p[i]) << (i*kBitsPerPixel);
+      hasher.add(word);
+    }
+    if (x < bounds.w) {
+      uint64_t word = 0;
+      for (int i=0; x<bounds.w; ++x, ++i, ++p)
+        word |= hash_value<ImageTraits>(*p) << (i*kBitsPerPixel);
+      hasher.add(word);
+    }
   }
+  return hasher.hash();
+}
 
-  uint32_t hash = 0;
+// Bitmap pixels aren't byte-aligned, so we get each pixel value
+// individually and pack 64 pixels (one bit each) in each word.
+template<>
+uint64_t calculate_image_hash_templ<BitmapTraits>(const Image* image,
+                                                  const gfx::Rect& bounds)
+{
+  ImageHasher hasher(hash_seed(image, bounds));
   for (int y=0; y<bounds.h; ++y) {
-    int bytes = img->getRowStrideSize(bounds.w);
-    uint8_t* p = img->getPixelAddress(bounds.x, bounds.y+y);
-    while (bytes-- > 0) {
-      hash += *p;
-      hash <<= 1;
-      ++p;
+    uint64_t word = 0;
+    int i = 0;
+    for (int x=0; x<bounds.w; ++x) {
+      if (get_pixel_fast<BitmapTraits>(image, bounds.x+x, bounds.y+y))
+        word |= (uint64_t(1) << i);
+      if (++i == 64) {
+        hasher.add(word);
+        word = 0;
+        i = 0;
+      }
     }
+    if (i > 0)
+      hasher.add(word);
+  }
+  return hasher.hash();
+}
+
+} // anonymous namespace
+
+uint64_t calculate_image_hash(const Image* img, const gfx::Rect& bounds)
+{
+  switch (img->pixelFormat()) {
+    case IMAGE_RGB:       return calculate_image_hash_templ<RgbTraits>(img, bounds);
+    case IMAGE_GRAYSCALE: return calculate_image_hash_templ<GrayscaleTraits>(img, bounds);
+    case IMAGE_INDEXED:   return calculate_image_hash_templ<IndexedTraits>(img, bounds);
+    case IMAGE_BITMAP:    return calculate_image_hash_templ<BitmapTraits>(img, bounds);
   }
-  return hash;
+  ASSERT(false);
+  return 0;
 }
 
 } // namespace doc
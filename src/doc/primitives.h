@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018-2021 Igara Studio S.A.
+// Copyright (c) 2018-2022 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -49,7 +49,9 @@ namespace doc {
 
   void remap_image(Image* image, const Remap& remap);
 
-  uint32_t calculate_image_hash(const Image* image,
+  // Returns a 64-bit hash of the pixels inside the given bounds.
+  // Images that are equal for is_same_image() have the same hash.
+  uint64_t calculate_image_hash(const Image* image,
                                 const gfx::Rect& bounds);
 
 } // namespace doc
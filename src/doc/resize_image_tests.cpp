@@ -16,6 +16,7 @@
 #include "doc/image.h"
 #include "doc/image_ref.h"
 #include "doc/primitives.h"
+#include "gfx/size.h"
 
 using namespace std;
 using namespace doc;
@@ -101,6 +102,73 @@ TEST(ResizeImage, BilinearInterpRGBType)
 }
 #endif
 
+TEST(ResizeImage, NearestNeighborBigImage)
+{
+  // Big enough to be resized in several threads
+  ImageRef src(Image::create(IMAGE_RGB, 301, 203));
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src.get(), x, y, rgba(x & 255, y & 255, (x+y) & 255, 255));
+
+  ImageRef dst(Image::create(IMAGE_RGB, 700, 500));
+  algorithm::resize_image(src.get(), dst.get(),
+                          algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR,
+                          nullptr, nullptr, -1);
+
+  for (int y=0; y<dst->height(); ++y)
+    for (int x=0; x<dst->width(); ++x)
+      ASSERT_EQ(get_pixel(src.get(), x*301/700, y*203/500),
+                get_pixel(dst.get(), x, y));
+}
+
+TEST(ResizeImage, BilinearInterpCorners)
+{
+  for (PixelFormat format : { IMAGE_RGB, IMAGE_GRAYSCALE }) {
+    ImageRef src(create_image_from_data(format, test_image_base_3x3, 3, 3));
+    if (format == IMAGE_GRAYSCALE) {
+      for (int y=0; y<3; ++y)
+        for (int x=0; x<3; ++x)
+          put_pixel(src.get(), x, y, graya(get_pixel(src.get(), x, y) ? 255: 0, 255));
+    }
+
+    ImageRef dst(Image::create(format, 9, 9));
+    algorithm::resize_image(src.get(), dst.get(),
+                            algorithm::RESIZE_METHOD_BILINEAR,
+                            nullptr, nullptr, -1);
+
+    // Rows/columns 0, 4, and 8 are the source rows/columns 0, 1, and 2
+    for (int y=0; y<3; ++y)
+      for (int x=0; x<3; ++x)
+        EXPECT_EQ(get_pixel(src.get(), x, y),
+                  get_pixel(dst.get(), 4*x, 4*y));
+
+    // Middle of a black and a white pixel
+    if (format == IMAGE_RGB)
+      EXPECT_EQ(rgba(127, 127, 127, 0), get_pixel(dst.get(), 2, 0));
+    else
+      EXPECT_EQ(graya(127, 255), get_pixel(dst.get(), 2, 0));
+  }
+}
+
+TEST(ResizeImage, BilinearInterpConstantImage)
+{
+  const color_t c = rgba(10, 100, 200, 255);
+  ImageRef src(Image::create(IMAGE_RGB, 37, 23));
+  clear_image(src.get(), c);
+
+  // Upscale (in several threads) and downscale
+  for (auto size : { gfx::Size(401, 257), gfx::Size(5, 3), gfx::Size(1, 1) }) {
+    ImageRef dst(Image::create(IMAGE_RGB, size.w, size.h));
+    algorithm::resize_image(src.get(), dst.get(),
+                            algorithm::RESIZE_METHOD_BILINEAR,
+                            nullptr, nullptr, -1);
+
+    for (int y=0; y<dst->height(); ++y)
+      for (int x=0; x<dst->width(); ++x)
+        ASSERT_EQ(c, get_pixel(dst.get(), x, y));
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
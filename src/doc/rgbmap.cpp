@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,26 +11,36 @@
 
 #include "doc/rgbmap.h"
 
-#include "doc/color_scales.h"
 #include "doc/palette.h"
+#include "doc/rgbmap_kdtree.h"
+#include "doc/rgbmap_rgb5a3.h"
 
 namespace doc {
 
-#define RSIZE   32
-#define GSIZE   32
-#define BSIZE   32
-#define ASIZE   8
-#define MAPSIZE (RSIZE*GSIZE*BSIZE*ASIZE)
+// static
+RgbMap* RgbMap::create(RgbMapAlgorithm algorithm)
+{
+  switch (algorithm) {
+    case RgbMapAlgorithm::RGB5A3: return new RgbMapRGB5A3;
+    case RgbMapAlgorithm::KDTREE: return new RgbMapKdTree;
+  }
+  ASSERT(false);
+  return new RgbMapRGB5A3;
+}
 
-RgbMap::RgbMap()
+RgbMap::RgbMap(RgbMapAlgorithm algorithm)
   : Object(ObjectType::RgbMap)
-  , m_map(MAPSIZE)
-  , m_palette(NULL)
+  , m_algorithm(algorithm)
+  , m_palette(nullptr)
   , m_modifications(0)
   , m_maskIndex(0)
 {
 }
 
+RgbMap::~RgbMap()
+{
+}
+
 bool RgbMap::match(const Palette* palette) const
 {
   return (m_palette == palette &&
@@ -42,19 +53,7 @@ void RgbMap::regenerate(const Palette* palette, int mask_index)
   m_modifications = palette->getModifications();
   m_maskIndex = mask_index;
 
-  // Mark all entries as invalid (need to be regenerated)
-  for (uint16_t& entry : m_map)
-    entry |= INVALID;
-}
-
-int RgbMap::generateEntry(int i, int r, int g, int b, int a) const
-{
-  return m_map[i] =
-    m_palette->findBestfit(
-      scale_5bits_to_8bits(r>>3),
-      scale_5bits_to_8bits(g>>3),
-      scale_5bits_to_8bits(b>>3),
-      scale_3bits_to_8bits(a>>5), m_maskIndex);
+  onRegenerate();
 }
 
 } // namespace doc
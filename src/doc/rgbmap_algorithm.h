@@ -0,0 +1,22 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_RGBMAP_ALGORITHM_H_INCLUDED
+#define DOC_RGBMAP_ALGORITHM_H_INCLUDED
+#pragma once
+
+namespace doc {
+
+  enum class RgbMapAlgorithm {
+    RGB5A3 = 0,                 // Lazy 32x32x32x8 table of approximated colors
+    KDTREE = 1,                 // Exact nearest color using a k-d tree
+
+    DEFAULT = RGB5A3,           // Default for preferences
+  };
+
+} // namespace doc
+
+#endif
@@ -0,0 +1,78 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/image_impl.h"
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <memory>
+
+using namespace doc;
+
+// Converts a 2048x2048 RGB image to a 256 colors palette (the RgbMap
+// is regenerated in each iteration so the cost of filling caches is
+// included).
+static void BM_RgbToIndexed(benchmark::State& state) {
+  const auto algorithm = (RgbMapAlgorithm)state.range(0);
+  const int w = 2048, h = 2048;
+
+  Palette::initBestfit();
+  Palette pal(frame_t(0), 256);
+  std::srand(1);
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba(std::rand() % 256,
+                         std::rand() % 256,
+                         std::rand() % 256, 255));
+
+  std::unique_ptr<Image> src(Image::create(IMAGE_RGB, w, h));
+  std::unique_ptr<Image> dst(Image::create(IMAGE_INDEXED, w, h));
+  {
+    LockImageBits<RgbTraits> bits(src.get());
+    int i = 0;
+    for (auto it=bits.begin(), end=bits.end(); it!=end; ++it, ++i) {
+      // Gradient with noise
+      const int x = i % w, y = i / w;
+      *it = rgba((x/8 + std::rand()%16) & 255,
+                 (y/8 + std::rand()%16) & 255,
+                 ((x+y)/16) & 255, 255);
+    }
+  }
+
+  std::unique_ptr<RgbMap> rgbmap(RgbMap::create(algorithm));
+  while (state.KeepRunning()) {
+    pal.setEntry(0, pal.getEntry(0)); // Force regeneration
+    rgbmap->regenerate(&pal, -1);
+
+    const LockImageBits<RgbTraits> srcBits(src.get());
+    LockImageBits<IndexedTraits> dstBits(dst.get());
+    auto srcIt = srcBits.begin(), srcEnd = srcBits.end();
+    auto dstIt = dstBits.begin();
+    for (; srcIt != srcEnd; ++srcIt, ++dstIt) {
+      const color_t c = *srcIt;
+      *dstIt = rgbmap->mapColor(rgba_getr(c),
+                                rgba_getg(c),
+                                rgba_getb(c),
+                                rgba_geta(c));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * w * h);
+}
+
+BENCHMARK(BM_RgbToIndexed)
+  ->Arg(int(RgbMapAlgorithm::RGB5A3))
+  ->Arg(int(RgbMapAlgorithm::KDTREE))
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK_MAIN();
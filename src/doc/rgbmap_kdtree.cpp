@@ -0,0 +1,208 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/rgbmap_kdtree.h"
+
+#include "doc/color.h"
+#include "doc/palette.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace doc {
+
+namespace {
+
+// Same weights used in Palette::initBestfit()
+const int kWeights[4] = { 30, 59, 11, 8 };
+
+const int kLeafSize = 4;
+const int kCacheBits = 12;
+const int kCacheSize = (1 << kCacheBits);
+const uint64_t kValidEntry = 0x10000;
+
+inline int cache_slot(const uint32_t c) {
+  return int((c * 0x9E3779B1u) >> (32 - kCacheBits));
+}
+
+} // anonymous namespace
+
+RgbMapKdTree::RgbMapKdTree()
+  : RgbMap(RgbMapAlgorithm::KDTREE)
+  , m_cache(new std::atomic<uint64_t>[kCacheSize])
+{
+  for (int i=0; i<kCacheSize; ++i)
+    m_cache[i].store(0, std::memory_order_relaxed);
+}
+
+int RgbMapKdTree::mapColor(int r, int g, int b, int a) const
+{
+  ASSERT(r >= 0 && r < 256);
+  ASSERT(g >= 0 && g < 256);
+  ASSERT(b >= 0 && b < 256);
+  ASSERT(a >= 0 && a < 256);
+
+  const uint32_t c = rgba(r, g, b, a);
+  std::atomic<uint64_t>& slot = m_cache[cache_slot(c)];
+  uint64_t v = slot.load(std::memory_order_relaxed);
+  if ((v >> 32) == c && (v & kValidEntry))
+    return int(v & 0xffff);
+
+  const int index = findNearest(r, g, b, a);
+  slot.store((uint64_t(c) << 32) | kValidEntry | uint64_t(index),
+             std::memory_order_relaxed);
+  return index;
+}
+
+int RgbMapKdTree::findNearest(int r, int g, int b, int a) const
+{
+  // Mask index is like alpha = 0, so we can use it as transparent color.
+  if (a == 0 && maskIndex() >= 0)
+    return maskIndex();
+
+  if (m_nodes.empty())
+    return 0;
+
+  const int c[4] = { r * kWeights[0],
+                     g * kWeights[1],
+                     b * kWeights[2],
+                     a * kWeights[3] };
+  int offsets[4] = { 0, 0, 0, 0 };
+  int bestIndex = 0;
+  int bestDist = std::numeric_limits<int>::max();
+  searchNode(0, c, offsets, 0, bestIndex, bestDist);
+  return bestIndex;
+}
+
+void RgbMapKdTree::onRegenerate()
+{
+  const Palette* pal = palette();
+  const int size = std::min(256, pal->size());
+
+  m_entries.clear();
+  m_entries.reserve(size);
+  for (int i=0; i<size; ++i) {
+    if (i == maskIndex())
+      continue;
+
+    const color_t color = pal->getEntry(i);
+    Entry entry;
+    entry.c[0] = rgba_getr(color) * kWeights[0];
+    entry.c[1] = rgba_getg(color) * kWeights[1];
+    entry.c[2] = rgba_getb(color) * kWeights[2];
+    entry.c[3] = rgba_geta(color) * kWeights[3];
+    entry.index = i;
+    m_entries.push_back(entry);
+  }
+
+  m_nodes.clear();
+  if (!m_entries.empty())
+    buildNode(0, int(m_entries.size()));
+
+  for (int i=0; i<kCacheSize; ++i)
+    m_cache[i].store(0, std::memory_order_relaxed);
+}
+
+int RgbMapKdTree::buildNode(int begin, int end)
+{
+  const int nodeIndex = int(m_nodes.size());
+  m_nodes.push_back(Node());
+
+  Node node;
+  node.axis = -1;
+  node.split = 0;
+  node.begin = begin;
+  node.end = end;
+  node.left = node.right = -1;
+
+  if (end - begin > kLeafSize) {
+    // Split by the axis with the biggest spread
+    int bestSpread = -1;
+    for (int axis=0; axis<4; ++axis) {
+      int lo = std::numeric_limits<int>::max();
+      int hi = std::numeric_limits<int>::min();
+      for (int i=begin; i<end; ++i) {
+        lo = std::min(lo, m_entries[i].c[axis]);
+        hi = std::max(hi, m_entries[i].c[axis]);
+      }
+      if (hi - lo > bestSpread) {
+        bestSpread = hi - lo;
+        node.axis = axis;
+      }
+    }
+
+    // All entries are equal, there is no need to split them
+    if (bestSpread == 0) {
+      node.axis = -1;
+    }
+    else {
+      const int axis = node.axis;
+      const int mid = (begin + end) / 2;
+      std::nth_element(m_entries.begin()+begin,
+                       m_entries.begin()+mid,
+                       m_entries.begin()+end,
+                       [axis](const Entry& a, const Entry& b) {
+                         return a.c[axis] < b.c[axis];
+                       });
+      node.split = m_entries[mid].c[axis];
+      node.left = buildNode(begin, mid);
+      node.right = buildNode(mid, end);
+    }
+  }
+
+  m_nodes[nodeIndex] = node;
+  return nodeIndex;
+}
+
+void RgbMapKdTree::searchNode(const int nodeIndex, const int* c,
+                              int* offsets, const int regionDist,
+                              int& bestIndex, int& bestDist) const
+{
+  const Node& node = m_nodes[nodeIndex];
+
+  if (node.axis < 0) {
+    for (int i=node.begin; i<node.end; ++i) {
+      const Entry& entry = m_entries[i];
+      int dist = 0;
+      for (int j=0; j<4; ++j) {
+        const int d = entry.c[j] - c[j];
+        dist += d*d;
+      }
+      // In case of a tie we use the lowest index (like
+      // Palette::findBestfit() does)
+      if (dist < bestDist ||
+          (dist == bestDist && entry.index < bestIndex)) {
+        bestDist = dist;
+        bestIndex = entry.index;
+      }
+    }
+    return;
+  }
+
+  // Entries in the left node are <= split, and in the right node
+  // >= split. The far node is visited only if the distance from the
+  // color to its bounding region (accumulated in "offsets" for each
+  // axis) is less than the best distance found.
+  const int d = c[node.axis] - node.split;
+  const int nearNode = (d < 0 ? node.left: node.right);
+  const int farNode = (d < 0 ? node.right: node.left);
+
+  searchNode(nearNode, c, offsets, regionDist, bestIndex, bestDist);
+
+  const int oldOffset = offsets[node.axis];
+  const int farDist = regionDist - oldOffset*oldOffset + d*d;
+  if (farDist <= bestDist) {
+    offsets[node.axis] = d;
+    searchNode(farNode, c, offsets, farDist, bestIndex, bestDist);
+    offsets[node.axis] = oldOffset;
+  }
+}
+
+} // namespace doc
@@ -0,0 +1,61 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_RGBMAP_KDTREE_H_INCLUDED
+#define DOC_RGBMAP_KDTREE_H_INCLUDED
+#pragma once
+
+#include "doc/rgbmap.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace doc {
+
+  // Finds the exact nearest palette entry for each RGBA color (using
+  // the same weighted distance of Palette::findBestfit() but with
+  // the full 8 bits of each component). Palette entries are stored
+  // in a k-d tree which is built in regenerate(), and the result of
+  // recent queries is kept in a small lock-free cache.
+  class RgbMapKdTree final : public RgbMap {
+  public:
+    RgbMapKdTree();
+
+    int mapColor(int r, int g, int b, int a) const override;
+
+    // Same as mapColor() but without using the cache.
+    int findNearest(int r, int g, int b, int a) const;
+
+  private:
+    struct Entry {
+      int c[4];                 // Weighted components
+      int index;                // Palette index
+    };
+
+    struct Node {
+      int axis;                 // -1 if it's a leaf
+      int split;                // Splitting value in the given axis
+      int begin, end;           // Range of m_entries for leafs
+      int left, right;          // Children nodes
+    };
+
+    void onRegenerate() override;
+    int buildNode(int begin, int end);
+    void searchNode(const int node, const int* c,
+                    int* offsets, const int regionDist,
+                    int& bestIndex, int& bestDist) const;
+
+    std::vector<Entry> m_entries;
+    std::vector<Node> m_nodes;
+
+    // Direct-mapped cache of (rgba << 32) | (kValidEntry | index)
+    std::unique_ptr<std::atomic<uint64_t>[]> m_cache;
+  };
+
+} // namespace doc
+
+#endif
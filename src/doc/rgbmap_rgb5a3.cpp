@@ -0,0 +1,52 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/rgbmap_rgb5a3.h"
+
+#include "doc/color_scales.h"
+#include "doc/palette.h"
+
+namespace doc {
+
+#define RSIZE   32
+#define GSIZE   32
+#define BSIZE   32
+#define ASIZE   8
+#define MAPSIZE (RSIZE*GSIZE*BSIZE*ASIZE)
+
+RgbMapRGB5A3::RgbMapRGB5A3()
+  : RgbMap(RgbMapAlgorithm::RGB5A3)
+  , m_map(new std::atomic<uint16_t>[MAPSIZE])
+{
+  for (int i=0; i<MAPSIZE; ++i)
+    m_map[i].store(0, std::memory_order_relaxed);
+}
+
+void RgbMapRGB5A3::onRegenerate()
+{
+  // Mark all entries as invalid (need to be regenerated)
+  for (int i=0; i<MAPSIZE; ++i)
+    m_map[i].fetch_or(INVALID, std::memory_order_relaxed);
+}
+
+int RgbMapRGB5A3::generateEntry(int i, int r, int g, int b, int a) const
+{
+  const int v =
+    palette()->findBestfit(
+      scale_5bits_to_8bits(r>>3),
+      scale_5bits_to_8bits(g>>3),
+      scale_5bits_to_8bits(b>>3),
+      scale_3bits_to_8bits(a>>5), maskIndex());
+  m_map[i].store(v, std::memory_order_relaxed);
+  return v;
+}
+
+} // namespace doc
@@ -0,0 +1,52 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+// Copyright (c) 2001-2016 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_RGBMAP_RGB5A3_H_INCLUDED
+#define DOC_RGBMAP_RGB5A3_H_INCLUDED
+#pragma once
+
+#include "doc/rgbmap.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace doc {
+
+  // Lazy table of 32x32x32x8 entries (5 bits for RGB and 3 bits for
+  // alpha), each entry is calculated with Palette:findBestfit() the
+  // first time it's used. Entries are atomic so the same map can be
+  // used from several threads at the same time (two threads can
+  // calculate the same entry, but they will store the same value).
+  class RgbMapRGB5A3 final : public RgbMap {
+    // Bit activated on m_map entries that aren't yet calculated.
+    const int INVALID = 256;
+
+  public:
+    RgbMapRGB5A3();
+
+    int mapColor(int r, int g, int b, int a) const override {
+      ASSERT(r >= 0 && r < 256);
+      ASSERT(g >= 0 && g < 256);
+      ASSERT(b >= 0 && b < 256);
+      ASSERT(a >= 0 && a < 256);
+      // bits -> bbbbbgggggrrrrraaa
+      int i = (a>>5) | ((b>>3) << 3) | ((g>>3) << 8) | ((r>>3) << 13);
+      int v = m_map[i].load(std::memory_order_relaxed);
+      return (v & INVALID) ? generateEntry(i, r, g, b, a): v;
+    }
+
+  private:
+    void onRegenerate() override;
+    int generateEntry(int i, int r, int g, int b, int a) const;
+
+    std::unique_ptr<std::atomic<uint16_t>[]> m_map;
+  };
+
+} // namespace doc
+
+#endif
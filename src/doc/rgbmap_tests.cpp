@@ -0,0 +1,137 @@
+// Aseprite Document Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/palette.h"
+#include "doc/rgbmap_kdtree.h"
+#include "doc/rgbmap_rgb5a3.h"
+
+#include <cstdlib>
+#include <limits>
+#include <memory>
+
+using namespace doc;
+
+// Exact nearest color using a linear search
+static int find_nearest(const Palette& pal, int r, int g, int b, int a,
+                        int maskIndex)
+{
+  if (a == 0 && maskIndex >= 0)
+    return maskIndex;
+
+  int bestIndex = 0;
+  int bestDist = std::numeric_limits<int>::max();
+  for (int i=0; i<pal.size(); ++i) {
+    if (i == maskIndex)
+      continue;
+    color_t c = pal.getEntry(i);
+    int dr = (rgba_getr(c) - r) * 30;
+    int dg = (rgba_getg(c) - g) * 59;
+    int db = (rgba_getb(c) - b) * 11;
+    int da = (rgba_geta(c) - a) * 8;
+    int dist = dr*dr + dg*dg + db*db + da*da;
+    if (dist < bestDist) {
+      bestDist = dist;
+      bestIndex = i;
+    }
+  }
+  return bestIndex;
+}
+
+TEST(RgbMap, Create)
+{
+  std::unique_ptr<RgbMap> a(RgbMap::create(RgbMapAlgorithm::RGB5A3));
+  std::unique_ptr<RgbMap> b(RgbMap::create(RgbMapAlgorithm::KDTREE));
+  EXPECT_EQ(RgbMapAlgorithm::RGB5A3, a->algorithm());
+  EXPECT_EQ(RgbMapAlgorithm::KDTREE, b->algorithm());
+}
+
+TEST(RgbMap, KdTreeIsExact)
+{
+  std::srand(1);
+
+  for (int ncolors : { 1, 2, 5, 16, 256 }) {
+    Palette pal(frame_t(0), ncolors);
+    for (int i=0; i<ncolors; ++i)
+      pal.setEntry(i, rgba(std::rand() % 256,
+                           std::rand() % 256,
+                           std::rand() % 256,
+                           (i & 1 ? 255: std::rand() % 256)));
+    // Repeated entries
+    if (ncolors > 4)
+      pal.setEntry(3, pal.getEntry(1));
+
+    for (int maskIndex : { -1, 0, ncolors-1 }) {
+      RgbMapKdTree rgbmap;
+      rgbmap.regenerate(&pal, maskIndex);
+      EXPECT_TRUE(rgbmap.match(&pal));
+
+      for (int i=0; i<5000; ++i) {
+        int r = std::rand() % 256;
+        int g = std::rand() % 256;
+        int b = std::rand() % 256;
+        int a = (i & 1 ? 255: std::rand() % 256);
+        int expected = find_nearest(pal, r, g, b, a, maskIndex);
+        EXPECT_EQ(expected, rgbmap.findNearest(r, g, b, a));
+        EXPECT_EQ(expected, rgbmap.mapColor(r, g, b, a));
+        // Cached value
+        EXPECT_EQ(expected, rgbmap.mapColor(r, g, b, a));
+      }
+    }
+  }
+}
+
+TEST(RgbMap, KdTreeRegenerate)
+{
+  Palette pal(frame_t(0), 2);
+  pal.setEntry(0, rgba(0, 0, 0, 255));
+  pal.setEntry(1, rgba(255, 255, 255, 255));
+
+  RgbMapKdTree rgbmap;
+  rgbmap.regenerate(&pal, -1);
+  EXPECT_EQ(0, rgbmap.mapColor(10, 10, 10, 255));
+  EXPECT_EQ(1, rgbmap.mapColor(250, 250, 250, 255));
+
+  // Cached results must be discarded
+  pal.setEntry(0, rgba(255, 255, 255, 255));
+  pal.setEntry(1, rgba(0, 0, 0, 255));
+  EXPECT_FALSE(rgbmap.match(&pal));
+  rgbmap.regenerate(&pal, -1);
+  EXPECT_EQ(1, rgbmap.mapColor(10, 10, 10, 255));
+  EXPECT_EQ(0, rgbmap.mapColor(250, 250, 250, 255));
+
+  // Transparent color
+  rgbmap.regenerate(&pal, 1);
+  EXPECT_EQ(1, rgbmap.mapColor(250, 250, 250, 0));
+  EXPECT_EQ(0, rgbmap.mapColor(10, 10, 10, 255));
+}
+
+TEST(RgbMap, RGB5A3UsesFindBestfit)
+{
+  doc::Palette::initBestfit();
+
+  Palette pal(frame_t(0), 3);
+  pal.setEntry(0, rgba(0, 0, 0, 255));
+  pal.setEntry(1, rgba(255, 0, 0, 255));
+  pal.setEntry(2, rgba(0, 0, 255, 255));
+
+  RgbMapRGB5A3 rgbmap;
+  rgbmap.regenerate(&pal, -1);
+  EXPECT_EQ(0, rgbmap.mapColor(10, 10, 10, 255));
+  EXPECT_EQ(1, rgbmap.mapColor(250, 10, 10, 255));
+  EXPECT_EQ(2, rgbmap.mapColor(10, 10, 250, 255));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
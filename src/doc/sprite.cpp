@@ -47,6 +47,20 @@ void Sprite::SetDefaultGridBounds(const gfx::Rect& defGridBounds)
   g_defaultGridBounds = defGridBounds;
 }
 
+static RgbMapAlgorithm g_defaultRgbMapAlgorithm = RgbMapAlgorithm::DEFAULT;
+
+// static
+RgbMapAlgorithm Sprite::DefaultRgbMapAlgorithm()
+{
+  return g_defaultRgbMapAlgorithm;
+}
+
+// static
+void Sprite::SetDefaultRgbMapAlgorithm(const RgbMapAlgorithm mapAlgo)
+{
+  g_defaultRgbMapAlgorithm = mapAlgo;
+}
+
 Sprite::Sprite(const ImageSpec& spec,
                int ncolors)
   : Object(ObjectType::Sprite)
@@ -58,6 +72,7 @@ Sprite::Sprite(const ImageSpec& spec,
   , m_root(new LayerGroup(this))
   , m_gridBounds(Sprite::DefaultGridBounds())
   , m_rgbMap(nullptr)           // Initial RGB map
+  , m_rgbMapAlgorithm(Sprite::DefaultRgbMapAlgorithm())
   , m_tags(this)
   , m_slices(this)
 {
@@ -162,7 +177,7 @@ void Sprite::setColorSpace(const gfx::ColorSpaceRef& colorSpace)
 {
   m_spec.setColorSpace(colorSpace);
   for (auto cel : uniqueCels())
-    cel->image()->setColorSpace(colorSpace);
+    cel->peekImage()->setColorSpace(colorSpace);
 }
 
 bool Sprite::isOpaque() const
@@ -361,8 +376,10 @@ RgbMap* Sprite::rgbMap(frame_t frame, RgbMapFor forLayer) const
   int maskIndex = (forLayer == RgbMapFor::OpaqueLayer ?
                    -1: transparentColor());
 
-  if (m_rgbMap == NULL) {
-    m_rgbMap = new RgbMap();
+  if (m_rgbMap == NULL ||
+      m_rgbMap->algorithm() != m_rgbMapAlgorithm) {
+    delete m_rgbMap;
+    m_rgbMap = RgbMap::create(m_rgbMapAlgorithm);
     m_rgbMap->regenerate(palette(frame), maskIndex);
   }
   else if (!m_rgbMap->match(palette(frame)) ||
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (C) 2018-2019  Igara Studio S.A.
+// Copyright (C) 2018-2022  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -21,6 +21,7 @@
 #include "doc/object.h"
 #include "doc/pixel_format.h"
 #include "doc/pixel_ratio.h"
+#include "doc/rgbmap_algorithm.h"
 #include "doc/slices.h"
 #include "doc/tags.h"
 #include "gfx/rect.h"
@@ -106,6 +107,13 @@ namespace doc {
     const gfx::Rect& gridBounds() const { return m_gridBounds; }
     void setGridBounds(const gfx::Rect& rc) { m_gridBounds = rc; }
 
+    static RgbMapAlgorithm DefaultRgbMapAlgorithm();
+    static void SetDefaultRgbMapAlgorithm(const RgbMapAlgorithm mapAlgo);
+
+    // Algorithm used to create the RgbMap returned by rgbMap().
+    RgbMapAlgorithm rgbMapAlgorithm() const { return m_rgbMapAlgorithm; }
+    void setRgbMapAlgorithm(const RgbMapAlgorithm mapAlgo) { m_rgbMapAlgorithm = mapAlgo; }
+
     virtual int getMemSize() const override;
 
     ////////////////////////////////////////
@@ -200,6 +208,7 @@ namespace doc {
 
     // Current rgb map
     mutable RgbMap* m_rgbMap;
+    RgbMapAlgorithm m_rgbMapAlgorithm;
 
     Tags m_tags;
     Slices m_slices;
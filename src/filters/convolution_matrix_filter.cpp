@@ -15,114 +15,141 @@
 #include "filters/filter_indexed_data.h"
 #include "filters/filter_manager.h"
 #include "filters/neighboring_pixels.h"
+#include "doc/blend_funcs.h"
 #include "doc/image_impl.h"
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
 
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
 namespace filters {
 
 using namespace doc;
 
 namespace {
 
-  struct GetPixelsDelegate {
-    int div;
-    const int* matrixData;
-
-    void reset(const ConvolutionMatrix* matrix) {
-      div = matrix->getDiv();
-      matrixData = &matrix->value(0, 0);
-    }
+  // Planes (one integer per pixel) of each converted row
+  enum {
+    kPlaneR,                    // Red (or gray value), 0 if transparent
+    kPlaneG,
+    kPlaneB,
+    kPlaneA,
+    kPlaneTransparent,          // 1 if the pixel is transparent
+    kPlaneIndex,                // Index of indexed images
+    kPlanes
   };
 
-  struct GetPixelsDelegateRgba : public GetPixelsDelegate {
-    int r, g, b, a;
+  inline int round_up8(const int n)
+  {
+    return (n+7) & ~7;
+  }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = 0;
-    }
-
-    void operator()(RgbTraits::pixel_t color) {
-      if (*matrixData) {
-        if (rgba_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(color) * (*matrixData);
-          g += rgba_getg(color) * (*matrixData);
-          b += rgba_getb(color) * (*matrixData);
-          a += rgba_geta(color) * (*matrixData);
-        }
-      }
-      matrixData++;
+  struct GetPlanesRgba {
+    void operator()(RgbTraits::pixel_t color, int* planes, const int stride) const {
+      const bool transparent = (rgba_geta(color) == 0);
+      planes[kPlaneR*stride] = (transparent ? 0: rgba_getr(color));
+      planes[kPlaneG*stride] = (transparent ? 0: rgba_getg(color));
+      planes[kPlaneB*stride] = (transparent ? 0: rgba_getb(color));
+      planes[kPlaneA*stride] = rgba_geta(color);
+      planes[kPlaneTransparent*stride] = (transparent ? 1: 0);
     }
   };
 
-  struct GetPixelsDelegateGrayscale : public GetPixelsDelegate {
-    int v, a;
-
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      v = a = 0;
-    }
-
-    void operator()(GrayscaleTraits::pixel_t color) {
-      if (*matrixData) {
-        if (graya_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          v += graya_getv(color) * (*matrixData);
-          a += graya_geta(color) * (*matrixData);
-        }
-      }
-      matrixData++;
+  struct GetPlanesGrayscale {
+    void operator()(GrayscaleTraits::pixel_t color, int* planes, const int stride) const {
+      const bool transparent = (graya_geta(color) == 0);
+      planes[kPlaneR*stride] = (transparent ? 0: graya_getv(color));
+      planes[kPlaneA*stride] = graya_geta(color);
+      planes[kPlaneTransparent*stride] = (transparent ? 1: 0);
     }
   };
 
-  struct GetPixelsDelegateIndexed : public GetPixelsDelegate {
+  struct GetPlanesIndexed {
     const Palette* pal;
-    int r, g, b, a, index;
 
-    GetPixelsDelegateIndexed(const Palette* pal) : pal(pal) { }
+    GetPlanesIndexed(const Palette* pal) : pal(pal) { }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = index = 0;
+    void operator()(IndexedTraits::pixel_t index, int* planes, const int stride) const {
+      GetPlanesRgba()(pal->getEntry(index), planes, stride);
+      planes[kPlaneIndex*stride] = index;
     }
+  };
 
-    void operator()(IndexedTraits::pixel_t color) {
-      if (*matrixData) {
-        index += color * (*matrixData);
-        color_t rgba = pal->getEntry(color);
-        if (rgba_geta(rgba) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(rgba) * (*matrixData);
-          g += rgba_getg(rgba) * (*matrixData);
-          b += rgba_getb(rgba) * (*matrixData);
-          a += rgba_geta(rgba) * (*matrixData);
-        }
-      }
-      matrixData++;
+}
+
+// Each block of 8 pixels is accumulated in a local array so the
+// compiler can keep it in vector registers.
+void convolve_row_portable(int* dst,
+                           const ConvolutionTap* taps,
+                           const int ntaps,
+                           const int n)
+{
+  for (int i=0; i<n; i+=8) {
+    int v[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    for (int t=0; t<ntaps; ++t) {
+      const int* src = taps[t].src + i;
+      const int k = taps[t].k;
+      for (int j=0; j<8; ++j)
+        v[j] += k*src[j];
     }
-  };
+    for (int j=0; j<8; ++j)
+      dst[i+j] = v[j];
+  }
+}
 
+ConvolveRowFunc get_convolve_row_func()
+{
+#if FILTERS_CONVOLUTION_AVX2
+  static const bool avx2 = doc::cpu_supports_avx2();
+  if (avx2)
+    return convolve_row_avx2;
+#endif
+  return convolve_row_portable;
 }
 
 ConvolutionMatrixFilter::ConvolutionMatrixFilter()
   : m_matrix(NULL)
   , m_tiledMode(TiledMode::NONE)
+  , m_allowSeparable(true)
+  , m_separable(false)
+  , m_src(nullptr)
+  , m_x(0)
+  , m_rowWidth(0)
+  , m_target(0)
+  , m_planes{ false, false, false, false, false, false }
+  , m_rowStride(0)
+  , m_expandedStride(0)
+  , m_accStride(0)
+  , m_convolveRow(get_convolve_row_func())
 {
 }
 
 void ConvolutionMatrixFilter::setMatrix(const std::shared_ptr<ConvolutionMatrix>& matrix)
 {
   m_matrix = matrix;
+  m_src = nullptr;
+  findSeparableMatrix();
 }
 
 void ConvolutionMatrixFilter::setTiledMode(TiledMode tiledMode)
 {
   m_tiledMode = tiledMode;
+  m_src = nullptr;
+}
+
+void ConvolutionMatrixFilter::setAllowSeparable(const bool state)
+{
+  m_allowSeparable = state;
+  m_src = nullptr;
+  findSeparableMatrix();
+}
+
+void ConvolutionMatrixFilter::setConvolveRowFunc(ConvolveRowFunc func)
+{
+  m_convolveRow = func;
+  m_src = nullptr;
 }
 
 const char* ConvolutionMatrixFilter::getName()
@@ -139,61 +166,62 @@ void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint32_t color;
-  GetPixelsDelegateRgba delegate;
+  int r, g, b, a;
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  m_planes[kPlaneR] = (target & TARGET_RED_CHANNEL);
+  m_planes[kPlaneG] = (target & TARGET_GREEN_CHANNEL);
+  m_planes[kPlaneB] = (target & TARGET_BLUE_CHANNEL);
+  m_planes[kPlaneA] = (target & TARGET_ALPHA_CHANNEL);
+  m_planes[kPlaneTransparent] = true;
+  m_planes[kPlaneIndex] = false;
+  convolveRow<RgbTraits>(filterMgr, GetPlanesRgba());
+
+  const int* rs = plane(kPlaneR);
+  const int* gs = plane(kPlaneG);
+  const int* bs = plane(kPlaneB);
+  const int* as = plane(kPlaneA);
+  const int* ts = plane(kPlaneTransparent);
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<RgbTraits>(src, x, y,
-                                      m_matrix->getWidth(),
-                                      m_matrix->getHeight(),
-                                      m_matrix->getCenterX(),
-                                      m_matrix->getCenterY(),
-                                      m_tiledMode, delegate);
-
     color = get_pixel_fast<RgbTraits>(src, x, y);
-    if (delegate.div == 0) {
+
+    // Transparent pixels are not used
+    const int div = m_matrix->getDiv() - ts[i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
-    if (target & TARGET_RED_CHANNEL) {
-      delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-      delegate.r = std::clamp(delegate.r, 0, 255);
-    }
+    if (target & TARGET_RED_CHANNEL)
+      r = std::clamp(rs[i] / div + m_matrix->getBias(), 0, 255);
     else
-      delegate.r = rgba_getr(color);
+      r = rgba_getr(color);
 
-    if (target & TARGET_GREEN_CHANNEL) {
-      delegate.g = delegate.g / delegate.div + m_matrix->getBias();
-      delegate.g = std::clamp(delegate.g, 0, 255);
-    }
+    if (target & TARGET_GREEN_CHANNEL)
+      g = std::clamp(gs[i] / div + m_matrix->getBias(), 0, 255);
     else
-      delegate.g = rgba_getg(color);
+      g = rgba_getg(color);
 
-    if (target & TARGET_BLUE_CHANNEL) {
-      delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-      delegate.b = std::clamp(delegate.b, 0, 255);
-    }
+    if (target & TARGET_BLUE_CHANNEL)
+      b = std::clamp(bs[i] / div + m_matrix->getBias(), 0, 255);
     else
-      delegate.b = rgba_getb(color);
+      b = rgba_getb(color);
 
-    if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = std::clamp(delegate.a, 0, 255);
-    }
+    if (target & TARGET_ALPHA_CHANNEL)
+      a = std::clamp(as[i] / m_matrix->getDiv() + m_matrix->getBias(), 0, 255);
     else
-      delegate.a = rgba_geta(color);
+      a = rgba_geta(color);
 
-    *(dst_address++) = rgba(delegate.r, delegate.g, delegate.b, delegate.a);
+    *(dst_address++) = rgba(r, g, b, a);
   }
 }
 
@@ -206,47 +234,50 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint16_t color;
-  GetPixelsDelegateGrayscale delegate;
+  int v, a;
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  m_planes[kPlaneR] = (target & TARGET_GRAY_CHANNEL);
+  m_planes[kPlaneG] = false;
+  m_planes[kPlaneB] = false;
+  m_planes[kPlaneA] = (target & TARGET_ALPHA_CHANNEL);
+  m_planes[kPlaneTransparent] = true;
+  m_planes[kPlaneIndex] = false;
+  convolveRow<GrayscaleTraits>(filterMgr, GetPlanesGrayscale());
+
+  const int* vs = plane(kPlaneR);
+  const int* as = plane(kPlaneA);
+  const int* ts = plane(kPlaneTransparent);
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y,
-                                            m_matrix->getWidth(),
-                                            m_matrix->getHeight(),
-                                            m_matrix->getCenterX(),
-                                            m_matrix->getCenterY(),
-                                            m_tiledMode, delegate);
-
     color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-    if (delegate.div == 0) {
+
+    // Transparent pixels are not used
+    const int div = m_matrix->getDiv() - ts[i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
-    if (target & TARGET_GRAY_CHANNEL) {
-      delegate.v = delegate.v / delegate.div + m_matrix->getBias();
-      delegate.v = std::clamp(delegate.v, 0, 255);
-    }
+    if (target & TARGET_GRAY_CHANNEL)
+      v = std::clamp(vs[i] / div + m_matrix->getBias(), 0, 255);
     else
-      delegate.v = graya_getv(color);
+      v = graya_getv(color);
 
-    if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = std::clamp(delegate.a, 0, 255);
-    }
+    if (target & TARGET_ALPHA_CHANNEL)
+      a = std::clamp(as[i] / m_matrix->getDiv() + m_matrix->getBias(), 0, 255);
     else
-      delegate.a = graya_geta(color);
+      a = graya_geta(color);
 
-    *(dst_address++) = graya(delegate.v, delegate.a);
+    *(dst_address++) = graya(v, a);
   }
 }
 
@@ -261,72 +292,237 @@ void ConvolutionMatrixFilter::applyToIndexed(FilterManager* filterMgr)
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
   uint8_t color;
-  GetPixelsDelegateIndexed delegate(pal);
+  color_t rgba;
+  int r, g, b, a;
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  const bool indexTarget = (target & TARGET_INDEX_CHANNEL);
+  m_planes[kPlaneR] = (!indexTarget && (target & TARGET_RED_CHANNEL));
+  m_planes[kPlaneG] = (!indexTarget && (target & TARGET_GREEN_CHANNEL));
+  m_planes[kPlaneB] = (!indexTarget && (target & TARGET_BLUE_CHANNEL));
+  m_planes[kPlaneA] = (!indexTarget && (target & TARGET_ALPHA_CHANNEL));
+  m_planes[kPlaneTransparent] = true;
+  m_planes[kPlaneIndex] = indexTarget;
+  convolveRow<IndexedTraits>(filterMgr, GetPlanesIndexed(pal));
+
+  const int* rs = plane(kPlaneR);
+  const int* gs = plane(kPlaneG);
+  const int* bs = plane(kPlaneB);
+  const int* as = plane(kPlaneA);
+  const int* ts = plane(kPlaneTransparent);
+  const int* is = plane(kPlaneIndex);
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<IndexedTraits>(src, x, y,
-                                          m_matrix->getWidth(),
-                                          m_matrix->getHeight(),
-                                          m_matrix->getCenterX(),
-                                          m_matrix->getCenterY(),
-                                          m_tiledMode, delegate);
-
     color = get_pixel_fast<IndexedTraits>(src, x, y);
-    if (delegate.div == 0) {
+
+    // Transparent pixels are not used
+    const int div = m_matrix->getDiv() - ts[i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
-    if (target & TARGET_INDEX_CHANNEL) {
-      delegate.index = delegate.index / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.index = std::clamp(delegate.index, 0, 255);
-
-      *(dst_address++) = delegate.index;
+    if (indexTarget) {
+      *(dst_address++) =
+        std::clamp(is[i] / m_matrix->getDiv() + m_matrix->getBias(), 0, 255);
     }
     else {
-      color = pal->getEntry(color);
+      rgba = pal->getEntry(color);
 
-      if (target & TARGET_RED_CHANNEL) {
-        delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-        delegate.r = std::clamp(delegate.r, 0, 255);
-      }
+      if (target & TARGET_RED_CHANNEL)
+        r = std::clamp(rs[i] / div + m_matrix->getBias(), 0, 255);
       else
-        delegate.r = rgba_getr(color);
+        r = rgba_getr(rgba);
 
-      if (target & TARGET_GREEN_CHANNEL) {
-        delegate.g =  delegate.g / delegate.div + m_matrix->getBias();
-        delegate.g = std::clamp(delegate.g, 0, 255);
-      }
+      if (target & TARGET_GREEN_CHANNEL)
+        g = std::clamp(gs[i] / div + m_matrix->getBias(), 0, 255);
       else
-        delegate.g = rgba_getg(color);
+        g = rgba_getg(rgba);
 
-      if (target & TARGET_BLUE_CHANNEL) {
-        delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-        delegate.b = std::clamp(delegate.b, 0, 255);
-      }
+      if (target & TARGET_BLUE_CHANNEL)
+        b = std::clamp(bs[i] / div + m_matrix->getBias(), 0, 255);
       else
-        delegate.b = rgba_getb(color);
+        b = rgba_getb(rgba);
 
-      if (target & TARGET_ALPHA_CHANNEL) {
-        delegate.a = delegate.a / delegate.div + m_matrix->getBias();
-        delegate.a = std::clamp(delegate.a, 0, 255);
-      }
+      if (target & TARGET_ALPHA_CHANNEL)
+        a = std::clamp(as[i] / div + m_matrix->getBias(), 0, 255);
       else
-        delegate.a = rgba_geta(color);
+        a = rgba_geta(rgba);
+
+      *(dst_address++) = rgbmap->mapColor(r, g, b, a);
+    }
+  }
+}
+
+template<typename Traits, typename GetPlanes>
+void ConvolutionMatrixFilter::convolveRow(FilterManager* filterMgr,
+                                          GetPlanes getPlanes)
+{
+  const Image* src = filterMgr->getSourceImage();
+  const int x = filterMgr->x();
+  const int y = filterMgr->y();
+  const int w = filterMgr->getWidth();
+  const Target target = filterMgr->getTarget();
+  const int kw = m_matrix->getWidth();
+  const int kh = m_matrix->getHeight();
+  const int cy = m_matrix->getCenterY();
+
+  // Discard the converted rows of the previous image/bounds
+  if (filterMgr->isFirstRow() ||
+      src != m_src ||
+      x != m_x ||
+      w != m_rowWidth ||
+      target != m_target) {
+    const bool tiledX = (int(m_tiledMode) & int(TiledMode::X_AXIS));
+    const int ncols = w + kw - 1;
+    const int cx = m_matrix->getCenterX();
+
+    m_columnX.resize(ncols);
+    for (int c=0; c<ncols; ++c)
+      m_columnX[c] = get_neighboring_coord(x-cx+c, src->width(), tiledX);
+
+    // Rows are padded to process blocks of 8 pixels
+    m_accStride = round_up8(w);
+    m_expandedStride = round_up8(m_accStride + kw - 1);
+    m_rowStride = (m_separable ? m_accStride: m_expandedStride);
+
+    m_expanded.assign(m_separable ? kPlanes*m_expandedStride: 0, 0);
+    m_rows.assign(kh*kPlanes*m_rowStride, 0);
+    m_rowsY.assign(kh, std::numeric_limits<int>::min());
+    m_acc.resize(kPlanes*m_accStride);
+
+    m_src = src;
+    m_x = x;
+    m_rowWidth = w;
+    m_target = target;
+  }
 
-      *(dst_address++) = rgbmap->mapColor(delegate.r, delegate.g, delegate.b, delegate.a);
+  // Convert the source rows that aren't in the ring buffer
+  for (int dy=0; dy<kh; ++dy) {
+    const int rowY = y - cy + dy;
+    const int slot = ((rowY % kh) + kh) % kh;
+    if (m_rowsY[slot] != rowY) {
+      fillRow<Traits>(src, rowY, &m_rows[slot*kPlanes*m_rowStride], getPlanes);
+      m_rowsY[slot] = rowY;
     }
   }
+
+  for (int p=0; p<kPlanes; ++p) {
+    if (!m_planes[p])
+      continue;
+
+    m_taps.clear();
+    for (int dy=0; dy<kh; ++dy) {
+      const int rowY = y - cy + dy;
+      const int slot = ((rowY % kh) + kh) % kh;
+      const int* rowPlane = &m_rows[(slot*kPlanes + p)*m_rowStride];
+      if (m_separable) {
+        if (m_colVector[dy])
+          m_taps.push_back(ConvolutionTap{ rowPlane, m_colVector[dy] });
+      }
+      else {
+        for (int dx=0; dx<kw; ++dx) {
+          const int k = m_matrix->value(dx, dy);
+          if (k)
+            m_taps.push_back(ConvolutionTap{ rowPlane + dx, k });
+        }
+      }
+    }
+    m_convolveRow(&m_acc[p*m_accStride], m_taps.data(), int(m_taps.size()),
+                  m_accStride);
+  }
+}
+
+template<typename Traits, typename GetPlanes>
+void ConvolutionMatrixFilter::fillRow(const Image* src, const int y, int* dst,
+                                      GetPlanes getPlanes)
+{
+  const bool tiledY = (int(m_tiledMode) & int(TiledMode::Y_AXIS));
+  auto srcRow = (typename Traits::const_address_t)
+    src->getPixelAddress(0, get_neighboring_coord(y, src->height(), tiledY));
+
+  int* planes = (m_separable ? &m_expanded[0]: dst);
+  const int stride = (m_separable ? m_expandedStride: m_rowStride);
+  const int ncols = int(m_columnX.size());
+  for (int c=0; c<ncols; ++c)
+    getPlanes(srcRow[m_columnX[c]], planes+c, stride);
+
+  // Convolve the row with the row vector
+  if (m_separable) {
+    const int kw = int(m_rowVector.size());
+    for (int p=0; p<kPlanes; ++p) {
+      if (!m_planes[p])
+        continue;
+
+      m_taps.clear();
+      for (int dx=0; dx<kw; ++dx) {
+        if (m_rowVector[dx])
+          m_taps.push_back(ConvolutionTap{ planes + p*stride + dx,
+                                           m_rowVector[dx] });
+      }
+      m_convolveRow(dst + p*m_rowStride, m_taps.data(), int(m_taps.size()),
+                    m_rowStride);
+    }
+  }
+}
+
+void ConvolutionMatrixFilter::findSeparableMatrix()
+{
+  m_separable = false;
+  m_rowVector.clear();
+  m_colVector.clear();
+
+  if (!m_matrix || !m_allowSeparable)
+    return;
+
+  const ConvolutionMatrix& m = *m_matrix;
+  const int kw = m.getWidth();
+  const int kh = m.getHeight();
+  if (kw < 2 || kh < 2)
+    return;
+
+  // The row vector is the first non-zero row divided by the GCD of
+  // its values, so each row of the matrix must be an integer
+  // multiple of it (we need the exact same integer results).
+  int pivotY = 0, pivotX = 0;
+  for (; pivotY<kh; ++pivotY) {
+    for (pivotX=0; pivotX<kw && m.value(pivotX, pivotY) == 0; ++pivotX)
+      ;
+    if (pivotX < kw)
+      break;
+  }
+  if (pivotY == kh)
+    return;
+
+  int gcd = 0;
+  for (int x=0; x<kw; ++x)
+    gcd = std::gcd(gcd, m.value(x, pivotY));
+
+  std::vector<int> rowVector(kw);
+  std::vector<int> colVector(kh);
+  for (int x=0; x<kw; ++x)
+    rowVector[x] = m.value(x, pivotY) / gcd;
+
+  for (int y=0; y<kh; ++y) {
+    const int k = m.value(pivotX, y) / rowVector[pivotX];
+    for (int x=0; x<kw; ++x) {
+      if (k * rowVector[x] != m.value(x, y))
+        return;
+    }
+    colVector[y] = k;
+  }
+
+  m_separable = true;
+  m_rowVector = std::move(rowVector);
+  m_colVector = std::move(colVector);
 }
 
 } // namespace filters
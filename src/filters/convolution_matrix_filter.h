@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -9,15 +9,31 @@
 #define FILTERS_CONVOLUTION_MATRIX_FILTER_H_INCLUDED
 #pragma once
 
+#include "filters/convolution_row.h"
 #include "filters/filter.h"
+#include "filters/target.h"
 #include "filters/tiled_mode.h"
 
 #include <memory>
+#include <vector>
+
+namespace doc {
+  class Image;
+}
 
 namespace filters {
 
   class ConvolutionMatrix;
 
+  // Applies a convolution matrix to whole rows: the source rows that
+  // are needed for the current row are converted to one plane of
+  // integers per channel (and kept for the next rows), and the
+  // products of all matrix values are accumulated for blocks of 8
+  // pixels of the row at the same time (with AVX2 if the CPU supports
+  // it). If the matrix is the product of a column and a row vector
+  // (e.g. blur-3x3), each source row is convolved with the row vector
+  // first, and then the current row is calculated with the column
+  // vector.
   class ConvolutionMatrixFilter : public Filter {
   public:
     ConvolutionMatrixFilter();
@@ -28,15 +44,57 @@ namespace filters {
     std::shared_ptr<ConvolutionMatrix> getMatrix() { return m_matrix; }
     TiledMode getTiledMode() const { return m_tiledMode; }
 
+    // These are used in tests to compare the results of the
+    // separable/generic paths and the AVX2/portable row functions
+    // (the fastest ones are used by default).
+    void setAllowSeparable(const bool state);
+    void setConvolveRowFunc(ConvolveRowFunc func);
+    bool isSeparable() const { return m_separable; }
+
     // Filter implementation
     const char* getName();
     void applyToRgba(FilterManager* filterMgr);
     void applyToGrayscale(FilterManager* filterMgr);
     void applyToIndexed(FilterManager* filterMgr);
 
+    // Rows are calculated incrementally from the previous one.
+    bool isThreadSafe() const { return false; }
+
   private:
+    template<typename Traits, typename GetPlanes>
+    void convolveRow(FilterManager* filterMgr, GetPlanes getPlanes);
+    template<typename Traits, typename GetPlanes>
+    void fillRow(const doc::Image* src, const int y, int* dst,
+                 GetPlanes getPlanes);
+    void findSeparableMatrix();
+    const int* plane(const int i) const { return &m_acc[i*m_accStride]; }
+
     std::shared_ptr<ConvolutionMatrix> m_matrix;
     TiledMode m_tiledMode;
+
+    // Row and column vectors (if the matrix is separable)
+    bool m_allowSeparable;
+    bool m_separable;
+    std::vector<int> m_rowVector;
+    std::vector<int> m_colVector;
+
+    // State of the last processed row (source rows are reused only
+    // for the same image/bounds).
+    const doc::Image* m_src;
+    int m_x;
+    int m_rowWidth;
+    Target m_target;
+    bool m_planes[6];           // Channels that we have to calculate
+    std::vector<int> m_columnX; // Source X of each column of a row
+    std::vector<int> m_rowsY;   // Y coordinate of each row in m_rows
+    std::vector<int> m_rows;    // Ring buffer of getHeight() rows
+    int m_rowStride;            // Integers per plane in m_rows
+    std::vector<int> m_expanded;
+    int m_expandedStride;
+    std::vector<int> m_acc;     // Accumulated values of the current row
+    int m_accStride;
+    std::vector<ConvolutionTap> m_taps;
+    ConvolveRowFunc m_convolveRow;
   };
 
 } // namespace filters
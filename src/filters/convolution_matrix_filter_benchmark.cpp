@@ -0,0 +1,137 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "filters/convolution_matrix_filter.h"
+
+#include "doc/image_impl.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "filters/convolution_matrix.h"
+#include "filters/filter_manager.h"
+#include "filters/filter_test_utils.h"
+#include "filters/neighboring_pixels.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+using namespace doc;
+using namespace filters;
+
+// Old ConvolutionMatrixFilter::applyToRgba() implementation (visits
+// all the neighboring pixels of each pixel).
+class LegacyConvolutionMatrixFilter : public Filter {
+public:
+  LegacyConvolutionMatrixFilter(const std::shared_ptr<ConvolutionMatrix>& matrix)
+    : m_matrix(matrix) { }
+
+  const char* getName() override { return "Legacy Convolution Matrix"; }
+  void applyToGrayscale(FilterManager* filterMgr) override { }
+  void applyToIndexed(FilterManager* filterMgr) override { }
+
+  void applyToRgba(FilterManager* filterMgr) override {
+    const Image* src = filterMgr->getSourceImage();
+    uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
+    int x = filterMgr->x();
+    int x2 = x+filterMgr->getWidth();
+    int y = filterMgr->y();
+
+    for (; x<x2; ++x) {
+      const int* matrixData = &m_matrix->value(0, 0);
+      int div = m_matrix->getDiv();
+      int r = 0, g = 0, b = 0, a = 0;
+      auto delegate = [&](RgbTraits::pixel_t color) {
+        if (*matrixData) {
+          if (rgba_geta(color) == 0)
+            div -= *matrixData;
+          else {
+            r += rgba_getr(color) * (*matrixData);
+            g += rgba_getg(color) * (*matrixData);
+            b += rgba_getb(color) * (*matrixData);
+            a += rgba_geta(color) * (*matrixData);
+          }
+        }
+        matrixData++;
+      };
+      get_neighboring_pixels<RgbTraits>(src, x, y,
+                                        m_matrix->getWidth(),
+                                        m_matrix->getHeight(),
+                                        m_matrix->getCenterX(),
+                                        m_matrix->getCenterY(),
+                                        TiledMode::NONE, delegate);
+      if (div == 0) {
+        *(dst_address++) = get_pixel_fast<RgbTraits>(src, x, y);
+        continue;
+      }
+
+      const int bias = m_matrix->getBias();
+      *(dst_address++) = rgba(std::clamp(r / div + bias, 0, 255),
+                              std::clamp(g / div + bias, 0, 255),
+                              std::clamp(b / div + bias, 0, 255),
+                              std::clamp(a / m_matrix->getDiv() + bias, 0, 255));
+    }
+  }
+
+private:
+  std::shared_ptr<ConvolutionMatrix> m_matrix;
+};
+
+// Creates the "blur-NxN" matrix of data/convmatr.def (blur-3x3 is
+// separable, the others are not).
+static std::shared_ptr<ConvolutionMatrix> create_blur_matrix(const int size)
+{
+  auto matrix = std::make_shared<ConvolutionMatrix>(size, size);
+  const int c = size/2;
+  int div = 0;
+  for (int y=0; y<size; ++y) {
+    for (int x=0; x<size; ++x) {
+      const int v = (size == 3 ? (2-std::abs(x-c)) * (2-std::abs(y-c)):
+                                 1 + (c-std::abs(x-c)) + (c-std::abs(y-c)));
+      matrix->value(x, y) = v;
+      div += v;
+    }
+  }
+  matrix->setCenterX(c);
+  matrix->setCenterY(c);
+  matrix->setDiv(div);
+  matrix->setBias(0);
+  return matrix;
+}
+
+static void run_filter(benchmark::State& state, Filter* filter) {
+  const ImageRef src = create_random_image(IMAGE_RGB, state.range(0), state.range(0));
+  TestFilterManager filterMgr(src.get(), TARGET_ALL_CHANNELS);
+
+  for (auto _ : state)
+    filterMgr.apply(filter);
+  state.SetItemsProcessed(state.iterations() * src->width() * src->height());
+}
+
+static void BM_LegacyConvolution(benchmark::State& state) {
+  LegacyConvolutionMatrixFilter filter(create_blur_matrix(state.range(1)));
+  run_filter(state, &filter);
+}
+
+static void BM_Convolution(benchmark::State& state) {
+  ConvolutionMatrixFilter filter;
+  filter.setMatrix(create_blur_matrix(state.range(1)));
+  run_filter(state, &filter);
+}
+
+BENCHMARK(BM_LegacyConvolution)
+  ->ArgsProduct({ { 64, 256, 1024 }, { 3, 5 } })
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Convolution)
+  ->ArgsProduct({ { 64, 256, 1024 }, { 3, 5 } })
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
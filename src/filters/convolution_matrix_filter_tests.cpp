@@ -0,0 +1,334 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "filters/convolution_matrix_filter.h"
+
+#include "doc/blend_funcs.h"
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_row.h"
+#include "filters/filter_test_utils.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace doc;
+using namespace filters;
+
+namespace {
+
+struct Random {
+  uint32_t seed;
+  int next(const int min, const int max) {
+    seed = seed*1103515245 + 12345;
+    return min + int((seed >> 16) % uint32_t(max-min+1));
+  }
+};
+
+// Creates a matrix with random values, if "separable" is true the
+// matrix is the product of a random column and row vector.
+std::shared_ptr<ConvolutionMatrix> create_random_matrix(
+  const int w, const int h, const bool separable, Random& rnd)
+{
+  auto matrix = std::make_shared<ConvolutionMatrix>(w, h);
+  std::vector<int> row(w), col(h);
+  for (int& v : row) v = rnd.next(-2, 3);
+  for (int& v : col) v = rnd.next(-2, 3);
+  row[rnd.next(0, w-1)] = rnd.next(1, 3);
+  col[rnd.next(0, h-1)] = rnd.next(1, 3);
+
+  int div = 0;
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      const int v = (separable ? row[x]*col[y]: rnd.next(-3, 4));
+      matrix->value(x, y) = v;
+      div += v;
+    }
+  }
+  matrix->setCenterX(rnd.next(0, w-1));
+  matrix->setCenterY(rnd.next(0, h-1));
+  matrix->setDiv(div > 0 ? div: 1);
+  matrix->setBias(rnd.next(0, 16));
+  return matrix;
+}
+
+// Random image where some pixels are transparent (transparent
+// pixels are not used in the convolution).
+ImageRef create_test_image(const PixelFormat format,
+                           const int w, const int h,
+                           const int ncolors = 256)
+{
+  ImageRef image = create_random_image(format, w, h, 1, ncolors);
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      if ((x*7 + y*3) % 5)
+        continue;
+      const color_t c = get_pixel(image.get(), x, y);
+      switch (format) {
+        case IMAGE_RGB:
+          put_pixel(image.get(), x, y, c & rgba_rgb_mask);
+          break;
+        case IMAGE_GRAYSCALE:
+          put_pixel(image.get(), x, y, graya(graya_getv(c), 0));
+          break;
+        case IMAGE_INDEXED:
+          put_pixel(image.get(), x, y, 0);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  return image;
+}
+
+// Palette where the first entry is transparent
+std::unique_ptr<Palette> create_test_palette(const int ncolors)
+{
+  std::unique_ptr<Palette> pal(new Palette(frame_t(0), ncolors));
+  Random rnd{ 3 };
+  for (int i=0; i<ncolors; ++i)
+    pal->setEntry(i, rgba(rnd.next(0, 255), rnd.next(0, 255),
+                          rnd.next(0, 255), (i == 0 ? 0: rnd.next(1, 255))));
+  return pal;
+}
+
+int matrix_coord(const int v, const int size, const bool tiled)
+{
+  if (tiled)
+    return ((v % size) + size) % size;
+  else
+    return std::clamp(v, 0, size-1);
+}
+
+// Convolution of one RGB pixel visiting all the pixels of the matrix
+color_t brute_force_rgba(const Image* src, const int x, const int y,
+                         const ConvolutionMatrix& m,
+                         const TiledMode tiled)
+{
+  const bool tiledX = (int(tiled) & int(TiledMode::X_AXIS));
+  const bool tiledY = (int(tiled) & int(TiledMode::Y_AXIS));
+  int div = m.getDiv();
+  int r = 0, g = 0, b = 0, a = 0;
+  for (int v=0; v<m.getHeight(); ++v) {
+    for (int u=0; u<m.getWidth(); ++u) {
+      const int k = m.value(u, v);
+      if (!k)
+        continue;
+      const color_t c = get_pixel(
+        src,
+        matrix_coord(x - m.getCenterX() + u, src->width(), tiledX),
+        matrix_coord(y - m.getCenterY() + v, src->height(), tiledY));
+      if (rgba_geta(c) == 0)
+        div -= k;
+      else {
+        r += k*rgba_getr(c);
+        g += k*rgba_getg(c);
+        b += k*rgba_getb(c);
+        a += k*rgba_geta(c);
+      }
+    }
+  }
+  if (div == 0)
+    return get_pixel(src, x, y);
+
+  const int bias = m.getBias();
+  return rgba(std::clamp(r / div + bias, 0, 255),
+              std::clamp(g / div + bias, 0, 255),
+              std::clamp(b / div + bias, 0, 255),
+              std::clamp(a / m.getDiv() + bias, 0, 255));
+}
+
+// Row functions that can be used in this CPU
+std::vector<ConvolveRowFunc> row_funcs()
+{
+  std::vector<ConvolveRowFunc> funcs = { convolve_row_portable };
+#if FILTERS_CONVOLUTION_AVX2
+  if (doc::cpu_supports_avx2())
+    funcs.push_back(convolve_row_avx2);
+#endif
+  return funcs;
+}
+
+struct Input {
+  const Image* src;
+  Target target;
+  const Palette* pal = nullptr;
+  const RgbMap* rgbmap = nullptr;
+  gfx::Rect bounds;
+  std::vector<bool> selected;
+};
+
+// Applies the matrix with all the combinations of separable/generic
+// paths and row functions, all results must be identical.
+void expect_same_results_in_all_paths(
+  const Input& input,
+  const std::shared_ptr<ConvolutionMatrix>& matrix,
+  const TiledMode tiled,
+  const bool separable)
+{
+  ImageRef expected;
+  for (const bool allowSeparable : { false, true }) {
+    for (ConvolveRowFunc func : row_funcs()) {
+      ConvolutionMatrixFilter filter;
+      filter.setMatrix(matrix);
+      filter.setTiledMode(tiled);
+      filter.setAllowSeparable(allowSeparable);
+      filter.setConvolveRowFunc(func);
+      EXPECT_EQ(allowSeparable && separable, filter.isSeparable());
+
+      TestFilterManager filterMgr(input.src, input.target,
+                                  input.pal, input.rgbmap);
+      if (!input.bounds.isEmpty())
+        filterMgr.setBounds(input.bounds);
+      if (!input.selected.empty())
+        filterMgr.setSelected(input.selected);
+
+      ImageRef result(Image::createCopy(filterMgr.apply(&filter)));
+      if (!expected) {
+        expected = result;
+
+        // Check the generic path with the brute force version
+        if (input.src->pixelFormat() == IMAGE_RGB &&
+            input.target == TARGET_ALL_CHANNELS) {
+          for (int y=0; y<input.src->height(); ++y) {
+            for (int x=0; x<input.src->width(); ++x) {
+              ASSERT_EQ(filterMgr.isSelected(x, y) ?
+                        brute_force_rgba(input.src, x, y, *matrix, tiled):
+                        get_pixel(input.src, x, y),
+                        get_pixel(result.get(), x, y))
+                << "pixel (" << x << ", " << y << ")";
+            }
+          }
+        }
+        continue;
+      }
+
+      for (int y=0; y<input.src->height(); ++y) {
+        for (int x=0; x<input.src->width(); ++x) {
+          ASSERT_EQ(get_pixel(expected.get(), x, y),
+                    get_pixel(result.get(), x, y))
+            << "pixel (" << x << ", " << y << ")"
+            << " separable " << allowSeparable
+            << " avx2 " << (func != convolve_row_portable);
+        }
+      }
+    }
+  }
+}
+
+const TiledMode kTiledModes[] = {
+  TiledMode::NONE,
+  TiledMode::X_AXIS,
+  TiledMode::Y_AXIS,
+  TiledMode::BOTH,
+};
+
+const gfx::Size kMatrixSizes[] = {
+  { 3, 3 }, { 5, 3 }, { 2, 7 }, { 7, 7 }, { 1, 5 },
+};
+
+void test_random_matrices(const Input& input)
+{
+  Random rnd{ 1 };
+  for (const gfx::Size& size : kMatrixSizes) {
+    for (const bool separable : { true, false }) {
+      auto matrix = create_random_matrix(size.w, size.h, separable, rnd);
+      // 1xN matrices are not separable (they are just one row)
+      const bool expectSeparable =
+        (separable && size.w > 1 && size.h > 1);
+      for (TiledMode tiled : kTiledModes) {
+        SCOPED_TRACE(testing::Message()
+                     << "matrix " << size.w << "x" << size.h
+                     << " separable " << separable
+                     << " tiled " << int(tiled));
+        expect_same_results_in_all_paths(input, matrix, tiled,
+                                         expectSeparable);
+      }
+    }
+  }
+}
+
+} // anonymous namespace
+
+TEST(ConvolutionMatrixFilter, Rgb)
+{
+  const ImageRef src = create_test_image(IMAGE_RGB, 45, 33);
+  for (Target target : { TARGET_ALL_CHANNELS,
+                         TARGET_GREEN_CHANNEL | TARGET_ALPHA_CHANNEL }) {
+    Input input;
+    input.src = src.get();
+    input.target = target;
+    test_random_matrices(input);
+  }
+}
+
+TEST(ConvolutionMatrixFilter, Grayscale)
+{
+  const ImageRef src = create_test_image(IMAGE_GRAYSCALE, 45, 33);
+  Input input;
+  input.src = src.get();
+  input.target = TARGET_ALL_CHANNELS;
+  test_random_matrices(input);
+}
+
+TEST(ConvolutionMatrixFilter, Indexed)
+{
+  const auto pal = create_test_palette(32);
+  std::unique_ptr<RgbMap> rgbmap(RgbMap::create(RgbMapAlgorithm::KDTREE));
+  rgbmap->regenerate(pal.get(), 0);
+
+  const ImageRef src = create_test_image(IMAGE_INDEXED, 45, 33, pal->size());
+  for (Target target : { TARGET_INDEX_CHANNEL,
+                         TARGET_ALL_CHANNELS }) {
+    Input input;
+    input.src = src.get();
+    input.target = target;
+    input.pal = pal.get();
+    input.rgbmap = rgbmap.get();
+    test_random_matrices(input);
+  }
+}
+
+// The matrix is bigger than the image
+TEST(ConvolutionMatrixFilter, SmallImage)
+{
+  const ImageRef src = create_test_image(IMAGE_RGB, 3, 2);
+  Input input;
+  input.src = src.get();
+  input.target = TARGET_ALL_CHANNELS;
+  test_random_matrices(input);
+}
+
+TEST(ConvolutionMatrixFilter, Mask)
+{
+  const ImageRef src = create_test_image(IMAGE_RGB, 45, 33);
+  Input input;
+  input.src = src.get();
+  input.target = TARGET_ALL_CHANNELS;
+  input.bounds = gfx::Rect(3, 5, 37, 21);
+  input.selected.resize(src->width()*src->height());
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      input.selected[y*src->width() + x] = ((x/4 + y/3) % 3 != 0);
+  test_random_matrices(input);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,43 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef FILTERS_CONVOLUTION_ROW_H_INCLUDED
+#define FILTERS_CONVOLUTION_ROW_H_INCLUDED
+#pragma once
+
+namespace filters {
+
+  // A matrix value and the row of integers that is multiplied by it
+  struct ConvolutionTap {
+    const int* src;
+    int k;
+  };
+
+  // dst[i] = sum of tap.k*tap.src[i] of all taps for i in [0, n) (n
+  // must be a multiple of 8).
+  typedef void (*ConvolveRowFunc)(int* dst,
+                                  const ConvolutionTap* taps,
+                                  const int ntaps,
+                                  const int n);
+
+  // Returns the AVX2 version if the CPU supports it.
+  ConvolveRowFunc get_convolve_row_func();
+
+  void convolve_row_portable(int* dst,
+                             const ConvolutionTap* taps,
+                             const int ntaps,
+                             const int n);
+
+#if FILTERS_CONVOLUTION_AVX2
+  void convolve_row_avx2(int* dst,
+                         const ConvolutionTap* taps,
+                         const int ntaps,
+                         const int n);
+#endif
+
+} // namespace filters
+
+#endif
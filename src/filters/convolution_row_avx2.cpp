@@ -0,0 +1,36 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+//
+// This file must be compiled with AVX2 support (-mavx2 or
+// /arch:AVX2), get_convolve_row_func() returns this function only if
+// the CPU supports AVX2.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "filters/convolution_row.h"
+
+#include <immintrin.h>
+
+namespace filters {
+
+void convolve_row_avx2(int* dst,
+                       const ConvolutionTap* taps,
+                       const int ntaps,
+                       const int n)
+{
+  for (int i=0; i<n; i+=8) {
+    __m256i v = _mm256_setzero_si256();
+    for (int t=0; t<ntaps; ++t) {
+      const __m256i src = _mm256_loadu_si256((const __m256i*)(taps[t].src + i));
+      v = _mm256_add_epi32(v, _mm256_mullo_epi32(src, _mm256_set1_epi32(taps[t].k)));
+    }
+    _mm256_storeu_si256((__m256i*)(dst + i), v);
+  }
+}
+
+} // namespace filters
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2019  Igara Studio S.A.
+// Copyright (C) 2019-2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -44,6 +44,12 @@ namespace filters {
 
     // Applies the filter to the color palette.
     virtual void applyToPalette(FilterManager* filterMgr) { }
+
+    // Returns true if applyToRgba/Grayscale/Indexed() can be called
+    // from several threads at the same time (with different
+    // FilterManagers for different rows/images). Filters that keep
+    // state from one row to the next one must return false.
+    virtual bool isThreadSafe() const { return true; }
   };
 
   // Filter that support applying it only to palette colors.
@@ -0,0 +1,140 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef FILTERS_FILTER_TEST_UTILS_H_INCLUDED
+#define FILTERS_FILTER_TEST_UTILS_H_INCLUDED
+#pragma once
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/palette_picks.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/filter.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+#include "gfx/rect.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace filters {
+
+  // Applies a filter row by row (from top to bottom) in the given
+  // bounds of the source image, skipping the pixels that are not
+  // selected in the optional "selected" array (one bool per pixel of
+  // the image), like app::FilterManagerImpl does with the mask. Used
+  // by the filters tests and benchmarks.
+  class TestFilterManager : public FilterManager
+                          , public FilterIndexedData {
+  public:
+    TestFilterManager(const doc::Image* src,
+                      const Target target,
+                      const doc::Palette* palette = nullptr,
+                      const doc::RgbMap* rgbmap = nullptr)
+      : m_src(src)
+      , m_dst(doc::Image::createCopy(src))
+      , m_target(target)
+      , m_palette(palette)
+      , m_rgbmap(rgbmap)
+      , m_bounds(src->bounds())
+      , m_row(0)
+      , m_col(0) {
+    }
+
+    void setBounds(const gfx::Rect& bounds) { m_bounds = bounds; }
+    void setSelected(const std::vector<bool>& selected) { m_selected = selected; }
+
+    doc::Image* apply(Filter* filter) {
+      for (m_row=m_bounds.y; m_row<m_bounds.y2(); ++m_row) {
+        m_col = m_bounds.x;
+        switch (m_src->pixelFormat()) {
+          case doc::IMAGE_RGB:       filter->applyToRgba(this); break;
+          case doc::IMAGE_GRAYSCALE: filter->applyToGrayscale(this); break;
+          case doc::IMAGE_INDEXED:   filter->applyToIndexed(this); break;
+          default:                   break;
+        }
+      }
+      return m_dst.get();
+    }
+
+    bool isSelected(const int x, const int y) const {
+      return (m_bounds.contains(gfx::Point(x, y)) &&
+              (m_selected.empty() || m_selected[y*m_src->width() + x]));
+    }
+
+    // FilterManager implementation
+    doc::PixelFormat pixelFormat() const override { return m_src->pixelFormat(); }
+    const void* getSourceAddress() override { return m_src->getPixelAddress(m_bounds.x, m_row); }
+    void* getDestinationAddress() override { return m_dst->getPixelAddress(m_bounds.x, m_row); }
+    int getWidth() override { return m_bounds.w; }
+    Target getTarget() override { return m_target; }
+    FilterIndexedData* getIndexedData() override { return this; }
+    bool skipPixel() override {
+      const bool skip = !isSelected(m_col, m_row);
+      ++m_col;
+      return skip;
+    }
+    const doc::Image* getSourceImage() override { return m_src; }
+    int x() const override { return m_bounds.x; }
+    int y() const override { return m_row; }
+    bool isFirstRow() const override { return m_row == m_bounds.y; }
+    bool isMaskActive() const override { return !m_selected.empty(); }
+
+    // FilterIndexedData implementation
+    const doc::Palette* getPalette() const override { return m_palette; }
+    const doc::RgbMap* getRgbMap() const override { return m_rgbmap; }
+    doc::Palette* getNewPalette() override { return nullptr; }
+    doc::PalettePicks getPalettePicks() override { return doc::PalettePicks(); }
+
+  private:
+    const doc::Image* m_src;
+    doc::ImageRef m_dst;
+    Target m_target;
+    const doc::Palette* m_palette;
+    const doc::RgbMap* m_rgbmap;
+    gfx::Rect m_bounds;
+    std::vector<bool> m_selected;
+    int m_row;
+    int m_col;
+  };
+
+  // Creates an image with pseudo-random pixels (a fixed seed is used
+  // so tests are reproducible). Indexed images use the first
+  // "ncolors" entries of the palette.
+  inline doc::ImageRef create_random_image(const doc::PixelFormat format,
+                                           const int w, const int h,
+                                           uint32_t seed = 1,
+                                           const int ncolors = 256) {
+    doc::ImageRef image(doc::Image::create(format, w, h));
+    for (int y=0; y<h; ++y) {
+      for (int x=0; x<w; ++x) {
+        seed = seed*1103515245 + 12345;
+        doc::color_t c = 0;
+        switch (format) {
+          case doc::IMAGE_RGB:
+            c = doc::rgba((seed >> 24) & 255, (seed >> 16) & 255,
+                          (seed >> 8) & 255, (seed >> 4) & 255);
+            break;
+          case doc::IMAGE_GRAYSCALE:
+            c = doc::graya((seed >> 24) & 255, (seed >> 16) & 255);
+            break;
+          case doc::IMAGE_INDEXED:
+            c = ((seed >> 16) & 0x7fff) % ncolors;
+            break;
+          default:
+            break;
+        }
+        doc::put_pixel(image.get(), x, y, c);
+      }
+    }
+    return image;
+  }
+
+} // namespace filters
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite
-// Copyright (C) 2020  Igara Studio S.A.
+// Copyright (C) 2020-2022  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -11,7 +11,6 @@
 
 #include "filters/median_filter.h"
 
-#include "base/memory.h"
 #include "doc/image_impl.h"
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
@@ -27,80 +26,58 @@ namespace filters {
 using namespace doc;
 
 namespace {
-  struct GetPixelsDelegateRgba {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
 
-    GetPixelsDelegateRgba(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
-
-    void reset() { c = 0; }
-
-    void operator()(RgbTraits::pixel_t color)
-    {
-      channel[0][c] = rgba_getr(color);
-      channel[1][c] = rgba_getg(color);
-      channel[2][c] = rgba_getb(color);
-      channel[3][c] = rgba_geta(color);
-      c++;
+  struct GetChannelRgba {
+    int operator()(RgbTraits::pixel_t color, int channel) const {
+      static const uint32_t shifts[4] = { rgba_r_shift, rgba_g_shift,
+                                          rgba_b_shift, rgba_a_shift };
+      return (color >> shifts[channel]) & 0xff;
     }
   };
 
-  struct GetPixelsDelegateGrayscale {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
-
-    GetPixelsDelegateGrayscale(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
-
-    void reset() { c = 0; }
-
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      channel[0][c] = graya_getv(color);
-      channel[1][c] = graya_geta(color);
-      c++;
+  struct GetChannelGrayscale {
+    int operator()(GrayscaleTraits::pixel_t color, int channel) const {
+      return (channel == 0 ? graya_getv(color): graya_geta(color));
     }
   };
 
-  struct GetPixelsDelegateIndexed {
+  struct GetChannelIndexed {
     const Palette* pal;
-    std::vector<std::vector<uint8_t> >& channel;
     Target target;
-    int c;
 
-    GetPixelsDelegateIndexed(const Palette* pal, std::vector<std::vector<uint8_t> >& channel, Target target)
-      : pal(pal), channel(channel), target(target) { }
+    GetChannelIndexed(const Palette* pal, Target target)
+      : pal(pal), target(target) { }
 
-    void reset() { c = 0; }
-
-    void operator()(IndexedTraits::pixel_t color)
-    {
-      if (target & TARGET_INDEX_CHANNEL) {
-        channel[0][c] = color;
-      }
-      else {
-        color_t rgb = pal->getEntry(color);
-        channel[0][c] = rgba_getr(rgb);
-        channel[1][c] = rgba_getg(rgb);
-        channel[2][c] = rgba_getb(rgb);
-        channel[3][c] = rgba_geta(rgb);
-      }
-      c++;
+    int operator()(IndexedTraits::pixel_t color, int channel) const {
+      if (target & TARGET_INDEX_CHANNEL)
+        return color;
+      else
+        return GetChannelRgba()(pal->getEntry(color), channel);
     }
   };
-};
+
+} // anonymous namespace
 
 MedianFilter::MedianFilter()
   : m_tiledMode(TiledMode::NONE)
   , m_width(1)
   , m_height(1)
-  , m_ncolors(0)
-  , m_channel(4)
+  , m_ncolors(1)
+  , m_src(nullptr)
+  , m_x(0)
+  , m_y(0)
+  , m_rowWidth(0)
+  , m_target(0)
+  , m_windowPos(-1)
+  , m_nchannels(0)
+  , m_channels{ false, false, false, false }
 {
 }
 
 void MedianFilter::setTiledMode(TiledMode tiled)
 {
   m_tiledMode = tiled;
+  m_src = nullptr;
 }
 
 void MedianFilter::setSize(int width, int height)
@@ -108,12 +85,10 @@ void MedianFilter::setSize(int width, int height)
   ASSERT(width >= 1);
   ASSERT(height >= 1);
 
-  m_width = std::max(1, width);
-  m_height = std::max(1, height);
-  m_ncolors = width*height;
-
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
+  m_width = std::clamp(width, 1, kMaxSize);
+  m_height = std::clamp(height, 1, kMaxSize);
+  m_ncolors = m_width*m_height;
+  m_src = nullptr;
 }
 
 const char* MedianFilter::getName()
@@ -126,53 +101,34 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
   const Image* src = filterMgr->getSourceImage();
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
+  const bool channels[4] = {
+    (target & TARGET_RED_CHANNEL) != 0,
+    (target & TARGET_GREEN_CHANNEL) != 0,
+    (target & TARGET_BLUE_CHANNEL) != 0,
+    (target & TARGET_ALPHA_CHANNEL) != 0
+  };
   int color;
   int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  updateColumns<RgbTraits>(filterMgr, 4, channels, GetChannelRgba());
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset();
-    get_neighboring_pixels<RgbTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                      m_tiledMode, delegate);
-
+    moveWindow(i);
     color = get_pixel_fast<RgbTraits>(src, x, y);
 
-    if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
-    }
-    else
-      r = rgba_getr(color);
-
-    if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
-    }
-    else
-      g = rgba_getg(color);
-
-    if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
-    }
-    else
-      b = rgba_getb(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
-    }
-    else
-      a = rgba_geta(color);
+    r = (channels[0] ? median(0): rgba_getr(color));
+    g = (channels[1] ? median(1): rgba_getg(color));
+    b = (channels[2] ? median(2): rgba_getb(color));
+    a = (channels[3] ? median(3): rgba_geta(color));
 
     *(dst_address++) = rgba(r, g, b, a);
   }
@@ -183,38 +139,29 @@ void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
   const Image* src = filterMgr->getSourceImage();
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
+  const bool channels[2] = {
+    (target & TARGET_GRAY_CHANNEL) != 0,
+    (target & TARGET_ALPHA_CHANNEL) != 0
+  };
   int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  updateColumns<GrayscaleTraits>(filterMgr, 2, channels, GetChannelGrayscale());
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset();
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                            m_tiledMode, delegate);
-
+    moveWindow(i);
     color = get_pixel_fast<GrayscaleTraits>(src, x, y);
 
-    if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
-    }
-    else
-      k = graya_getv(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
-    }
-    else
-      a = graya_geta(color);
+    k = (channels[0] ? median(0): graya_getv(color));
+    a = (channels[1] ? median(1): graya_geta(color));
 
     *(dst_address++) = graya(k, a);
   }
@@ -227,62 +174,208 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
   const Palette* pal = filterMgr->getIndexedData()->getPalette();
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
+  const bool channels[4] = {
+    (target & (TARGET_RED_CHANNEL | TARGET_INDEX_CHANNEL)) != 0,
+    (target & TARGET_GREEN_CHANNEL) != 0,
+    (target & TARGET_BLUE_CHANNEL) != 0,
+    (target & TARGET_ALPHA_CHANNEL) != 0
+  };
   int color, r, g, b, a;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  updateColumns<IndexedTraits>(filterMgr,
+                               (target & TARGET_INDEX_CHANNEL ? 1: 4),
+                               channels,
+                               GetChannelIndexed(pal, target));
+
+  for (int i=0; x<x2; ++x, ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset();
-    get_neighboring_pixels<IndexedTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                          m_tiledMode, delegate);
+    moveWindow(i);
 
     if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
+      *(dst_address++) = median(0);
     }
     else {
       color = get_pixel_fast<IndexedTraits>(src, x, y);
       color = pal->getEntry(color);
 
-      if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
-      }
-      else
-        r = rgba_getr(color);
+      r = (channels[0] ? median(0): rgba_getr(color));
+      g = (channels[1] ? median(1): rgba_getg(color));
+      b = (channels[2] ? median(2): rgba_getb(color));
+      a = (channels[3] ? median(3): rgba_geta(color));
 
-      if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
-      }
-      else
-        g = rgba_getg(pal->getEntry(color));
+      *(dst_address++) = rgbmap->mapColor(r, g, b, a);
+    }
+  }
+}
 
-      if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
-      }
-      else
-        b = rgba_getb(color);
+template<typename Traits, typename GetChannel>
+void MedianFilter::updateColumns(FilterManager* filterMgr,
+                                 const int nchannels,
+                                 const bool* channels,
+                                 GetChannel getChannel)
+{
+  const Image* src = filterMgr->getSourceImage();
+  const int x = filterMgr->x();
+  const int y = filterMgr->y();
+  const int w = filterMgr->getWidth();
+  const Target target = filterMgr->getTarget();
+  const bool tiledY = (int(m_tiledMode) & int(TiledMode::Y_AXIS));
+  const int cy = m_height/2;
+
+  m_windowPos = -1;
+  std::fill(&m_finePos[0][0], &m_finePos[0][0]+4*16, -1);
+
+  // Move the window of each column histogram one row down
+  if (!filterMgr->isFirstRow() &&
+      src == m_src &&
+      x == m_x &&
+      y == m_y+1 &&
+      w == m_rowWidth &&
+      target == m_target) {
+    const int oldY = get_neighboring_coord(y-1-cy, src->height(), tiledY);
+    const int newY = get_neighboring_coord(y-1-cy+m_height, src->height(), tiledY);
+    if (oldY != newY) {
+      addRow<Traits>(src, oldY, -1, getChannel);
+      addRow<Traits>(src, newY, +1, getChannel);
+    }
+  }
+  // Calculate the column histograms from scratch
+  else {
+    const bool tiledX = (int(m_tiledMode) & int(TiledMode::X_AXIS));
+    const int ncols = w + m_width - 1;
+    const int cx = m_width/2;
+
+    m_columnX.resize(ncols);
+    for (int c=0; c<ncols; ++c)
+      m_columnX[c] = get_neighboring_coord(x-cx+c, src->width(), tiledX);
+
+    m_nchannels = nchannels;
+    for (int ch=0; ch<4; ++ch) {
+      m_channels[ch] = (ch < nchannels && channels[ch]);
+      m_columns[ch].clear();
+      if (m_channels[ch])
+        m_columns[ch].resize(ncols, Histogram());
+    }
+
+    for (int row=0; row<m_height; ++row)
+      addRow<Traits>(src, get_neighboring_coord(y-cy+row, src->height(), tiledY),
+                     +1, getChannel);
+  }
+
+  m_src = src;
+  m_x = x;
+  m_y = y;
+  m_rowWidth = w;
+  m_target = target;
+}
+
+template<typename Traits, typename GetChannel>
+void MedianFilter::addRow(const Image* src, const int y, const int delta,
+                          GetChannel getChannel)
+{
+  auto row = (typename Traits::const_address_t)src->getPixelAddress(0, y);
+  const int ncols = int(m_columnX.size());
+
+  for (int ch=0; ch<m_nchannels; ++ch) {
+    if (!m_channels[ch])
+      continue;
+
+    Histogram* columns = &m_columns[ch][0];
+    for (int c=0; c<ncols; ++c) {
+      const int v = getChannel(row[m_columnX[c]], ch);
+      columns[c].coarse[v >> 4] += delta;
+      columns[c].fine[v] += delta;
+    }
+  }
+}
+
+void MedianFilter::moveWindow(const int i)
+{
+  if (i == m_windowPos)
+    return;
+
+  // Only the coarse histogram of the window is updated for each
+  // pixel, the fine histogram of each coarse bin is updated in
+  // median() only when it's needed.
+  const bool slide = canSlide(m_windowPos, i);
 
-      if (target & TARGET_ALPHA_CHANNEL) {
-        std::sort(m_channel[3].begin(), m_channel[3].end());
-        a = m_channel[3][m_ncolors/2];
+  for (int ch=0; ch<m_nchannels; ++ch) {
+    if (!m_channels[ch])
+      continue;
+
+    Histogram& window = m_window[ch];
+    const Histogram* columns = &m_columns[ch][0];
+    if (slide) {
+      for (int c=m_windowPos; c<i; ++c) {
+        const uint16_t* in = columns[c+m_width].coarse;
+        const uint16_t* out = columns[c].coarse;
+        for (int j=0; j<16; ++j)
+          window.coarse[j] += in[j] - out[j];
       }
-      else
-        a = rgba_geta(color);
+    }
+    else {
+      std::fill(window.coarse, window.coarse+16, 0);
+      for (int c=i; c<i+m_width; ++c) {
+        const uint16_t* in = columns[c].coarse;
+        for (int j=0; j<16; ++j)
+          window.coarse[j] += in[j];
+      }
+    }
+  }
+  m_windowPos = i;
+}
 
-      *(dst_address++) = rgbmap->mapColor(r, g, b, a);
+int MedianFilter::median(const int channel)
+{
+  Histogram& h = m_window[channel];
+  int rank = m_ncolors/2;
+  int bin = 0;
+  for (; rank >= h.coarse[bin]; ++bin)
+    rank -= h.coarse[bin];
+
+  // Update the fine histogram of the coarse bin where the median is
+  uint16_t* fine = h.fine + 16*bin;
+  int& finePos = m_finePos[channel][bin];
+  if (finePos != m_windowPos) {
+    const Histogram* columns = &m_columns[channel][0];
+    if (canSlide(finePos, m_windowPos)) {
+      for (int c=finePos; c<m_windowPos; ++c) {
+        const uint16_t* in = columns[c+m_width].fine + 16*bin;
+        const uint16_t* out = columns[c].fine + 16*bin;
+        for (int j=0; j<16; ++j)
+          fine[j] += in[j] - out[j];
+      }
+    }
+    else {
+      std::fill(fine, fine+16, 0);
+      for (int c=m_windowPos; c<m_windowPos+m_width; ++c) {
+        const uint16_t* in = columns[c].fine + 16*bin;
+        for (int j=0; j<16; ++j)
+          fine[j] += in[j];
+      }
     }
+    finePos = m_windowPos;
   }
+
+  int i = 0;
+  for (; rank >= fine[i]; ++i)
+    rank -= fine[i];
+  return 16*bin + i;
+}
+
+bool MedianFilter::canSlide(const int from, const int to) const
+{
+  // Sliding the window is faster than calculating it again from
+  // the column histograms if we move it less than half its width.
+  return (from >= 0 && from < to && 2*(to - from) <= m_width);
 }
 
 } // namespace filters
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -10,17 +11,40 @@
 
 #include "base/ints.h"
 #include "filters/filter.h"
+#include "filters/target.h"
 #include "filters/tiled_mode.h"
 
 #include <vector>
 
+namespace doc {
+  class Image;
+}
+
 namespace filters {
 
+  // Median filter with constant time per pixel (independent of the
+  // window size) using sliding histograms (Perreault & Hebert,
+  // "Median Filtering in Constant Time"). There is one histogram for
+  // each column of the window, which is updated when we move from one
+  // row to the next one (rows must be processed from top to bottom),
+  // and the histogram of the whole window is updated adding/removing
+  // one column histogram when we move from one pixel to the next one.
+  //
+  // Histograms have two levels (16 coarse bins and 256 fine bins),
+  // only the coarse level of the window is updated for each pixel,
+  // and the fine bins are updated only when the median is inside
+  // them.
   class MedianFilter : public Filter {
   public:
+    // Histogram counters are 16-bit values, so the window cannot have
+    // more than 65535 pixels.
+    static constexpr int kMaxSize = 255;
+
     MedianFilter();
 
     void setTiledMode(TiledMode tiled);
+
+    // Each dimension of the window is clamped to [1, kMaxSize].
     void setSize(int width, int height);
 
     TiledMode getTiledMode() const { return m_tiledMode; }
@@ -33,12 +57,49 @@ namespace filters {
     void applyToGrayscale(FilterManager* filterMgr);
     void applyToIndexed(FilterManager* filterMgr);
 
+    // Rows are calculated incrementally from the previous one.
+    bool isThreadSafe() const { return false; }
+
   private:
+    // Histogram of 8-bit values with 16 coarse bins (to find the
+    // median with 32 iterations at most).
+    struct Histogram {
+      uint16_t coarse[16];
+      uint16_t fine[256];
+    };
+
+    template<typename Traits, typename GetChannel>
+    void updateColumns(FilterManager* filterMgr,
+                       const int nchannels,
+                       const bool* channels,
+                       GetChannel getChannel);
+    template<typename Traits, typename GetChannel>
+    void addRow(const doc::Image* src, const int y, const int delta,
+                GetChannel getChannel);
+    void moveWindow(const int i);
+    int median(const int channel);
+    bool canSlide(const int from, const int to) const;
+
     TiledMode m_tiledMode;
     int m_width;
     int m_height;
     int m_ncolors;
-    std::vector<std::vector<uint8_t> > m_channel;
+
+    // State of the last processed row (the column histograms are
+    // updated incrementally only if the next row is the row below
+    // it in the same image).
+    const doc::Image* m_src;
+    int m_x, m_y;
+    int m_rowWidth;
+    Target m_target;
+    int m_windowPos;
+
+    int m_nchannels;
+    bool m_channels[4];
+    std::vector<int> m_columnX;           // Source X of each column
+    std::vector<Histogram> m_columns[4];  // Histograms of each column
+    Histogram m_window[4];                // Histogram of the whole window
+    int m_finePos[4][16];                 // Window position of each fine bin
   };
 
 } // namespace filters
@@ -0,0 +1,104 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "filters/median_filter.h"
+
+#include "doc/image_impl.h"
+#include "doc/image_ref.h"
+#include "doc/primitives.h"
+#include "filters/filter_manager.h"
+#include "filters/filter_test_utils.h"
+#include "filters/neighboring_pixels.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace doc;
+using namespace filters;
+
+// Old MedianFilter::applyToRgba() implementation (sorts all the
+// neighboring pixels of each pixel).
+class LegacyMedianFilter : public Filter {
+public:
+  LegacyMedianFilter(int width, int height)
+    : m_width(width), m_height(height), m_channel(4) {
+    for (auto& channel : m_channel)
+      channel.resize(width*height);
+  }
+
+  const char* getName() override { return "Legacy Median Blur"; }
+  void applyToGrayscale(FilterManager* filterMgr) override { }
+  void applyToIndexed(FilterManager* filterMgr) override { }
+
+  void applyToRgba(FilterManager* filterMgr) override {
+    const Image* src = filterMgr->getSourceImage();
+    uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
+    const int n = m_width*m_height;
+    int x = filterMgr->x();
+    int x2 = x+filterMgr->getWidth();
+    int y = filterMgr->y();
+
+    for (; x<x2; ++x) {
+      int c = 0;
+      auto delegate = [this, &c](RgbTraits::pixel_t color) {
+        m_channel[0][c] = rgba_getr(color);
+        m_channel[1][c] = rgba_getg(color);
+        m_channel[2][c] = rgba_getb(color);
+        m_channel[3][c] = rgba_geta(color);
+        ++c;
+      };
+      get_neighboring_pixels<RgbTraits>(src, x, y, m_width, m_height,
+                                        m_width/2, m_height/2,
+                                        TiledMode::NONE, delegate);
+
+      int v[4];
+      for (int i=0; i<4; ++i) {
+        std::sort(m_channel[i].begin(), m_channel[i].end());
+        v[i] = m_channel[i][n/2];
+      }
+      *(dst_address++) = rgba(v[0], v[1], v[2], v[3]);
+    }
+  }
+
+private:
+  int m_width, m_height;
+  std::vector<std::vector<uint8_t>> m_channel;
+};
+
+static void run_filter(benchmark::State& state, Filter* filter) {
+  const ImageRef src = create_random_image(IMAGE_RGB, 256, 256);
+  TestFilterManager filterMgr(src.get(), TARGET_ALL_CHANNELS);
+
+  for (auto _ : state)
+    filterMgr.apply(filter);
+  state.SetItemsProcessed(state.iterations() * src->width() * src->height());
+}
+
+static void BM_LegacyMedian(benchmark::State& state) {
+  LegacyMedianFilter filter(state.range(0), state.range(0));
+  run_filter(state, &filter);
+}
+
+static void BM_Median(benchmark::State& state) {
+  MedianFilter filter;
+  filter.setSize(state.range(0), state.range(0));
+  run_filter(state, &filter);
+}
+
+BENCHMARK(BM_LegacyMedian)
+  ->Arg(3)->Arg(7)->Arg(15)->Arg(31)
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Median)
+  ->Arg(3)->Arg(7)->Arg(15)->Arg(31)
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,293 @@
+// Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "filters/median_filter.h"
+
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/filter_test_utils.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace doc;
+using namespace filters;
+
+namespace {
+
+struct Window {
+  int width, height;
+  TiledMode tiled;
+};
+
+// Returns the source coordinate of a pixel of the window (clamped to
+// the image edges or wrapped around in tiled axes)
+int window_coord(const int v, const int size, const bool tiled)
+{
+  if (tiled)
+    return ((v % size) + size) % size;
+  else
+    return std::clamp(v, 0, size-1);
+}
+
+// Median of the "channel" values of all the pixels in the window
+// centered in (x,y), sorting all the values.
+template<typename GetChannel>
+int brute_force_median(const Image* src, const int x, const int y,
+                       const Window& win, const int channel,
+                       GetChannel getChannel)
+{
+  const bool tiledX = (int(win.tiled) & int(TiledMode::X_AXIS));
+  const bool tiledY = (int(win.tiled) & int(TiledMode::Y_AXIS));
+  std::vector<int> values;
+  for (int v=0; v<win.height; ++v) {
+    for (int u=0; u<win.width; ++u) {
+      const int sx = window_coord(x - win.width/2 + u, src->width(), tiledX);
+      const int sy = window_coord(y - win.height/2 + v, src->height(), tiledY);
+      values.push_back(getChannel(get_pixel(src, sx, sy), channel));
+    }
+  }
+  std::sort(values.begin(), values.end());
+  return values[values.size()/2];
+}
+
+int rgba_channel(const color_t c, const int channel)
+{
+  switch (channel) {
+    case 0: return rgba_getr(c);
+    case 1: return rgba_getg(c);
+    case 2: return rgba_getb(c);
+    case 3: return rgba_geta(c);
+  }
+  return 0;
+}
+
+int graya_channel(const color_t c, const int channel)
+{
+  return (channel == 0 ? graya_getv(c): graya_geta(c));
+}
+
+// Expected result of the filter for the pixel (x,y)
+color_t expected_pixel(const Image* src, const int x, const int y,
+                       const Window& win, const Target target,
+                       const Palette* pal, const RgbMap* rgbmap)
+{
+  const color_t c = get_pixel(src, x, y);
+  switch (src->pixelFormat()) {
+
+    case IMAGE_RGB: {
+      const Target bits[4] = { TARGET_RED_CHANNEL, TARGET_GREEN_CHANNEL,
+                               TARGET_BLUE_CHANNEL, TARGET_ALPHA_CHANNEL };
+      int v[4];
+      for (int ch=0; ch<4; ++ch)
+        v[ch] = ((target & bits[ch]) ? brute_force_median(src, x, y, win, ch, rgba_channel):
+                                       rgba_channel(c, ch));
+      return rgba(v[0], v[1], v[2], v[3]);
+    }
+
+    case IMAGE_GRAYSCALE: {
+      const Target bits[2] = { TARGET_GRAY_CHANNEL, TARGET_ALPHA_CHANNEL };
+      int v[2];
+      for (int ch=0; ch<2; ++ch)
+        v[ch] = ((target & bits[ch]) ? brute_force_median(src, x, y, win, ch, graya_channel):
+                                       graya_channel(c, ch));
+      return graya(v[0], v[1]);
+    }
+
+    case IMAGE_INDEXED: {
+      if (target & TARGET_INDEX_CHANNEL) {
+        return brute_force_median(
+          src, x, y, win, 0,
+          [](color_t i, int){ return int(i); });
+      }
+
+      const Target bits[4] = { TARGET_RED_CHANNEL, TARGET_GREEN_CHANNEL,
+                               TARGET_BLUE_CHANNEL, TARGET_ALPHA_CHANNEL };
+      auto palChannel = [pal](color_t i, int channel){
+        return rgba_channel(pal->getEntry(i), channel);
+      };
+      int v[4];
+      for (int ch=0; ch<4; ++ch)
+        v[ch] = ((target & bits[ch]) ? brute_force_median(src, x, y, win, ch, palChannel):
+                                       palChannel(c, ch));
+      return rgbmap->mapColor(v[0], v[1], v[2], v[3]);
+    }
+
+    default:
+      break;
+  }
+  return 0;
+}
+
+void expect_brute_force_result(TestFilterManager& filterMgr,
+                               MedianFilter& filter,
+                               const Image* src,
+                               const Window& win,
+                               const Target target,
+                               const Palette* pal = nullptr,
+                               const RgbMap* rgbmap = nullptr)
+{
+  filter.setSize(win.width, win.height);
+  filter.setTiledMode(win.tiled);
+  const Image* dst = filterMgr.apply(&filter);
+
+  for (int y=0; y<src->height(); ++y) {
+    for (int x=0; x<src->width(); ++x) {
+      const color_t expected =
+        (filterMgr.isSelected(x, y) ?
+         expected_pixel(src, x, y, win, target, pal, rgbmap):
+         get_pixel(src, x, y));
+      ASSERT_EQ(expected, get_pixel(dst, x, y))
+        << "pixel (" << x << ", " << y << ")"
+        << " window " << win.width << "x" << win.height
+        << " tiled " << int(win.tiled);
+    }
+  }
+}
+
+const Window kWindows[] = {
+  { 1, 1, TiledMode::NONE },
+  { 3, 3, TiledMode::NONE },
+  { 3, 3, TiledMode::BOTH },
+  { 7, 7, TiledMode::NONE },
+  { 7, 7, TiledMode::X_AXIS },
+  { 7, 7, TiledMode::Y_AXIS },
+  { 7, 3, TiledMode::BOTH },
+  { 2, 5, TiledMode::NONE },
+  { 31, 31, TiledMode::NONE },
+  { 31, 31, TiledMode::BOTH },
+};
+
+} // anonymous namespace
+
+TEST(MedianFilter, Rgb)
+{
+  const ImageRef src = create_random_image(IMAGE_RGB, 41, 37);
+  for (const Window& win : kWindows) {
+    for (Target target : { TARGET_ALL_CHANNELS,
+                           TARGET_RED_CHANNEL | TARGET_ALPHA_CHANNEL }) {
+      MedianFilter filter;
+      TestFilterManager filterMgr(src.get(), target);
+      expect_brute_force_result(filterMgr, filter, src.get(), win, target);
+    }
+  }
+}
+
+TEST(MedianFilter, Grayscale)
+{
+  const ImageRef src = create_random_image(IMAGE_GRAYSCALE, 41, 37);
+  for (const Window& win : kWindows) {
+    for (Target target : { TARGET_ALL_CHANNELS,
+                           TARGET_GRAY_CHANNEL }) {
+      MedianFilter filter;
+      TestFilterManager filterMgr(src.get(), target);
+      expect_brute_force_result(filterMgr, filter, src.get(), win, target);
+    }
+  }
+}
+
+TEST(MedianFilter, Indexed)
+{
+  Palette pal(frame_t(0), 32);
+  uint32_t seed = 7;
+  for (int i=0; i<pal.size(); ++i) {
+    seed = seed*1103515245 + 12345;
+    pal.setEntry(i, rgba((seed >> 24) & 255, (seed >> 16) & 255,
+                         (seed >> 8) & 255, 255));
+  }
+  std::unique_ptr<RgbMap> rgbmap(RgbMap::create(RgbMapAlgorithm::KDTREE));
+  rgbmap->regenerate(&pal, -1);
+
+  const ImageRef src = create_random_image(IMAGE_INDEXED, 41, 37, 1, pal.size());
+  for (const Window& win : kWindows) {
+    for (Target target : { TARGET_INDEX_CHANNEL,
+                           TARGET_ALL_CHANNELS }) {
+      MedianFilter filter;
+      TestFilterManager filterMgr(src.get(), target, &pal, rgbmap.get());
+      expect_brute_force_result(filterMgr, filter, src.get(), win, target,
+                                &pal, rgbmap.get());
+    }
+  }
+}
+
+// The window is bigger than the image
+TEST(MedianFilter, SmallImage)
+{
+  const ImageRef src = create_random_image(IMAGE_RGB, 5, 4);
+  for (const Window& win : kWindows) {
+    MedianFilter filter;
+    TestFilterManager filterMgr(src.get(), TARGET_ALL_CHANNELS);
+    expect_brute_force_result(filterMgr, filter, src.get(), win,
+                              TARGET_ALL_CHANNELS);
+  }
+}
+
+TEST(MedianFilter, Mask)
+{
+  const ImageRef src = create_random_image(IMAGE_RGB, 41, 37);
+
+  // Selected pixels: a ring (so some rows have holes)
+  std::vector<bool> selected(src->width()*src->height());
+  for (int y=0; y<src->height(); ++y) {
+    for (int x=0; x<src->width(); ++x) {
+      const int dx = x-20, dy = y-18;
+      const int d = dx*dx + dy*dy;
+      selected[y*src->width() + x] = (d >= 25 && d < 200);
+    }
+  }
+
+  for (const Window& win : kWindows) {
+    MedianFilter filter;
+    TestFilterManager filterMgr(src.get(), TARGET_ALL_CHANNELS);
+    filterMgr.setBounds(gfx::Rect(5, 4, 31, 29));
+    filterMgr.setSelected(selected);
+    expect_brute_force_result(filterMgr, filter, src.get(), win,
+                              TARGET_ALL_CHANNELS);
+  }
+}
+
+// The same filter can be applied several times (the incremental
+// state of the previous image/rows must be reset).
+TEST(MedianFilter, ReuseFilter)
+{
+  const ImageRef a = create_random_image(IMAGE_RGB, 23, 19, 1);
+  const ImageRef b = create_random_image(IMAGE_RGB, 23, 19, 2);
+  MedianFilter filter;
+  for (const Window& win : kWindows) {
+    for (const Image* src : { a.get(), b.get(), a.get() }) {
+      TestFilterManager filterMgr(src, TARGET_ALL_CHANNELS);
+      expect_brute_force_result(filterMgr, filter, src, win,
+                                TARGET_ALL_CHANNELS);
+    }
+  }
+}
+
+TEST(MedianFilter, SizeIsClampedToMaxSize)
+{
+  MedianFilter filter;
+  filter.setSize(MedianFilter::kMaxSize+1, 1000);
+  EXPECT_EQ(MedianFilter::kMaxSize, filter.getWidth());
+  EXPECT_EQ(MedianFilter::kMaxSize, filter.getHeight());
+
+  filter.setSize(MedianFilter::kMaxSize, 3);
+  EXPECT_EQ(MedianFilter::kMaxSize, filter.getWidth());
+  EXPECT_EQ(3, filter.getHeight());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2022  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -12,11 +13,26 @@
 #include "doc/image.h"
 #include "doc/image_traits.h"
 
+#include <algorithm>
 #include <vector>
 
 namespace filters {
   using namespace doc;
 
+  // Returns the coordinate of the source image pixel that is used for
+  // the given coordinate (which can be outside the image) in a
+  // neighborhood, clamping it to the image edges, or wrapping it
+  // around if the axis is tiled.
+  inline int get_neighboring_coord(const int v, const int size, const bool tiled)
+  {
+    if (tiled) {
+      const int u = v % size;
+      return (u < 0 ? u+size: u);
+    }
+    else
+      return std::clamp(v, 0, size-1);
+  }
+
   // Calls the specified "delegate" for all neighboring pixels in a 2D
   // (width*height) matrix located in (x,y) where its center is the
   // (centerX,centerY) element of the matrix.
@@ -1,4 +1,5 @@
 // Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -8,6 +9,7 @@
 #define RENDER_COLOR_HISTOGRAM_H_INCLUDED
 #pragma once
 
+#include <algorithm>
 #include <limits>
 #include <vector>
 
@@ -77,6 +79,39 @@ namespace render {
       }
     }
 
+    // Adds all the samples of the "other" histogram. The
+    // high-precision colors of "other" are added after the colors of
+    // this histogram, so merging histograms of consecutive parts of
+    // the input in order gives the same result as feeding all the
+    // input in only one histogram.
+    void merge(const ColorHistogram& other) {
+      for (std::size_t i=0; i<m_histogram.size(); ++i) {
+        const std::size_t count = other.m_histogram[i];
+        if (m_histogram[i] < std::numeric_limits<std::size_t>::max()-count) // Avoid overflow
+          m_histogram[i] += count;
+        else
+          m_histogram[i] = std::numeric_limits<std::size_t>::max();
+      }
+
+      if (!m_useHighPrecision)
+        return;
+      if (!other.m_useHighPrecision) {
+        m_useHighPrecision = false;
+        return;
+      }
+      for (doc::color_t color : other.m_highPrecision) {
+        if (std::find(m_highPrecision.begin(), m_highPrecision.end(), color) != m_highPrecision.end())
+          continue;
+        if (m_highPrecision.size() < 256) {
+          m_highPrecision.push_back(color);
+        }
+        else {
+          m_useHighPrecision = false;
+          break;
+        }
+      }
+    }
+
     // Creates a set of entries for the given palette in the given range
     // with the more important colors in the histogram. Returns the
     // number of used entries in the palette (maybe the range [from,to]
@@ -15,11 +15,17 @@
 #include "render/dithering_matrix.h"
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <thread>
 #include <vector>
 
 namespace render {
 
+// Minimum number of pixels dithered by each thread with ordered
+// dithering.
+static const int kMinPixelsPerThread = 64*1024;
+
 // Base 2x2 dither matrix, called D(2):
 int BayerMatrix::D2[4] = { 0, 2,
                            3, 1 };
@@ -234,7 +240,8 @@ void dither_rgb_image_to_indexed(
   doc::Image* dstImage,
   const doc::RgbMap* rgbmap,
   const doc::Palette* palette,
-  TaskDelegate* delegate)
+  TaskDelegate* delegate,
+  const int maxThreads)
 {
   const int w = srcImage->width();
   const int h = srcImage->height();
@@ -242,31 +249,66 @@ void dither_rgb_image_to_indexed(
   algorithm.start(srcImage, dstImage, dithering.factor());
 
   if (algorithm.dimensions() == 1) {
-    const doc::LockImageBits<doc::RgbTraits> srcBits(srcImage);
-    doc::LockImageBits<doc::IndexedTraits> dstBits(dstImage);
-    auto srcIt = srcBits.begin();
-    auto dstIt = dstBits.begin();
+    // Each pixel depends only on its own color and position, so each
+    // thread dithers a band of rows. Only the calling thread (first
+    // band) uses the delegate to report the progress.
+    const int maxBands =
+      std::max(1, std::min(h, w * h / kMinPixelsPerThread));
+    const int nthreads =
+      std::clamp(maxThreads > 0 ? maxThreads:
+                                  int(std::thread::hardware_concurrency()),
+                 1, maxBands);
+    std::atomic<bool> canceled(false);
+
+    auto ditherBand = [&](const int i) {
+      const int y0 = h * i / nthreads;
+      const int y1 = h * (i+1) / nthreads;
+      const gfx::Rect bounds(0, y0, w, y1 - y0);
+      const doc::LockImageBits<doc::RgbTraits> srcBits(srcImage, bounds);
+      doc::LockImageBits<doc::IndexedTraits> dstBits(dstImage, doc::Image::WriteLock, bounds);
+      auto srcIt = srcBits.begin();
+      auto dstIt = dstBits.begin();
+      const DitheringMatrix matrix = dithering.matrix();
+
+      for (int y=y0; y<y1 && !canceled; ++y) {
+        for (int x=0; x<w; ++x, ++srcIt, ++dstIt) {
+          ASSERT(srcIt != srcBits.end());
+          ASSERT(dstIt != dstBits.end());
+          *dstIt = algorithm.ditherRgbPixelToIndex(
+            matrix, *srcIt, x, y, rgbmap, palette);
+
+          if (i == 0 && delegate) {
+            if (!delegate->continueTask()) {
+              canceled = true;
+              return;
+            }
+          }
+        }
 
-    for (int y=0; y<h; ++y) {
-      for (int x=0; x<w; ++x, ++srcIt, ++dstIt) {
-        ASSERT(srcIt != srcBits.end());
-        ASSERT(dstIt != dstBits.end());
-        *dstIt = algorithm.ditherRgbPixelToIndex(
-          dithering.matrix(), *srcIt, x, y, rgbmap, palette);
-
-        if (delegate) {
-          if (!delegate->continueTask())
-            return;
+        if (i == 0 && delegate) {
+          delegate->notifyTaskProgress(
+            double(y+1-y0) / double(y1-y0));
         }
       }
+    };
 
-      if (delegate) {
-        delegate->notifyTaskProgress(
-          double(y+1) / double(h));
-      }
-    }
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads-1);
+    for (int i=1; i<nthreads; ++i)
+      threads.emplace_back(ditherBand, i);
+
+    ditherBand(0);
+
+    for (auto& thread : threads)
+      thread.join();
+
+    if (canceled)
+      return;
   }
   else {
+    // Error diffusion propagates the error of each pixel to the next
+    // ones (and with zig-zag, the first pixel of a row depends on the
+    // last pixel of the previous row), so it's done in one thread.
     auto dstIt = doc::get_pixel_address_fast<doc::IndexedTraits>(dstImage, 0, 0);
     const bool zigZag = algorithm.zigZag();
 
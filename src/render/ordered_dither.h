@@ -84,7 +84,8 @@ namespace render {
     doc::Image* dstImage,
     const doc::RgbMap* rgbmap,
     const doc::Palette* palette,
-    TaskDelegate* delegate = nullptr);
+    TaskDelegate* delegate = nullptr,
+    const int maxThreads = 0);
 
 } // namespace render
 
@@ -1,5 +1,5 @@
 // Aseprite Render Library
-// Copyright (c) 2019-2021  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2018  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -25,9 +25,13 @@
 #include "render/task_delegate.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace render {
@@ -35,6 +39,11 @@ namespace render {
 using namespace doc;
 using namespace gfx;
 
+// Minimum number of pixels converted by each thread in
+// convert_pixel_format() (smaller images are converted in the
+// calling thread).
+static const int kMinPixelsPerThread = 64*1024;
+
 Palette* create_palette_from_sprite(
   const Sprite* sprite,
   const frame_t fromFrame,
@@ -42,33 +51,106 @@ Palette* create_palette_from_sprite(
   const bool withAlpha,
   Palette* palette,
   TaskDelegate* delegate,
-  const bool newBlend)
+  const bool newBlend,
+  const int frameStep,
+  const int pixelStep)
 {
-  PaletteOptimizer optimizer;
-
   if (!palette)
     palette = new Palette(fromFrame, 256);
 
-  // Add a flat image with the current sprite's frame rendered
-  ImageRef flat_image(Image::create(IMAGE_RGB,
-      sprite->width(), sprite->height()));
+  std::vector<frame_t> frames;
+  for (frame_t frame=fromFrame; frame<=toFrame; frame+=std::max(1, frameStep))
+    frames.push_back(frame);
+
+  // Each thread needs its own histogram (16MB), so we limit the
+  // number of threads.
+  const int nframes = int(frames.size());
+  const int nthreads =
+    std::clamp(int(std::thread::hardware_concurrency()), 1,
+               std::clamp(nframes, 1, 8));
+
+  // Each thread renders a range of consecutive frames and feeds its
+  // own optimizer. Merging the optimizers in order gives the same
+  // palette as rendering all frames in one thread.
+  std::vector<PaletteOptimizer> optimizers(nthreads);
+  std::mutex mutex;
+  std::condition_variable cv;
+  int framesDone = 0;
+  int runningThreads = nthreads;
+  std::atomic<bool> canceled(false);
+
+  // Progress/cancellation is handled only from the calling thread
+  // (the delegate doesn't need to be thread-safe).
+  auto continueTask = [&](const int done) -> bool {
+    if (delegate) {
+      if (!delegate->continueTask()) {
+        canceled = true;
+        return false;
+      }
+      delegate->notifyTaskProgress(double(done) / double(nframes));
+    }
+    return true;
+  };
 
-  // Feed the optimizer with all rendered frames
-  render::Render render;
-  render.setNewBlend(newBlend);
-  for (frame_t frame=fromFrame; frame<=toFrame; ++frame) {
-    render.renderSprite(flat_image.get(), sprite, frame);
-    optimizer.feedWithImage(flat_image.get(), withAlpha);
+  auto feedFrames = [&](const int i) {
+    const int begin = nframes * i / nthreads;
+    const int end = nframes * (i+1) / nthreads;
 
-    if (delegate) {
-      if (!delegate->continueTask())
-        return nullptr;
+    // Add a flat image with the current sprite's frame rendered
+    ImageRef flat_image(Image::create(IMAGE_RGB,
+        sprite->width(), sprite->height()));
+
+    render::Render render;
+    render.setNewBlend(newBlend);
+    for (int j=begin; j<end && !canceled; ++j) {
+      render.renderSprite(flat_image.get(), sprite, frames[j]);
+      optimizers[i].feedWithImage(flat_image.get(), withAlpha, pixelStep);
 
-      delegate->notifyTaskProgress(
-        double(frame-fromFrame+1) / double(toFrame-fromFrame+1));
+      int done;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = ++framesDone;
+      }
+      if (i == 0)
+        continueTask(done);
+      else
+        cv.notify_one();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    --runningThreads;
+    cv.notify_one();
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads-1);
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(feedFrames, i);
+
+  feedFrames(0);
+
+  // Report the progress of the other threads
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (runningThreads > 0) {
+      cv.wait(lock);
+      const int done = framesDone;
+      lock.unlock();
+      continueTask(done);
+      lock.lock();
     }
   }
 
+  for (auto& thread : threads)
+    thread.join();
+
+  if (canceled)
+    return nullptr;
+
+  PaletteOptimizer& optimizer = optimizers[0];
+  for (int i=1; i<nthreads; ++i)
+    optimizer.merge(optimizers[i]);
+
   // Transparent color is needed if we have transparent layers
   int maskIndex;
   if (sprite->backgroundLayer() && sprite->allLayersCount() == 1)
@@ -86,72 +168,37 @@ Palette* create_palette_from_sprite(
   return palette;
 }
 
-Image* convert_pixel_format(
+// Converts the given rows of the image (used from several threads
+// on different bands of rows).
+static void convert_pixel_format_rows(
   const Image* image,
   Image* new_image,
-  PixelFormat pixelFormat,
-  const Dithering& dithering,
+  const gfx::Rect& bounds,
   const RgbMap* rgbmap,
   const Palette* palette,
-  bool is_background,
-  color_t new_mask_color,
-  rgba_to_graya_func toGray,
-  TaskDelegate* delegate)
+  const bool is_background,
+  const color_t new_mask_color,
+  const rgba_to_graya_func toGray)
 {
-  if (!new_image)
-    new_image = Image::create(pixelFormat, image->width(), image->height());
-  new_image->setMaskColor(new_mask_color);
-
-  // RGB -> Indexed with ordered dithering
-  if (image->pixelFormat() == IMAGE_RGB &&
-      pixelFormat == IMAGE_INDEXED &&
-      dithering.algorithm() != DitheringAlgorithm::None) {
-    std::unique_ptr<DitheringAlgorithmBase> dither;
-    switch (dithering.algorithm()) {
-      case DitheringAlgorithm::Ordered:
-        dither.reset(new OrderedDither2(is_background ? -1: new_mask_color));
-        break;
-      case DitheringAlgorithm::Old:
-        dither.reset(new OrderedDither(is_background ? -1: new_mask_color));
-        break;
-      case DitheringAlgorithm::ErrorDiffusion:
-        dither.reset(new ErrorDiffusionDither(is_background ? -1: new_mask_color));
-        break;
-    }
-    if (dither)
-      dither_rgb_image_to_indexed(
-        *dither, dithering,
-        image, new_image, rgbmap, palette, delegate);
-    return new_image;
-  }
-
-  // RGB/Indexed -> Gray
-  if ((image->pixelFormat() == IMAGE_RGB ||
-       image->pixelFormat() == IMAGE_INDEXED) &&
-      new_image->pixelFormat() == IMAGE_GRAYSCALE) {
-    if (!toGray)
-      toGray = &rgba_to_graya_using_luma;
-  }
-
   color_t c;
   int r, g, b, a;
 
   switch (image->pixelFormat()) {
 
     case IMAGE_RGB: {
-      const LockImageBits<RgbTraits> srcBits(image);
+      const LockImageBits<RgbTraits> srcBits(image, bounds);
       LockImageBits<RgbTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
 
       switch (new_image->pixelFormat()) {
 
         // RGB -> RGB
         case IMAGE_RGB:
-          new_image->copy(image, gfx::Clip(image->bounds()));
+          new_image->copy(image, gfx::Clip(bounds.x, bounds.y, bounds));
           break;
 
         // RGB -> Grayscale
         case IMAGE_GRAYSCALE: {
-          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<GrayscaleTraits>::iterator dst_it = dstBits.begin();
 #ifdef _DEBUG
           LockImageBits<GrayscaleTraits>::iterator dst_end = dstBits.end();
@@ -168,7 +215,7 @@ Image* convert_pixel_format(
 
         // RGB -> Indexed
         case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin();
 #ifdef _DEBUG
           LockImageBits<IndexedTraits>::iterator dst_end = dstBits.end();
@@ -198,14 +245,14 @@ Image* convert_pixel_format(
     }
 
     case IMAGE_GRAYSCALE: {
-      const LockImageBits<GrayscaleTraits> srcBits(image);
+      const LockImageBits<GrayscaleTraits> srcBits(image, bounds);
       LockImageBits<GrayscaleTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
 
       switch (new_image->pixelFormat()) {
 
         // Grayscale -> RGB
         case IMAGE_RGB: {
-          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<RgbTraits>::iterator dst_it = dstBits.begin();
 #ifdef _DEBUG
           LockImageBits<RgbTraits>::iterator dst_end = dstBits.end();
@@ -225,12 +272,12 @@ Image* convert_pixel_format(
 
         // Grayscale -> Grayscale
         case IMAGE_GRAYSCALE:
-          new_image->copy(image, gfx::Clip(image->bounds()));
+          new_image->copy(image, gfx::Clip(bounds.x, bounds.y, bounds));
           break;
 
         // Grayscale -> Indexed
         case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin();
 #ifdef _DEBUG
           LockImageBits<IndexedTraits>::iterator dst_end = dstBits.end();
@@ -257,14 +304,14 @@ Image* convert_pixel_format(
     }
 
     case IMAGE_INDEXED: {
-      const LockImageBits<IndexedTraits> srcBits(image);
+      const LockImageBits<IndexedTraits> srcBits(image, bounds);
       LockImageBits<IndexedTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
 
       switch (new_image->pixelFormat()) {
 
         // Indexed -> RGB
         case IMAGE_RGB: {
-          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<RgbTraits>::iterator dst_it = dstBits.begin();
 #ifdef _DEBUG
           LockImageBits<RgbTraits>::iterator dst_end = dstBits.end();
@@ -290,7 +337,7 @@ Image* convert_pixel_format(
 
         // Indexed -> Grayscale
         case IMAGE_GRAYSCALE: {
-          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<GrayscaleTraits>::iterator dst_it = dstBits.begin();
 #ifdef _DEBUG
           LockImageBits<GrayscaleTraits>::iterator dst_end = dstBits.end();
@@ -314,7 +361,7 @@ Image* convert_pixel_format(
 
         // Indexed -> Indexed
         case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin();
 #ifdef _DEBUG
           LockImageBits<IndexedTraits>::iterator dst_end = dstBits.end();
@@ -347,6 +394,83 @@ Image* convert_pixel_format(
       break;
     }
   }
+}
+
+Image* convert_pixel_format(
+  const Image* image,
+  Image* new_image,
+  PixelFormat pixelFormat,
+  const Dithering& dithering,
+  const RgbMap* rgbmap,
+  const Palette* palette,
+  bool is_background,
+  color_t new_mask_color,
+  rgba_to_graya_func toGray,
+  TaskDelegate* delegate,
+  const int maxThreads)
+{
+  if (!new_image)
+    new_image = Image::create(pixelFormat, image->width(), image->height());
+  new_image->setMaskColor(new_mask_color);
+
+  // RGB -> Indexed with ordered dithering
+  if (image->pixelFormat() == IMAGE_RGB &&
+      pixelFormat == IMAGE_INDEXED &&
+      dithering.algorithm() != DitheringAlgorithm::None) {
+    std::unique_ptr<DitheringAlgorithmBase> dither;
+    switch (dithering.algorithm()) {
+      case DitheringAlgorithm::Ordered:
+        dither.reset(new OrderedDither2(is_background ? -1: new_mask_color));
+        break;
+      case DitheringAlgorithm::Old:
+        dither.reset(new OrderedDither(is_background ? -1: new_mask_color));
+        break;
+      case DitheringAlgorithm::ErrorDiffusion:
+        dither.reset(new ErrorDiffusionDither(is_background ? -1: new_mask_color));
+        break;
+    }
+    if (dither)
+      dither_rgb_image_to_indexed(
+        *dither, dithering,
+        image, new_image, rgbmap, palette, delegate, maxThreads);
+    return new_image;
+  }
+
+  // RGB/Indexed -> Gray
+  if ((image->pixelFormat() == IMAGE_RGB ||
+       image->pixelFormat() == IMAGE_INDEXED) &&
+      new_image->pixelFormat() == IMAGE_GRAYSCALE) {
+    if (!toGray)
+      toGray = &rgba_to_graya_using_luma;
+  }
+
+  // Each thread converts a band of rows, there is no dependency
+  // between pixels and the RgbMap can be used from several threads.
+  const int h = image->height();
+  const int maxBands =
+    std::max(1, std::min(h, image->width() * h / kMinPixelsPerThread));
+  const int nthreads =
+    std::clamp(maxThreads > 0 ? maxThreads:
+                                int(std::thread::hardware_concurrency()),
+               1, maxBands);
+
+  auto convertBand = [&](const int i) {
+    const int y = h * i / nthreads;
+    convert_pixel_format_rows(
+      image, new_image,
+      gfx::Rect(0, y, image->width(), h * (i+1) / nthreads - y),
+      rgbmap, palette, is_background, new_mask_color, toGray);
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads-1);
+  for (int i=1; i<nthreads; ++i)
+    threads.emplace_back(convertBand, i);
+
+  convertBand(0);
+
+  for (auto& thread : threads)
+    thread.join();
 
   return new_image;
 }
@@ -355,9 +479,11 @@ Image* convert_pixel_format(
 // Creation of optimized palette for RGB images
 // by David Capello
 
-void PaletteOptimizer::feedWithImage(Image* image, bool withAlpha)
+void PaletteOptimizer::feedWithImage(Image* image, bool withAlpha,
+                                     const int pixelStep)
 {
   uint32_t color;
+  int skip = 0;
 
   if (withAlpha)
     m_withAlpha = true;
@@ -371,6 +497,12 @@ void PaletteOptimizer::feedWithImage(Image* image, bool withAlpha)
         LockImageBits<RgbTraits>::const_iterator it = bits.begin(), end = bits.end();
 
         for (; it != end; ++it) {
+          if (skip > 0) {
+            --skip;
+            continue;
+          }
+          skip = pixelStep-1;
+
           color = *it;
           if (rgba_geta(color) > 0) {
             if (!withAlpha)
@@ -388,6 +520,12 @@ void PaletteOptimizer::feedWithImage(Image* image, bool withAlpha)
         LockImageBits<RgbTraits>::const_iterator it = bits.begin(), end = bits.end();
 
         for (; it != end; ++it) {
+          if (skip > 0) {
+            --skip;
+            continue;
+          }
+          skip = pixelStep-1;
+
           color = *it;
 
           if (graya_geta(color) > 0) {
@@ -415,6 +553,13 @@ void PaletteOptimizer::feedWithRgbaColor(color_t color)
   m_histogram.addSamples(color, 1);
 }
 
+void PaletteOptimizer::merge(const PaletteOptimizer& other)
+{
+  m_histogram.merge(other.m_histogram);
+  if (other.m_withAlpha)
+    m_withAlpha = true;
+}
+
 void PaletteOptimizer::calculate(Palette* palette, int maskIndex)
 {
   bool addMask;
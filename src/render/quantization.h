@@ -1,5 +1,5 @@
 // Aseprite Rener Library
-// Copyright (c) 2019-2020  Igara Studio S.A.
+// Copyright (c) 2019-2022  Igara Studio S.A.
 // Copyright (c) 2001-2017  David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -28,8 +28,12 @@ namespace render {
 
   class PaletteOptimizer {
   public:
-    void feedWithImage(doc::Image* image, bool withAlpha);
+    // Adds the colors of the given image to the histogram (only one
+    // of each "pixelStep" pixels if pixelStep > 1).
+    void feedWithImage(doc::Image* image, bool withAlpha,
+                       const int pixelStep = 1);
     void feedWithRgbaColor(doc::color_t color);
+    void merge(const PaletteOptimizer& other);
     void calculate(doc::Palette* palette, int maskIndex);
 
   private:
@@ -38,6 +42,10 @@ namespace render {
   };
 
   // Creates a new palette suitable to quantize the given RGB sprite to Indexed color.
+  //
+  // Frames are rendered in several threads. A faster approximate
+  // palette can be created using only one of each "frameStep" frames
+  // and one of each "pixelStep" pixels.
   doc::Palette* create_palette_from_sprite(
     const doc::Sprite* sprite,
     const doc::frame_t fromFrame,
@@ -45,10 +53,17 @@ namespace render {
     const bool withAlpha,
     doc::Palette* newPalette, // Can be NULL to create a new palette
     TaskDelegate* delegate,
-    const bool newBlend);
+    const bool newBlend,
+    const int frameStep = 1,
+    const int pixelStep = 1);
 
   // Changes the image pixel format. The dithering method is used only
   // when you want to convert from RGB to Indexed.
+  //
+  // Big images are converted in bands of rows in several threads,
+  // using up to "maxThreads" threads (0 = one per CPU core). Callers
+  // that convert several images at the same time can use 1 to avoid
+  // creating more threads than CPU cores.
   Image* convert_pixel_format(
     const doc::Image* src,
     doc::Image* dst,         // Can be NULL to create a new image
@@ -59,7 +74,8 @@ namespace render {
     bool is_background,
     doc::color_t new_mask_color,
     doc::rgba_to_graya_func toGray = nullptr,
-    TaskDelegate* delegate = nullptr);
+    TaskDelegate* delegate = nullptr,
+    const int maxThreads = 0);
 
 } // namespace render
 
@@ -0,0 +1,239 @@
+// Aseprite Render Library
+// Copyright (c) 2022 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "render/quantization.h"
+
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "doc/sprite.h"
+#include "render/dithering.h"
+#include "render/dithering_matrix.h"
+#include "render/ordered_dither.h"
+#include "render/render.h"
+#include "render/task_delegate.h"
+
+#include <memory>
+
+using namespace doc;
+using namespace render;
+
+class CancelAfter : public TaskDelegate {
+public:
+  CancelAfter(int n) : m_n(n) { }
+  void notifyTaskProgress(double progress) override {
+    EXPECT_GE(progress, m_progress);
+    m_progress = progress;
+  }
+  bool continueTask() override { return (--m_n >= 0); }
+  double progress() const { return m_progress; }
+private:
+  int m_n;
+  double m_progress = 0.0;
+};
+
+static std::unique_ptr<Sprite> create_sprite(const int nframes, const int colorsPerFrame)
+{
+  std::unique_ptr<Sprite> spr(Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, 16, 16)));
+  spr->setTotalFrames(nframes);
+
+  LayerImage* layer = static_cast<LayerImage*>(spr->root()->firstLayer());
+  for (frame_t frame=0; frame<nframes; ++frame) {
+    ImageRef image(Image::create(IMAGE_RGB, 16, 16));
+    clear_image(image.get(), 0);
+    for (int i=0; i<colorsPerFrame; ++i) {
+      const int c = frame*colorsPerFrame + i;
+      put_pixel(image.get(), i % 16, i / 16,
+                rgba((c*7) & 255, (c*13) & 255, (c*29) & 255, 255));
+    }
+    if (frame == 0)
+      layer->cel(0)->image()->copy(image.get(), gfx::Clip(image->bounds()));
+    else
+      layer->addCel(new Cel(frame, image));
+  }
+  return spr;
+}
+
+static void expect_palette_from_frames(const Sprite* spr,
+                                       const Palette& pal,
+                                       const int frameStep,
+                                       const int pixelStep)
+{
+  PaletteOptimizer optimizer;
+  ImageRef flat(Image::create(IMAGE_RGB, spr->width(), spr->height()));
+  Render render;
+  for (frame_t frame=0; frame<spr->totalFrames(); frame+=frameStep) {
+    render.renderSprite(flat.get(), spr, frame);
+    optimizer.feedWithImage(flat.get(), true, pixelStep);
+  }
+
+  Palette expected(frame_t(0), 256);
+  optimizer.calculate(&expected, 0);
+
+  ASSERT_EQ(expected.size(), pal.size());
+  for (int i=0; i<pal.size(); ++i)
+    EXPECT_EQ(expected.getEntry(i), pal.getEntry(i)) << " index=" << i;
+}
+
+TEST(Quantization, PaletteFromSpriteIsEqualToSerialPalette)
+{
+  // Less than 256 colors (the order of the palette entries depends on
+  // the order of the frames) and more than 256 colors (median cut).
+  for (int colorsPerFrame : { 3, 40 }) {
+    std::unique_ptr<Sprite> spr = create_sprite(30, colorsPerFrame);
+    std::unique_ptr<Palette> pal(
+      create_palette_from_sprite(spr.get(), 0, spr->lastFrame(),
+                                 true, nullptr, nullptr, true));
+    ASSERT_TRUE(pal != nullptr);
+    expect_palette_from_frames(spr.get(), *pal, 1, 1);
+  }
+}
+
+TEST(Quantization, PaletteFromSpriteWithSampling)
+{
+  std::unique_ptr<Sprite> spr = create_sprite(30, 40);
+  std::unique_ptr<Palette> pal(
+    create_palette_from_sprite(spr.get(), 0, spr->lastFrame(),
+                               true, nullptr, nullptr, true, 3, 5));
+  ASSERT_TRUE(pal != nullptr);
+  expect_palette_from_frames(spr.get(), *pal, 3, 5);
+}
+
+TEST(Quantization, PaletteFromSpriteProgressAndCancel)
+{
+  std::unique_ptr<Sprite> spr = create_sprite(30, 3);
+
+  CancelAfter all(1000);
+  std::unique_ptr<Palette> pal(
+    create_palette_from_sprite(spr.get(), 0, spr->lastFrame(),
+                               true, nullptr, &all, true));
+  EXPECT_TRUE(pal != nullptr);
+  EXPECT_EQ(1.0, all.progress());
+
+  Palette tmp(frame_t(0), 256);
+  CancelAfter cancel(2);
+  EXPECT_EQ(nullptr,
+            create_palette_from_sprite(spr.get(), 0, spr->lastFrame(),
+                                       true, &tmp, &cancel, true));
+}
+
+// Creates an image big enough to be converted in several threads
+static ImageRef create_big_rgb_image()
+{
+  ImageRef image(Image::create(IMAGE_RGB, 512, 384));
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x)
+      put_pixel(image.get(), x, y,
+                rgba((x*3) & 255, (y*5) & 255, (x+y) & 255,
+                     (x+y) % 7 == 0 ? 0: 255));
+  return image;
+}
+
+static Palette create_palette()
+{
+  Palette pal(frame_t(0), 64);
+  for (int i=1; i<pal.size(); ++i)
+    pal.setEntry(i, rgba((i*37) & 255, (i*71) & 255, (i*113) & 255, 255));
+  return pal;
+}
+
+TEST(Quantization, ConvertPixelFormatIsEqualToMapColor)
+{
+  const ImageRef image = create_big_rgb_image();
+  const Palette pal = create_palette();
+
+  for (auto algorithm : { RgbMapAlgorithm::RGB5A3,
+                          RgbMapAlgorithm::KDTREE }) {
+    std::unique_ptr<RgbMap> rgbmap(RgbMap::create(algorithm));
+    rgbmap->regenerate(&pal, 0);
+
+    ImageRef indexed(
+      convert_pixel_format(image.get(), nullptr, IMAGE_INDEXED,
+                           Dithering(), rgbmap.get(), &pal,
+                           false, 0));
+    ASSERT_EQ(IMAGE_INDEXED, indexed->pixelFormat());
+
+    for (int y=0; y<image->height(); ++y) {
+      for (int x=0; x<image->width(); ++x) {
+        const color_t c = get_pixel(image.get(), x, y);
+        const int expected =
+          (rgba_geta(c) == 0 ? 0:
+           rgbmap->mapColor(rgba_getr(c), rgba_getg(c),
+                            rgba_getb(c), rgba_geta(c)));
+        ASSERT_EQ(expected, get_pixel(indexed.get(), x, y))
+          << " x=" << x << " y=" << y;
+      }
+    }
+  }
+}
+
+TEST(Quantization, OrderedDitherIsEqualToDitherPixel)
+{
+  const ImageRef image = create_big_rgb_image();
+  const Palette pal = create_palette();
+  std::unique_ptr<RgbMap> rgbmap(RgbMap::create(RgbMapAlgorithm::RGB5A3));
+  rgbmap->regenerate(&pal, 0);
+
+  const Dithering dithering(DitheringAlgorithm::Ordered,
+                            BayerMatrix(8), 1.0);
+  ImageRef indexed(
+    convert_pixel_format(image.get(), nullptr, IMAGE_INDEXED,
+                         dithering, rgbmap.get(), &pal,
+                         false, 0));
+
+  OrderedDither2 dither(0);
+  const DitheringMatrix matrix = dithering.matrix();
+  for (int y=0; y<image->height(); ++y) {
+    for (int x=0; x<image->width(); ++x) {
+      ASSERT_EQ(dither.ditherRgbPixelToIndex(
+                  matrix, get_pixel(image.get(), x, y),
+                  x, y, rgbmap.get(), &pal),
+                get_pixel(indexed.get(), x, y))
+        << " x=" << x << " y=" << y;
+    }
+  }
+}
+
+TEST(Quantization, ConvertPixelFormatWithMaxThreads)
+{
+  const ImageRef image = create_big_rgb_image();
+  const Palette pal = create_palette();
+  std::unique_ptr<RgbMap> rgbmap(RgbMap::create(RgbMapAlgorithm::RGB5A3));
+  rgbmap->regenerate(&pal, 0);
+
+  for (const Dithering& dithering :
+         { Dithering(),
+           Dithering(DitheringAlgorithm::Ordered, BayerMatrix(8), 1.0) }) {
+    ImageRef expected(
+      convert_pixel_format(image.get(), nullptr, IMAGE_INDEXED,
+                           dithering, rgbmap.get(), &pal,
+                           false, 0, nullptr, nullptr, 1));
+    for (int maxThreads : { 0, 2, 3 }) {
+      ImageRef indexed(
+        convert_pixel_format(image.get(), nullptr, IMAGE_INDEXED,
+                             dithering, rgbmap.get(), &pal,
+                             false, 0, nullptr, nullptr, maxThreads));
+      EXPECT_EQ(0, count_diff_between_images(expected.get(), indexed.get()))
+        << " maxThreads=" << maxThreads;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  doc::Palette::initBestfit();
+  return RUN_ALL_TESTS();
+}
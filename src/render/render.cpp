@@ -11,6 +11,7 @@
 
 #include "render/render.h"
 
+#include "base/thread_pool.h"
 #include "doc/blend_internals.h"
 #include "doc/blend_mode.h"
 #include "doc/doc.h"
@@ -19,7 +20,13 @@
 #include "gfx/clip.h"
 #include "gfx/region.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
 
 namespace render {
 
@@ -48,6 +55,51 @@ public:
     else
       return dst;
   }
+  // Returns false if the whole row must be blended pixel by pixel
+  inline bool blendRow(typename DstTraits::pixel_t* dst,
+                       const typename SrcTraits::pixel_t* src,
+                       const int n,
+                       const int opacity)
+  {
+    return false;
+  }
+};
+
+template<>
+class BlenderHelper<RgbTraits, RgbTraits> {
+  BlendFunc m_blendFunc;
+  BlendRowFunc m_blendRowFunc;
+  color_t m_mask_color;
+public:
+  BlenderHelper(const Image* src, const Palette* pal, BlendMode blendMode, const bool newBlend)
+  {
+    m_blendFunc = RgbTraits::get_blender(blendMode, newBlend);
+    m_blendRowFunc = get_rgba_row_blender(blendMode, newBlend);
+    m_mask_color = src->maskColor();
+  }
+  inline RgbTraits::pixel_t
+  operator()(const RgbTraits::pixel_t& dst,
+             const RgbTraits::pixel_t& src,
+             const int opacity)
+  {
+    if (src != m_mask_color)
+      return (*m_blendFunc)(dst, src, opacity);
+    else
+      return dst;
+  }
+  // Uses the vectorized row blender (if it's available for this
+  // blend mode)
+  inline bool blendRow(RgbTraits::pixel_t* dst,
+                       const RgbTraits::pixel_t* src,
+                       const int n,
+                       const int opacity)
+  {
+    if (!m_blendRowFunc)
+      return false;
+
+    (*m_blendRowFunc)(dst, src, n, m_mask_color, opacity);
+    return true;
+  }
 };
 
 template<>
@@ -72,6 +124,13 @@ public:
     else
       return dst;
   }
+  inline bool blendRow(RgbTraits::pixel_t* dst,
+                       const GrayscaleTraits::pixel_t* src,
+                       const int n,
+                       const int opacity)
+  {
+    return false;
+  }
 };
 
 template<>
@@ -104,6 +163,13 @@ public:
         return dst;
     }
   }
+  inline bool blendRow(RgbTraits::pixel_t* dst,
+                       const IndexedTraits::pixel_t* src,
+                       const int n,
+                       const int opacity)
+  {
+    return false;
+  }
 };
 
 template<>
@@ -139,6 +205,13 @@ public:
         return dst;
     }
   }
+  inline bool blendRow(IndexedTraits::pixel_t* dst,
+                       const IndexedTraits::pixel_t* src,
+                       const int n,
+                       const int opacity)
+  {
+    return false;
+  }
 };
 
 template<class DstTraits, class SrcTraits>
@@ -163,37 +236,26 @@ void composite_image_without_scale(
                  src->width(), src->height()))
     return;
 
-  gfx::Rect srcBounds = area.srcBounds();
-  gfx::Rect dstBounds = area.dstBounds();
-  int bottom = dstBounds.y2()-1;
+  const gfx::Rect srcBounds = area.srcBounds();
+  const gfx::Rect dstBounds = area.dstBounds();
 
   ASSERT(!srcBounds.isEmpty());
-
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-#ifdef _DEBUG
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-#endif
-  typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
+  ASSERT(srcBounds.size() == dstBounds.size());
 
   // For each line to draw of the source image...
-  dstBounds.h = 1;
   for (int y=0; y<srcBounds.h; ++y) {
-    dst_it = dstBits.begin_area(dstBounds);
-    dst_end = dstBits.end_area(dstBounds);
+    auto dst_it = get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y+y);
+    auto src_it = get_pixel_address_fast<SrcTraits>(src, srcBounds.x, srcBounds.y+y);
+
+    // Blend the whole row at once (e.g. with vectorized blenders)
+    if (blender.blendRow(dst_it, src_it, srcBounds.w, opacity))
+      continue;
 
     for (int x=0; x<srcBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
       *dst_it = blender(*dst_it, *src_it, opacity);
       ++src_it;
       ++dst_it;
     }
-
-    if (++dstBounds.y > bottom)
-      break;
   }
 }
 
@@ -219,7 +281,6 @@ void composite_image_scale_up(
     return;
 
   BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
-  int px_x, px_y;
   int px_w = int(sx);
   int px_h = int(sy);
 
@@ -247,106 +308,60 @@ void composite_image_scale_up(
   if (srcBounds.isEmpty())
     return;
 
-  gfx::Rect dstBounds = area.dstBounds();
-  int bottom = dstBounds.y2()-1;
-  int line_h;
+  const gfx::Rect dstBounds = area.dstBounds();
+  const int bottom = dstBounds.y2();
 
-  // the scanline variable is used to blend src/dst pixels one time for each pixel
+  // The scanline contains the result of blending each source pixel
+  // with the first destination pixel covered by it, so we blend
+  // src/dst pixels one time for each source pixel.
   typedef std::vector<typename DstTraits::pixel_t> Scanline;
   Scanline scanline(srcBounds.w);
-  typename Scanline::iterator scanline_it;
-#ifdef _DEBUG
-  typename Scanline::iterator scanline_end = scanline.end();
-#endif
-
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-#ifdef _DEBUG
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-#endif
-  typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
-
-  // For each line to draw of the source image...
-  dstBounds.h = 1;
-  for (int y=0; y<srcBounds.h; ++y) {
-    dst_it = dstBits.begin_area(dstBounds);
-    dst_end = dstBits.end_area(dstBounds);
-
-    // Read 'src' and 'dst' and blend them, put the result in `scanline'
-    scanline_it = scanline.begin();
-    for (int x=0; x<srcBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
-      ASSERT(scanline_it >= scanline.begin() && scanline_it < scanline_end);
 
-      *scanline_it = blender(*dst_it, *src_it, opacity);
-      ++src_it;
-
-      int delta;
-      if (x == 0)
-        delta = first_px_w;
-      else
-        delta = px_w;
-
-      while (dst_it != dst_end && delta-- > 0)
-        ++dst_it;
-
-      ++scanline_it;
+  int dstY = dstBounds.y;
+  for (int y=0; y<srcBounds.h && dstY<bottom; ++y) {
+    auto dstRow = get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstY);
+    auto srcRow = get_pixel_address_fast<SrcTraits>(src, srcBounds.x, srcBounds.y+y);
+
+    // Read the 'dst' pixels below each 'src' pixel
+    for (int x=0, dstX=0; x<srcBounds.w; ++x) {
+      ASSERT(dstX < dstBounds.w);
+      scanline[x] = dstRow[std::min(dstX, dstBounds.w-1)];
+      dstX += (x == 0 ? first_px_w: px_w);
     }
 
-    // Get the 'height' of the line to be painted in 'dst'
-    if ((y == 0) && (first_px_h > 0))
-      line_h = first_px_h;
-    else
-      line_h = px_h;
-
-    // Draw the line in 'dst'
-    for (px_y=0; px_y<line_h; ++px_y) {
-      dst_it = dstBits.begin_area(dstBounds);
-      dst_end = dstBits.end_area(dstBounds);
-      scanline_it = scanline.begin();
-
-      int x = 0;
-
-      // first pixel
-      for (px_x=0; px_x<first_px_w; ++px_x) {
-        ASSERT(scanline_it != scanline_end);
-        ASSERT(dst_it != dst_end);
-
-        *dst_it = *scanline_it;
-
-        ++dst_it;
-        if (dst_it == dst_end)
-          goto done_with_line;
-      }
-
-      ++scanline_it;
-      ++x;
-
-      // the rest of the line
-      for (; x<srcBounds.w; ++x) {
-        for (px_x=0; px_x<px_w; ++px_x) {
-          ASSERT(dst_it !=  dst_end);
-
-          *dst_it = *scanline_it;
-
-          ++dst_it;
-          if (dst_it == dst_end)
-            goto done_with_line;
-        }
+    // Blend 'src' and 'dst' (with the vectorized row blender if it's
+    // available)
+    if (!blender.blendRow(&scanline[0], srcRow, srcBounds.w, opacity)) {
+      for (int x=0; x<srcBounds.w; ++x)
+        scanline[x] = blender(scanline[x], srcRow[x], opacity);
+    }
 
-        ++scanline_it;
+    // Draw the first line in 'dst' repeating each pixel horizontally
+    {
+      auto dstIt = dstRow;
+      int remaining = dstBounds.w;
+      int n = std::min(first_px_w, remaining);
+      std::fill_n(dstIt, n, scanline[0]);
+      dstIt += n;
+      remaining -= n;
+
+      for (int x=1; x<srcBounds.w && remaining > 0; ++x) {
+        n = std::min(px_w, remaining);
+        std::fill_n(dstIt, n, scanline[x]);
+        dstIt += n;
+        remaining -= n;
       }
+    }
 
-done_with_line:;
-      if (++dstBounds.y > bottom)
-        goto done_with_blit;
+    // Get the 'height' of the line to be painted in 'dst' and copy
+    // the first line in the other ones
+    const int line_h = std::min((y == 0 ? first_px_h: px_h), bottom-dstY);
+    for (int px_y=1; px_y<line_h; ++px_y) {
+      std::copy(dstRow, dstRow+dstBounds.w,
+                get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstY+px_y));
     }
+    dstY += line_h;
   }
-
-done_with_blit:;
 }
 
 template<class DstTraits, class SrcTraits>
@@ -384,36 +399,25 @@ void composite_image_scale_down(
   if (srcBounds.isEmpty())
     return;
 
-  gfx::Rect dstBounds = area.dstBounds();
-
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  auto src_it = srcBits.begin();
-  auto dst_it = dstBits.begin();
-#ifdef _DEBUG
-  auto src_end = srcBits.end();
-  auto dst_end = dstBits.end();
-#endif
+  const gfx::Rect dstBounds = area.dstBounds();
 
-  // Adjust to src_it for each line
-  int adjust_per_line = (dstBounds.w*step_w)*(step_h-1);
+  // Source pixels to blend in each row (one of each step_w pixels)
+  std::vector<typename SrcTraits::pixel_t> scanline(dstBounds.w);
 
   // For each line to draw of the source image...
   for (int y=0; y<dstBounds.h; ++y) {
-    for (int x=0; x<dstBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
+    auto dstRow = get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y+y);
+    auto srcRow = get_pixel_address_fast<SrcTraits>(src, srcBounds.x, srcBounds.y+y*step_h);
+    ASSERT(srcBounds.y+y*step_h < src->height());
 
-      *dst_it = blender(*dst_it, *src_it, opacity);
+    // Skip columns
+    for (int x=0; x<dstBounds.w; ++x)
+      scanline[x] = srcRow[x*step_w];
 
-      // Skip columns
-      src_it += step_w;
-      ++dst_it;
+    if (!blender.blendRow(dstRow, &scanline[0], dstBounds.w, opacity)) {
+      for (int x=0; x<dstBounds.w; ++x)
+        dstRow[x] = blender(dstRow[x], scanline[x], opacity);
     }
-
-    // Skip rows
-    src_it += adjust_per_line;
   }
 }
 
@@ -491,26 +495,49 @@ void composite_image_general(
   }
 }
 
-template<class DstTraits, class SrcTraits>
-CompositeImageFunc get_fastest_composition_path(const Projection& proj,
-                                                const bool finegrain)
+enum class CompositionPath {
+  General,
+  WithoutScale,
+  ScaleUp,
+  ScaleDown,
+};
+
+CompositionPath get_fastest_composition_path_type(const Projection& proj,
+                                                  const bool finegrain)
 {
   if (finegrain || !proj.zoom().isSimpleZoomLevel()) {
-    return composite_image_general<DstTraits, SrcTraits>;
+    return CompositionPath::General;
   }
   else if (proj.applyX(1) == 1 && proj.applyY(1) == 1) {
-    return composite_image_without_scale<DstTraits, SrcTraits>;
+    return CompositionPath::WithoutScale;
   }
   else if (proj.scaleX() >= 1.0 && proj.scaleY() >= 1.0) {
-    return composite_image_scale_up<DstTraits, SrcTraits>;
+    return CompositionPath::ScaleUp;
   }
   // Slower composite function for special cases with odd zoom and non-square pixel ratio
   else if (((proj.removeX(1) > 1) && (proj.removeX(1) & 1)) ||
            ((proj.removeY(1) > 1) && (proj.removeY(1) & 1))) {
-    return composite_image_general<DstTraits, SrcTraits>;
+    return CompositionPath::General;
   }
   else {
-    return composite_image_scale_down<DstTraits, SrcTraits>;
+    return CompositionPath::ScaleDown;
+  }
+}
+
+template<class DstTraits, class SrcTraits>
+CompositeImageFunc get_fastest_composition_path(const Projection& proj,
+                                                const bool finegrain)
+{
+  switch (get_fastest_composition_path_type(proj, finegrain)) {
+    case CompositionPath::WithoutScale:
+      return composite_image_without_scale<DstTraits, SrcTraits>;
+    case CompositionPath::ScaleUp:
+      return composite_image_scale_up<DstTraits, SrcTraits>;
+    case CompositionPath::ScaleDown:
+      return composite_image_scale_down<DstTraits, SrcTraits>;
+    case CompositionPath::General:
+    default:
+      return composite_image_general<DstTraits, SrcTraits>;
   }
 }
 
@@ -530,6 +557,15 @@ bool has_visible_reference_layers(const LayerGroup* group)
   return false;
 }
 
+bool is_same_or_child_layer(const Layer* layer, const Layer* parent)
+{
+  for (; layer; layer=layer->parent()) {
+    if (layer == parent)
+      return true;
+  }
+  return false;
+}
+
 } // anonymous namespace
 
 Render::Render()
@@ -549,6 +585,11 @@ Render::Render()
   , m_previewImage(nullptr)
   , m_previewBlendMode(BlendMode::NORMAL)
   , m_onionskin(OnionskinType::NONE)
+  , m_renderThreads(1)
+  , m_renderTileSize(256, 256)
+  , m_cacheLayer(nullptr)
+  , m_cacheBelow(nullptr)
+  , m_cacheAbove(nullptr)
 {
 }
 
@@ -633,6 +674,17 @@ void Render::disableOnionskin()
   m_onionskin.type(OnionskinType::NONE);
 }
 
+void Render::setRenderThreads(const int threads)
+{
+  m_renderThreads = std::max(1, threads);
+}
+
+void Render::setRenderTileSize(const gfx::Size& tileSize)
+{
+  m_renderTileSize.w = std::max(1, tileSize.w);
+  m_renderTileSize.h = std::max(1, tileSize.h);
+}
+
 void Render::renderSprite(
   Image* dstImage,
   const Sprite* sprite,
@@ -681,6 +733,12 @@ void Render::renderSprite(
   frame_t frame,
   const gfx::ClipF& area)
 {
+  if (m_renderThreads > 1 &&
+      canRenderInTiles(dstImage, sprite, area)) {
+    renderSpriteInTiles(dstImage, sprite, frame, gfx::Clip(area));
+    return;
+  }
+
   m_sprite = sprite;
 
   CompositeImageFunc compositeImage =
@@ -691,29 +749,24 @@ void Render::renderSprite(
     return;
 
   const LayerImage* bgLayer = m_sprite->backgroundLayer();
-  color_t bg_color = 0;
-  if (m_sprite->pixelFormat() == IMAGE_INDEXED) {
-    switch (dstImage->pixelFormat()) {
-      case IMAGE_RGB:
-      case IMAGE_GRAYSCALE:
-        if (bgLayer && bgLayer->isVisible())
-          bg_color = m_sprite->palette(frame)->getEntry(m_sprite->transparentColor());
-        break;
-      case IMAGE_INDEXED:
-        bg_color = m_sprite->transparentColor();
-        break;
-    }
-  }
+  const color_t bg_color = getBgColor(dstImage->pixelFormat(), frame);
 
   // New Blending Method:
   if (m_newBlendMethod) {
-    // Clear dstImage with the bg_color (if the background is not a
-    // special background pattern like the checkered background, this
-    // is enough as a base color).
-    fill_rect(dstImage, area.dstBounds(), bg_color);
+    // The layers cache already contains the bg_color and the layers
+    // below/above the cached layer.
+    if (canUseLayersCache(dstImage, area)) {
+      renderCachedLayers(dstImage, gfx::Clip(area), frame, compositeImage);
+    }
+    else {
+      // Clear dstImage with the bg_color (if the background is not a
+      // special background pattern like the checkered background, this
+      // is enough as a base color).
+      fill_rect(dstImage, area.dstBounds(), bg_color);
 
-    // Draw the Background layer - Onion skin behind the sprite - Transparent Layers
-    renderSpriteLayers(dstImage, area, frame, compositeImage);
+      // Draw the Background layer - Onion skin behind the sprite - Transparent Layers
+      renderSpriteLayers(dstImage, area, frame, compositeImage);
+    }
 
     // In case that we need a special background (e.g. like the
     // checkered pattern), we can draw the background in a temporal
@@ -760,6 +813,120 @@ void Render::renderSprite(
   }
 }
 
+// Threads used by renderSpriteInTiles() (the calling thread renders
+// tiles too). The pool is shared by all Render instances, and it's
+// created the first time that a sprite is rendered in tiles.
+static base::thread_pool& render_tiles_pool()
+{
+  static base::thread_pool pool(
+    std::max(1, int(std::thread::hardware_concurrency())-1));
+  return pool;
+}
+
+bool Render::canRenderInTiles(
+  const Image* dstImage,
+  const Sprite* sprite,
+  const gfx::ClipF& area) const
+{
+  // Only integer areas starting at the origin of dstImage can be
+  // split in tiles without changing the result (e.g. the checkered
+  // background depends on the dstImage origin).
+  if (area.dst.x != 0.0 || area.dst.y != 0.0 ||
+      area.src.x != std::floor(area.src.x) ||
+      area.src.y != std::floor(area.src.y) ||
+      area.size.w != std::floor(area.size.w) ||
+      area.size.h != std::floor(area.size.h))
+    return false;
+
+  // It's not worth the threads for small areas (less than the area
+  // of 4 tiles)
+  if (area.size.w * area.size.h <
+      4.0 * m_renderTileSize.w * m_renderTileSize.h)
+    return false;
+
+  // The general and the scale down composition paths use the
+  // truncated (fractional) origin of each cel relative to the area
+  // origin, so tiles could sample different source pixels than a
+  // full render.
+  switch (get_fastest_composition_path_type(
+            m_proj, isFinegrainComposition(sprite->root()))) {
+    case CompositionPath::WithoutScale:
+    case CompositionPath::ScaleUp:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void Render::renderSpriteInTiles(
+  Image* dstImage,
+  const Sprite* sprite,
+  frame_t frame,
+  const gfx::Clip& area)
+{
+  const gfx::Rect bounds =
+    area.dstBounds().createIntersection(dstImage->bounds());
+  if (bounds.isEmpty())
+    return;
+
+  std::vector<gfx::Rect> tiles;
+  for (int y=bounds.y; y<bounds.y2(); y+=m_renderTileSize.h) {
+    for (int x=bounds.x; x<bounds.x2(); x+=m_renderTileSize.w) {
+      tiles.push_back(
+        gfx::Rect(x, y,
+                  std::min(m_renderTileSize.w, bounds.x2()-x),
+                  std::min(m_renderTileSize.h, bounds.y2()-y)));
+    }
+  }
+
+  // Each thread takes the next pending tile, so threads that finish
+  // cheap tiles (e.g. empty areas) continue with the remaining ones.
+  std::atomic<int> nextTile(0);
+  auto renderTiles = [this, dstImage, sprite, frame, &area, &tiles, &nextTile]{
+    // Each thread uses its own Render copy (the render state is
+    // modified while the layers are composited) and its own buffers.
+    Render render(*this);
+    render.m_renderThreads = 1;
+    render.m_tmpBuf.reset();
+
+    ImageBufferPtr tileBuf(new ImageBuffer);
+    ImageSpec spec = dstImage->spec();
+
+    for (int i=nextTile++; i<int(tiles.size()); i=nextTile++) {
+      const gfx::Rect& tile = tiles[i];
+      spec.setSize(tile.size());
+
+      ImageRef tileImage(Image::create(spec, tileBuf));
+      render.renderSprite(
+        tileImage.get(), sprite, frame,
+        gfx::ClipF(0, 0,
+                   area.src.x + tile.x - area.dst.x,
+                   area.src.y + tile.y - area.dst.y,
+                   tile.w, tile.h));
+
+      // Tiles don't overlap, so we can copy each one to dstImage
+      // without locking.
+      copy_image(dstImage, tileImage.get(), tile.x, tile.y);
+    }
+  };
+
+  const int nthreads = std::min(m_renderThreads, int(tiles.size()));
+  std::vector<std::future<void>> futures;
+  futures.reserve(nthreads-1);
+  for (int i=1; i<nthreads; ++i) {
+    auto task = std::make_shared<std::packaged_task<void()>>(renderTiles);
+    futures.push_back(task->get_future());
+    render_tiles_pool().execute([task]{ (*task)(); });
+  }
+
+  renderTiles();
+
+  // Wait all tasks (even the ones that didn't take any tile) because
+  // they reference local variables.
+  for (auto& future : futures)
+    future.wait();
+}
+
 void Render::renderSpriteLayers(Image* dstImage,
                               const gfx::ClipF& area,
                               frame_t frame,
@@ -787,6 +954,187 @@ void Render::renderSpriteLayers(Image* dstImage,
               BlendMode::UNSPECIFIED, false);
 }
 
+void Render::setLayersCache(const Layer* layer,
+                            const Image* below,
+                            const Image* above)
+{
+  m_cacheLayer = layer;
+  m_cacheBelow = below;
+  m_cacheAbove = above;
+}
+
+void Render::removeLayersCache()
+{
+  m_cacheLayer = nullptr;
+  m_cacheBelow = nullptr;
+  m_cacheAbove = nullptr;
+}
+
+void Render::renderLayersBelow(
+  Image* dstImage,
+  const Layer* layer,
+  frame_t frame,
+  const gfx::Clip& area)
+{
+  m_sprite = layer->sprite();
+
+  CompositeImageFunc compositeImage =
+    getImageComposition(
+      dstImage->pixelFormat(),
+      m_sprite->pixelFormat(), m_sprite->root());
+  if (!compositeImage)
+    return;
+
+  // Same base color used by renderSprite() so the cached image can
+  // replace the first steps of the sprite rendering.
+  fill_rect(dstImage, area.dstBounds(),
+            getBgColor(dstImage->pixelFormat(), frame));
+
+  renderLayersRange(dstImage, layer, true, area, frame, compositeImage);
+}
+
+void Render::renderLayersAbove(
+  Image* dstImage,
+  const Layer* layer,
+  frame_t frame,
+  const gfx::Clip& area)
+{
+  m_sprite = layer->sprite();
+
+  CompositeImageFunc compositeImage =
+    getImageComposition(
+      dstImage->pixelFormat(),
+      m_sprite->pixelFormat(), m_sprite->root());
+  if (!compositeImage)
+    return;
+
+  fill_rect(dstImage, area.dstBounds(), 0);
+  renderLayersRange(dstImage, layer, false, area, frame, compositeImage);
+}
+
+bool Render::canUseLayersCache(
+  const Image* dstImage,
+  const gfx::ClipF& area) const
+{
+  if (!m_cacheLayer ||
+      !m_cacheBelow ||
+      m_cacheLayer->sprite() != m_sprite ||
+      m_onionskin.type() != OnionskinType::NONE ||
+      m_proj.scaleX() != 1.0 ||
+      m_proj.scaleY() != 1.0)
+    return false;
+
+  // The cached images are in sprite coordinates
+  if (area.src.x != std::floor(area.src.x) ||
+      area.src.y != std::floor(area.src.y) ||
+      area.size.w != std::floor(area.size.w) ||
+      area.size.h != std::floor(area.size.h))
+    return false;
+
+  // Preview images and extra cels of other layers would be drawn
+  // between the cached layers.
+  if ((m_previewImage && m_selectedLayer && m_selectedLayer != m_cacheLayer) ||
+      (m_extraCel && m_currentLayer != m_cacheLayer))
+    return false;
+
+  return
+    (m_cacheBelow->pixelFormat() == dstImage->pixelFormat() &&
+     m_cacheBelow->size() == m_sprite->size() &&
+     (!m_cacheAbove ||
+      (m_cacheAbove->pixelFormat() == dstImage->pixelFormat() &&
+       m_cacheAbove->size() == m_sprite->size())));
+}
+
+void Render::renderCachedLayers(
+  Image* dstImage,
+  const gfx::Clip& area,
+  frame_t frame,
+  CompositeImageFunc compositeImage)
+{
+  dstImage->copy(m_cacheBelow, area);
+
+  if (m_cacheLayer->isVisibleHierarchy()) {
+    m_globalOpacity = 255;
+    renderLayer(m_cacheLayer, dstImage,
+                area, frame, compositeImage,
+                true, true,
+                BlendMode::UNSPECIFIED,
+                is_same_or_child_layer(m_cacheLayer, m_selectedLayerForOpacity));
+  }
+
+  if (m_cacheAbove) {
+    renderImage(
+      dstImage, m_cacheAbove,
+      m_sprite->palette(frame),
+      gfx::RectF(0, 0, m_cacheAbove->width(), m_cacheAbove->height()),
+      area,
+      getImageComposition(dstImage->pixelFormat(),
+                          m_cacheAbove->pixelFormat(),
+                          m_sprite->root()),
+      255, BlendMode::NORMAL);
+  }
+  else {
+    renderLayersRange(dstImage, m_cacheLayer, false,
+                      area, frame, compositeImage);
+  }
+}
+
+void Render::renderLayersRange(
+  Image* dstImage,
+  const Layer* layer,
+  const bool below,
+  const gfx::Clip& area,
+  frame_t frame,
+  CompositeImageFunc compositeImage)
+{
+  // Groups don't have their own blending, so rendering the image
+  // layers one by one (bottom to top) is the same as rendering the
+  // layers tree.
+  const LayerList layers = m_sprite->allLayers();
+  auto it = std::find(layers.begin(), layers.end(), layer);
+  if (it == layers.end())
+    return;
+
+  auto begin = (below ? layers.begin(): it+1);
+  auto end = (below ? it: layers.end());
+  for (; begin != end; ++begin) {
+    const Layer* child = *begin;
+    if (!child->isImage() ||
+        !child->isVisibleHierarchy())
+      continue;
+
+    // Same "isSelected" value that renderLayer() propagates from
+    // the selected group to its children.
+    m_globalOpacity = 255;
+    renderLayer(child, dstImage,
+                area, frame, compositeImage,
+                true, true,
+                BlendMode::UNSPECIFIED,
+                is_same_or_child_layer(child, m_selectedLayerForOpacity));
+  }
+}
+
+color_t Render::getBgColor(
+  const PixelFormat dstFormat,
+  const frame_t frame) const
+{
+  const LayerImage* bgLayer = m_sprite->backgroundLayer();
+  color_t bg_color = 0;
+  if (m_sprite->pixelFormat() == IMAGE_INDEXED) {
+    switch (dstFormat) {
+      case IMAGE_RGB:
+      case IMAGE_GRAYSCALE:
+        if (bgLayer && bgLayer->isVisible())
+          bg_color = m_sprite->palette(frame)->getEntry(m_sprite->transparentColor());
+        break;
+      case IMAGE_INDEXED:
+        bg_color = m_sprite->transparentColor();
+        break;
+    }
+  }
+  return bg_color;
+}
+
 void Render::renderBackground(Image* image,
                               const Layer* bgLayer,
                               const color_t bg_color,
@@ -1254,18 +1602,7 @@ CompositeImageFunc Render::getImageComposition(
   const PixelFormat srcFormat,
   const Layer* layer)
 {
-  // True if we need blending pixel by pixel. If this is false we can
-  // blend src+dst one time and repeat the resulting color in dst
-  // image n-times (where n is the zoom scale).
-  double intpart;
-  const bool finegrain =
-    (!m_bg.zoom && (m_bg.stripeSize.w < m_proj.applyX(1) ||
-                    m_bg.stripeSize.h < m_proj.applyY(1) ||
-                    std::modf(double(m_bg.stripeSize.w) / m_proj.applyX(1.0), &intpart) != 0.0 ||
-                    std::modf(double(m_bg.stripeSize.h) / m_proj.applyY(1.0), &intpart) != 0.0)) ||
-    (layer &&
-     layer->isGroup() &&
-     has_visible_reference_layers(static_cast<const LayerGroup*>(layer)));
+  const bool finegrain = isFinegrainComposition(layer);
 
   switch (srcFormat) {
 
@@ -1298,6 +1635,22 @@ CompositeImageFunc Render::getImageComposition(
   return nullptr;
 }
 
+bool Render::isFinegrainComposition(const Layer* layer) const
+{
+  // True if we need blending pixel by pixel. If this is false we can
+  // blend src+dst one time and repeat the resulting color in dst
+  // image n-times (where n is the zoom scale).
+  double intpart;
+  return
+    (!m_bg.zoom && (m_bg.stripeSize.w < m_proj.applyX(1) ||
+                    m_bg.stripeSize.h < m_proj.applyY(1) ||
+                    std::modf(double(m_bg.stripeSize.w) / m_proj.applyX(1.0), &intpart) != 0.0 ||
+                    std::modf(double(m_bg.stripeSize.h) / m_proj.applyY(1.0), &intpart) != 0.0)) ||
+    (layer &&
+     layer->isGroup() &&
+     has_visible_reference_layers(static_cast<const LayerGroup*>(layer)));
+}
+
 void composite_image(Image* dst,
                      const Image* src,
                      const Palette* pal,
@@ -81,6 +81,38 @@ namespace render {
     void setOnionskin(const OnionskinOptions& options);
     void disableOnionskin();
 
+    // Number of threads used by renderSprite(). With more than one
+    // thread the destination area is split in tiles of the given size
+    // which are composited in parallel (the result is the same as
+    // rendering the whole area in one pass). Areas smaller than 4
+    // tiles are rendered in the calling thread.
+    void setRenderThreads(const int threads);
+    void setRenderTileSize(const gfx::Size& tileSize);
+
+    // Sets pre-rendered images of the layers below/above the given
+    // layer (created with renderLayersBelow()/renderLayersAbove()
+    // using the sprite bounds). renderSprite() composites these
+    // images instead of those layers when it's possible (new blend
+    // method, 1:1 projection, without onion skin). "above" can be
+    // nullptr to render the layers above one by one (e.g. when some
+    // of them don't use the normal blend mode).
+    void setLayersCache(const Layer* layer,
+                        const Image* below,
+                        const Image* above);
+    void removeLayersCache();
+
+    void renderLayersBelow(
+      Image* dstImage,
+      const Layer* layer,
+      frame_t frame,
+      const gfx::Clip& area);
+
+    void renderLayersAbove(
+      Image* dstImage,
+      const Layer* layer,
+      frame_t frame,
+      const gfx::Clip& area);
+
     void renderSprite(
       Image* dstImage,
       const Sprite* sprite,
@@ -133,12 +165,47 @@ namespace render {
       const BlendMode blendMode);
 
   private:
+    bool canRenderInTiles(
+      const Image* dstImage,
+      const Sprite* sprite,
+      const gfx::ClipF& area) const;
+
+    void renderSpriteInTiles(
+      Image* dstImage,
+      const Sprite* sprite,
+      frame_t frame,
+      const gfx::Clip& area);
+
     void renderSpriteLayers(
       Image* dstImage,
       const gfx::ClipF& area,
       frame_t frame,
       CompositeImageFunc compositeImage);
 
+    bool canUseLayersCache(
+      const Image* dstImage,
+      const gfx::ClipF& area) const;
+
+    void renderCachedLayers(
+      Image* dstImage,
+      const gfx::Clip& area,
+      frame_t frame,
+      CompositeImageFunc compositeImage);
+
+    // Renders the visible image layers of the sprite below (or above)
+    // the given layer one by one.
+    void renderLayersRange(
+      Image* dstImage,
+      const Layer* layer,
+      const bool below,
+      const gfx::Clip& area,
+      frame_t frame,
+      CompositeImageFunc compositeImage);
+
+    color_t getBgColor(
+      const PixelFormat dstFormat,
+      const frame_t frame) const;
+
     void renderBackground(
       Image* image,
       const Layer* bgLayer,
@@ -191,6 +258,8 @@ namespace render {
       const PixelFormat srcFormat,
       const Layer* layer);
 
+    bool isFinegrainComposition(const Layer* layer) const;
+
     int m_flags;
     int m_nonactiveLayersOpacity;
     const Sprite* m_sprite;
@@ -212,6 +281,11 @@ namespace render {
     BlendMode m_previewBlendMode;
     OnionskinOptions m_onionskin;
     ImageBufferPtr m_tmpBuf;
+    int m_renderThreads;
+    gfx::Size m_renderTileSize;
+    const Layer* m_cacheLayer;
+    const Image* m_cacheBelow;
+    const Image* m_cacheAbove;
   };
 
   void composite_image(Image* dst,
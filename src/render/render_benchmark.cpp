@@ -19,14 +19,13 @@
 
 #include <benchmark/benchmark.h>
 
+#include <memory>
+
 using namespace doc;
 using namespace render;
 
-static void Bm_Render(benchmark::State& state)
+static Sprite* create_test_sprite(const int w, const int h)
 {
-  const int w = state.range(0);
-  const int h = state.range(1);
-
   Sprite* spr = Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, w, h));
   LayerImage* lay1 = static_cast<LayerImage*>(spr->root()->firstLayer());
   LayerImage* lay2 = new LayerImage(spr);
@@ -50,7 +49,47 @@ static void Bm_Render(benchmark::State& state)
   fill_rect(img1, 32, 32, w-64, h-64, rgba(32, 128, 255, 128));
   fill_rect(img2.get(), 0, 0, w-64, h-64, rgba(255, 100, 32, 128));
   fill_rect(img3.get(), 64, 64, w-64, h-64, rgba(200, 64, 80, 128));
+  return spr;
+}
+
+static void setup_checkered_background(Render& render)
+{
+  BgOptions bg;
+  bg.type = BgType::CHECKERED;
+  bg.zoom = true;
+  bg.color1 = rgba(100, 100, 100, 255);
+  bg.color2 = rgba(200, 200, 200, 255);
+  bg.stripeSize = gfx::Size(16, 16);
+  render.setBgOptions(bg);
+}
+
+static void Bm_Render(benchmark::State& state)
+{
+  const int w = state.range(0);
+  const int h = state.range(1);
+
+  std::unique_ptr<Sprite> spr(create_test_sprite(w, h));
+  std::unique_ptr<Image> dst(Image::create(spr->pixelFormat(), w, h));
+  clear_image(dst.get(), 0);
+
+  while (state.KeepRunning()) {
+    clear_image(dst.get(), 0);
+
+    Render render;
+    setup_checkered_background(render);
+    render.renderSprite(
+      dst.get(), spr.get(), frame_t(0),
+      gfx::Clip(0, 0, 0, 0, w, h));
+  }
+}
+
+static void Bm_RenderTiles(benchmark::State& state)
+{
+  const int w = state.range(0);
+  const int h = state.range(1);
+  const int threads = state.range(2);
 
+  std::unique_ptr<Sprite> spr(create_test_sprite(w, h));
   std::unique_ptr<Image> dst(Image::create(spr->pixelFormat(), w, h));
   clear_image(dst.get(), 0);
 
@@ -58,17 +97,41 @@ static void Bm_Render(benchmark::State& state)
     clear_image(dst.get(), 0);
 
     Render render;
-    BgOptions bg;
-    bg.type = BgType::CHECKERED;
-    bg.zoom = true;
-    bg.color1 = rgba(100, 100, 100, 255);
-    bg.color2 = rgba(200, 200, 200, 255);
-    bg.stripeSize = gfx::Size(16, 16);
-    render.setBgOptions(bg);
+    setup_checkered_background(render);
+    render.setRenderThreads(threads);
     render.renderSprite(
-      dst.get(), spr, frame_t(0),
+      dst.get(), spr.get(), frame_t(0),
       gfx::Clip(0, 0, 0, 0, w, h));
   }
+
+  state.SetItemsProcessed(state.iterations() * w * h);
+}
+
+// Renders a 1024x768 viewport of the sprite with the given zoom
+// level (e.g. 800 is 800%) like the editor does
+static void Bm_RenderZoomed(benchmark::State& state)
+{
+  const int w = state.range(0);
+  const int h = state.range(1);
+  const int zoom = state.range(2) / 100;
+  const int viewW = 1024;
+  const int viewH = 768;
+
+  std::unique_ptr<Sprite> spr(create_test_sprite(w, h));
+  std::unique_ptr<Image> dst(Image::create(spr->pixelFormat(), viewW, viewH));
+  clear_image(dst.get(), 0);
+
+  while (state.KeepRunning()) {
+    Render render;
+    setup_checkered_background(render);
+    render.setProjection(Projection(PixelRatio(1, 1), Zoom(zoom, 1)));
+    // Start in the middle of a zoomed pixel
+    render.renderSprite(
+      dst.get(), spr.get(), frame_t(0),
+      gfx::Clip(0, 0, 32*zoom + zoom/2, 32*zoom + zoom/2, viewW, viewH));
+  }
+
+  state.SetItemsProcessed(state.iterations() * viewW * viewH);
 }
 
 BENCHMARK(Bm_Render)
@@ -79,4 +142,23 @@ BENCHMARK(Bm_Render)
   ->Args({ 4096, 4096 })
   ->Unit(benchmark::kMicrosecond);
 
+BENCHMARK(Bm_RenderTiles)
+  ->Args({ 1024, 1024, 1 })
+  ->Args({ 1024, 1024, 2 })
+  ->Args({ 1024, 1024, 4 })
+  ->Args({ 1024, 1024, 8 })
+  ->Args({ 4096, 4096, 1 })
+  ->Args({ 4096, 4096, 2 })
+  ->Args({ 4096, 4096, 4 })
+  ->Args({ 4096, 4096, 8 })
+  ->Args({ 4096, 4096, 16 })
+  ->Unit(benchmark::kMicrosecond)
+  ->UseRealTime();
+
+BENCHMARK(Bm_RenderZoomed)
+  ->Args({ 1024, 1024, 200 })
+  ->Args({ 1024, 1024, 800 })
+  ->Args({ 1024, 1024, 3200 })
+  ->Unit(benchmark::kMicrosecond);
+
 BENCHMARK_MAIN();
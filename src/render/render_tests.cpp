@@ -274,6 +274,135 @@ TEST(Render, BugWithMultiplesOf3ZoomFactors)
   }
 }
 
+TEST(Render, TiledRenderIsEqualToSerialRender)
+{
+  std::shared_ptr<Document> doc = std::make_shared<Document>();
+  doc->sprites().add(Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, 61, 47)));
+  Sprite* spr = doc->sprite();
+
+  LayerImage* lay1 = static_cast<LayerImage*>(spr->root()->firstLayer());
+  LayerImage* lay2 = new LayerImage(spr);
+  spr->root()->addLayer(lay2);
+  lay2->setBlendMode(BlendMode::MULTIPLY);
+
+  Image* img1 = lay1->cel(0)->image();
+  ImageRef img2(Image::create(IMAGE_RGB, 40, 30));
+  lay2->addCel(new Cel(frame_t(0), img2));
+  lay2->cel(0)->setPosition(7, 5);
+
+  clear_image(img1, 0);
+  clear_image(img2.get(), rgba(255, 200, 100, 128));
+  for (int y=0; y<img1->height(); ++y)
+    for (int x=0; x<img1->width(); ++x)
+      put_pixel(img1, x, y, rgba(x*4, y*5, (x*y) & 255, (x+y)*3 & 255));
+
+  BgOptions bg;
+  bg.type = BgType::CHECKERED;
+  bg.zoom = true;
+  bg.color1 = rgba(128, 128, 128, 255);
+  bg.color2 = rgba(64, 64, 64, 255);
+  bg.stripeSize = gfx::Size(3, 3);
+
+  Zoom zooms[] = { Zoom(1, 1), Zoom(2, 1), Zoom(3, 1), Zoom(8, 1), Zoom(1, 2) };
+  for (const Zoom& zoom : zooms) {
+    const gfx::Size size(zoom.apply(spr->width()),
+                         zoom.apply(spr->height()));
+
+    Render render;
+    render.setBgOptions(bg);
+    render.setProjection(Projection(PixelRatio(1, 1), zoom));
+
+    std::unique_ptr<Image> serial(Image::create(IMAGE_RGB, size.w, size.h));
+    std::unique_ptr<Image> tiled(Image::create(IMAGE_RGB, size.w, size.h));
+    clear_image(serial.get(), 0);
+    clear_image(tiled.get(), 0);
+
+    render.renderSprite(serial.get(), spr, frame_t(0),
+                        gfx::Clip(0, 0, 0, 0, size.w, size.h));
+
+    render.setRenderThreads(3);
+    render.setRenderTileSize(gfx::Size(13, 7));
+    render.renderSprite(tiled.get(), spr, frame_t(0),
+                        gfx::Clip(0, 0, 0, 0, size.w, size.h));
+
+    EXPECT_EQ(0, count_diff_between_images(serial.get(), tiled.get()))
+      << " zoom=" << zoom.scale();
+  }
+}
+
+TEST(Render, LayersCacheIsEqualToFullRender)
+{
+  std::shared_ptr<Document> doc = std::make_shared<Document>();
+  doc->sprites().add(Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, 61, 47)));
+  Sprite* spr = doc->sprite();
+
+  LayerImage* layers[5];
+  layers[0] = static_cast<LayerImage*>(spr->root()->firstLayer());
+  for (int i=1; i<5; ++i) {
+    layers[i] = new LayerImage(spr);
+    spr->root()->addLayer(layers[i]);
+
+    ImageRef img(Image::create(IMAGE_RGB, 40, 30));
+    clear_image(img.get(), rgba(255, 40*i, 100, 64*i-1));
+    layers[i]->addCel(new Cel(frame_t(0), img));
+    layers[i]->cel(0)->setPosition(3*i, 4*i);
+  }
+  layers[1]->setBlendMode(BlendMode::MULTIPLY);
+  layers[3]->setOpacity(128);
+
+  Image* img0 = layers[0]->cel(0)->image();
+  for (int y=0; y<img0->height(); ++y)
+    for (int x=0; x<img0->width(); ++x)
+      put_pixel(img0, x, y, rgba(x*4, y*5, (x*y) & 255, 255));
+
+  BgOptions bg;
+  bg.type = BgType::CHECKERED;
+  bg.zoom = true;
+  bg.color1 = rgba(128, 128, 128, 255);
+  bg.color2 = rgba(64, 64, 64, 255);
+  bg.stripeSize = gfx::Size(3, 3);
+
+  const gfx::Clip area(5, 3, 2, 1, 50, 40);
+  Render render;
+  render.setBgOptions(bg);
+  render.setSelectedLayer(layers[2]);
+  render.setNonactiveLayersOpacity(200);
+
+  std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, 61, 47));
+  clear_image(expected.get(), 0);
+  render.renderSprite(expected.get(), spr, frame_t(0), area);
+
+  std::unique_ptr<Image> below(Image::create(IMAGE_RGB, 61, 47));
+  std::unique_ptr<Image> above(Image::create(IMAGE_RGB, 61, 47));
+  render.renderLayersBelow(below.get(), layers[2], frame_t(0),
+                           gfx::Clip(spr->bounds()));
+  render.renderLayersAbove(above.get(), layers[2], frame_t(0),
+                           gfx::Clip(spr->bounds()));
+
+  // Layers above rendered one by one
+  std::unique_ptr<Image> result(Image::create(IMAGE_RGB, 61, 47));
+  clear_image(result.get(), 0);
+  render.setLayersCache(layers[2], below.get(), nullptr);
+  render.renderSprite(result.get(), spr, frame_t(0), area);
+  EXPECT_EQ(0, count_diff_between_images(expected.get(), result.get()));
+
+  // Flattened layers above (all of them use the normal blend mode)
+  clear_image(result.get(), 0);
+  render.setLayersCache(layers[2], below.get(), above.get());
+  render.renderSprite(result.get(), spr, frame_t(0), area);
+  for (int y=0; y<result->height(); ++y) {
+    for (int x=0; x<result->width(); ++x) {
+      const color_t a = get_pixel(expected.get(), x, y);
+      const color_t b = get_pixel(result.get(), x, y);
+      EXPECT_NEAR(rgba_getr(a), rgba_getr(b), 2);
+      EXPECT_NEAR(rgba_getg(a), rgba_getg(b), 2);
+      EXPECT_NEAR(rgba_getb(a), rgba_getb(b), 2);
+      EXPECT_NEAR(rgba_geta(a), rgba_geta(b), 2);
+    }
+  }
+  render.removeLayersCache();
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);